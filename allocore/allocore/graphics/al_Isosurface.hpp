@@ -82,6 +82,7 @@
 
 namespace al{
 
+class ThreadPool;
 
 /// Isosurface generated using marching cubes
 class Isosurface : public Mesh {
@@ -169,6 +170,25 @@ public:
 	/// Set whether to normalize normals (if being computed)
 	Isosurface& normalize(bool v){ mNormalize=v; return *this; }
 
+	/// Set number of threads used to generate the surface from a scalar field
+
+	/// The field is split into slabs along z that are processed in parallel.
+	/// The surface is the same for any number of threads.
+	Isosurface& numThreads(int n);
+
+	/// Get number of threads used to generate the surface from a scalar field
+	int numThreads() const { return mNumThreads; }
+
+	/// Set whether to skip regions of the field the surface does not pass through
+
+	/// This builds an octree of minimum and maximum field values to find
+	/// regions entirely above or below the isolevel. It pays off when the
+	/// surface passes through a small part of the field.
+	Isosurface& skipEmpty(bool v){ mSkipEmpty=v; return *this; }
+
+	/// Get whether regions the surface does not pass through are skipped
+	bool skipEmpty() const { return mSkipEmpty; }
+
 
 	/// Begin cell-at-a-time mode
 	void begin();
@@ -204,7 +224,9 @@ public:
 
 	/// Generate isosurface from scalar field
 	template <class T>
-	void generate(const T * scalarField);
+	void generate(const T * scalarField){
+		generateField(scalarField, fieldRow<T>);
+	}
 
 
 	/// Generate isosurface from scalar field
@@ -283,6 +305,63 @@ protected:
 	void addEdgeVertex(int x, int y, int z, int cellID, int edge, const float * vals);
 
 	void compressTriangles();
+
+
+	// Returns row of 'n' field values starting at 'offset' as floats,
+	// converting them into 'buf' if needed
+	typedef const float * (*FieldRow)(const void * field, int offset, int n, float * buf);
+
+	template <class T>
+	static const float * fieldRow(const void * field, int offset, int n, float * buf){
+		const T * src = (const T *)field + offset;
+		for(int i=0; i<n; ++i) buf[i] = src[i];
+		return buf;
+	}
+
+	// Cells in range of z processed by one thread
+	struct Slab{
+		int z0, z1;								// cells in [z0, z1)
+		std::vector<Vertex> vertices;			// vertices in order of creation
+		std::vector<EdgeVertex> edgeVertices;	// same, if there is a vertex action
+		std::vector<int> indices;				// triangles as indices into vertices
+		std::vector<int> upper, lower;			// x and y edge vertices of z planes of current cell layer
+		std::vector<int> zEdges;				// z edge vertices of current cell layer
+		std::vector<int> top, bottom;			// x and y edge vertices of z planes z1 and z0
+		std::vector<int> remap;					// mesh vertex of each slab vertex
+		std::vector<float> rows;				// converted field values
+	};
+
+	struct MinMax{ float min, max; };
+
+	struct OctreeLevel{
+		int offset;		// index of first node
+		int dims[3];	// number of nodes along x, y and z
+	};
+
+	// Thread pool owned by the surface; not shared with copies
+	struct PoolRef{
+		ThreadPool * pool;
+		PoolRef(): pool(0){}
+		PoolRef(const PoolRef&): pool(0){}
+		PoolRef& operator= (const PoolRef&){ return *this; }
+		~PoolRef();
+	};
+
+	std::vector<Slab> mSlabs;
+	std::vector<MinMax> mOctree;			// value range of each node
+	std::vector<OctreeLevel> mOctreeLevels;	// levels of octree, leaves first
+	PoolRef mPool;
+	int mNumThreads;
+	bool mSkipEmpty;
+
+	void generateField(const void * field, FieldRow row);
+	void generateSlab(Slab& s, const void * field, FieldRow row) const;
+	void buildOctree(const void * field, FieldRow row);
+	void buildOctreeLeaves(int bz, const void * field, FieldRow row);
+	int emptyUntil(int x, int y, int z) const;
+	void finishSurface();
+	friend struct IsosurfaceSlabTask;
+	friend struct IsosurfaceOctreeTask;
 };
 
 
@@ -291,51 +370,9 @@ protected:
 
 // Implementation ______________________________________________________________
 
-template <class T>
-void Isosurface::generate(const T * vals){
-	inBox(true);
-	begin();
-
-	int Nx = mNF[0];
-	int Nxy = Nx*mNF[1];
-
-	// iterate through cubes (not field points)
-	//for(int z=0; z < mNF[2]-1; ++z){
-	// support transparency (assumes higher indices are farther away)
-	for(int z=mNF[2]-2; z>=0; --z){
-		int z0 = z   *Nxy;
-		int z1 =(z+1)*Nxy;
-		for(int y=0; y < mNF[1]-1; ++y){
-			int y0 = y   *Nx;
-			int y1 =(y+1)*Nx;
-
-			int z0y0 = z0+y0;
-			int z0y1 = z0+y1;
-			int z1y0 = z1+y0;
-			int z1y1 = z1+y1;
-
-			int z0y0_1 = z0y0+1;
-			int z0y1_1 = z0y1+1;
-			int z1y0_1 = z1y0+1;
-			int z1y1_1 = z1y1+1;
-
-			for(int x=0; x < mNF[0]-1; ++x){
-
-				float v8[] = {
-					vals[z0y0 + x], vals[z0y0_1 + x],
-					vals[z0y1 + x], vals[z0y1_1 + x],
-					vals[z1y0 + x], vals[z1y0_1 + x],
-					vals[z1y1 + x], vals[z1y1_1 + x]
-				};
-
-				int i3[] = {x,y,z};
-
-				addCell(i3,	v8);
-			}
-		}
-	}
-
-	end();
+template<>
+inline const float * Isosurface::fieldRow<float>(const void * field, int offset, int, float *){
+	return (const float *)field + offset;
 }
 
 } // al::
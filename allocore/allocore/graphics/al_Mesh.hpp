@@ -145,8 +145,26 @@ public:
 	Mesh& transform(const Mat<4,T>& m, int begin=0, int end=-1);
 
 	/// Generates indices for a set of vertices
+
+	/// Vertices with equal positions are merged into the first one. This
+	/// cannot be used if the mesh already has indices.
 	void compress();
 
+	/// Merge vertices within a distance of each other
+
+	/// Each vertex is merged into the first earlier vertex within 'eps' of
+	/// it. If there are indices, they are remapped to the merged vertices,
+	/// otherwise indices are generated as with compress(). Runs in linear time
+	/// using a hash grid.
+	///
+	/// @param[in] eps				maximum distance between merged vertices;
+	///								if zero, positions must be equal
+	/// @param[in] matchAttributes	whether normals, colors and texture
+	///								coordinates must also be within 'eps'
+	///								(or equal for integer colors)
+	/// \returns number of vertices removed
+	int weld(float eps=0, bool matchAttributes=true);
+
 	/// Generates normals for a set of vertices
 
 	/// This method will generate a normal for each vertex in the buffer
@@ -45,6 +45,8 @@
 #include <fstream>
 #include <vector>
 #include "allocore/system/al_Thread.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
+#include "allocore/types/al_BlockRing.hpp"
 #include "allocore/graphics/al_OpenGL.hpp"
 #include "allocore/graphics/al_Image.hpp"
 #include "allocore/io/al_AudioIO.hpp"
@@ -63,6 +65,14 @@ public:
 		REAL_TIME		/**< Real-time rendering */
 	};
 
+	/// Image encoding statistics since rendering last started
+	struct Stats{
+		unsigned frames;		///< Frames handed to the encoders
+		unsigned waits;			///< Frames that had to wait for a free buffer
+		double waitSec;			///< Total time spent waiting for free buffers
+		unsigned maxPending;	///< Most frames waiting or being encoded at once
+	};
+
 	/// @param[in] mode		rendering mode, /see mode
 	RenderToDisk(Mode mode = REAL_TIME);
 
@@ -100,8 +110,34 @@ public:
 	RenderToDisk& mode(Mode v);
 
 	/// Set format of image files
+
+	/// The format is given by the file extension. "ppm" images are written
+	/// uncompressed without an encoder, so capture is limited only by the
+	/// disk. With "png", a compression of 0 stores the pixels uncompressed,
+	/// which is much faster to encode than the default.
 	RenderToDisk& imageFormat(const std::string& ext, int compression=50);
 
+	/// Set number of image encoder threads and frame buffers (only when not rendering)
+
+	/// Frames are copied into a ring of preallocated buffers and encoded by
+	/// a persistent pool of threads. When every buffer is waiting to be
+	/// encoded, the rendering thread helps encode until the oldest is free.
+	/// @param[in] threads	number of encoder threads; if 0, one less than
+	///						the number of processors
+	/// @param[in] buffers	number of frame buffers; if 0, twice the number
+	///						of threads
+	RenderToDisk& encoders(unsigned threads, unsigned buffers=0);
+
+	/// Get image encoding statistics since rendering last started
+	const Stats& stats() const { return mStats; }
+
+	/// Get number of audio blocks dropped since rendering last started
+
+	/// Blocks are dropped in REAL_TIME mode if the sound file cannot be
+	/// written as fast as audio is produced. In NON_REAL_TIME mode, audio
+	/// processing waits for the sound file instead.
+	unsigned audioOverruns() const { return mAudioRing.overruns(); }
+
 	/// Start rendering
 
 	/// The soundfile sample rate and number of channels will be taken directly
@@ -137,33 +173,11 @@ public:
 
 private:
 
-	struct AudioRing{
-		std::vector<float> mBuffer;
-		unsigned mChannels, mBlockSize, mNumBlocks;
-		unsigned mWriteBlock, mReadBlock;
-
-		AudioRing();
-
-		void resize(unsigned channels, unsigned blockSize, unsigned numBlocks);
-		void write(const float * block);
-		int read();
-		const float * readBuffer() const;
-		unsigned blockSizeInSamples() const;
-	};
-
-	struct ImageWriter{
-		Thread mThread;
+	// A frame buffer, encoded to an image file on the encoder pool
+	struct Frame : public ThreadPool::Task{
 		Image mImage;
 		std::string mPath;
-		bool mBusy;
-
-		ImageWriter();
-
-		bool run(
-			const std::string& path,
-			const std::vector<unsigned char>& pixels, unsigned w, unsigned h,
-			Image::Format format, unsigned compress
-		);
+		void operator()();
 	};
 
 	Mode mMode;
@@ -174,7 +188,6 @@ private:
 	al::Window * mWindow;
 	double mFrameDur; // graphics frame duration
 	double mWindowFPS;
-	std::vector<unsigned char> mPixels;
 	GLenum mGraphicsBuf;
 
 	enum { Npbos = 2 };
@@ -182,16 +195,23 @@ private:
 	int mPBOIdx;
 	bool mReadPBO;
 
-	enum { Nthreads = 4 };
-	ImageWriter mImageWriters[Nthreads];
+	ThreadPool * mEncoders;
+	std::vector<Frame *> mFrames;
+	unsigned mNumEncoders, mNumFrames;
+	unsigned mFrameIdx; // next frame buffer to fill
+	Stats mStats;
 	std::string mImageExt;
 	unsigned mImageCompress;
 
 	al::AudioIO * mAudioIO;
-	//std::vector<char> mAudioBuf;
-	AudioRing mAudioRing;
+	BlockRing<float> mAudioRing;	// blocks of non-interleaved samples
+	Semaphore mAudioWritten;		// posted for each block written to ring
+	Semaphore mAudioRead;			// posted for each block read from ring
+	std::vector<float> mAudioBlock;	// block of interleaved samples for file
+	unsigned mAudioChannels, mAudioFrames;
 	std::ofstream mSoundFile;
 	Thread mSoundFileThread;
+	Atomic<int> mSoundFileRun;
 
 	bool mActive;
 
@@ -202,9 +222,13 @@ private:
 	bool toggle(al::AudioIO * aio, al::Window * win, double fps=-1);
 	void write(); // Write next block of audio and current frame buffer to files
 	void writeAudio(); // Write next block of audio to sound file
+	void writeSoundFile(); // Write blocks of audio in ring to sound file
 	void writeImage(); // Write current frame buffer to image file
 	void resetPBOQueue();
 	void saveImage(unsigned w, unsigned h, unsigned l=0, unsigned b=0, bool usePBO=true);
+	Frame& nextFrame(unsigned w, unsigned h); // Wait for next free frame buffer
+	void submitFrame(Frame& f); // Encode frame buffer to next image file
+	void finishFrames(); // Wait for all frames to be encoded
 };
 
 } // al::
@@ -104,6 +104,12 @@ public:
 	/// Get timeout duration, in seconds
 	al_sec timeout() const;
 
+	/// Get native socket descriptor, or -1 if not open
+
+	/// This is for system calls that the Socket does not wrap, such as
+	/// batched sends and receives or polling many sockets at once.
+	int fd() const;
+
 
 	/// Open socket (reopening if currently open)
 	bool open(uint16_t port, const char * address, al_sec timeout, int type);
@@ -580,9 +580,11 @@ template <class T>
 bool invert(Mat<2,T>& m){
 	T det = determinant(m);
 	if(det != 0){
+		// copy first; set() would otherwise read entries it has overwritten
+		const T a = m(0,0), b = m(0,1), c = m(1,0), d = m(1,1);
 		m.set(
-			 m(1,1),-m(0,1),
-			-m(1,0), m(0,0)
+			 d,-b,
+			-c, a
 		) /= det;
 		return true;
 	}
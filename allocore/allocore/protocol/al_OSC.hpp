@@ -47,7 +47,9 @@
 #include <string>
 #include <vector>
 #include "allocore/io/al_Socket.hpp"
+#include "allocore/system/al_Atomic.hpp"
 #include "allocore/system/al_Thread.hpp"
+#include "allocore/types/al_SingleRWRingBuffer.hpp"
 
 namespace al{
 
@@ -74,6 +76,18 @@ struct Blob{
 /// a one in the least signifigant bit is a special case meaning "immediately."
 typedef unsigned long long TimeTag;
 
+/// Convert a time tag to seconds since 1970, the time base of al_time()
+inline al_sec timeTagToSec(TimeTag t){
+	return al_sec(t >> 32) - 2208988800. + al_sec(t & 0xffffffffULL) * (1./4294967296.);
+}
+
+/// Convert seconds since 1970, the time base of al_time(), to a time tag
+inline TimeTag secToTimeTag(al_sec t){
+	t += 2208988800.;
+	const TimeTag s = TimeTag(t);
+	return (s << 32) | TimeTag((t - al_sec(s)) * 4294967296.);
+}
+
 
 /// Outbound OSC packet
 class Packet{
@@ -219,6 +233,79 @@ protected:
 };
 
 
+/// Inbound OSC message read in place
+
+/// This reads a message directly from the packet bytes, without copying or
+/// allocating, so it is only valid as long as the packet is. The message is
+/// checked once on construction, so extracting arguments needs no further
+/// bounds checks. Extracting an argument of the wrong type fails, leaving
+/// the value unchanged, and all later extractions fail as well until the
+/// stream is reset.
+class MessageView{
+public:
+
+	MessageView();
+
+	/// @param[in] message		raw OSC message bytes
+	/// @param[in] size			number of bytes in message
+	/// @param[in] timeTag		time tag of message (inherited from bundle)
+	MessageView(const char * message, int size, const TimeTag& timeTag=1);
+
+	/// Whether the bytes are a well-formed message
+	bool valid() const { return mAddressPattern != 0; }
+
+	/// Whether all extractions since the last reset succeeded
+	bool good() const { return !mFail; }
+
+	/// Get time tag
+	const TimeTag& timeTag() const { return mTimeTag; }
+
+	/// Get address pattern
+	const char * addressPattern() const { return mAddressPattern; }
+
+	/// Get type tags, without the leading comma
+	const char * typeTags() const { return mTypeTags; }
+
+	/// Get number of arguments
+	int numArgs() const { return mNumArgs; }
+
+	/// Get raw message bytes
+	const char * data() const { return mData; }
+
+	/// Get number of bytes in message
+	int size() const { return mSize; }
+
+	/// Pretty-print message information
+	void print() const;
+
+	/// Reset stream for converting from raw message bytes to types
+	MessageView& resetStream(){
+		mTag = mTypeTags; mArg = mArgs; mFail = false; return *this;
+	}
+
+	MessageView& operator>> (int& v);			///< Extract next stream element as integer
+	MessageView& operator>> (float& v);			///< Extract next stream element as float
+	MessageView& operator>> (double& v);		///< Extract next stream element as double
+	MessageView& operator>> (char& v);			///< Extract next stream element as char
+	MessageView& operator>> (const char*& v);	///< Extract next stream element as C-string
+	MessageView& operator>> (std::string& v);	///< Extract next stream element as string
+	MessageView& operator>> (Blob& v);			///< Extract next stream element as Blob
+
+protected:
+	const char * mData;
+	const char * mAddressPattern;
+	const char * mTypeTags;
+	const char * mArgs;
+	const char * mTag;		// stream position in type tags
+	const char * mArg;		// stream position in arguments
+	int mSize, mNumArgs;
+	TimeTag mTimeTag;
+	bool mFail;
+
+	const char * next(char tag);
+};
+
+
 
 /// Iterates through all messages contained within an OSC packet
 class PacketHandler{
@@ -227,17 +314,429 @@ public:
 	virtual ~PacketHandler(){}
 
 	/// Called for each message contained in packet
-	virtual void onMessage(Message& m) = 0;
+	virtual void onMessage(Message& m){}
 
+	/// Called for each message contained in packet, before it is copied
+
+	/// The default constructs a Message and calls onMessage(Message&).
+	/// Override this to handle messages without allocating.
+	virtual void onMessageView(MessageView& m);
+
+	/// Call the handler for each message in a packet
+
+	/// Messages in bundles get the time tag of the innermost bundle.
+	/// Malformed packets are reported and the rest of the packet skipped.
 	void parse(const char *packet, int size, TimeTag timeTag=1);
 };
 
 
 
+/// Dispatches messages to methods registered by address
+
+/// Methods are registered for an address, which may contain the OSC
+/// wildcards '?', '*', [chars] and {strings,...} in any of its parts, and
+/// optionally for the type tags that messages must have. The addresses are
+/// compiled into a trie of address parts, hashed, so matching a message
+/// follows its parts instead of comparing it against every address. An
+/// incoming address pattern with wildcards is matched against the
+/// registered addresses. Nothing is allocated while dispatching.
+///
+/// Methods taking up to four int, float, double, char, const char *,
+/// std::string or Blob arguments can be registered directly; they are called
+/// only for messages with exactly those argument types. A std::string
+/// argument is a copy of the string in the packet and may allocate.
+///
+/// Methods must not be added while packets are being parsed.
+class Dispatcher : public PacketHandler{
+public:
+
+	typedef void (*Callback)(MessageView& m, void * userData);
+
+	Dispatcher();
+
+	virtual ~Dispatcher();
+
+	/// Register a callback for an address
+
+	/// @param[in] address		address, possibly with wildcards
+	/// @param[in] callback		called with each matching message
+	/// @param[in] userData		passed to the callback
+	/// @param[in] typeTags		required type tags, without comma, or NULL for any
+	Dispatcher& add(const std::string& address, Callback callback, void * userData=NULL, const char * typeTags=NULL);
+
+	/// Register a method with no arguments
+	template <class T>
+	Dispatcher& add(const std::string& address, T& object, void (T::*method)()){
+		return addMethod(address, new Method0<T>(object, method));
+	}
+
+	/// Register a method with one argument
+	template <class T, class A>
+	Dispatcher& add(const std::string& address, T& object, void (T::*method)(A)){
+		return addMethod(address, new Method1<T,A>(object, method));
+	}
+
+	/// Register a method with two arguments
+	template <class T, class A, class B>
+	Dispatcher& add(const std::string& address, T& object, void (T::*method)(A,B)){
+		return addMethod(address, new Method2<T,A,B>(object, method));
+	}
+
+	/// Register a method with three arguments
+	template <class T, class A, class B, class C>
+	Dispatcher& add(const std::string& address, T& object, void (T::*method)(A,B,C)){
+		return addMethod(address, new Method3<T,A,B,C>(object, method));
+	}
+
+	/// Register a method with four arguments
+	template <class T, class A, class B, class C, class D>
+	Dispatcher& add(const std::string& address, T& object, void (T::*method)(A,B,C,D)){
+		return addMethod(address, new Method4<T,A,B,C,D>(object, method));
+	}
+
+	/// Remove all methods
+	void clear();
+
+	/// Dispatch a message to all matching methods
+
+	/// \returns the number of methods called
+	int dispatch(MessageView& m);
+
+	/// Get number of messages that matched no address
+	unsigned unhandled() const { return mUnhandled; }
+
+	/// Get number of messages that matched an address but not its type tags
+	unsigned mismatched() const { return mMismatched; }
+
+	/// Called for messages that matched no address; does nothing by default
+	virtual void onUnhandled(MessageView& m){}
+
+	virtual void onMessageView(MessageView& m){ dispatch(m); }
+
+	/// Whether an address matches an OSC address pattern
+	static bool matches(const char * pattern, const char * address);
+
+protected:
+
+	struct Method{
+		Method(const char * typeTags): tags(typeTags ? typeTags : ""), anyTags(!typeTags){}
+		virtual ~Method(){}
+		virtual void operator()(MessageView& m) = 0;
+		std::string tags;
+		bool anyTags;
+	};
+
+	template <class A> struct Arg{ typedef A type; };
+	template <class A> struct Arg<const A&>{ typedef A type; };
+	template <class A> struct Arg<const A>{ typedef A type; };
+
+	static char tag(int){ return 'i'; }
+	static char tag(float){ return 'f'; }
+	static char tag(double){ return 'd'; }
+	static char tag(char){ return 'c'; }
+	static char tag(const char *){ return 's'; }
+	static char tag(const std::string&){ return 's'; }
+	static char tag(const Blob&){ return 'b'; }
+
+	template <class A>
+	static char tag(){ return tag(typename Arg<A>::type()); }
+
+	struct CallbackMethod : public Method{
+		CallbackMethod(Callback f_, void * u, const char * t): Method(t), f(f_), userData(u){}
+		void operator()(MessageView& m){ f(m, userData); }
+		Callback f; void * userData;
+	};
+
+	template <class T>
+	struct Method0 : public Method{
+		Method0(T& o_, void (T::*f_)()): Method(""), o(o_), f(f_){}
+		void operator()(MessageView& m){ (o.*f)(); }
+		T& o; void (T::*f)();
+	};
+
+	template <class T, class A>
+	struct Method1 : public Method{
+		Method1(T& o_, void (T::*f_)(A)): Method(tags().c_str()), o(o_), f(f_){}
+		static std::string tags(){ return std::string(1, tag<A>()); }
+		void operator()(MessageView& m){
+			typename Arg<A>::type a;
+			m >> a;
+			(o.*f)(a);
+		}
+		T& o; void (T::*f)(A);
+	};
+
+	template <class T, class A, class B>
+	struct Method2 : public Method{
+		Method2(T& o_, void (T::*f_)(A,B)): Method(tags().c_str()), o(o_), f(f_){}
+		static std::string tags(){
+			char t[] = { tag<A>(), tag<B>(), 0 }; return t;
+		}
+		void operator()(MessageView& m){
+			typename Arg<A>::type a; typename Arg<B>::type b;
+			m >> a >> b;
+			(o.*f)(a,b);
+		}
+		T& o; void (T::*f)(A,B);
+	};
+
+	template <class T, class A, class B, class C>
+	struct Method3 : public Method{
+		Method3(T& o_, void (T::*f_)(A,B,C)): Method(tags().c_str()), o(o_), f(f_){}
+		static std::string tags(){
+			char t[] = { tag<A>(), tag<B>(), tag<C>(), 0 }; return t;
+		}
+		void operator()(MessageView& m){
+			typename Arg<A>::type a; typename Arg<B>::type b; typename Arg<C>::type c;
+			m >> a >> b >> c;
+			(o.*f)(a,b,c);
+		}
+		T& o; void (T::*f)(A,B,C);
+	};
+
+	template <class T, class A, class B, class C, class D>
+	struct Method4 : public Method{
+		Method4(T& o_, void (T::*f_)(A,B,C,D)): Method(tags().c_str()), o(o_), f(f_){}
+		static std::string tags(){
+			char t[] = { tag<A>(), tag<B>(), tag<C>(), tag<D>(), 0 }; return t;
+		}
+		void operator()(MessageView& m){
+			typename Arg<A>::type a; typename Arg<B>::type b;
+			typename Arg<C>::type c; typename Arg<D>::type d;
+			m >> a >> b >> c >> d;
+			(o.*f)(a,b,c,d);
+		}
+		T& o; void (T::*f)(A,B,C,D);
+	};
+
+	struct Node;
+	Node * mRoot;
+	unsigned mUnhandled, mMismatched;
+
+	Dispatcher& addMethod(const std::string& address, Method * m);
+	void match(const Node& n, const char * addr, MessageView& m, int& calls);
+
+private:
+	Dispatcher(const Dispatcher&);
+	Dispatcher& operator= (const Dispatcher&);
+};
+
+
+
+/// Estimate of a local clock in terms of wall-clock time
+
+/// Time tags are in wall-clock time, while messages may be scheduled on
+/// another clock, such as an audio sample count or Main::now(). This
+/// follows the relation between the two clocks with a second-order
+/// delay-locked loop, like DelayLockedLoop, which smooths the jitter in
+/// reading them together and tracks the drift between them.
+class TimeTagClock{
+public:
+
+	/// @param[in] bandwidth	weight of each update, in (0, 1]; smaller smooths more
+	TimeTagClock(double bandwidth=0.05);
+
+	/// Set weight of each update, in (0, 1]
+	TimeTagClock& bandwidth(double v);
+
+	/// Update estimate from readings of both clocks taken together
+
+	/// @param[in] local	local clock time
+	/// @param[in] wall		wall-clock time, as from al_time()
+	void update(al_sec local, al_sec wall);
+
+	/// Start over at the next update, e.g., after the local clock jumps
+	void reset(){ mReset = true; }
+
+	/// Whether the clock has been updated since being reset
+	bool valid() const { return !mReset; }
+
+	/// Get local time corresponding to a wall-clock time
+	al_sec localTime(al_sec wall) const { return mLocal + (wall - mWall) / mRate; }
+
+	/// Get local time of a time tag
+	al_sec localTime(TimeTag t) const { return localTime(timeTagToSec(t)); }
+
+	/// Get wall-clock seconds per local second
+	double rate() const { return mRate; }
+
+protected:
+	al_sec mLocal, mWall;	// a point on the estimated line
+	double mRate;			// and its slope
+	double mB, mC;			// 1st & 2nd order weights
+	bool mReset;
+};
+
+
+
+/// Executes messages at the times in their bundles' time tags
+
+/// Packets parsed by this, usually on a network thread, have their messages
+/// copied into a preallocated pool. Calling run() from another thread, such
+/// as the graphics or audio thread, passes the messages that are due to a
+/// handler, in order of time. Messages not in a bundle, or with the time tag
+/// "immediately", are due when they arrive. Adding a latency to all time
+/// tags absorbs network jitter: senders stamp bundles with the current
+/// time and each receiver executes them a fixed time later.
+///
+/// Time tags are converted to the clock run() is called with by a
+/// TimeTagClock, updated on each call. From the graphics thread, run() may
+/// be called with Main::get().realtime(); from the audio thread, with the
+/// time of the audio block and the block's duration as horizon, so that
+/// each message can be placed within the block by its time().
+///
+/// Only one thread may parse packets and only one may call run(). Nothing
+/// is allocated by either.
+class Scheduler : public PacketHandler{
+public:
+
+	/// Histogram of times
+	class Histogram{
+	public:
+
+		/// @param[in] min		start of first bin
+		/// @param[in] width	width of each bin
+		/// @param[in] bins		number of bins; values outside go in the first or last
+		Histogram(al_sec min=0, al_sec width=0.00025, int bins=64);
+
+		/// Add a value
+		void add(al_sec v);
+
+		/// Remove all values
+		void clear();
+
+		/// Get number of bins
+		int size() const { return mCounts.size(); }
+
+		/// Get count in a bin
+		unsigned operator[](int i) const { return mCounts[i]; }
+
+		/// Get start of a bin
+		al_sec binStart(int i) const { return mMin + i*mWidth; }
+
+		/// Get number of values
+		unsigned count() const { return mCount; }
+
+		/// Get mean of values
+		al_sec mean() const { return mCount ? mSum/mCount : 0; }
+
+		/// Get standard deviation of values
+		al_sec stddev() const;
+
+		/// Get smallest value
+		al_sec min() const { return mLo; }
+
+		/// Get largest value
+		al_sec max() const { return mHi; }
+
+		/// Get value below which a fraction of values lie, to a bin's width
+		al_sec percentile(double fraction) const;
+
+		/// Print non-empty bins
+		void print() const;
+
+	protected:
+		std::vector<unsigned> mCounts;
+		al_sec mMin, mWidth;
+		al_sec mSum, mSumSqr, mLo, mHi;
+		unsigned mCount;
+	};
+
+	/// Message counters
+	struct Stats{
+		Stats(): executed(0), late(0), dropped(0), tooLarge(0){}
+		unsigned executed;	///< Messages executed
+		unsigned late;		///< Messages that arrived after they were due
+		unsigned dropped;	///< Messages dropped because the pool was full
+		unsigned tooLarge;	///< Messages dropped because they were too large
+	};
+
+	/// @param[in] handler		receives each message when it is due
+	/// @param[in] capacity		maximum number of messages pending
+	/// @param[in] maxSize		maximum size, in bytes, of a message
+	Scheduler(PacketHandler& handler, int capacity=1024, int maxSize=512);
+
+	/// Set time added to all time tags
+	Scheduler& latency(al_sec v){ mLatency = v; return *this; }
+
+	/// Get time added to all time tags
+	al_sec latency() const { return mLatency; }
+
+	/// Execute the messages that are due
+
+	/// @param[in] now		local time
+	/// @param[in] horizon	also execute messages due before now + horizon
+	/// \returns the number of messages executed
+	int run(al_sec now, al_sec horizon=0);
+
+	/// Get local time at which the message being handled is due
+	al_sec time() const { return mTime; }
+
+	/// Get number of messages taken in by run() and not yet due
+	int pending() const { return mHeap.size(); }
+
+	/// Get clock mapping time tags to local time
+	TimeTagClock& clock(){ return mClock; }
+
+	/// Get histogram of execution times minus due times
+	Histogram& lateness(){ return mLateness; }
+
+	/// Get histogram of due times minus arrival times; negative when late
+	Histogram& margin(){ return mMargin; }
+
+	/// Get message counters
+	Stats stats() const;
+
+	virtual void onMessageView(MessageView& m);
+
+protected:
+	struct Slot{
+		TimeTag timeTag;
+		al_sec arrival;		// wall-clock time
+		al_sec due;			// local time
+		unsigned order;		// of arrival
+		int size;
+	};
+	struct Later;
+
+	PacketHandler& mHandler;
+	std::vector<Slot> mSlots;
+	std::vector<char> mData;
+	int mMaxSize;
+	SingleRWRingBuffer mFree, mReady;	// indices of slots
+	std::vector<int> mHeap;				// pending slots, soonest first
+	TimeTagClock mClock;
+	Histogram mLateness, mMargin;
+	al_sec mLatency, mTime;
+	unsigned mOrder, mExecuted, mLate;
+	Atomic<unsigned> mDropped, mTooLarge;
+
+private:
+	Scheduler(const Scheduler&);
+	Scheduler& operator= (const Scheduler&);
+};
+
+
+
 /// Socket for sending OSC packets
+
+/// Besides sending packets one at a time, packets can be queued and then
+/// sent together with flush(). On Linux, this sends many packets per system
+/// call (sendmmsg).
 class Send : public SocketClient, public Packet{
 public:
-	Send(){}
+
+	/// Send counters
+	struct Stats{
+		Stats(): packets(0), bytes(0), calls(0), dropped(0){}
+		unsigned long long packets;	///< Packets sent
+		unsigned long long bytes;	///< Bytes sent
+		unsigned long long calls;	///< System calls made
+		unsigned long long dropped;	///< Packets not sent, e.g., as the socket buffer was full
+	};
+
+	Send();
+	~Send();
 
 	/// @param[in] port		Port number (valid range is 0-65535)
 	/// @param[in] address	IP address
@@ -251,6 +750,25 @@ public:
 	/// Send a packet
 	int send(const Packet& p);
 
+	/// Queue current packet contents for flush() and clear them
+
+	/// \returns number of packets queued
+	int queue();
+
+	/// Queue a packet for flush()
+	int queue(const Packet& p);
+
+	/// Send all queued packets
+
+	/// \returns number of packets sent
+	int flush();
+
+	/// Get number of queued packets
+	int queued() const { return mQueueSizes.size(); }
+
+	/// Get send counters
+	const Stats& stats() const { return mStats; }
+
 	/// Send zero argument message immediately
 	int send(const std::string& addr){
 		addMessage(addr); return send();
@@ -297,16 +815,39 @@ public:
 	int send(const std::string& addr, const A& a, const B& b, const C& c, const D& d, const E& e, const F& f, const G& g){
 		addMessage(addr, a,b,c,d,e,f,g); return send();
 	}
+
+protected:
+	struct Batch; Batch * mBatch;
+	std::vector<char> mQueue;		// queued packets, end to end
+	std::vector<int> mQueueSizes;
+	Stats mStats;
+
+	int queue(const char * data, int size);
 };
 
 
 
 /// Socket for receiving OSC packets
 
-/// Supports explicit polling or implicit background thread polling
+/// Supports explicit polling or implicit background thread polling.
 ///
+/// On Linux, many packets can be received per system call (recvmmsg) by
+/// setting batchSize(). The counters in stats() then also include packets
+/// dropped by the system because the socket's receive queue was full.
 class Recv : public SocketServer{
 public:
+
+	/// Receive counters
+	struct Stats{
+		Stats(): packets(0), bytes(0), calls(0), truncated(0), dropped(0), maxBatch(0){}
+		unsigned long long packets;	///< Packets received
+		unsigned long long bytes;	///< Bytes received
+		unsigned long long calls;	///< System calls that returned packets
+		unsigned long long truncated;///< Packets larger than the buffer, which are skipped
+		unsigned long long dropped;	///< Packets dropped by the system before being received (Linux)
+		unsigned maxBatch;			///< Most packets received by one call; if batchSize(), more were likely waiting
+	};
+
 	Recv();
 
 	/// @param[in] port		Port number (valid range is 0-65535)
@@ -314,7 +855,7 @@ public:
 	/// @param[in] timeout	< 0: block forever; = 0: no blocking; > 0 block with timeout
 	Recv(uint16_t port, const char * address = "", al_sec timeout=0);
 
-	virtual ~Recv() { stop(); }
+	virtual ~Recv();
 
 	/// Whether background polling is activated
 	bool background() const { return mBackground; }
@@ -322,13 +863,33 @@ public:
 	/// Get current received packet data
 	const char * data() const { return &mBuffer[0]; }
 
-	/// Set size of internal buffer
-	void bufferSize(int n){ mBuffer.resize(n); }
+	/// Set size of internal buffer, the largest packet that can be received
+
+	/// This must not be called while receiving in the background.
+	///
+	void bufferSize(int n);
+
+	/// Get size of internal buffer
+	int bufferSize() const { return mBufferSize; }
+
+	/// Set maximum number of packets received per system call
+
+	/// Batches larger than 1 are only supported on Linux. This must not be
+	/// called while receiving in the background.
+	void batchSize(int n);
+
+	/// Get maximum number of packets received per system call
+	int batchSize() const { return mBatchSize; }
+
+	/// Get receive counters; these are updated by the receiving thread
+	const Stats& stats() const { return mStats; }
 
 	/// Set packet handling routine
 	Recv& handler(PacketHandler& v){ mHandler = &v; return *this; }
 
-	/// Check for an OSC packet and call handler
+	/// Check for OSC packets and call handler
+
+	/// This receives up to batchSize() packets.
 	/// returns bytes read
 	/// note: use while(recv()){} to ensure queue is fully flushed.
 	int recv();
@@ -344,9 +905,69 @@ public:
 
 protected:
 	PacketHandler * mHandler;
-	std::vector<char> mBuffer;
+	std::vector<char> mBuffer;		// mBatchSize buffers of mBufferSize bytes
+	int mBufferSize, mBatchSize;
+	struct Batch; Batch * mBatch;
+	Stats mStats;
 	al::Thread mThread;
 	bool mBackground;
+
+	int recvBatch();
+};
+
+
+
+/// Receives on many sockets from one thread
+
+/// This waits on all its sockets at once (with epoll on Linux, else poll)
+/// and calls recv() on those with packets waiting, so one thread can serve
+/// any number of ports without polling each in turn.
+class RecvGroup{
+public:
+
+	RecvGroup();
+
+	~RecvGroup();
+
+	/// Add an open socket
+
+	/// The socket is made non-blocking. It must not be receiving in the
+	/// background, nor be reopened while in the group. Sockets must not be
+	/// added or removed while the group is receiving in the background.
+	bool add(Recv& r);
+
+	/// Remove a socket
+	void remove(Recv& r);
+
+	/// Get number of sockets
+	int size() const { return mRecvs.size(); }
+
+	/// Wait for packets and receive them
+
+	/// @param[in] timeout	< 0: block forever; = 0: no blocking; > 0 block with timeout
+	/// \returns bytes read
+	int poll(al_sec timeout);
+
+	/// Begin a background thread to receive packets
+	bool start();
+
+	/// Stop the background thread
+	void stop();
+
+	/// Whether the background thread is running
+	bool background() const { return mBackground; }
+
+protected:
+	class Impl; Impl * mImpl;
+	std::vector<Recv *> mRecvs;
+	al::Thread mThread;
+	bool mBackground;
+
+	static void * threadFunc(void * user);
+
+private:
+	RecvGroup(const RecvGroup&);
+	RecvGroup& operator= (const RecvGroup&);
 };
 
 
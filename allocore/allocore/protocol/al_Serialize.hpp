@@ -46,9 +46,13 @@
 #include "al_Serialize.h"
 #include <vector>
 #include <string>
+#include "allocore/math/al_Vec.hpp"
+#include "allocore/types/al_Buffer.hpp"
 
 namespace al{
 
+class Array;
+
 namespace ser{
 
 template<class T> inline uint32_t encode(char * b, const T * v, uint32_t n){ return 0; }
@@ -127,6 +131,207 @@ private:
 
 
 
+namespace ser{
+
+/// Compile-time description of a struct's fields
+
+/// Specialize this to serialize a struct, listing its fields in order.
+/// Fields may be numbers, Vecs or other structs with a Schema:
+/// \code
+///	struct Particle{ Vec3f pos, vel; float mass; int id; };
+///
+///	namespace al{ namespace ser{
+///	template<> struct Schema<Particle>{
+///		template <class F, class P>
+///		static void fields(F& f, P& p){ f(p.pos); f(p.vel); f(p.mass); f(p.id); }
+///	};
+///	}}
+/// \endcode
+/// The fields are packed without padding, in order. When that is the
+/// struct's own layout, arrays of it are copied with a single memcpy.
+template <class T> struct Schema;
+
+template <class T> struct Layout;
+
+
+/// Values of a type read in place from a serialized buffer
+
+/// Values are unpacked when accessed, without copying the buffer.
+template <class T>
+class View{
+public:
+
+	View(): mData(0), mSize(0), mStride(0){}
+
+	/// @param[in] data		packed values
+	/// @param[in] size		number of values
+	/// @param[in] stride	size, in bytes, of a packed value
+	View(const char * data, uint32_t size, uint32_t stride)
+	:	mData(data), mSize(size), mStride(stride){}
+
+	/// Get number of values
+	uint32_t size() const { return mSize; }
+
+	/// Whether there are no values
+	bool empty() const { return 0 == mSize; }
+
+	/// Get packed values
+	const char * data() const { return mData; }
+
+	/// Get a value
+	T operator[](uint32_t i) const { T v; Layout<T>::unpack(&v, mData + i*mStride, 1); return v; }
+
+	/// Copy all values
+	void copy(T * dst) const { if(mSize) Layout<T>::unpack(dst, mData, mSize); }
+
+	/// Get values in place, or NULL if their layout or alignment differ from T's
+	const T * ptr() const;
+
+protected:
+	const char * mData;
+	uint32_t mSize, mStride;
+};
+
+
+/// Writes serialized data directly into a buffer
+
+/// This produces the same format as Serializer, readable by Deserializer,
+/// but writes into a buffer supplied by the caller instead of copying
+/// through temporaries. Arrays of numbers, Vecs, Buffers and Arrays are
+/// copied with one memcpy on little endian hosts. Writing past the end of a
+/// fixed buffer fails, after which nothing more is written. A vector
+/// buffer grows as needed and is never shrunk, so reusing it, with reset(),
+/// for each frame stops allocating once it is large enough. Only its first
+/// size() bytes are written.
+class Writer{
+public:
+
+	/// @param[in] buf		buffer to write into
+	/// @param[in] capacity	size of buffer, in bytes
+	Writer(char * buf, uint32_t capacity);
+
+	/// @param[in] buf		buffer to write into; grown as needed
+	Writer(std::vector<char>& buf);
+
+	/// Write a number, Vec or struct with a Schema
+	template <class T>
+	Writer& operator<< (const T& v){ return add(&v, 1); }
+
+	/// Write a C-string
+	Writer& operator<< (const char * v);
+
+	/// Write a string
+	Writer& operator<< (const std::string& v);
+
+	/// Write the elements of a Buffer
+	template <class T, class A>
+	Writer& operator<< (const Buffer<T,A>& v){ return add(v.size() ? v.elems() : (const T *)0, v.size()); }
+
+	/// Write an Array's format and cells
+	Writer& operator<< (const Array& v);
+
+	/// Write an array of numbers, Vecs or structs with a Schema
+	template <class T>
+	Writer& add(const T * v, uint32_t num);
+
+	/// Write the header for an array of numbers or Vecs to be filled in place
+
+	/// \returns where to write the packed values, or NULL on failure. As
+	/// headers are five bytes, this is generally not aligned for T.
+	template <class T>
+	char * reserve(uint32_t num);
+
+	/// Get written bytes
+	const char * data() const { return mBuf; }
+
+	/// Get number of bytes written
+	uint32_t size() const { return mPos; }
+
+	/// Whether all writes have succeeded
+	bool good() const { return !mFail; }
+
+	/// Start writing again from the beginning
+	Writer& reset(){ mPos = 0; mFail = false; return *this; }
+
+protected:
+	char * mBuf;
+	uint32_t mCap, mPos;
+	std::vector<char> * mVec;
+	bool mFail;
+
+	char * alloc(uint32_t bytes);
+	char * header(uint8_t type, uint32_t num, uint32_t bytes);
+};
+
+
+/// Reads serialized data in place from a buffer
+
+/// This reads the format of Serializer and Writer directly from the source
+/// buffer, which must outlive the reader. Reading a value whose header does
+/// not match its type fails, leaving the value unchanged, after which
+/// nothing more is read.
+class Reader{
+public:
+
+	/// @param[in] buf		serialized data
+	/// @param[in] size		size of data, in bytes
+	Reader(const char * buf, uint32_t size);
+
+	/// @param[in] buf		serialized data
+	Reader(const std::vector<char>& buf);
+
+	/// Read a number, Vec or struct with a Schema
+	template <class T>
+	Reader& operator>> (T& v){ if(good() && read(&v, 1) != 1) fail(); return *this; }
+
+	/// Read a string
+	Reader& operator>> (std::string& v);
+
+	/// Read into a Buffer, resizing it
+	template <class T, class A>
+	Reader& operator>> (Buffer<T,A>& v);
+
+	/// Read into an Array, formatting it
+	Reader& operator>> (Array& v);
+
+	/// Read an array of values
+
+	/// \returns the number of values read; fails if more than num
+	template <class T>
+	uint32_t read(T * v, uint32_t num);
+
+	/// Read an array of values in place
+	template <class T>
+	View<T> view();
+
+	/// Skip the next item
+	Reader& skip();
+
+	/// Get type of next item
+	uint8_t peekType() const { return remaining() >= SER_HEADER_SIZE ? uint8_t(mBuf[mPos]) : 0; }
+
+	/// Get number of bytes read
+	uint32_t position() const { return mPos; }
+
+	/// Get number of bytes left
+	uint32_t remaining() const { return mSize - mPos; }
+
+	/// Whether all reads have succeeded
+	bool good() const { return !mFail; }
+
+protected:
+	const char * mBuf;
+	uint32_t mSize, mPos;
+	bool mFail;
+
+	bool fail(){ mFail = true; return false; }
+	const char * header(uint8_t type, uint32_t& num, uint32_t elemSize);
+};
+
+} // ser::
+
+
+
 
 // =============================================================================
 // Implementation
@@ -162,6 +367,247 @@ template <class T> Deserializer& Deserializer::operator>> (T& v){
 //	return *this;
 //}
 
+
+
+namespace ser{
+
+// Alignment of a type
+template <class T> struct AlignOf{
+	struct S{ char c; T t; };
+	enum{ value = sizeof(S) - sizeof(T) };
+};
+
+// Copies elements of a size in serialized byte order
+template <int Size> struct Elems;
+template<> struct Elems<1>{ static void copy(void * d, const void * s, uint32_t n){ serCopy1(d,s,n); } };
+template<> struct Elems<2>{ static void copy(void * d, const void * s, uint32_t n){ serCopy2(d,s,n); } };
+template<> struct Elems<4>{ static void copy(void * d, const void * s, uint32_t n){ serCopy4(d,s,n); } };
+template<> struct Elems<8>{ static void copy(void * d, const void * s, uint32_t n){ serCopy8(d,s,n); } };
+
+#ifdef SER_IS_BIG_ENDIAN
+	#define SER_IN_PLACE(T) (sizeof(T) == 1)
+#else
+	#define SER_IN_PLACE(T) true
+#endif
+
+// Layout of a number
+#define SER_DEF_LAYOUT(T, ty)\
+template<> struct Layout<T>{\
+	enum{ schema = 0, count = 1 };\
+	typedef T elem;\
+	static uint8_t type(){ return ty; }\
+	static uint32_t packedSize(const T&){ return sizeof(T); }\
+	static bool inPlace(const T&){ return SER_IN_PLACE(T); }\
+	static void signature(const T&, char *& p, const char * end){ if(p < end) *p++ = ty; }\
+	static void pack(char * d, const T * s, uint32_t n){ Elems<sizeof(T)>::copy(d, s, n); }\
+	static void unpack(T * d, const char * s, uint32_t n){ Elems<sizeof(T)>::copy(d, s, n); }\
+};
+SER_DEF_LAYOUT(float, SER_FLOAT32)
+SER_DEF_LAYOUT(double, SER_FLOAT64)
+SER_DEF_LAYOUT(char, SER_INT8)
+SER_DEF_LAYOUT(int8_t, SER_INT8)
+SER_DEF_LAYOUT(int16_t, SER_INT16)
+SER_DEF_LAYOUT(int32_t, SER_INT32)
+SER_DEF_LAYOUT(int64_t, SER_INT64)
+SER_DEF_LAYOUT(bool, SER_UINT8)
+SER_DEF_LAYOUT(uint8_t, SER_UINT8)
+SER_DEF_LAYOUT(uint16_t, SER_UINT16)
+SER_DEF_LAYOUT(uint32_t, SER_UINT32)
+SER_DEF_LAYOUT(uint64_t, SER_UINT64)
+#undef SER_DEF_LAYOUT
+
+// Layout of a Vec, as its elements
+template <int N, class T> struct Layout<Vec<N,T> >{
+	enum{ schema = 0, count = N*Layout<T>::count };
+	typedef typename Layout<T>::elem elem;
+	static uint8_t type(){ return Layout<T>::type(); }
+	static uint32_t packedSize(const Vec<N,T>&){ return count*sizeof(elem); }
+	static bool inPlace(const Vec<N,T>&){ return sizeof(Vec<N,T>) == count*sizeof(elem) && SER_IN_PLACE(elem); }
+	static void signature(const Vec<N,T>& v, char *& p, const char * end){
+		for(int i=0; i<N; ++i) Layout<T>::signature(v[i], p, end);
+	}
+	static void pack(char * d, const Vec<N,T> * s, uint32_t n){ Elems<sizeof(elem)>::copy(d, s, n*count); }
+	static void unpack(Vec<N,T> * d, const char * s, uint32_t n){ Elems<sizeof(elem)>::copy(d, s, n*count); }
+};
+
+#undef SER_IN_PLACE
+
+// Visitors of the fields of a Schema
+struct SizeOfFields{
+	SizeOfFields(): size(0){}
+	template <class F> void operator()(const F& f){ size += Layout<F>::packedSize(f); }
+	uint32_t size;
+};
+
+struct FieldsInPlace{
+	FieldsInPlace(const void * b): base((const char *)b), offset(0), ok(true){}
+	template <class F> void operator()(const F& f){
+		ok = ok && (const char *)&f == base + offset && Layout<F>::inPlace(f);
+		offset += sizeof(F);
+	}
+	const char * base;
+	uint32_t offset;
+	bool ok;
+};
+
+struct SignatureOfFields{
+	SignatureOfFields(char *& p_, const char * e): p(p_), end(e){}
+	template <class F> void operator()(const F& f){ Layout<F>::signature(f, p, end); }
+	char *& p;
+	const char * end;
+};
+
+struct PackFields{
+	PackFields(char * p_): p(p_){}
+	template <class F> void operator()(const F& f){
+		Layout<F>::pack(p, &f, 1);
+		p += Layout<F>::packedSize(f);
+	}
+	char * p;
+};
+
+struct UnpackFields{
+	UnpackFields(const char * p_): p(p_){}
+	template <class F> void operator()(F& f){
+		Layout<F>::unpack(&f, p, 1);
+		p += Layout<F>::packedSize(f);
+	}
+	const char * p;
+};
+
+// Layout of a struct with a Schema
+template <class T> struct Layout{
+	enum{ schema = 1, count = 1 };
+	typedef T elem;
+	static uint8_t type(){ return SER_SUB; }
+
+	static uint32_t packedSize(const T& v){
+		SizeOfFields f; Schema<T>::fields(f, v); return f.size;
+	}
+
+	static bool inPlace(const T& v){
+		FieldsInPlace f(&v); Schema<T>::fields(f, v); return f.ok && f.offset == sizeof(T);
+	}
+
+	static void signature(const T& v, char *& p, const char * end){
+		SignatureOfFields f(p, end); Schema<T>::fields(f, v);
+	}
+
+	static void pack(char * d, const T * s, uint32_t n){
+		if(n && inPlace(s[0])){ memcpy(d, (const void *)s, n*sizeof(T)); return; }
+		for(uint32_t i=0; i<n; ++i){
+			PackFields f(d); Schema<T>::fields(f, s[i]); d = f.p;
+		}
+	}
+
+	static void unpack(T * d, const char * s, uint32_t n){
+		if(n && inPlace(d[0])){ memcpy((void *)d, s, n*sizeof(T)); return; }
+		for(uint32_t i=0; i<n; ++i){
+			UnpackFields f(s); Schema<T>::fields(f, d[i]); s = f.p;
+		}
+	}
+};
+
+// Signatures of structs longer than this are truncated
+enum{ SIGNATURE_SIZE = 256 };
+
+
+template <class T> const T * View<T>::ptr() const {
+	if(!mSize || mStride != sizeof(T) || size_t(mData) % AlignOf<T>::value) return 0;
+	const T& v = *(const T *)mData;
+	return Layout<T>::inPlace(v) ? &v : 0;
+}
+
+
+template <class T> Writer& Writer::add(const T * v, uint32_t num){
+	const uint32_t bytes = num ? num * Layout<T>::packedSize(v[0]) : 0;
+	if(Layout<T>::schema){
+		// a sub-structure header, then the signature of the fields and the
+		// packed structs
+		char sig[SIGNATURE_SIZE];
+		char * p = sig;
+		if(num) Layout<T>::signature(v[0], p, sig + SIGNATURE_SIZE-1);
+		*p = 0;
+		const uint32_t sigSize = p - sig + 1;
+		header(SER_SUB, num, 0);
+		char * d = header(SER_INT8, sigSize, sigSize);
+		if(d) memcpy(d, sig, sigSize);
+		d = header(SER_UINT8, bytes, bytes);
+		if(d && num) Layout<T>::pack(d, v, num);
+	}
+	else{
+		char * d = header(Layout<T>::type(), num*Layout<T>::count, bytes);
+		if(d && num) Layout<T>::pack(d, v, num);
+	}
+	return *this;
+}
+
+template <class T> char * Writer::reserve(uint32_t num){
+	if(Layout<T>::schema){ mFail = true; return 0; }
+	const uint32_t count = num*Layout<T>::count;
+	return header(Layout<T>::type(), count, count*sizeof(typename Layout<T>::elem));
+}
+
+
+template <class T> View<T> Reader::view(){
+	const uint32_t start = mPos;
+	if(Layout<T>::schema){
+		T probe;
+		char sig[SIGNATURE_SIZE];
+		char * p = sig;
+		Layout<T>::signature(probe, p, sig + SIGNATURE_SIZE-1);
+		*p = 0;
+		const uint32_t packed = Layout<T>::packedSize(probe);
+
+		uint32_t num, sigSize, bytes;
+		const char * s, * d;
+		if(header(SER_SUB, num, 0)
+			&& (s = header(SER_INT8, sigSize, 1))
+			&& (d = header(SER_UINT8, bytes, 1))
+		){
+			if(0 == num) return View<T>();
+			if(bytes == num*packed && sigSize == uint32_t(p - sig + 1)
+				&& 0 == memcmp(s, sig, sigSize)
+			){
+				return View<T>(d, num, packed);
+			}
+		}
+	}
+	else{
+		typedef typename Layout<T>::elem elem;
+		uint32_t num;
+		const char * d = header(Layout<T>::type(), num, sizeof(elem));
+		if(d && 0 == num % Layout<T>::count){
+			return View<T>(d, num / Layout<T>::count, Layout<T>::count*sizeof(elem));
+		}
+	}
+	mPos = start;
+	fail();
+	return View<T>();
+}
+
+template <class T> uint32_t Reader::read(T * v, uint32_t num){
+	if(!good()) return 0;
+	const uint32_t start = mPos;
+	View<T> w = view<T>();
+	if(w.size() > num){ mPos = start; fail(); }
+	if(!good()) return 0;
+	w.copy(v);
+	return w.size();
+}
+
+template <class T, class A> Reader& Reader::operator>> (Buffer<T,A>& v){
+	if(!good()) return *this;
+	View<T> w = view<T>();
+	if(good()){
+		v.resize(w.size());
+		if(w.size()) w.copy(v.elems());
+	}
+	return *this;
+}
+
+} // ser::
+
 } // al::
 
 
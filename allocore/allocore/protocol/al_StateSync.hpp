@@ -0,0 +1,274 @@
+#ifndef INCLUDE_AL_STATESYNC_HPP
+#define INCLUDE_AL_STATESYNC_HPP
+
+/*	Allocore --
+	Multimedia / virtual environment application class library
+
+	Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology, UCSB.
+	Copyright (C) 2012. The Regents of the University of California.
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+		Redistributions of source code must retain the above copyright notice,
+		this list of conditions and the following disclaimer.
+
+		Redistributions in binary form must reproduce the above copyright
+		notice, this list of conditions and the following disclaimer in the
+		documentation and/or other materials provided with the distribution.
+
+		Neither the name of the University of California nor the names of its
+		contributors may be used to endorse or promote products derived from
+		this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+
+
+
+	File description:
+	Replicates a block of state, such as a simulation's, to many receivers
+	over UDP, as delta-encoded frames
+
+	File author(s):
+	AlloSystem contributors, 2016
+*/
+
+#include <string>
+#include <vector>
+#include "allocore/io/al_Socket.hpp"
+
+namespace al{
+
+/// Delta encoding of a state against a keyframe
+
+/// A delta is a sequence of pairs of a run of bytes equal to the keyframe's
+/// and a run of bytes that differ, each length a variable-length integer,
+/// followed by the differing bytes. Bytes past the last pair equal the
+/// keyframe's.
+struct StateDelta{
+
+	/// Encode a delta
+
+	/// @param[out] dst		delta; resized to hold at least size bytes
+	/// @param[in] state	new state
+	/// @param[in] key		keyframe state
+	/// @param[in] size		size, in bytes, of the states
+	/// \returns size of delta in bytes, or 0 if it would not be smaller than
+	///			the state
+	static unsigned encode(std::vector<char>& dst, const char * state, const char * key, unsigned size);
+
+	/// Decode a delta
+
+	/// @param[out] state	new state
+	/// @param[in] key		keyframe state
+	/// @param[in] size		size, in bytes, of the states
+	/// @param[in] delta	delta
+	/// @param[in] deltaSize size, in bytes, of the delta
+	/// \returns whether the delta was well-formed
+	static bool decode(char * state, const char * key, unsigned size, const char * delta, unsigned deltaSize);
+};
+
+
+
+/// Sends a block of state to many StateReceivers each frame
+
+/// Each frame is split into fragments that fit in a datagram, numbered so
+/// that receivers can reassemble it and detect losses. Most frames are
+/// deltas against a keyframe, which is sent whole: at the start, at a
+/// regular interval, when a receiver asks for one, and when a delta would
+/// be larger than the mean bytes sent per frame since the last keyframe,
+/// as happens when the changes since it accumulate.
+///
+/// Receivers acknowledge keyframes on a feedback port. Deltas are encoded
+/// against the newest keyframe that every receiver heard from recently has
+/// acknowledged, so a receiver that misses a keyframe can still decode
+/// them. Without feedback, deltas use the newest keyframe.
+///
+/// The state must be plain data, laid out the same on all hosts. To reach
+/// many hosts, send to a broadcast address, such as
+/// Simulator::defaultBroadcastIP(), from the simulator's step and poll a
+/// StateReceiver from each renderer's frame.
+class StateSender{
+public:
+
+	/// Send counters
+	struct Stats{
+		Stats(): frames(0), keyframes(0), packets(0), bytes(0), frameBytes(0), receivers(0){}
+		unsigned frames;			///< Frames sent
+		unsigned keyframes;			///< Keyframes sent
+		unsigned long long packets;	///< Datagrams sent
+		unsigned long long bytes;	///< Bytes sent, including headers
+		unsigned frameBytes;		///< Bytes sent for the last frame
+		unsigned receivers;			///< Receivers heard from recently
+	};
+
+	/// @param[in] stateSize		size, in bytes, of the state
+	/// @param[in] port				port receivers listen on
+	/// @param[in] address			address of receivers; may be a broadcast address
+	/// @param[in] feedbackPort		port to listen on for feedback, or 0 for none
+	/// @param[in] packetSize		largest datagram to send, in bytes
+	StateSender(
+		unsigned stateSize, uint16_t port, const char * address = "localhost",
+		uint16_t feedbackPort = 0, unsigned packetSize = 1400
+	);
+
+	/// Set number of frames between regular keyframes, or 0 for none
+	StateSender& keyframeInterval(unsigned frames){ mKeyInterval = frames; return *this; }
+
+	/// Set number of frames after which a silent receiver is forgotten
+	StateSender& receiverTimeout(unsigned frames){ mReceiverTimeout = frames; return *this; }
+
+	/// Make the next frame a keyframe
+	void requestKeyframe(){ mKeyRequested = true; }
+
+	/// Send a frame of state
+
+	/// Feedback from receivers is read first. This blocks while the
+	/// socket's send buffer is full.
+	/// \returns the frame number
+	unsigned send(const void * state);
+
+	/// Get size, in bytes, of the state
+	unsigned stateSize() const { return mStateSize; }
+
+	/// Get send counters
+	const Stats& stats() const { return mStats; }
+
+protected:
+	struct Receiver{
+		uint32_t id;
+		uint32_t key;		// newest keyframe acknowledged
+		uint32_t seen;		// frame when last heard from
+	};
+
+	struct Client : public SocketClient{
+	protected:
+		virtual bool onOpen();
+	};
+
+	Client mSocket;
+	SocketServer mFeedback;
+	unsigned mStateSize, mPacketSize;
+	unsigned mKeyInterval, mReceiverTimeout;
+	uint32_t mFrame;
+	std::vector<char> mKeys[2];		// keyframe states
+	uint32_t mKeyFrames[2];			// their frame numbers
+	int mNewest, mRef;				// newest keyframe, and the one deltas use
+	unsigned mDeltas;				// deltas since newest keyframe
+	uint64_t mDeltaBytes;			// and their size
+	std::vector<char> mEncoded, mPacket;
+	std::vector<Receiver> mReceivers;
+	Stats mStats;
+	bool mKeyRequested;
+
+	void readFeedback();
+	void sendFrame(int type, uint32_t key, const char * data, unsigned size);
+};
+
+
+
+/// Receives a block of state from a StateSender
+
+/// Call poll() regularly, e.g., once per frame, to read the datagrams that
+/// have arrived. When a frame is complete and decoded, it becomes the
+/// current state. Frames that are incomplete when a newer one arrives, or
+/// that are deltas against a keyframe this receiver does not have, are
+/// dropped; in the latter case a keyframe is requested.
+class StateReceiver{
+public:
+
+	/// Receive counters
+	struct Stats{
+		Stats(): frames(0), keyframes(0), lost(0), incomplete(0), missingKey(0),
+			keyRequests(0), packets(0), bytes(0){}
+		unsigned frames;			///< Frames decoded
+		unsigned keyframes;			///< Keyframes decoded
+		unsigned lost;				///< Frames of which no datagram arrived
+		unsigned incomplete;		///< Frames missing datagrams
+		unsigned missingKey;		///< Deltas against an unknown keyframe
+		unsigned keyRequests;		///< Keyframes requested
+		unsigned long long packets;	///< Datagrams received
+		unsigned long long bytes;	///< Bytes received
+	};
+
+	/// @param[in] stateSize		size, in bytes, of the state
+	/// @param[in] port				port to listen on
+	/// @param[in] senderAddress	address of sender, for feedback
+	/// @param[in] feedbackPort		sender's feedback port, or 0 for none
+	StateReceiver(
+		unsigned stateSize, uint16_t port,
+		const char * senderAddress = "localhost", uint16_t feedbackPort = 0
+	);
+
+	/// Read all datagrams that have arrived
+
+	/// @param[in] timeout	time to wait for the first datagram;
+	///						< 0: block forever; = 0: no blocking; > 0 block with timeout
+	/// \returns whether a new frame was decoded
+	bool poll(al_sec timeout = 0);
+
+	/// Get current state
+	const void * state() const { return &mState[0]; }
+
+	/// Get frame number of current state
+	unsigned frame() const { return mFrame; }
+
+	/// Whether any frame has been decoded
+	bool valid() const { return mValid; }
+
+	/// Get size, in bytes, of the state
+	unsigned stateSize() const { return mStateSize; }
+
+	/// Get receive counters
+	const Stats& stats() const { return mStats; }
+
+protected:
+	struct Key{
+		Key(): frame(0), valid(false){}
+		std::vector<char> state;
+		uint32_t frame;
+		bool valid;
+	};
+
+	SocketServer mSocket;
+	SocketClient mFeedback;
+	unsigned mStateSize;
+	uint32_t mId;
+	std::vector<char> mState;
+	std::vector<char> mPacket;
+	Key mKeys[2];
+	int mRefKey;				// keyframe the last delta used
+
+	// frame being assembled
+	std::vector<char> mAssembly;
+	std::vector<bool> mHave;
+	uint32_t mAsmFrame, mAsmKey;
+	unsigned mAsmSize, mAsmCount, mAsmReceived;
+	int mAsmType;
+	bool mAssembling;
+
+	uint32_t mFrame, mLastSeen, mRequestFrame;
+	unsigned mStale;			// consecutive datagrams of old frames
+	bool mValid, mSeen, mRequested;
+	Stats mStats;
+
+	bool receive(const char * packet, unsigned size);
+	bool decode();
+	int newestKey() const;
+	void feedback(int type, uint32_t key);
+};
+
+} // al::
+
+#endif
@@ -99,9 +99,20 @@ namespace al{
 class AmbiBase{
 public:
 
+	/// Ordering and normalization of Ambisonic channels
+	enum Format{
+		FUMA,		/**< Furse-Malham, up to 3rd order (default) */
+		ACN_SN3D,	/**< ACN ordering with SN3D normalization (AmbiX) */
+		ACN_N3D		/**< ACN ordering with N3D normalization */
+	};
+
+	/// Highest order of encoders and decoders using ACN ordering
+	static const int maxOrder = 7;
+
 	/// @param[in] dim		number of spatial dimensions (2 or 3)
 	/// @param[in] order	highest spherical harmonic order
-	AmbiBase(int dim, int order);
+	/// @param[in] format	channel ordering and normalization
+	AmbiBase(int dim, int order, Format format=FUMA);
 
 	virtual ~AmbiBase();
 
@@ -111,6 +122,9 @@ public:
 	/// Get order
 	int order() const { return mOrder; }
 
+	/// Get channel ordering and normalization
+	Format format() const { return mFormat; }
+
 	/// Get Ambisonic channel weights
 	const float * weights() const { return mWeights; }
 
@@ -118,6 +132,9 @@ public:
 	int channels() const { return mChannels; }
 
 	/// Set the order
+
+	/// The order is limited to 3 for FUMA and to maxOrder otherwise.
+	///
 	void order(int order);
 
 
@@ -134,6 +151,27 @@ public:
 	/// Compute spherical harmonic weights based on unit direction vector (in the listener's coordinate frame)
 	static void encodeWeightsFuMa(float * ws, int dim, int order, float x, float y, float z);
 
+	/// Compute spherical harmonic weights of any order in ACN ordering
+
+	/// The real spherical harmonics are computed with recurrences over the
+	/// components of the unit direction vector, so no trigonometric functions
+	/// are evaluated. The Condon-Shortley phase is omitted. In 2D, only the
+	/// harmonics with |m| = l are computed, in the order m = 0, -1, 1, -2, 2,
+	/// ... Weights must be of size orderToChannels(dim, order).
+	/// (x,y,z unit vector in the listener's coordinate frame)
+	static void encodeWeightsSN3D(float * ws, int dim, int order, float x, float y, float z);
+
+	/// Compute N3D normalized spherical harmonic weights of any order
+
+	/// N3D weights are SN3D weights of order l scaled by sqrt(2l+1), making
+	/// the harmonics orthonormal over the sphere.
+	/// (x,y,z unit vector in the listener's coordinate frame)
+	static void encodeWeightsN3D(float * ws, int dim, int order, float x, float y, float z);
+
+	/// Compute spherical harmonic weights in a given format
+	/// (x,y,z unit vector in the listener's coordinate frame)
+	static void encodeWeights(float * ws, Format format, int dim, int order, float x, float y, float z);
+
 	/// Brute force 3rd order.  Weights must be of size 16.
 	static void encodeWeightsFuMa16(float * weights, float azimuth, float elevation);
 	/// (x,y,z unit vector in the listener's coordinate frame)
@@ -145,8 +183,9 @@ public:
 
 protected:
 	int mDim;			// dimensions - 2d or 3d
-	int mOrder;			// order - 0th, 1st, 2nd, or 3rd
+	int mOrder;			// order - 0th to 3rd for FuMa, up to maxOrder for ACN
 	int mChannels;		// cached for efficiency
+	Format mFormat;		// channel ordering and normalization
 	float * mWeights;	// weights for each ambi channel
 
 	template<typename T>
@@ -159,15 +198,28 @@ protected:
 class AmbiDecode : public AmbiBase{
 public:
 
+	/// Method used to compute decoding matrix
+	enum Method{
+		PROJECTION,	/**< Sample spherical harmonics at speakers (default) */
+		ALLRAD		/**< All-round decoding of virtual speakers panned with VBAP */
+	};
+
 	/// @param[in] dim			number of spatial dimensions (2 or 3)
 	/// @param[in] order		highest spherical harmonic order
 	/// @param[in] numSpeakers	number of speakers
 	/// @param[in] flavor		decoding algorithm
-	AmbiDecode(int dim, int order, int numSpeakers, int flavor=1);
+	/// @param[in] format		channel ordering and normalization
+	AmbiDecode(int dim, int order, int numSpeakers, int flavor=1, Format format=FUMA);
 
 	virtual ~AmbiDecode();
 
 
+	/// Decode a block of Ambisonic domain frames
+
+	/// This multiplies the (speakers x channels) decoding matrix with the
+	/// (channels x frames) Ambisonic domain buffers, adding the result to the
+	/// speakers' device channels. Four channels are accumulated per pass over
+	/// the output using SIMD where available.
 	/// @param[out] dec				output time domain buffers (non-interleaved)
 	/// @param[in ] enc				input Ambisonic domain buffers (non-interleaved)
 	/// @param[in ] numDecFrames	number of frames in time domain buffers
@@ -180,6 +232,9 @@ public:
 	/// Returns decode flavor
 	int flavor() const { return mFlavor; }
 
+	/// Returns method used to compute decoding matrix
+	Method method() const { return mMethod; }
+
 	/// Returns number of speakers
 	int numSpeakers() const { return mNumSpeakers; }
 
@@ -187,8 +242,22 @@ public:
 
 
 	/// Set decoding algorithm
+
+	/// For ACN formats, the weights of each order are computed for any order:
+	/// 0 is basic, 2 is in-phase and 1 (default) and 3 are max-rE.
 	void flavor(int type);
 
+	/// Set method used to compute decoding matrix
+
+	/// AllRAD decodes to a dense set of virtual speakers spread evenly over
+	/// the sphere and pans each virtual speaker onto the speakers using VBAP.
+	/// This suits irregular layouts, such as domes, at higher orders than
+	/// projection, but requires 3D and all speakers to be set first.
+	/// Virtual speakers outside of all VBAP triplets are dropped.
+	/// AllRAD is only supported for the ACN formats; in 2D or with FUMA a
+	/// warning is printed and projection is used instead.
+	void method(Method m);
+
 	/// Set number of speakers. Positions are zeroed upon resize.
 	void numSpeakers(int num);
 
@@ -211,14 +280,16 @@ public:
 protected:
 	int mNumSpeakers;
 	int mFlavor;				// decode flavor
+	Method mMethod;				// decoding matrix method
 	float * mDecodeMatrix;		// deccoding matrix for each ambi channel & speaker
 								// cols are channels and rows are speakers
-	float mWOrder[5];			// weights for each order
+	float mWOrder[maxOrder+1];	// weights for each order
     Speakers* mSpeakers;
     //float * mPositions;		// speakers' azimuths + elevations
 	//float * mFrame;			// an ambisonic channel frame used for decode(int)
 
 	void updateChanWeights();
+	void updateAllRAD();
 	void resizeArrays(int numChannels, int numSpeakers);
 
 	float decode(float * encFrame, int encNumChannels, int speakerNum);	// is this useful?
@@ -234,7 +305,8 @@ public:
 
 	/// @param[in] dim			number of spatial dimensions (2 or 3)
 	/// @param[in] order		highest spherical harmonic order
-	AmbiEncode(int dim, int order) : AmbiBase(dim, order) {}
+	/// @param[in] format		channel ordering and normalization
+	AmbiEncode(int dim, int order, Format format=FUMA) : AmbiBase(dim, order, format) {}
 
 //	/// Encode input sample and set decoder frame.
 //	void encode   (const AmbiDecode &dec, float input);
@@ -272,7 +344,7 @@ public:
 class AmbisonicsSpatializer : public Spatializer {
 public:
 
-	AmbisonicsSpatializer(SpeakerLayout &sl, int dim, int order, int flavor=1);
+	AmbisonicsSpatializer(SpeakerLayout &sl, int dim, int order, int flavor=1, AmbiBase::Format format=AmbiBase::FUMA);
 
 	void zeroAmbi();
 
@@ -286,14 +358,28 @@ public:
 
 	void setSpeakerLayout(const SpeakerLayout& sl);
 
+	/// Set method used to compute decoding matrix
+	void decodeMethod(AmbiDecode::Method m){ mDecoder.method(m); }
+
+	/// Get decoder
+	const AmbiDecode& decoder() const { return mDecoder; }
+
 	void prepare(AudioIOData& io);
 
+	void prepare();
+
 	/// Per sample processing
 	void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample);
 
 	/// Per buffer processing
 	void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, float *samples);
 
+	/// Block processing; sources are encoded into the Ambisonic domain bus
+	bool supportsBlockProcessing() const { return true; }
+	int busChannels() const { return mDecoder.channels(); }
+	float * busBuffer(int chan, float * outputBuffer){ return ambiChans(chan); }
+	void performBlock(float ** bus, SoundSource& src, const Vec3d& relposStart, const Vec3d& relposEnd, int numFrames, const float * samples) const;
+
 	void finalize(AudioIOData& io);
 
 private:
@@ -357,11 +443,12 @@ inline float AmbiDecode::decode(float * encFrame, int encNumChannels, int speake
 //}
 
 inline void AmbiEncode::direction(float az, float el){
-	AmbiBase::encodeWeightsFuMa(mWeights, mDim, mOrder, az, el);
+	float cosel = cos(el);
+	direction(cos(az) * cosel, sin(az) * cosel, mDim>=3 ? sin(el) : 0.f);
 }
 
 inline void AmbiEncode::direction(float x, float y, float z){
-	AmbiBase::encodeWeightsFuMa(mWeights, mDim, mOrder, x,y,z);
+	AmbiBase::encodeWeights(mWeights, mFormat, mDim, mOrder, x,y,z);
 }
 
 inline void AmbiEncode::encode(float * ambiChans, int numFrames, int timeIndex, float timeSample) const {
@@ -370,6 +457,7 @@ inline void AmbiEncode::encode(float * ambiChans, int numFrames, int timeIndex,
 	// This requires only a simple jump per time sample.
 	#define CS(c) case c: ambiChans[c*numFrames+timeIndex] += weights()[c] * timeSample;
 	int ch = channels()-1;
+	for(; ch>15; --ch) ambiChans[ch*numFrames+timeIndex] += weights()[ch] * timeSample;
 	switch(ch){
 		CS(15) CS(14) CS(13) CS(12) CS(11) CS(10) CS( 9) CS( 8)
 		CS( 7) CS( 6) CS( 5) CS( 4) CS( 3) CS( 2) CS( 1) CS( 0)
@@ -152,6 +152,40 @@ public:
     virtual void finalize(float **outs, const int numFrames){};
 #endif
 
+	/// Returns whether performBlock() is implemented
+
+	/// Spatializers that do not support block processing are rendered with
+	/// the per buffer perform() when the scene uses block processing.
+	virtual bool supportsBlockProcessing() const { return false; }
+
+	/// Get number of channels in the bus performBlock() renders into
+
+	/// By default, the bus is the set of audio output channels up to the
+	/// highest device channel of the speakers.
+	virtual int busChannels() const;
+
+	/// Get buffer of a bus channel that is rendered into on the audio thread
+
+	/// By default, this is the audio output buffer of the same channel.
+	virtual float * busBuffer(int chan, float * outputBuffer){ return outputBuffer; }
+
+	/// Render a block of samples from a source moving along a straight path
+
+	/// This is called once per source and listener when the scene uses block
+	/// processing. The source moves linearly from 'relposStart' at the first
+	/// frame to 'relposEnd' one frame past the last frame. Gains should be
+	/// ramped accordingly and the result summed into 'bus'.
+	/// This must not modify the spatializer's state so that sources can be
+	/// rendered concurrently into different buses.
+	virtual void performBlock(
+		float ** bus,
+		SoundSource& src,
+		const Vec3d& relposStart,
+		const Vec3d& relposEnd,
+		int numFrames,
+		const float * samples
+	) const {}
+
 	/// Print out information about spatializer
 	virtual void print(){};
 
@@ -304,6 +338,15 @@ public:
     /// Set Doppler Type
     void dopplerType(DopplerType type){ mDopplerType = type; }
 
+	/// Read a block of samples from delay-line using cubic interpolation
+
+	/// This gives the same result as calling readSample() with an index
+	/// starting at 'index' and moving by 'indexInc' each frame. Frames are
+	/// processed in short runs, first gathering the interpolation taps and
+	/// then interpolating, so that the latter can be vectorized. All indices
+	/// must be less than or equal to maxIndex().
+	void readSamples(float * dst, int numFrames, double index, double indexInc) const;
+
 	/// Write sample to internal delay-line
 	void writeSample(float v){ mSound.write(v); }
 
@@ -389,13 +432,82 @@ public:
         mPerSampleProcessing = shouldUsePerSampleProcessing;
     }
 
+	/// Set block processing (false by default)
+
+	/// Block processing renders each source once per block. Its delay and
+	/// gain are ramped linearly across the block from the same trajectory
+	/// used by per sample processing and the whole block is handed to the
+	/// spatializer with a single call. This gives smooth motion and Doppler
+	/// at a small fraction of the cost of per sample processing, which makes
+	/// it the mode of choice for scenes with many sources. Per sample
+	/// processing takes precedence when both are enabled.
+	void useBlockProcessing(bool v){ mBlockProcessing = v; }
+
+	/// Returns whether block processing is enabled
+	bool useBlockProcessing() const { return mBlockProcessing; }
+
+	/// Set number of threads used to render sources (0 by default)
+
+	/// A non-zero number of threads enables threaded rendering in block
+	/// processing mode. Sources are split into groups of a fixed size and
+	/// each group is mixed into its own set of bus buffers. The groups are
+	/// rendered by n-1 worker threads together with the thread calling
+	/// render(), which wakes up the workers and waits for them without
+	/// locking. The group buses are then summed in order before the
+	/// spatializer finalizes its output. Unthreaded block processing sums
+	/// the groups in the same way, so the result is bit-identical for any
+	/// number of threads. This should not be called while rendering.
+	void numThreads(int n);
+
+	/// Get number of threads used to render sources
+	int numThreads() const { return mNumThreads; }
+
+	/// Set number of sources per group in block processing (32 by default)
+
+	/// Smaller groups balance the load between threads better, but need
+	/// more memory and time to sum the group buses. Changing the group size
+	/// changes the order in which sources are summed, so it should be kept
+	/// fixed when comparing output.
+	void sourcesPerGroup(int n){ if(n > 0) mSourcesPerGroup = n; }
+
+	/// Get number of sources per group in block processing
+	int sourcesPerGroup() const { return mSourcesPerGroup; }
+
 protected:
+	class Workers;
+	friend class Workers;
+
 	Listeners mListeners;
 	Sources mSources;
 	int mNumFrames;				// audio frames per block
 	std::vector<float> mBuffer;	// temporary frame buffer
 	double mSpeedOfSound;		// distance per second
+	std::vector<float *> mBus;	// bus channels of current listener
+	std::vector<float> mDiscard;// bus channel without output
     bool mPerSampleProcessing;
+	bool mBlockProcessing;
+
+	// Threaded rendering
+	Workers * mWorkers;
+	int mNumThreads;
+	int mSourcesPerGroup;
+	std::vector<SoundSource *> mSourceArray;	// sources in render order
+	std::vector<float> mGroupBus;				// bus channels of each group
+	std::vector<float *> mGroupBusChans;
+	std::vector<float> mThreadBuffer;			// temporary buffer of each thread
+
+	// Render a source group into its bus in block processing
+	void renderGroup(
+		int group, const Listener& l, int numFrames, double sampleRate,
+		float * buffer
+	);
+
+	// Render a source in block processing mode; 'buffer' is temporary
+	// storage of size numFrames
+	void renderBlock(
+		const Spatializer& spatializer, const Listener& l, SoundSource& src,
+		float ** bus, float * buffer, int numFrames, double sampleRate
+	) const;
 };
 
 } // al::
@@ -64,6 +64,10 @@ public:
 	/// Per Buffer Processing
 	void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, float *samples);
 
+	/// Block Processing
+	bool supportsBlockProcessing() const { return true; }
+	void performBlock(float ** bus, SoundSource& src, const Vec3d& relposStart, const Vec3d& relposEnd, int numFrames, const float * samples) const;
+
 	/// focus is an exponent determining the amplitude focus to nearby speakers.
 
 	///focus is (0, inf) with usable range typically [0.2, 5]. Default is 1.
@@ -78,6 +82,8 @@ private:
 	int mDeviceChannels[DBAP_MAX_NUM_SPEAKERS];
 	int mNumSpeakers;
 	float mFocus;
+
+	float gain(const Vec3d& relpos, int speaker) const;
 };
 
 
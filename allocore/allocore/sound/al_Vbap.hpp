@@ -59,7 +59,9 @@ struct SpeakerTriple{
 	int s3;
 	Vec3d s3Vec;
 	Vec3d vec[3];
-	Mat3d mat;
+	Mat3d mat;		// speaker vectors as rows
+	Mat3d matInv;	// inverse of mat, maps directions to gains; for pairs
+					// (s3 == -1) the inverse of the x-z components
 
 	void loadVectors(const std::vector<Speaker>& spkrs);
 };
@@ -69,13 +71,46 @@ struct SpeakerTriple{
 class Vbap : public Spatializer{
 public:
 
-	/// @param[in] sl	A speaker layout
-	Vbap(const SpeakerLayout &sl);
+	/// Method used to find speaker triplets
+	enum Triangulation{
+		TRIANGULATION_HULL,		/**< Convex hull of speaker directions (default) */
+		TRIANGULATION_SEARCH	/**< Test all triples of speakers */
+	};
+
+	/// @param[in] sl		A speaker layout
+	/// @param[in] is3D	Whether to pan between triplets of speakers or, for a
+	///					ring of speakers, between pairs in the horizontal plane
+	Vbap(const SpeakerLayout &sl, bool is3D=true);
+
+	/// Whether panning between triplets (3D) or pairs (2D) of speakers
+	bool is3D() const { return mIs3D; }
+
+	/// Set method used to find speaker triplets when compiling
+
+	/// The convex hull of the speaker directions is built incrementally,
+	/// taking well under a millisecond for the 54 speakers of the AlloSphere.
+	/// Searching through all triples of speakers takes O(n^4) time for n
+	/// speakers, but can be spread over several threads. The hull covers
+	/// every direction, including narrow triplets between speakers that
+	/// nearly coincide. The search drops narrow triplets, which can leave
+	/// gaps, and returns all overlapping triplets of speakers on a common
+	/// plane, such as a ring, where the hull splits the polygon one way.
+	/// @param[in] v			triangulation method
+	/// @param[in] numThreads	number of threads used by TRIANGULATION_SEARCH
+	void triangulation(Triangulation v, int numThreads=1){
+		mTriangulation = v; mTriangulationThreads = numThreads;
+	}
+
+	/// Get method used to find speaker triplets
+	Triangulation triangulation() const { return mTriangulation; }
+
+	/// Get speaker triplets
+	const std::vector<SpeakerTriple>& triplets() const { return mTriplets; }
 
 	/// Add triplet of speakers
 	void addTriple(const SpeakerTriple& st);
 
-	Vec3d computeGains(const Vec3d& vecA, const SpeakerTriple& speak);
+	Vec3d computeGains(const Vec3d& vecA, const SpeakerTriple& speak) const;
 
 
 	// 2D VBAP, find pairs of speakers.
@@ -86,18 +121,91 @@ public:
 	// 3D VBAP, find triplets.
 	void findSpeakerTriplets(const std::vector<Speaker>& spkrs);
 
+	// 3D VBAP, find triplets from convex hull of speaker directions.
+	void findSpeakerTripletsHull(const std::vector<Speaker>& spkrs);
+
 	void compile(Listener& listener);
 
+	/// Per Sample Processing
 	void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample);
 
+	/// Per Buffer Processing
+	void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, float *samples);
+
+	/// Block Processing
+	bool supportsBlockProcessing() const { return true; }
+	void performBlock(float ** bus, SoundSource& src, const Vec3d& relposStart, const Vec3d& relposEnd, int numFrames, const float * samples) const;
+
 	void print();
 
+
+	/// Set resolution of gain table (0, i.e. no table, by default)
+
+	/// The gain table stores the triplet and gains for a grid of directions
+	/// on each face of a cube around the listener. Gains of other directions
+	/// are interpolated bilinearly from the four surrounding grid points, so
+	/// no search through the triplets is needed. Each face has n x n cells.
+	/// The table is built when compiling or, if already compiled, right away.
+	/// It is only used for 3D layouts.
+	void gainTableResolution(int n);
+
+	/// Set resolution of gain table to the highest fitting a memory budget
+
+	/// @param[in] bytes	maximum size of table, in bytes
+	///
+	void gainTableMemory(int bytes);
+
+	/// Get resolution of gain table
+	int gainTableResolution() const { return mTableRes; }
+
+	/// Get size of gain table, in bytes
+	int gainTableMemory() const { return mTable.size() * sizeof(TableEntry); }
+
+	/// Compare gain table against exact gains
+
+	/// The errors are the differences between the table and exact speaker
+	/// gains of randomly chosen directions.
+	/// @param[in] numDirs		number of random directions to test
+	/// @param[out] rmsError	root-mean-square gain error (optional)
+	/// \returns maximum gain error
+	double gainTableError(int numDirs=10000, double * rmsError=NULL) const;
+
+	/// Compute speaker gains for a direction relative to the listener
+
+	/// The gains are normalized to unit power. The gain table is used if
+	/// enabled, otherwise the triplet containing the direction is searched.
+	/// @param[in]  dir			direction in listener coordinates
+	/// @param[out] speakers	speaker indices; must hold at least 12 elements
+	/// @param[out] gains		speaker gains; must hold at least 12 elements
+	/// @param[in,out] triplet	triplet to start searching from, set to the
+	///							triplet found (optional)
+	/// \returns number of speakers with a gain
+	int speakerGains(const Vec3d& dir, int * speakers, float * gains, unsigned * triplet=NULL) const;
+
 private:
+	struct TableEntry{
+		int triplet;
+		float gains[3];
+	};
+
 	std::vector<SpeakerTriple> mTriplets;
 	unsigned mNumTriplets;
 	Listener* mListener;
 	unsigned int mCachedTripletIndex;
 	bool mIs3D;
+	std::vector<TableEntry> mTable;
+	int mTableRes;
+	Triangulation mTriangulation;
+	int mTriangulationThreads;
+
+	// Find triplet containing direction starting from the triplet 'start'.
+	// Returns triplet index and normalized gains or -1 if none was found.
+	int findTriplet(const Vec3d& vec, Vec3d& gains, unsigned start) const;
+
+	// Gains interpolated from gain table
+	int tableGains(const Vec3d& dir, int * speakers, float * gains) const;
+
+	void buildGainTable();
 };
 
 } // al::
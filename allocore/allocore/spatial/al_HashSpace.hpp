@@ -2,8 +2,10 @@
 #define INCLUDE_AL_HASHSPACE_HPP
 
 #include "allocore/math/al_Vec.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
 #include "allocore/types/al_Array.hpp"
 
+#include <algorithm>
 #include <vector>
 
 
@@ -48,9 +50,14 @@
 	It is optimized for densely packed points and querying for nearest neighbors
 	within given radii (results will be roughly sorted by distance).
 
-	TODO: non-toroidal options
-	TODO: have query() automatically (insertion) sort results by distance
-		(perhaps use std::set instead of vector?)
+	In the default LINKED mode, each voxel keeps a linked list of its objects,
+	updated as objects move. In SORTED mode, objects are instead sorted by
+	voxel into contiguous arrays by rebuild(), which is faster when most
+	objects move every frame.
+
+	For bounded (non-toroidal) or very large, sparse spaces, see SparseHashSpace.
+	Query::sort() orders results by distance, and Query::nearest() finds
+	exactly the k nearest objects, already sorted.
 
 	File author(s):
 	Wesley Smith, 2010, wesley.hoke@gmail.com
@@ -72,6 +79,12 @@ namespace al {
 class HashSpace {
 public:
 
+	/// How objects are found from voxels
+	enum Mode {
+		LINKED = 0,	///< linked list per voxel, updated by move()
+		SORTED = 1	///< arrays sorted by voxel, updated by rebuild()
+	};
+
 	/// container for registered spatial elements
 	struct Object {
 		Object() : hash(invalidHash()), next(NULL), prev(NULL), userdata(0) {}
@@ -123,6 +136,10 @@ public:
 				return x.distanceSquared > y.distanceSquared;
 			}
 
+			static bool nearer(const Result& x, const Result& y) {
+				return x.distanceSquared < y.distanceSquared;
+			}
+
 			Result() : object(0), distanceSquared(0) {}
 			Result(const Result& cpy) : object(cpy.object), distanceSquared(cpy.distanceSquared) {}
 		};
@@ -172,6 +189,23 @@ public:
 		*/
 		Object * nearest(const HashSpace& space, const Object * obj);
 
+		/**
+			finds exactly the k nearest neighbors, sorted by increasing distance
+			this replaces any previous results
+
+			@param space the HashSpace object to search in
+			@param center finds objects near to this point
+			@param obj finds objects other than obj near to it
+			@param k the number of neighbors to find
+			@return the number of results found (less than k only if the
+				space has fewer objects)
+		*/
+		int nearest(const HashSpace& space, const Vec3d& center, uint32_t k);
+		int nearest(const HashSpace& space, const Object * obj, uint32_t k);
+
+		/// sort results by increasing distance
+		Query& sort();
+
 
 		/// get number of results:
 		unsigned size() const { return mObjects.size(); }
@@ -200,6 +234,10 @@ public:
 	protected:
 		uint32_t mMaxResults;
 		Results mObjects;
+
+		// add objects other than exclude within radii of center
+		int query(const HashSpace& space, const Vec3d& center, const Object * exclude, double maxRadius, double minRadius);
+		inline void test(const HashSpace& space, Object * o, const Vec3d& pos, const Vec3d& center, double minr2, double maxr2);
 	};
 
 	/**
@@ -258,6 +296,54 @@ public:
 	/// an invalid voxel index used to indicate non-membership
 	static uint32_t invalidHash() { return UINT_MAX; }
 
+
+	/// Set how objects are found from voxels
+
+	/// In SORTED mode, move() and remove() only update the objects, and
+	/// rebuild() must be called before querying.
+	HashSpace& mode(Mode m);
+
+	/// Get how objects are found from voxels
+	Mode mode() const { return mMode; }
+
+	/// Sort objects by voxel into arrays used by queries in SORTED mode
+	void rebuild();
+
+	/// Find the neighbors of every object
+
+	/// For each object not removed, this calls func(id, query), where query
+	/// holds the objects other than itself within maxRadius. In SORTED mode,
+	/// objects are visited in voxel order. If a thread pool is given, objects
+	/// are processed in parallel, each thread with its own query, so func
+	/// must be safe to call from several threads at once.
+	///
+	/// @param maxRadius	finds objects if they are nearer this distance
+	/// @param func		function object called as func(uint32_t, Query&)
+	/// @param pool		thread pool to run on, or NULL for calling thread
+	/// @param maxResults	maximum number of neighbors per object
+	template <class Func>
+	void queryAll(double maxRadius, Func& func, ThreadPool * pool=NULL, uint32_t maxResults=128) const;
+
+	/// Find the k nearest objects to each of several points
+
+	/// Points are grouped by voxel, and each group walks the voxel shells
+	/// once, offering every object found to all points in the group.
+	/// Objects at a point are included, so to find the neighbors of objects
+	/// from their positions, ask for k+1 and skip each object itself.
+	///
+	/// @param points	the points to search from
+	/// @param n		number of points
+	/// @param k		number of neighbors per point
+	/// @param results	neighbors of point i start at results[i*k], sorted
+	///					by increasing distance; resized to n*k
+	/// @param counts	number of neighbors found per point; resized to n
+	/// @param pool		thread pool to run on, or NULL for calling thread
+	void nearest(
+		const Vec3d * points, int n, uint32_t k,
+		std::vector<Query::Result>& results, std::vector<uint32_t>& counts,
+		ThreadPool * pool=NULL
+	) const;
+
 protected:
 
 	// integer distance squared
@@ -309,10 +395,40 @@ protected:
 	/// the array of voxels (indexed by hashed location)
 	std::vector<Voxel> mVoxels;
 
+	Mode mMode;
+
+	/// SORTED mode: for each voxel, its first index into the sorted arrays,
+	/// followed by the total number of sorted objects
+	std::vector<uint32_t> mCellStart;
+	/// SORTED mode: object ids and positions sorted by voxel
+	std::vector<uint32_t> mSortIds;
+	std::vector<double> mSortX, mSortY, mSortZ;
+
+	template <class Func>
+	struct QueryAllBody : public ThreadPool::LoopBody {
+		QueryAllBody(const HashSpace& s, Func& f, double r, uint32_t n)
+		:	space(s), func(f), maxRadius(r), maxResults(n) {}
+		void operator()(int begin, int end);
+		const HashSpace& space;
+		Func& func;
+		double maxRadius;
+		uint32_t maxResults;
+	};
+
+	struct NearestBody;
+
+	// find k nearest objects to points which[0..n) in one voxel, as
+	// max-heaps at heaps + which[i]*k with sizes in counts[which[i]]
+	void nearest(
+		const Vec3d * points, const uint32_t * which, int n, uint32_t k,
+		const Object * exclude, Query::Result * heaps, uint32_t * counts
+	) const;
+
 	/// a baked array of voxel indices sorted by distance
 	std::vector<uint32_t> mVoxelIndices;
 	/// a baked array mapping distance to mVoxelIndices offsets
 	std::vector<uint32_t> mDistanceToVoxelIndices;
+	/// the distance of each entry of mVoxelIndices
 	std::vector<uint32_t> mVoxelIndicesToDistance;
 };
 
@@ -357,52 +473,32 @@ inline int HashSpace::Query :: operator()(const HashSpace& space, const Object *
 	return (*this)(space, obj, space.maxRadius());
 }
 
-// the maximum permissible value of radius is mDimHalf
-// if int(inner^2) == int(outer^2), only 1 shell will be queried.
-// TODO: non-toroidal version.
 inline int HashSpace::Query :: operator()(const HashSpace& space, Vec3d center, double maxRadius, double minRadius) {
-	unsigned nres = 0;
-	double minr2 = minRadius*minRadius;
-	double maxr2 = maxRadius*maxRadius;
-	uint32_t iminr2 = al::max(uint32_t(0), uint32_t(minRadius*minRadius));
-	uint32_t imaxr2 = al::min(space.mMaxHalfD2, uint32_t(1 + (maxRadius+1)*(maxRadius+1)));
-	if (iminr2 < imaxr2) {
-		uint32_t cellstart = space.mDistanceToVoxelIndices[iminr2];
-		uint32_t cellend = space.mDistanceToVoxelIndices[imaxr2];
-		for (uint32_t i = cellstart; i < cellend; i++) {
-			uint32_t index = space.hash(center, space.mVoxelIndices[i]);
-			const Voxel& voxel = space.mVoxels[index];
-			// now add any objects in this voxel to the result...
-			Object * head = voxel.mObjects;
-			if (head) {
-				Object * o = head;
-				do {
-					// final check - float version:
-					Vec3d rel = space.wrapRelative(o->pos - center);
-					double d2 = rel.magSqr();
-					if (d2 >= minr2 && d2 <= maxr2) {
-						mObjects[nres].object = o;
-						mObjects[nres].distanceSquared = d2;
-						nres++;
-					}
-					o = o->next;
-				} while (o != head && nres < mMaxResults);
-			}
-			if(nres == mMaxResults) {
-				break;
-			}
-		}
+	return query(space, center, NULL, maxRadius, minRadius);
+}
+
+inline int HashSpace::Query :: operator()(const HashSpace& space, const HashSpace::Object * obj, double maxRadius, double minRadius) {
+	return query(space, obj->pos, obj, maxRadius, minRadius);
+}
+
+inline void HashSpace::Query :: test(const HashSpace& space, Object * o, const Vec3d& pos, const Vec3d& center, double minr2, double maxr2) {
+	// final check - float version:
+	Vec3d rel = space.wrapRelative(pos - center);
+	double d2 = rel.magSqr();
+	if (d2 >= minr2 && d2 <= maxr2) {
+		// here we could insert-sort based on distance...
+		mObjects.push_back(Result());
+		mObjects.back().object = o;
+		mObjects.back().distanceSquared = d2;
 	}
-	//std::sort(mObjects.begin(), mObjects.end(), Result::compare);
-	return nres;
 }
 
 // the maximum permissible value of radius is mDimHalf
 // if int(inner^2) == int(outer^2), only 1 shell will be queried.
 // TODO: non-toroidal version.
-inline int HashSpace::Query :: operator()(const HashSpace& space, const HashSpace::Object * obj, double maxRadius, double minRadius) {
-	unsigned nres = 0;
-	const Vec3d& center = obj->pos;
+inline int HashSpace::Query :: query(const HashSpace& space, const Vec3d& center, const Object * exclude, double maxRadius, double minRadius) {
+	const unsigned start = mObjects.size();
+	if (start >= mMaxResults || space.mObjects.empty()) return 0;
 	double minr2 = minRadius*minRadius;
 	double maxr2 = maxRadius*maxRadius;
 	uint32_t iminr2 = al::max(uint32_t(0), uint32_t(minRadius*minRadius));
@@ -410,53 +506,45 @@ inline int HashSpace::Query :: operator()(const HashSpace& space, const HashSpac
 	if (iminr2 < imaxr2) {
 		uint32_t cellstart = space.mDistanceToVoxelIndices[iminr2];
 		uint32_t cellend = space.mDistanceToVoxelIndices[imaxr2];
+		Object * objects = const_cast<Object *>(&space.mObjects[0]);
+		const uint32_t cx = center.x, cy = center.y, cz = center.z;
 		for (uint32_t i = cellstart; i < cellend; i++) {
-			uint32_t index = space.hash(center, space.mVoxelIndices[i]);
-			const Voxel& voxel = space.mVoxels[index];
+			uint32_t index = space.hash(cx, cy, cz, space.mVoxelIndices[i]);
 			// now add any objects in this voxel to the result...
-			Object * head = voxel.mObjects;
-			if (head) {
-				Object * o = head;
-				do {
-					if (o != obj) {
-						// final check - float version:
-						Vec3d rel = space.wrapRelative(o->pos - center);
-						double d2 = rel.magSqr();
-						if (d2 >= minr2 && d2 <= maxr2) {
-							// here we could insert-sort based on distance...
-							mObjects[nres].object = o;
-							mObjects[nres].distanceSquared = d2;
-							nres++;
-						}
+			if (space.mMode == SORTED) {
+				if (space.mCellStart.empty()) break;
+				uint32_t end = space.mCellStart[index+1];
+				for (uint32_t j = space.mCellStart[index]; j < end && mObjects.size() < mMaxResults; j++) {
+					Object * o = objects + space.mSortIds[j];
+					if (o != exclude) {
+						test(space, o, Vec3d(space.mSortX[j], space.mSortY[j], space.mSortZ[j]), center, minr2, maxr2);
 					}
-					o = o->next;
-				} while (o != head && nres < mMaxResults);
+				}
+			} else {
+				Object * head = space.mVoxels[index].mObjects;
+				if (head) {
+					Object * o = head;
+					do {
+						if (o != exclude) test(space, o, o->pos, center, minr2, maxr2);
+						o = o->next;
+					} while (o != head && mObjects.size() < mMaxResults);
+				}
 			}
-			if(nres == mMaxResults) break;
+			if (mObjects.size() == mMaxResults) break;
 		}
 	}
 	//std::sort(mObjects.begin(), mObjects.end(), Result::compare);
-	return nres;
+	return mObjects.size() - start;
 }
 
 // of the matches, return the best:
 inline HashSpace::Object * HashSpace::Query :: nearest(const HashSpace& space, const Object * src) {
-	clear();
-	const Vec3d& center = src->pos;
-	uint32_t results = (*this)(space, src, space.mMaxHalfD2);
-
-	Object * result = 0;
-	double rd2 = space.mMaxHalfD2;
-	for (uint32_t i=0; i<results; i++) {
-		Object * o = mObjects[i].object;
-		Vec3d rel = space.wrapRelative(o->pos - center);
-		double d2 = rel.magSqr();
-		if (d2 < rd2) {
-			rd2 = d2;
-			result = o;
-		}
-	}
-	return result;
+	return nearest(space, src, 1) ? mObjects[0].object : 0;
+}
+
+inline HashSpace::Query& HashSpace::Query :: sort() {
+	std::sort(mObjects.begin(), mObjects.end(), Result::nearer);
+	return *this;
 }
 
 
@@ -467,6 +555,28 @@ inline void HashSpace :: numObjects(int numObjects) {
 	for (unsigned i=0; i<mVoxels.size(); i++) {
 		mVoxels[i].mObjects = 0;
 	}
+	mCellStart.clear();
+}
+
+template <class Func>
+inline void HashSpace::QueryAllBody<Func> :: operator()(int begin, int end) {
+	Query query(maxResults);
+	for (int i=begin; i<end; i++) {
+		uint32_t id = space.mMode == SORTED ? space.mSortIds[i] : i;
+		const Object& o = space.mObjects[id];
+		if (o.hash == invalidHash()) continue;
+		query.clear();
+		query(space, &o, maxRadius);
+		func(id, query);
+	}
+}
+
+template <class Func>
+inline void HashSpace :: queryAll(double maxRadius, Func& func, ThreadPool * pool, uint32_t maxResults) const {
+	int count = mMode == SORTED ? mSortIds.size() : mObjects.size();
+	QueryAllBody<Func> body(*this, func, maxRadius, maxResults);
+	if (pool) pool->runLoop(0, count, 64, body);
+	else body(0, count);
 }
 
 template<typename T>
@@ -474,7 +584,9 @@ inline HashSpace& HashSpace :: move(uint32_t objectId, Vec<3,T> pos) {
 	Object& o = mObjects[objectId];
 	o.pos.set(wrap(pos));
 	uint32_t newhash = hash(o.pos);
-	if (newhash != o.hash) {
+	if (mMode == SORTED) {
+		o.hash = newhash;
+	} else if (newhash != o.hash) {
 		if (o.hash != invalidHash()) mVoxels[o.hash].remove(&o);
 		o.hash = newhash;
 		mVoxels[newhash].add(&o);
@@ -484,7 +596,7 @@ inline HashSpace& HashSpace :: move(uint32_t objectId, Vec<3,T> pos) {
 
 inline HashSpace& HashSpace :: remove(uint32_t objectId) {
 	Object& o = mObjects[objectId];
-	if (o.hash != invalidHash()) mVoxels[o.hash].remove(&o);
+	if (o.hash != invalidHash() && mMode == LINKED) mVoxels[o.hash].remove(&o);
 	o.hash = invalidHash();
 	return *this;
 }
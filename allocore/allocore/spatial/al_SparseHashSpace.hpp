@@ -0,0 +1,303 @@
+#ifndef INCLUDE_AL_SPARSEHASHSPACE_HPP
+#define INCLUDE_AL_SPARSEHASHSPACE_HPP
+
+#include "allocore/math/al_Vec.hpp"
+
+#include <float.h>
+#include <limits.h>
+#include <vector>
+
+
+/*	Allocore --
+	Multimedia / virtual environment application class library
+
+	Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology, UCSB.
+	Copyright (C) 2012. The Regents of the University of California.
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+		Redistributions of source code must retain the above copyright notice,
+		this list of conditions and the following disclaimer.
+
+		Redistributions in binary form must reproduce the above copyright
+		notice, this list of conditions and the following disclaimer in the
+		documentation and/or other materials provided with the distribution.
+
+		Neither the name of the University of California nor the names of its
+		contributors may be used to endorse or promote products derived from
+		this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+
+
+	File description:
+	SparseHashSpace is a bounded, non-wrapping variant of HashSpace for large,
+	sparsely occupied scenes
+
+	Cells are cubes of a given size, identified by 64-bit Morton codes of
+	their integer coordinates (21 bits per axis, so 2^21 cells per side).
+	Only occupied cells are stored, in an open-addressing hash table, so
+	memory use is proportional to the number of occupied cells rather than
+	to the volume of the space.
+
+	Queries accept any radius, and can find exactly the k nearest objects.
+
+	File author(s):
+	AlloSystem contributors, 2016
+*/
+
+namespace al {
+
+/**
+	SparseHashSpace detects object proximity using a sparse grid of cells
+
+	Positions are clamped to [-extent(), extent()] on each axis. Unlike
+	HashSpace, the space does not wrap, and distances are plain Euclidean.
+*/
+class SparseHashSpace {
+public:
+
+	/// container for registered spatial elements
+	struct Object {
+		Object()
+		:	cell(invalidCell()), next(invalidObject()), prev(invalidObject()), userdata(0) {}
+
+		Vec3d pos;
+		uint64_t cell;		///< key of the cell it belongs to (or invalidCell())
+		uint32_t next, prev;///< indices of neighbors in the same cell
+		union {				///< a way to attach user-defined payloads:
+			uint32_t id;
+			void * userdata;
+		};
+	};
+
+	/**
+		Query functor
+		create and re-use a query functor to find neighbors
+
+		SparseHashSpace::Query query;
+
+		query.clear(); // do this if you want to re-use the query object
+		query(space, Vec3d(0, 0, 0), 10);
+		for (int i=0; i<query.size(); i++) {
+			SparseHashSpace::Object * o = query[i];
+			...
+		}
+	*/
+	struct Query {
+
+		struct Result {
+			Object * object;
+			double distanceSquared;
+
+			Result() : object(0), distanceSquared(0) {}
+			Result(Object * o, double d2) : object(o), distanceSquared(d2) {}
+
+			// orders nearer results first
+			bool operator< (const Result& r) const { return distanceSquared < r.distanceSquared; }
+		};
+
+		typedef std::vector<Result> Results;
+		typedef Results::iterator Iterator;
+
+		/**
+			Constructor
+			@param maxResults the maximum number of results to find
+		*/
+		Query(uint32_t maxResults=128)
+		:	mMaxResults(maxResults)
+		{
+			mObjects.reserve(maxResults);
+		}
+
+		/**
+			finds the neighbors of a given point, within given distances
+			the matches are in no particular order
+
+			@param space the SparseHashSpace object to search in
+			@param center finds objects near to this point
+			@param obj finds objects other than obj near to it
+			@param maxRadius finds objects if they are nearer this distance
+			@param minRadius finds objects if they are beyond this distance
+			@return the number of results found
+		*/
+		int operator()(const SparseHashSpace& space, const Vec3d& center, double maxRadius, double minRadius=0.);
+		int operator()(const SparseHashSpace& space, const Object * obj, double maxRadius, double minRadius=0.);
+
+		/**
+			finds exactly the k nearest neighbors, sorted by increasing distance
+			this replaces any previous results
+
+			@param space the SparseHashSpace object to search in
+			@param center finds objects near to this point
+			@param obj finds objects other than obj near to it
+			@param k the number of neighbors to find
+			@param maxRadius only finds objects nearer this distance
+			@return the number of results found, which is less than k only
+				if fewer objects are within maxRadius
+		*/
+		int nearest(const SparseHashSpace& space, const Vec3d& center, uint32_t k, double maxRadius=DBL_MAX);
+		int nearest(const SparseHashSpace& space, const Object * obj, uint32_t k, double maxRadius=DBL_MAX);
+
+		/// get number of results:
+		unsigned size() const { return mObjects.size(); }
+		/// get each result:
+		Object * operator[](unsigned i) const { return mObjects[i].object; }
+		double distanceSquared(unsigned i) const { return mObjects[i].distanceSquared; }
+		double distance(unsigned i) const { return sqrt(distanceSquared(i)); }
+
+		/**
+			clear is separated from the main query operation,
+			to support aggregating queries in series
+		*/
+		Query& clear() { mObjects.clear(); return *this; }
+
+		/// set the maximum number of desired results
+		Query& maxResults(uint32_t i) { mMaxResults = i; return *this; }
+		/// get the maximum number of desired results
+		uint32_t maxResults() const { return mMaxResults; }
+
+		/// std::vector interface:
+		Iterator begin() { return mObjects.begin(); }
+		Iterator end() { return mObjects.end(); }
+		Results& results() { return mObjects; }
+
+	protected:
+		uint32_t mMaxResults;
+		Results mObjects;
+
+		int query(const SparseHashSpace& space, const Vec3d& center, const Object * exclude, double maxRadius, double minRadius);
+		int knn(const SparseHashSpace& space, const Vec3d& center, const Object * exclude, uint32_t k, double maxRadius);
+	};
+
+
+	/**
+		Construct a SparseHashSpace
+
+		@param cellSize the edge length of each cell; queries are fastest
+			when this is similar to the typical query radius
+		@param numObjects set how many Object slots to initially allocate
+	*/
+	SparseHashSpace(double cellSize=1, uint32_t numObjects=0);
+
+	~SparseHashSpace();
+
+	/// the edge length of each cell:
+	double cellSize() const { return mCellSize; }
+	/// positions are clamped to [-extent(), extent()] on each axis:
+	double extent() const { return mCellSize * double(1<<(bits()-1)); }
+
+	/// get/set the number of objects:
+	void numObjects(int numObjects);
+	uint32_t numObjects() const { return mObjects.size(); }
+
+	/// get the object at a given index:
+	Object& object(uint32_t i) { return mObjects[i]; }
+
+	/// set the position of an object:
+	SparseHashSpace& move(uint32_t objectId, double x, double y, double z) { return move(objectId, Vec3d(x,y,z)); }
+	template<typename T>
+	SparseHashSpace& move(uint32_t objectId, const Vec<3,T>& pos) { return moveObject(objectId, Vec3d(pos)); }
+
+	/// this removes the object from cells/queries, but does not destroy it
+	/// the objectId can be reused later via move()
+	SparseHashSpace& remove(uint32_t objectId);
+
+	/// clamp an absolute position within the space:
+	Vec3d clamp(const Vec3d& v) const;
+
+	/// the number of occupied cells:
+	uint32_t numCells() const { return mNumCells; }
+	/// the number of slots in the cell table, proportional to numCells():
+	uint32_t cellCapacity() const { return mCells.size(); }
+
+	/// the number of bits per axis in cell keys
+	static int bits() { return 21; }
+	/// an invalid cell key used to indicate non-membership
+	static uint64_t invalidCell() { return ~uint64_t(0); }
+	/// an invalid object index used to terminate lists
+	static uint32_t invalidObject() { return UINT_MAX; }
+
+	/// interleave bits of cell coordinates into a Morton code
+	static uint64_t morton(uint32_t x, uint32_t y, uint32_t z) {
+		return spread(x) | (spread(y)<<1) | (spread(z)<<2);
+	}
+	/// separate a Morton code into cell coordinates
+	static Vec<3,uint32_t> unmorton(uint64_t k) {
+		return Vec<3,uint32_t>(compact(k), compact(k>>1), compact(k>>2));
+	}
+
+protected:
+
+	struct Cell {
+		Cell() : key(invalidCell()), first(invalidObject()) {}
+		uint64_t key;	///< Morton code of cell coordinates (or invalidCell())
+		uint32_t first;	///< head of circular list of objects in the cell
+	};
+
+	// spread 21 bits to every third bit
+	static uint64_t spread(uint64_t v) {
+		v &= 0x1fffff;
+		v = (v | (v<<32)) & 0x1f00000000ffffULL;
+		v = (v | (v<<16)) & 0x1f0000ff0000ffULL;
+		v = (v | (v<< 8)) & 0x100f00f00f00f00fULL;
+		v = (v | (v<< 4)) & 0x10c30c30c30c30c3ULL;
+		v = (v | (v<< 2)) & 0x1249249249249249ULL;
+		return v;
+	}
+	// gather every third bit into 21 bits
+	static uint32_t compact(uint64_t v) {
+		v &= 0x1249249249249249ULL;
+		v = (v ^ (v>> 2)) & 0x10c30c30c30c30c3ULL;
+		v = (v ^ (v>> 4)) & 0x100f00f00f00f00fULL;
+		v = (v ^ (v>> 8)) & 0x1f0000ff0000ffULL;
+		v = (v ^ (v>>16)) & 0x1f00000000ffffULL;
+		v = (v ^ (v>>32)) & 0x1fffffULL;
+		return uint32_t(v);
+	}
+
+	// cell coordinate along an axis of a (clamped) position component
+	int32_t cellCoord(double x) const;
+
+	// table slot of a key (Fibonacci hashing, so nearby keys spread out)
+	uint32_t slot(uint64_t key) const { return uint32_t((key * 0x9E3779B97F4A7C15ULL) >> mSlotShift); }
+
+	// find table slot of a cell, or invalidObject() if not occupied
+	uint32_t findCell(uint64_t key) const;
+	// find or insert table slot of a cell
+	uint32_t insertCell(uint64_t key);
+	// remove cell at table slot
+	void eraseCell(uint32_t i);
+	// reallocate table with capacity of 2^bits
+	void rehash(int bits);
+
+	SparseHashSpace& moveObject(uint32_t objectId, const Vec3d& pos);
+	void link(uint32_t objectId, uint64_t key);
+	void unlink(uint32_t objectId);
+
+	double mCellSize, mInvCellSize;
+
+	/// the array of objects
+	std::vector<Object> mObjects;
+
+	/// open-addressing table of occupied cells (linear probing)
+	std::vector<Cell> mCells;
+	uint32_t mNumCells;
+	int mSlotShift;
+};
+
+} // al::
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef INCLUDE_AL_ATOMIC_HPP
+#define INCLUDE_AL_ATOMIC_HPP
+
+/*	Allocore --
+	Multimedia / virtual environment application class library
+
+	Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology, UCSB.
+	Copyright (C) 2012. The Regents of the University of California.
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+		Redistributions of source code must retain the above copyright notice,
+		this list of conditions and the following disclaimer.
+
+		Redistributions in binary form must reproduce the above copyright
+		notice, this list of conditions and the following disclaimer in the
+		documentation and/or other materials provided with the distribution.
+
+		Neither the name of the University of California nor the names of its
+		contributors may be used to endorse or promote products derived from
+		this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+
+
+	File description:
+	Integer types with atomic operations for lock-free communication between
+	threads
+
+	File author(s):
+	AlloSystem contributors, 2016
+*/
+
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1700)
+	#define AL_ATOMIC_STD
+	#include <atomic>
+#elif !defined(__GNUC__)
+	#error "al::Atomic requires C++11 or GCC-compatible atomic builtins"
+#endif
+
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
+namespace al{
+
+/// Integer with atomic operations
+
+/// Loads have acquire semantics and stores have release semantics. All
+/// read-modify-write operations are sequentially consistent. This means that
+/// anything a thread writes before storing a value is visible to another
+/// thread after it loads that value. None of the operations ever block, so
+/// they are safe to use from a real-time thread.
+template <class T>
+class Atomic{
+public:
+
+	/// @param[in] v	initial value
+	Atomic(T v=T(0)){ store(v); }
+
+	/// Get value
+	T load() const;
+
+	/// Set value
+	void store(T v);
+
+	/// Add to value and return value before addition
+	T fetchAdd(T v);
+
+	/// Subtract from value and return value before subtraction
+	T fetchSub(T v){ return fetchAdd(-v); }
+
+	/// Set value and return previous value
+	T exchange(T v);
+
+	/// Set value to 'desired' if it is equal to 'expected'
+
+	/// @param[in,out] expected		expected value; on failure, set to the
+	///								current value
+	/// @param[in] desired			new value
+	/// \returns whether the value was set
+	bool compareExchange(T& expected, T desired);
+
+	/// Get value, without ordering guarantees
+
+	/// This is useful for counters that are only read for statistics.
+	///
+	T loadRelaxed() const;
+
+	/// Set value, without ordering guarantees
+	void storeRelaxed(T v);
+
+private:
+	#ifdef AL_ATOMIC_STD
+	std::atomic<T> mValue;
+	#else
+	volatile T mValue;
+	#endif
+
+	// non-copyable
+	Atomic(const Atomic&);
+	Atomic& operator= (const Atomic&);
+};
+
+
+/// Hint to the processor that the calling thread is spin-waiting
+inline void spinPause(){
+	#if defined(__i386__) || defined(__x86_64__)
+		__asm__ __volatile__("pause");
+	#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+		_mm_pause();
+	#endif
+}
+
+
+
+
+// -----------------------------------------------------------------------------
+// Inline implementation
+
+#ifdef AL_ATOMIC_STD
+
+template<class T>
+inline T Atomic<T>::load() const { return mValue.load(std::memory_order_acquire); }
+
+template<class T>
+inline void Atomic<T>::store(T v){ mValue.store(v, std::memory_order_release); }
+
+template<class T>
+inline T Atomic<T>::fetchAdd(T v){ return mValue.fetch_add(v); }
+
+template<class T>
+inline T Atomic<T>::exchange(T v){ return mValue.exchange(v); }
+
+template<class T>
+inline bool Atomic<T>::compareExchange(T& expected, T desired){
+	return mValue.compare_exchange_strong(expected, desired);
+}
+
+template<class T>
+inline T Atomic<T>::loadRelaxed() const { return mValue.load(std::memory_order_relaxed); }
+
+template<class T>
+inline void Atomic<T>::storeRelaxed(T v){ mValue.store(v, std::memory_order_relaxed); }
+
+#else
+
+template<class T>
+inline T Atomic<T>::load() const { return __atomic_load_n(&mValue, __ATOMIC_ACQUIRE); }
+
+template<class T>
+inline void Atomic<T>::store(T v){ __atomic_store_n(&mValue, v, __ATOMIC_RELEASE); }
+
+template<class T>
+inline T Atomic<T>::fetchAdd(T v){ return __atomic_fetch_add(&mValue, v, __ATOMIC_SEQ_CST); }
+
+template<class T>
+inline T Atomic<T>::exchange(T v){ return __atomic_exchange_n(&mValue, v, __ATOMIC_SEQ_CST); }
+
+template<class T>
+inline bool Atomic<T>::compareExchange(T& expected, T desired){
+	return __atomic_compare_exchange_n(&mValue, &expected, desired, false,
+		__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+template<class T>
+inline T Atomic<T>::loadRelaxed() const { return __atomic_load_n(&mValue, __ATOMIC_RELAXED); }
+
+template<class T>
+inline void Atomic<T>::storeRelaxed(T v){ __atomic_store_n(&mValue, v, __ATOMIC_RELAXED); }
+
+#endif
+
+} // al::
+
+#endif
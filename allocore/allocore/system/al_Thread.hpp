@@ -137,6 +137,37 @@ protected:
 
 
 
+/// Counting semaphore
+
+/// A semaphore holds a count of available resources. Waiting on a semaphore
+/// blocks the calling thread until the count is positive and then decrements
+/// it. Posting never blocks, so a real-time thread can use it to wake up
+/// waiting threads.
+class Semaphore{
+public:
+
+	/// @param[in] count		initial count
+	Semaphore(unsigned count=0);
+
+	~Semaphore();
+
+	/// Increment count, waking up a waiting thread
+	void post();
+
+	/// Block until count is positive, then decrement it
+	void wait();
+
+private:
+	class Impl;
+	Impl * mImpl;
+
+	// non-copyable
+	Semaphore(const Semaphore&);
+	Semaphore& operator= (const Semaphore&);
+};
+
+
+
 /// Multiple threads acting as a single work unit
 template <class ThreadFunction>
 class Threads{
@@ -0,0 +1,242 @@
+#ifndef INCLUDE_AL_THREADPOOL_HPP
+#define INCLUDE_AL_THREADPOOL_HPP
+
+/*	Allocore --
+	Multimedia / virtual environment application class library
+
+	Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology, UCSB.
+	Copyright (C) 2012. The Regents of the University of California.
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+		Redistributions of source code must retain the above copyright notice,
+		this list of conditions and the following disclaimer.
+
+		Redistributions in binary form must reproduce the above copyright
+		notice, this list of conditions and the following disclaimer in the
+		documentation and/or other materials provided with the distribution.
+
+		Neither the name of the University of California nor the names of its
+		contributors may be used to endorse or promote products derived from
+		this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+
+
+
+	File description:
+	Persistent pool of worker threads with work stealing
+
+	File author(s):
+	AlloSystem contributors, 2016
+*/
+
+#include "allocore/system/al_Atomic.hpp"
+#include "allocore/system/al_Thread.hpp"
+#include "allocore/system/pstdint.h"
+
+namespace al{
+
+/// Persistent pool of worker threads with work stealing
+
+/// The worker threads are started once and sleep while there is no work, so
+/// that, unlike Threads, running work on the pool does not create threads.
+/// The pool runs two kinds of work: tasks and loops.
+///
+/// A task is a function object submitted to the pool. Each worker has its own
+/// queue of tasks. Tasks submitted from a worker go to its queue and tasks
+/// submitted from other threads go to a queue shared by all workers. A worker
+/// that runs out of tasks steals tasks from the other workers. A task is also
+/// a future; waiting on it runs other tasks of the pool until it is done.
+///
+/// A loop, run by parallelFor, splits an index range into chunks that are
+/// distributed evenly over the workers and the calling thread. A thread that
+/// runs out of chunks steals half of the remaining chunks of the thread with
+/// the most, so loops with an uneven cost per index are balanced.
+class ThreadPool{
+public:
+
+	/// Function object run by a thread pool
+
+	/// The object must not be destroyed while it is submitted and not done.
+	///
+	class Task : public ThreadFunction{
+	public:
+		Task(): mDone(1), mPool(0){}
+
+		/// Returns whether the task has been run since it was last submitted
+		bool done() const { return mDone.load() != 0; }
+
+		/// Block until the task is done, running other tasks meanwhile
+		void wait();
+
+	private:
+		friend class ThreadPool;
+		Atomic<int> mDone;
+		ThreadPool * mPool;
+	};
+
+	/// Work done by a thread since construction or last reset
+	struct Stats{
+		unsigned tasks;		///< Number of tasks run
+		unsigned chunks;	///< Number of loop chunks run
+		unsigned steals;	///< Number of successful steals of tasks or chunks
+		unsigned sleeps;	///< Number of times the thread slept for lack of work
+	};
+
+
+	/// @param[in] numThreads	number of worker threads; if 0, one less than
+	///							the number of processors, as the calling
+	///							thread also works on loops
+	/// @param[in] pinThreads	whether to pin each worker thread to its own
+	///							processor (Linux and Windows only)
+	ThreadPool(int numThreads=0, bool pinThreads=false);
+
+	/// Run all submitted tasks, then stop the worker threads
+	~ThreadPool();
+
+
+	/// Returns number of worker threads
+	int size() const { return mSize; }
+
+	/// Submit a task to be run by a worker thread
+
+	/// If the task queue is full, the task is run on the calling thread.
+	///
+	void submit(Task& task);
+
+	/// Call func(i) for each i in [begin, end) in parallel
+
+	/// The range is split into chunks of 'grain' indices, which are the unit
+	/// of work stealing. This returns when all indices are done. Only one loop
+	/// runs on the pool at a time; a loop started from a worker thread, or
+	/// while another loop is running, runs on the calling thread alone.
+	template <class Func>
+	void parallelFor(int begin, int end, int grain, Func& func){
+		ForBody<Func> body(func);
+		runLoop(begin, end, grain, body);
+	}
+
+
+	/// Get work statistics of a worker thread
+
+	/// @param[in] i	worker index; size() gives the work done on the pool's
+	///					behalf by other threads, e.g. in parallelFor
+	Stats stats(int i) const;
+
+	/// Reset work statistics of all threads
+	void resetStats();
+
+
+	/// Loop body called with sub-ranges of indices [begin, end)
+	struct LoopBody{
+		virtual ~LoopBody(){}
+		virtual void operator()(int begin, int end) = 0;
+	};
+
+	/// Call body with sub-ranges of [begin, end) in parallel
+	void runLoop(int begin, int end, int grain, LoopBody& body);
+
+private:
+	struct Counters{
+		Atomic<unsigned> tasks, chunks, steals, sleeps;
+	};
+
+	// Fixed size work-stealing deque of tasks (Chase-Lev). Only the owner
+	// pushes and pops at the bottom; any thread steals at the top.
+	struct TaskDeque{
+		enum{ CAPACITY = 1024 };
+		TaskDeque(): mTop(0), mBottom(0){}
+		bool push(Task * t);
+		Task * pop();
+		Task * steal();
+		bool empty() const { return mBottom.load() <= mTop.load(); }
+	private:
+		Atomic<int64_t> mTop, mBottom;
+		Atomic<Task *> mTasks[CAPACITY];
+	};
+
+	// Fixed size multi-producer multi-consumer queue of tasks
+	struct TaskQueue{
+		enum{ CAPACITY = 1024 };
+		TaskQueue();
+		bool push(Task * t);
+		Task * pop();
+		bool empty() const { return mHead.load() == mTail.load(); }
+	private:
+		Atomic<unsigned> mHead, mTail;
+		Atomic<unsigned> mSeqs[CAPACITY];
+		Task * mTasks[CAPACITY];
+	};
+
+	struct Worker : public ThreadFunction{
+		void operator()();
+		ThreadPool * pool;
+		int index;
+		unsigned loopGen;	// last loop joined
+		Thread thread;
+		TaskDeque tasks;
+		Counters counters;
+		char pad[64];		// keep workers on separate cache lines
+	};
+
+	template <class Func>
+	struct ForBody : public LoopBody{
+		ForBody(Func& f): func(f){}
+		void operator()(int begin, int end){
+			for(int i=begin; i<end; ++i) func(i);
+		}
+		Func& func;
+	};
+
+	int mSize;
+	bool mPin;
+	Worker * mWorkers;
+	TaskQueue mShared;
+	Counters mExternal;
+	Semaphore mWake;
+	Atomic<int> mSleepers;	// workers about to sleep, not yet woken
+	Atomic<int> mQuit;
+
+	// current loop
+	LoopBody * mLoopBody;
+	int mLoopBegin, mLoopEnd, mLoopGrain;
+	Atomic<uint64_t> * mLoopRanges;	// chunk range [lo, hi) of each thread
+	Atomic<int> mLoopBusy;			// loop is being run
+	Atomic<int> mLoopOpen;			// workers may join loop
+	Atomic<unsigned> mLoopGen;		// incremented for each loop
+	Atomic<int> mLoopUsers;			// workers in loop
+	Atomic<int> mLoopChunksDone;
+
+	void work(Worker& w);
+	Task * findTask(Worker * w, Counters& c);
+	bool hasWork(const Worker& w) const;
+	bool joinLoop(Worker& w);
+	void loopWork(int slot, Counters& c);
+	bool takeChunk(int slot, int& chunk);
+	bool stealChunks(int slot);
+	void runTask(Task * t, Counters& c);
+	void wakeOne();
+	void wakeAll();
+	bool helpOnce();
+
+	// non-copyable
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator= (const ThreadPool&);
+};
+
+} // al::
+
+#endif
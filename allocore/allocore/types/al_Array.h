@@ -357,7 +357,7 @@ static inline uint32_t allo_array_elements(const AlloArray * arr) {
 static inline size_t allo_array_size_from_header(const AlloArrayHeader * h) {
 	if(h->dimcount != 0){
 		int idx = h->dimcount-1;
-		return h->stride[idx] * h->dim[idx];
+		return (size_t)h->stride[idx] * h->dim[idx];
 	}
 	return 0;
 }
@@ -0,0 +1,182 @@
+#ifndef INCLUDE_AL_BLOCKRING_HPP
+#define INCLUDE_AL_BLOCKRING_HPP
+
+/*	Allocore --
+	Multimedia / virtual environment application class library
+
+	Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology, UCSB.
+	Copyright (C) 2012. The Regents of the University of California.
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+		Redistributions of source code must retain the above copyright notice,
+		this list of conditions and the following disclaimer.
+
+		Redistributions in binary form must reproduce the above copyright
+		notice, this list of conditions and the following disclaimer in the
+		documentation and/or other materials provided with the distribution.
+
+		Neither the name of the University of California nor the names of its
+		contributors may be used to endorse or promote products derived from
+		this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+
+
+
+	File description:
+	Lock-free single-reader-single-writer ring of fixed-size blocks
+
+	File author(s):
+	AlloSystem contributors, 2016
+*/
+
+#include <string.h>
+#include <vector>
+#include "allocore/system/al_Atomic.hpp"
+#include "allocore/types/al_SingleRWRingBuffer.hpp" // next_power_of_two
+
+namespace al{
+
+/// Lock-free single-reader-single-writer ring of fixed-size blocks
+
+/// This passes blocks of data, such as audio buffers, from one thread to
+/// another without locking or allocating, so either thread may be a
+/// real-time thread. Blocks can be filled and consumed in place, so no
+/// copies are needed beyond those into and out of the ring.
+///
+/// The writer publishes a block only after filling it, and the reader
+/// releases a block only after consuming it, so neither sees a block that
+/// the other is still using. When the ring is full, the writer's block is
+/// dropped and counted as an overrun. When a reader that needs a block on
+/// every call finds the ring empty, it is counted as an underrun.
+///
+/// Only one thread may write and only one other thread may read at a time.
+template <class T>
+class BlockRing{
+public:
+
+	/// @param[in] blockSize	number of elements in each block
+	/// @param[in] numBlocks	number of blocks, rounded up to a power of two
+	BlockRing(unsigned blockSize=1, unsigned numBlocks=2)
+	:	mRead(0), mWrite(0), mOverruns(0), mUnderruns(0)
+	{	resize(blockSize, numBlocks); }
+
+
+	/// Set size and empty the ring; not safe while reading or writing
+	void resize(unsigned blockSize, unsigned numBlocks){
+		mBlockSize = blockSize;
+		mNumBlocks = next_power_of_two(numBlocks < 1 ? 1 : numBlocks);
+		mData.assign(size_t(mBlockSize)*mNumBlocks, T());
+		clear();
+	}
+
+	/// Empty the ring and reset counts; not safe while reading or writing
+	void clear(){
+		mRead.store(0);
+		mWrite.store(0);
+		mOverruns.store(0);
+		mUnderruns.store(0);
+	}
+
+	/// Get number of elements in each block
+	unsigned blockSize() const { return mBlockSize; }
+
+	/// Get number of blocks
+	unsigned numBlocks() const { return mNumBlocks; }
+
+	/// Get number of blocks ready to be read
+	unsigned readable() const { return mWrite.load() - mRead.load(); }
+
+	/// Get number of blocks free to be written
+	unsigned writable() const { return mNumBlocks - readable(); }
+
+	/// Get number of blocks dropped because the ring was full
+	unsigned overruns() const { return mOverruns.load(); }
+
+	/// Get number of times read() found the ring empty
+	unsigned underruns() const { return mUnderruns.load(); }
+
+
+	/// Get the next block to write to, or NULL if the ring is full
+
+	/// The block is not visible to the reader until commitWrite().
+	/// Returning NULL counts as an overrun.
+	T * writeBlock(){
+		unsigned w = mWrite.loadRelaxed();
+		// acquire, so the reader is done with the block before we reuse it
+		if(w - mRead.load() >= mNumBlocks){
+			mOverruns.fetchAdd(1);
+			return 0;
+		}
+		return &mData[size_t(w & (mNumBlocks-1)) * mBlockSize];
+	}
+
+	/// Publish the block from writeBlock() to the reader
+	void commitWrite(){ mWrite.store(mWrite.loadRelaxed() + 1); }
+
+	/// Copy a block into the ring
+
+	/// \returns false if the ring is full, in which case the block is dropped
+	bool write(const T * src){
+		T * dst = writeBlock();
+		if(!dst) return false;
+		memcpy(dst, src, mBlockSize*sizeof(T));
+		commitWrite();
+		return true;
+	}
+
+
+	/// Get the oldest unread block, or NULL if the ring is empty
+
+	/// The block remains valid until commitRead().
+	const T * readBlock() const {
+		unsigned r = mRead.loadRelaxed();
+		// acquire, so the block's contents are visible
+		if(mWrite.load() == r) return 0;
+		return &mData[size_t(r & (mNumBlocks-1)) * mBlockSize];
+	}
+
+	/// Release the block from readBlock() to the writer
+	void commitRead(){ mRead.store(mRead.loadRelaxed() + 1); }
+
+	/// Copy the oldest unread block out of the ring
+
+	/// \returns false if the ring is empty, which counts as an underrun
+	bool read(T * dst){
+		const T * src = readBlock();
+		if(!src){
+			mUnderruns.fetchAdd(1);
+			return false;
+		}
+		memcpy(dst, src, mBlockSize*sizeof(T));
+		commitRead();
+		return true;
+	}
+
+private:
+	std::vector<T> mData;
+	unsigned mBlockSize, mNumBlocks;
+	Atomic<unsigned> mRead, mWrite;	// blocks read and written, wrapping
+	Atomic<unsigned> mOverruns, mUnderruns;
+
+	// non-copyable
+	BlockRing(const BlockRing&);
+	BlockRing& operator= (const BlockRing&);
+};
+
+} // al::
+
+#endif
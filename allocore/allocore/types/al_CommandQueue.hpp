@@ -0,0 +1,343 @@
+#ifndef INCLUDE_AL_COMMAND_QUEUE_HPP
+#define INCLUDE_AL_COMMAND_QUEUE_HPP
+
+/*	Allocore --
+	Multimedia / virtual environment application class library
+
+	Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology, UCSB.
+	Copyright (C) 2012. The Regents of the University of California.
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+		Redistributions of source code must retain the above copyright notice,
+		this list of conditions and the following disclaimer.
+
+		Redistributions in binary form must reproduce the above copyright
+		notice, this list of conditions and the following disclaimer in the
+		documentation and/or other materials provided with the distribution.
+
+		Neither the name of the University of California nor the names of its
+		contributors may be used to endorse or promote products derived from
+		this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+
+
+
+	File description:
+	Lock-free multi-producer single-consumer queue of timestamped commands
+
+	File author(s):
+	AlloSystem contributors, 2016
+*/
+
+#include <new>
+#include <string.h>
+#include "allocore/system/al_Atomic.hpp"
+#include "allocore/system/pstdint.h"
+
+namespace al{
+
+/// Lock-free multi-producer single-consumer queue of timestamped commands
+
+/// This passes commands from any number of threads, such as OSC handlers,
+/// the GUI or a simulation, to a single real-time thread, usually the audio
+/// thread. A command is a function pointer, a timestamp in frames and up to
+/// argSize() bytes of arguments. All slots are allocated on construction and
+/// arguments are copied into them, so neither sending nor executing ever
+/// allocates memory or takes a lock. Sending fails when the queue is full;
+/// this is counted in the overflow statistics and the producer may retry or
+/// drop the command.
+///
+/// The consumer executes commands in the order in which they were sent. A
+/// consumer that renders audio in blocks can apply commands at the exact
+/// frame they are stamped with:
+/// \code
+///	uint64_t t;
+///	while(queue.nextTime(t) && t < blockEnd){
+///		// render frames up to t
+///		queue.executeNext();
+///	}
+///	// render remaining frames of block
+/// \endcode
+/// Commands from one producer are executed in order. Commands from different
+/// producers are interleaved by the time they were sent, not their timestamp,
+/// so a command stamped earlier than the one ahead of it waits for it.
+class CommandQueue{
+public:
+
+	/// Function executed by the consumer
+
+	/// @param[in] frame	timestamp of command
+	/// @param[in] args		copy of arguments passed to sendData
+	typedef void (*Func)(uint64_t frame, const char * args);
+
+	/// @param[in] capacity		maximum number of pending commands; rounded up
+	///							to the next power of two
+	/// @param[in] argSize		maximum size of arguments of a command, in bytes
+	CommandQueue(unsigned capacity=1024, unsigned argSize=48);
+
+	~CommandQueue();
+
+
+	/// Send command with arguments copied from memory
+
+	/// This may be called from any thread.
+	/// \returns whether the command was queued. This is false if the queue is
+	/// full or if the arguments do not fit into a slot; only the former
+	/// counts as an overflow.
+	bool sendData(uint64_t frame, Func func, const void * args=0, unsigned size=0);
+
+	/// Send command calling function without arguments
+	bool send(uint64_t frame, void (*f)(uint64_t frame)){
+		struct Data{
+			void (*f)(uint64_t frame);
+			static void call(uint64_t frame, const char * args){
+				(((const Data *)args)->f)(frame);
+			}
+		};
+		Data data = { f };
+		return sendData(frame, Data::call, &data, sizeof(Data));
+	}
+
+	/// Send command calling function with one argument
+
+	/// Arguments are copied bytewise and must therefore be plain data types.
+	///
+	template <class A1>
+	bool send(uint64_t frame, void (*f)(uint64_t frame, A1 a1), A1 a1){
+		struct Data{
+			void (*f)(uint64_t frame, A1 a1);
+			A1 a1;
+			static void call(uint64_t frame, const char * args){
+				const Data * d = (const Data *)args;
+				(d->f)(frame, d->a1);
+			}
+		};
+		Data data = { f, a1 };
+		return sendData(frame, Data::call, &data, sizeof(Data));
+	}
+
+	/// Send command calling function with two arguments
+	template <class A1, class A2>
+	bool send(uint64_t frame, void (*f)(uint64_t frame, A1 a1, A2 a2), A1 a1, A2 a2){
+		struct Data{
+			void (*f)(uint64_t frame, A1 a1, A2 a2);
+			A1 a1; A2 a2;
+			static void call(uint64_t frame, const char * args){
+				const Data * d = (const Data *)args;
+				(d->f)(frame, d->a1, d->a2);
+			}
+		};
+		Data data = { f, a1, a2 };
+		return sendData(frame, Data::call, &data, sizeof(Data));
+	}
+
+	/// Send command calling function with three arguments
+	template <class A1, class A2, class A3>
+	bool send(uint64_t frame, void (*f)(uint64_t frame, A1 a1, A2 a2, A3 a3), A1 a1, A2 a2, A3 a3){
+		struct Data{
+			void (*f)(uint64_t frame, A1 a1, A2 a2, A3 a3);
+			A1 a1; A2 a2; A3 a3;
+			static void call(uint64_t frame, const char * args){
+				const Data * d = (const Data *)args;
+				(d->f)(frame, d->a1, d->a2, d->a3);
+			}
+		};
+		Data data = { f, a1, a2, a3 };
+		return sendData(frame, Data::call, &data, sizeof(Data));
+	}
+
+	/// Send command calling function with four arguments
+	template <class A1, class A2, class A3, class A4>
+	bool send(uint64_t frame, void (*f)(uint64_t frame, A1 a1, A2 a2, A3 a3, A4 a4), A1 a1, A2 a2, A3 a3, A4 a4){
+		struct Data{
+			void (*f)(uint64_t frame, A1 a1, A2 a2, A3 a3, A4 a4);
+			A1 a1; A2 a2; A3 a3; A4 a4;
+			static void call(uint64_t frame, const char * args){
+				const Data * d = (const Data *)args;
+				(d->f)(frame, d->a1, d->a2, d->a3, d->a4);
+			}
+		};
+		Data data = { f, a1, a2, a3, a4 };
+		return sendData(frame, Data::call, &data, sizeof(Data));
+	}
+
+
+	/// Get timestamp of next command
+
+	/// This must only be called from the consumer thread.
+	/// \returns whether there is a command pending
+	bool nextTime(uint64_t& frame) const;
+
+	/// Execute next command
+
+	/// This must only be called from the consumer thread.
+	/// \returns whether a command was executed
+	bool executeNext();
+
+	/// Execute all commands up to, but not including, a frame
+
+	/// Execution stops at the first command stamped at or after 'frame'.
+	/// This must only be called from the consumer thread.
+	/// \returns number of commands executed
+	unsigned executeUntil(uint64_t frame);
+
+
+	/// Get maximum number of pending commands
+	unsigned capacity() const { return mWrap + 1; }
+
+	/// Get maximum size of arguments of a command, in bytes
+	unsigned argSize() const { return mArgSize; }
+
+	/// Get approximate number of pending commands
+	unsigned size() const { return mTail.loadRelaxed() - mHead.loadRelaxed(); }
+
+	/// Get number of commands that could not be sent because the queue was full
+	unsigned overflows() const { return mOverflows.loadRelaxed(); }
+
+	/// Get largest number of pending commands since construction or last reset
+	unsigned highWater() const { return mHighWater.loadRelaxed(); }
+
+	/// Reset overflow count and high water mark
+	void resetStats(){ mOverflows.store(0); mHighWater.store(0); }
+
+private:
+
+	// Slot header; arguments follow at offset HEADER_SIZE
+	struct Slot{
+		Atomic<uint32_t> seq;	// equals position when free, position+1 when full
+		uint64_t frame;
+		Func func;
+		Slot(uint32_t pos): seq(pos){}
+	};
+
+	enum{ HEADER_SIZE = (sizeof(Slot) + 15) & ~15, SLOT_ALIGN = 64 };
+
+	Slot * slot(uint32_t pos) const {
+		return (Slot *)(mSlots + (pos & mWrap) * mStride);
+	}
+	static char * args(Slot * s){ return (char *)s + HEADER_SIZE; }
+
+	// Producer and consumer positions are kept on separate cache lines
+	Atomic<uint32_t> mTail;
+	char mPad1[SLOT_ALIGN];
+	Atomic<uint32_t> mHead;
+	char mPad2[SLOT_ALIGN];
+	Atomic<uint32_t> mOverflows;
+	Atomic<uint32_t> mHighWater;
+	uint32_t mWrap;
+	unsigned mArgSize;
+	unsigned mStride;
+	char * mMem;
+	char * mSlots;
+
+	// non-copyable
+	CommandQueue(const CommandQueue&);
+	CommandQueue& operator= (const CommandQueue&);
+};
+
+
+
+
+// -----------------------------------------------------------------------------
+// Inline implementation
+
+inline CommandQueue::CommandQueue(unsigned capacity, unsigned argSize)
+:	mTail(0), mHead(0), mOverflows(0), mHighWater(0), mArgSize(argSize)
+{
+	unsigned cap = 1;
+	while(cap < capacity) cap <<= 1;
+	mWrap = cap - 1;
+
+	// Round slot size up to a cache line so producers writing neighboring
+	// slots do not contend
+	mStride = (HEADER_SIZE + argSize + SLOT_ALIGN-1) & ~(SLOT_ALIGN-1);
+	mMem = new char[cap * mStride + SLOT_ALIGN];
+	mSlots = mMem + ((SLOT_ALIGN - ((uintptr_t)mMem & (SLOT_ALIGN-1))) & (SLOT_ALIGN-1));
+	for(unsigned i=0; i<cap; ++i){
+		new (slot(i)) Slot(i);
+	}
+}
+
+inline CommandQueue::~CommandQueue(){
+	delete[] mMem;
+}
+
+inline bool CommandQueue::sendData(uint64_t frame, Func func, const void * data, unsigned size){
+	if(size > mArgSize) return false;
+
+	// Claim the slot at the tail, unless it still holds a command from the
+	// previous lap, in which case the queue is full
+	uint32_t pos = mTail.loadRelaxed();
+	Slot * s;
+	for(;;){
+		s = slot(pos);
+		int32_t dif = int32_t(s->seq.load() - pos);
+		if(0 == dif){
+			if(mTail.compareExchange(pos, pos+1)) break;
+		}
+		else if(dif < 0){
+			mOverflows.fetchAdd(1);
+			return false;
+		}
+		else{
+			pos = mTail.loadRelaxed();
+		}
+	}
+
+	s->frame = frame;
+	s->func = func;
+	if(size) memcpy(args(s), data, size);
+	s->seq.store(pos+1); // publish to consumer
+
+	// The consumer may already have moved past this command
+	int32_t used = int32_t(pos+1 - mHead.loadRelaxed());
+	uint32_t high = mHighWater.loadRelaxed();
+	while(used > int32_t(high) && !mHighWater.compareExchange(high, used)){}
+	return true;
+}
+
+inline bool CommandQueue::nextTime(uint64_t& frame) const {
+	uint32_t pos = mHead.loadRelaxed();
+	Slot * s = slot(pos);
+	if(s->seq.load() != pos+1) return false;
+	frame = s->frame;
+	return true;
+}
+
+inline bool CommandQueue::executeNext(){
+	uint32_t pos = mHead.loadRelaxed();
+	Slot * s = slot(pos);
+	if(s->seq.load() != pos+1) return false;
+	s->func(s->frame, args(s));
+	mHead.store(pos+1);
+	s->seq.store(pos + mWrap + 1); // hand slot back to producers
+	return true;
+}
+
+inline unsigned CommandQueue::executeUntil(uint64_t frame){
+	unsigned n = 0;
+	uint64_t t;
+	while(nextTime(t) && t < frame){
+		executeNext();
+		++n;
+	}
+	return n;
+}
+
+} // al::
+
+#endif
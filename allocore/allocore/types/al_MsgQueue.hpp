@@ -56,7 +56,17 @@ public:
 	typedef void * (*malloc_func)(size_t size);
 	typedef void (*free_func)(void * ptr);
 
-	MsgQueue(int size = 128, malloc_func mfunc = NULL, free_func ffunc = NULL);
+	/// Data structure used to order scheduled messages
+	enum Scheduler {
+		LIST,	/**< Sorted linked list; O(1) for increasing timestamps, O(n) otherwise */
+		HEAP	/**< Binary heap; O(log n) for any timestamps */
+	};
+
+	/// @param[in] size		number of messages allocated at once
+	/// @param[in] mfunc	memory allocation function (default is malloc)
+	/// @param[in] ffunc	memory deallocation function (default is free)
+	/// @param[in] sched	data structure used to order messages
+	MsgQueue(int size = 128, malloc_func mfunc = NULL, free_func ffunc = NULL, Scheduler sched = LIST);
 	~MsgQueue();
 
 	// for truly accurate scheduling, always use this as logical time:
@@ -71,6 +81,9 @@ public:
 	// how many messages are scheduled?
 	int len() const { return mLen; }
 
+	// which data structure orders the messages?
+	Scheduler scheduler() const { return mScheduler; }
+
 	// template wrappers for multi-argument functions
 	// be sure to cast the send arguments to exactly match the function argument types!
 	void send(al_sec at, void (*f)(al_sec t)) {
@@ -283,11 +296,12 @@ public:
 protected:
 
 	// messages that are larger than this will be heap copied
-	#define AL_MSGQUEUE_ARGS_SIZE (128 - sizeof(struct Msg *) - sizeof(size_t) - sizeof(al_sec) - sizeof(msg_func))
+	#define AL_MSGQUEUE_ARGS_SIZE (128 - sizeof(struct Msg *) - 2*sizeof(size_t) - sizeof(al_sec) - sizeof(msg_func))
 
 	struct Msg {
 		struct Msg * next;
 		size_t size;
+		size_t order;	// insertion count, keeps equal timestamps in order in heap
 		al_sec t;
 		msg_func func;
 		char mArgs[AL_MSGQUEUE_ARGS_SIZE];
@@ -299,13 +313,23 @@ protected:
 	Msg * mHead;
 	Msg * mTail;
 	Msg * mPool;
-	int mLen, mChunkSize;
+	Msg * mSlabs;	// blocks of messages; first of each links to next block
+	Msg ** mHeap;
+	int mLen, mChunkSize, mHeapSize;
+	size_t mOrder;
 	al_sec mNow;
 	malloc_func mMalloc;
 	free_func mFree;
+	Scheduler mScheduler;
 
 	void growPool(int size);
 	void recycle(Msg * m);
+	void insertList(Msg * m);
+	void insertHeap(Msg * m);
+	Msg * popHeap();
+	static bool before(const Msg * a, const Msg * b){
+		return a->t < b->t || (a->t == b->t && a->order < b->order);
+	}
 };
 
 
@@ -44,6 +44,7 @@
 
 #include <cstring>
 
+#include "allocore/system/al_Atomic.hpp"
 #include "allocore/system/pstdint.h"
 
 namespace al {
@@ -52,7 +53,9 @@ namespace al {
  * Can be used to stream data safely between two threads, one being
  * a reader, one a writer. There is no locking in this ring buffer,
  * so it is ideal to pass data to and from a high priority thread
- * like an audio thread.
+ * like an audio thread. The read and write positions are atomic, so data
+ * written is visible to the reader once the write position is.
+ * For fixed-size blocks, such as audio buffers, see BlockRing.
  */
 class SingleRWRingBuffer {
 public:
@@ -91,8 +94,12 @@ public:
 protected:
 
 	size_t mSize, mWrap;
-	size_t mRead, mWrite;
+	Atomic<size_t> mRead, mWrite;
 	char * mData;
+
+	// non-copyable
+	SingleRWRingBuffer(const SingleRWRingBuffer&);
+	SingleRWRingBuffer& operator= (const SingleRWRingBuffer&);
 };
 
 
@@ -120,15 +127,15 @@ inline SingleRWRingBuffer :: ~SingleRWRingBuffer() {
 }
 
 inline size_t SingleRWRingBuffer :: writeSpace() const {
-	const size_t r = mRead;
-	const size_t w = mWrite;
+	const size_t r = mRead.load();
+	const size_t w = mWrite.load();
 	if (r==w) return mWrap;
 	return ((mSize + (r - w)) & mWrap) - 1;
 }
 
 inline size_t SingleRWRingBuffer :: readSpace() const {
-	const size_t r = mRead;
-	const size_t w = mWrite;
+	const size_t r = mRead.load();
+	const size_t w = mWrite.load();
 	return (mSize + (w - r)) & mWrap;
 }
 
@@ -137,7 +144,7 @@ inline size_t SingleRWRingBuffer :: write(const char * src, size_t sz) {
 	sz = sz > space ? space : sz;
 	if (sz == 0) return 0;
 
-	size_t w = mWrite;
+	size_t w = mWrite.loadRelaxed();
 	size_t end = w + sz;
 
 	if (end < mSize) {
@@ -149,7 +156,7 @@ inline size_t SingleRWRingBuffer :: write(const char * src, size_t sz) {
 		memcpy(mData, src+split, end);
 	}
 
-	mWrite = end;
+	mWrite.store(end);
 	return sz;
 }
 
@@ -158,7 +165,7 @@ inline size_t SingleRWRingBuffer :: read(char * dst, size_t sz) {
 	sz = sz > space ? space : sz;
 	if (sz == 0) return 0;
 
-	size_t r = mRead;
+	size_t r = mRead.loadRelaxed();
 	size_t end = r + sz;
 
 	if (end < mSize) {
@@ -170,7 +177,7 @@ inline size_t SingleRWRingBuffer :: read(char * dst, size_t sz) {
 		memcpy(dst+split, mData, end);
 	}
 
-	mRead = end;
+	mRead.store(end);
 	return sz;
 }
 
@@ -179,7 +186,7 @@ inline size_t SingleRWRingBuffer :: peek(char * dst, size_t sz) {
 	sz = sz > space ? space : sz;
 	if (sz == 0) return 0;
 
-	size_t r = mRead;
+	size_t r = mRead.loadRelaxed();
 	size_t end = r + sz;
 
 	if (end < mSize) {
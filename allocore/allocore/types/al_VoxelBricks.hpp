@@ -0,0 +1,200 @@
+#ifndef INCLUDE_AL_VOXELBRICKS_HPP
+#define INCLUDE_AL_VOXELBRICKS_HPP
+
+/*	Allocore --
+	Multimedia / virtual environment application class library
+
+	Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology, UCSB.
+	Copyright (C) 2012. The Regents of the University of California.
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+		Redistributions of source code must retain the above copyright notice,
+		this list of conditions and the following disclaimer.
+
+		Redistributions in binary form must reproduce the above copyright
+		notice, this list of conditions and the following disclaimer in the
+		documentation and/or other materials provided with the distribution.
+
+		Neither the name of the University of California nor the names of its
+		contributors may be used to endorse or promote products derived from
+		this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+
+
+
+	File description:
+	Bricked, multi-resolution storage of a volume
+
+	File author(s):
+	AlloSystem contributors, 2016
+*/
+
+#include <vector>
+#include "allocore/types/al_Array.hpp"
+
+namespace al{
+
+class ThreadPool;
+
+/// Bricked, multi-resolution copy of a volume
+
+/// The volume is stored as a pyramid of levels. Level 0 has the resolution of
+/// the source and each further level halves it, averaging 2x2x2 voxels, down
+/// to a level that fits in one brick. Each level is split into cubic bricks
+/// that are stored contiguously, so a brick can be read or uploaded as a
+/// texture without gathering. Bricks at the far edges of a level are padded
+/// by repeating the last voxel.
+///
+/// Each brick records the minimum, maximum and mean of its voxels, so that
+/// bricks with no values in a range, e.g. that cannot contain an isosurface,
+/// can be skipped without touching their voxels.
+///
+/// Voxel (x,y,z) of a level covers voxels (2x..2x+1, 2y..2y+1, 2z..2z+1) of
+/// the next finer level, so brick (bx,by,bz) of a level covers bricks
+/// (2bx..2bx+1, 2by..2by+1, 2bz..2bz+1) of the next finer level.
+class VoxelBricks{
+public:
+
+	/// Metadata of a brick
+	struct Brick{
+		uint32_t x, y, z;	///< brick coordinates within its level
+		float min, max;		///< range of voxel values
+		float mean;			///< mean voxel value
+
+		/// Whether any voxel may be within [lo, hi]
+		bool overlaps(float lo, float hi) const { return max >= lo && min <= hi; }
+	};
+
+
+	/// @param[in] brickSize	edge length of bricks in voxels; must be even
+	VoxelBricks(int brickSize=32);
+
+
+	/// Build the pyramid from a volume
+
+	/// @param[in] src		single-component volume of 8-bit, 16-bit or float
+	///						voxels, such as an al::Voxels
+	/// @param[in] pool		thread pool to build bricks on, or NULL to build
+	///						on the calling thread
+	/// \returns whether the volume could be bricked
+	bool build(const Array& src, ThreadPool * pool=NULL);
+
+	/// Release all levels
+	void clear();
+
+
+	/// Edge length of bricks in voxels
+	int brickSize() const { return mBrickSize; }
+
+	/// Number of voxels in a brick
+	uint32_t brickVoxels() const { return mBrickSize*mBrickSize*mBrickSize; }
+
+	/// Type of voxels
+	AlloTy type() const { return mType; }
+
+	/// Number of levels, 0 if not built
+	int levels() const { return mLevels.size(); }
+
+	/// Number of voxels of a level along an axis
+	uint32_t dim(int axis, int level=0) const { return mLevels[level].dim[axis]; }
+
+	/// Number of bricks of a level along an axis
+	uint32_t bricks(int axis, int level=0) const { return mLevels[level].bricks[axis]; }
+
+	/// Number of bricks of a level
+	uint32_t numBricks(int level=0) const { return mLevels[level].meta.size(); }
+
+	/// Index of a brick from its brick coordinates
+	uint32_t brickIndex(int level, uint32_t bx, uint32_t by, uint32_t bz) const {
+		const Level& l = mLevels[level];
+		return bx + l.bricks[0]*(by + l.bricks[1]*bz);
+	}
+
+	/// Get metadata of a brick
+	const Brick& brick(int level, uint32_t index) const { return mLevels[level].meta[index]; }
+
+	/// Get voxels of a brick, brickVoxels() of them with x varying fastest
+	const char * brickData(int level, uint32_t index) const {
+		return &mLevels[level].data[0] + size_t(index)*brickVoxels()*allo_type_size(mType);
+	}
+
+	/// Get a voxel value
+	double value(int level, uint32_t x, uint32_t y, uint32_t z) const;
+
+
+	/// Find bricks of a level that may have values within [lo, hi]
+
+	/// @param[out] indices		indices of bricks, in increasing order
+	/// @param[in] level		level to search
+	/// @param[in] lo			lower bound of range
+	/// @param[in] hi			upper bound of range
+	/// \returns number of bricks found
+	uint32_t bricksInRange(std::vector<uint32_t>& indices, int level, float lo, float hi) const;
+
+	/// Call func(index, brick) for each brick of a level that may have
+	/// values within [lo, hi]
+	template <class Func>
+	void forEachBrick(int level, float lo, float hi, Func& func) const {
+		const std::vector<Brick>& meta = mLevels[level].meta;
+		for(uint32_t i=0; i<meta.size(); ++i){
+			if(meta[i].overlaps(lo, hi)) func(i, meta[i]);
+		}
+	}
+
+
+	/// Read a region of a level into an Array, formatting it to the region
+
+	/// Coordinates are in voxels of the level, i.e. voxels of level 0
+	/// divided by 2^level.
+	/// \returns false if the region is not within the level
+	bool read(Array& dst, int level, uint32_t x0, uint32_t y0, uint32_t z0,
+		uint32_t nx, uint32_t ny, uint32_t nz) const;
+
+
+	/// Copy bricks into a 3D texture atlas
+
+	/// Bricks are placed in order in slots of brickSize() voxels, x varying
+	/// fastest, with 'side' slots along x and y and as many layers of slots
+	/// along z as needed. Slot i is at (i % side, (i / side) % side,
+	/// i / (side*side)) times brickSize().
+	///
+	/// @param[out] dst			atlas, formatted to fit the bricks
+	/// @param[in] level		level of bricks
+	/// @param[in] indices		indices of bricks to copy
+	/// @param[in] side			slots along x and y; if 0, the least number
+	///							that makes the atlas about cubic
+	/// \returns number of slots along x and y
+	uint32_t atlas(Array& dst, int level, const std::vector<uint32_t>& indices, uint32_t side=0) const;
+
+protected:
+	struct Level{
+		uint32_t dim[3];
+		uint32_t bricks[3];
+		std::vector<Brick> meta;
+		std::vector<char> data;
+	};
+
+	struct BuildBody;
+
+	int mBrickSize;
+	AlloTy mType;
+	std::vector<Level> mLevels;
+};
+
+} // al::
+
+#endif
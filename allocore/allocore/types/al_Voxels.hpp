@@ -65,6 +65,8 @@ using namespace std;
 
 namespace al {
 
+class ThreadPool;
+
 typedef int UnitsTy;
 
 enum VoxelUnits {
@@ -157,36 +159,70 @@ struct MRCHeader {
 /// OBJECT-oriented interface to AlloArray
 class Voxels : public Array {
 public:
+
+  /// Which samples of image slices become voxels
+  enum SliceChannel {
+    SLICE_RED = 0,
+    SLICE_GREEN = 1,
+    SLICE_BLUE = 2,
+    SLICE_ALPHA = 3,
+    SLICE_LUMINANCE = 4   ///< 0.299 red + 0.587 green + 0.114 blue
+  };
+
+  /// Called by loadFromImages() with the number of slices done and the
+  /// total; return false to cancel. It may be called from several threads
+  /// at once.
+  typedef bool (*SliceProgress)(int done, int total, void * userData);
+
   Voxels() :
-      Array() {
+      Array(), m_map(NULL), m_mapSize(0) {
     init(1,1,1, VOX_METERS);
   }
 
   /// Construct dimx x dimy x dimz voxel grid giving 3D size of each voxel cuboid with units
   Voxels(AlloTy ty, uint32_t dimx, uint32_t dimy, uint32_t dimz, float sizex, float sizey, float sizez, UnitsTy units) :
-       Array(1, ty, dimx, dimy, dimz) {
+       Array(1, ty, dimx, dimy, dimz), m_map(NULL), m_mapSize(0) {
     init(sizex, sizey, sizez, units);
   }
 
 
   /// Construct dimx x dimy x dimz voxel grid giving 3D size of each voxel cuboid in meters
   Voxels(AlloTy ty, uint32_t dimx, uint32_t dimy, uint32_t dimz, float sizex, float sizey, float sizez) :
-      Array(1, ty, dimx, dimy, dimz) {
+      Array(1, ty, dimx, dimy, dimz), m_map(NULL), m_mapSize(0) {
     init(sizex, sizey, sizez, VOX_METERS);
   }
 
   /// Construct dimx x dimy x dimz voxel grid giving dimension of each voxel cube with units
   Voxels(AlloTy ty, uint32_t dimx, uint32_t dimy, uint32_t dimz, float voxelsize, UnitsTy units) :
-      Array(1, ty, dimx, dimy, dimz) {
+      Array(1, ty, dimx, dimy, dimz), m_map(NULL), m_mapSize(0) {
     init(voxelsize, voxelsize, voxelsize, units);
   }
 
   /// Construct dimx x dimy x dimz voxel grid with every voxel 1m x 1m x 1m
   Voxels(AlloTy ty, uint32_t dimx, uint32_t dimy, uint32_t dimz) :
-      Array(1, ty, dimx, dimy, dimz) {
+      Array(1, ty, dimx, dimy, dimz), m_map(NULL), m_mapSize(0) {
     init(1, 1, 1, VOX_METERS);
   }
 
+  /// Copy voxels into memory of our own, even if cpy is mapped
+  Voxels(const Voxels& cpy) :
+      Array(), m_map(NULL), m_mapSize(0) {
+    *this = cpy;
+  }
+
+  /// Copy voxels, releasing any mapped file first
+  Voxels& operator= (const Voxels& cpy) {
+    if (&cpy != this) {
+      unmap();
+      Array::operator=(cpy);
+      m_units = cpy.m_units;
+      for (int i = 0; i < 3; ++i) m_voxWidth[i] = cpy.m_voxWidth[i];
+      m_min = cpy.m_min; m_max = cpy.m_max;
+      m_mean = cpy.m_mean; m_rms = cpy.m_rms;
+    }
+    return *this;
+  }
+
   int getdir(string dir, vector<string> &files) {
     DIR *dp;
     struct dirent * dirp;
@@ -196,8 +232,8 @@ public:
     }
     while((dirp = readdir(dp)) != NULL) {
       char *name = dirp->d_name;
-      if (strcmp(name, ".") && strcmp(name, "..") && strcmp(name, "info.txt")) {
-      	cout << name << endl;
+      // skip ".", ".." and hidden files such as .DS_Store
+      if (name[0] != '.' && strcmp(name, "info.txt")) {
       	files.push_back(dir + "/" + string(name));
       }
     }
@@ -208,7 +244,6 @@ public:
     
   int parseInfo(string dir, vector<string> &data){
     string file = dir + "/info.txt";
-    cout << file << endl;
     ifstream infile(file.c_str());
     if (!infile.good())
       return 1; // exit if file not found
@@ -244,113 +279,14 @@ public:
    convention, assemble them all into an al::Array or al::Voxels
    and write the result as one huge fast-to-load raw binary data file.
 
-
-   Limitations:
-
-   - Images must contain 8-bit RGB pixels
-
-   - Ignores all but the red channel
-
-   - Chokes if directory contains anything besides "info.txt" and image files
-
-   - Creates a voxel from the data
+   See loadFromImages() for the details. On failure the reason is
+   printed and the voxels are left empty.
 */
 
-  Voxels(string dir) : Array() {
-  
-    vector<string> files;
-    vector<string> info;
-
-    // Image and Texture handle reading and displaying image files.
-    Image RGBImage; // for reading into
-    
-    if (getdir(dir,files) != 0) {
-      cout << "Problem reading directory " << dir << endl;
-      exit(-1);
-    }
-
-    if (files.size() == 0) {
-      cout << "Read zero files from directory " << dir << endl;
-      exit(-2);
-    }
-
-    cout << "Judging by " << dir << " there are " << files.size() << " images (or at least files)" << endl;
-
-
-    // Try reading the first one just to get the size
-    if (!RGBImage.load(files[0])) {
-      cout << "Couldn't read file " << files[0] << endl;
-      exit(-3);
-    }
-
-    int nx = RGBImage.width();
-    int ny = RGBImage.height();
-    int nz = files.size();
-    float vx = 1.;
-    float vy = 1.;
-    float vz = 1.;
-    float type = VOX_NANOMETERS;
-
-    if (parseInfo(dir,info) == 0) {
-      if (info.size() == 4) {
-      	type = atoi(info[0].c_str());
-      	vx = atof(info[1].c_str());
-      	vy = atof(info[2].c_str());
-      	vz = atof(info[3].c_str());
-      	cout << "imported values from info.txt: " << type << ", " << vx << ", " << vy << ", " << vz << endl;
-      } else {
-      	cout << info.size() << " info.txt doesn't have enough info, using default data" << endl;
-      }
-    } else {
-      cout << "no info.txt, using default data" << endl;
-    }
-
-    cout << "Judging by " << files[0] << " each image should be " << nx << " by " << ny << endl;
-
-    // For now assume 8-bit with 1 nm cube voxels
-    format(1, AlloUInt8Ty, nx, ny, nz);
-    init(vx,vy,vz,type);
-
-
-    // Iterate through entire directory
-    int slice = 0;
-    for (vector<string>::iterator it = files.begin(); it != files.end(); ++it, ++slice) {
-      string &filename = *it;
-
-      if (RGBImage.load(filename)) {
-      	cout << "loaded " << filename << 
-      	  " (" << slice+1 << " of " << files.size() << ")" << endl;
-      } else {
-      	cout << "Failed to read image from " << filename << endl;
-      	exit(-4);
-      }
-
-      // Verify XY resolution
-      if (RGBImage.width() != nx || RGBImage.height() != ny) {
-      	cout << "Error:  resolution mismatch!" << endl;
-      	cout << "   " << files[0] << ": " << nx << " by " << ny << endl;
-      	cout << "   " << filename << ": " << RGBImage.width() << " by " << RGBImage.height() << endl;
-      	exit(-5);
-      }
-	
-
-      // Access the read-in image data
-      Array& array(RGBImage.array());
-      
-      // For now assume 8-bit RGBA
-      Image::RGBAPix<uint8_t> pixel;
-
-      // Copy it out pixel-by-pixel:
-      for (size_t row = 0; row < array.height(); ++row) {
-      	for (size_t col = 0; col < array.width(); ++col) {
-      	  array.read(&pixel, col, row);
-
-      	  // For now we'll take only the red and put it in the single component; that's lame.
-      	  elem<char>(0, col, row, slice) = (char) pixel.r;
-      	}
-      }
-    }
-    // v is ready
+  Voxels(string dir, SliceChannel channel = SLICE_RED, ThreadPool * pool = NULL) :
+      Array(), m_map(NULL), m_mapSize(0) {
+    init(1,1,1, VOX_METERS);
+    loadFromImages(dir, channel, pool);
   }
 
   
@@ -406,10 +342,52 @@ public:
   // mostly for saving partial changes into mrc header.
   bool writeToMRC(std::string filename, MRCHeader& header);
 
+  /// Assemble a volume from a directory of 2D image slices
+
+  /// Every file in the directory but info.txt is a slice, in file name
+  /// order. The voxels have the sample type of the first slice, so 8-bit,
+  /// 16-bit and float images keep their precision. Single-channel slices are
+  /// copied as they are; of color slices, one channel or the luminance is
+  /// taken. An optional info.txt holds four "name: value" lines giving the
+  /// units and the voxel widths along x, y and z.
+  ///
+  /// Given a thread pool, slices are decoded in parallel. Each thread holds
+  /// at most one decoded slice, copying it into the volume before decoding
+  /// the next, so memory use does not grow with the number of slices.
+  ///
+  /// @param dir       directory of slices
+  /// @param channel   channel of color slices to use
+  /// @param pool      pool to decode slices on, or NULL to decode them here
+  /// @param progress  called after each slice, or NULL
+  /// @param userData  passed to progress
+  /// @return          false if a slice cannot be loaded or does not match
+  ///                  the first, or if cancelled; the reason is printed and
+  ///                  the voxels are left empty
+  bool loadFromImages(const std::string& dir, SliceChannel channel = SLICE_LUMINANCE,
+                      ThreadPool * pool = NULL, SliceProgress progress = NULL, void * userData = NULL);
+
   // write/read files for voxel class
   bool writeToFile(std::string filename);
   
   bool loadFromFile(std::string filename);
+
+  /// Map an MRC file into memory and use its voxels in place
+
+  /// Pages are read from disk when first accessed, so this returns at once
+  /// and uses no memory up front. The mapping is private, so changes to the
+  /// voxels are not written to the file. Voxels of foreign-endian files are
+  /// byte-swapped in place, which reads every page once. Call unmap() (or
+  /// load another file) before reformatting this Array.
+  bool mapMRC(std::string filename);
+
+  /// Map a file written by writeToFile() into memory; see mapMRC()
+  bool mapFile(std::string filename);
+
+  /// Whether the voxels are a view of a mapped file
+  bool mapped() const { return m_map != NULL; }
+
+  /// Release a mapped file, leaving the Array empty
+  void unmap();
   
   void print(FILE * fp = stdout);
 
@@ -422,13 +400,77 @@ public:
   float rms() const { return m_rms; }
 
   ~Voxels() {
+    unmap();
   }
 
 protected:
 
+  // map a whole file, replacing any data
+  bool mapWhole(const std::string& filename);
+  // view data at offset into the mapping; unmaps and returns false if the
+  // data would not fit or be aligned
+  bool viewMapped(size_t offset, const AlloArrayHeader& h);
+  void setFromMRCHeader(const MRCHeader& header);
+
   UnitsTy m_units;
   float m_voxWidth[3];
   float m_min, m_max, m_mean, m_rms;
+  void * m_map;
+  size_t m_mapSize;
+};
+
+
+/// Reads blocks of voxels from an MRC file on demand
+
+/// This is for volumes too large to load or map at once. Only the header is
+/// read when opening, and each read() converts the byte order if needed.
+/// Reads do not change the file position, so several threads may read from
+/// one MRCStream at once.
+class MRCStream {
+public:
+  MRCStream();
+  ~MRCStream();
+
+  /// Open a file and read its header
+  bool open(std::string filename);
+
+  void close();
+
+  bool opened() const { return m_fd >= 0; }
+
+  /// Get the header, in native byte order
+  const MRCHeader& header() const { return m_header; }
+
+  /// Get type of voxels
+  AlloTy type() const { return m_type; }
+
+  /// Get number of voxels along an axis
+  uint32_t dim(int axis) const { return (&m_header.nx)[axis]; }
+
+  /// Whether the file is foreign-endian
+  bool swapped() const { return m_swapped; }
+
+  /// Read a block of voxels into an Array, formatting it to the block size
+
+  /// @param dst    array to read into
+  /// @param x0     first voxel along x
+  /// @param y0     first voxel along y
+  /// @param z0     first voxel along z
+  /// @param nx     number of voxels along x
+  /// @param ny     number of voxels along y
+  /// @param nz     number of voxels along z
+  /// @return       false if the block is not within the volume or on error
+  bool read(Array& dst, uint32_t x0, uint32_t y0, uint32_t z0, uint32_t nx, uint32_t ny, uint32_t nz) const;
+
+private:
+  MRCHeader m_header;
+  AlloTy m_type;
+  bool m_swapped;
+  int m_fd;
+  size_t m_offset;
+
+  MRCStream(const MRCStream&);
+  MRCStream& operator= (const MRCStream&);
 };
 
 } // namespace al
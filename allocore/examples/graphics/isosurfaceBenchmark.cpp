@@ -0,0 +1,79 @@
+/*
+Allocore Example: Isosurface Benchmark
+
+Description:
+This measures the time to generate an isosurface from the golgi volume of the
+IMOD sample data at several iso levels. The surface is generated using one
+thread and using one thread per processor, each with and without skipping
+regions of the volume the surface does not pass through. Most of the golgi
+data lies between 60 and 105, so the lowest and highest levels give small
+surfaces and the middle ones large surfaces.
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "allocore/graphics/al_Isosurface.hpp"
+#include "allocore/io/al_File.hpp"
+#include "allocore/system/al_Info.hpp"
+#include "allocore/system/al_Time.hpp"
+#include "allocore/types/al_Voxels.hpp"
+using namespace al;
+
+#define NUM_RUNS (5)
+
+// Returns average time to generate surface in milliseconds
+double benchmark(Isosurface& iso, const Voxels& vox){
+	Timer timer;
+	timer.start();
+	for(int i=0; i<NUM_RUNS; ++i){
+		iso.generate((const int8_t *)vox.data.ptr,
+			vox.dim(0), vox.dim(1), vox.dim(2), 1, 1, 1);
+	}
+	timer.stop();
+	return timer.elapsedSec() * 1e3 / NUM_RUNS;
+}
+
+int main(){
+	SearchPaths paths;
+	paths.addAppPaths();
+	paths.addSearchPath(paths.appPath() + "../../", true);
+	std::string mrcpath = paths.find("golgi.mrc").filepath();
+
+	Voxels vox;
+	if(!vox.loadFromMRC(mrcpath)){
+		printf("Cannot open MRC file %s\n", mrcpath.c_str());
+		return EXIT_FAILURE;
+	}
+
+	int numThreads = numProcessors();
+	if(numThreads < 2) numThreads = 2;
+
+	const float levels[] = { 65, 75, 85, 95, 105 };
+
+	printf("\n%d x %d x %d field, time per surface (ms)\n",
+		vox.dim(0), vox.dim(1), vox.dim(2));
+	printf("%6s %9s %10s %10s %10s %10s\n", "level", "vertices",
+		"1 thread", "1 skip", "N threads", "N skip");
+
+	Isosurface iso;
+	iso.normals(false);
+
+	for(int l=0; l<5; ++l){
+		iso.level(levels[l]);
+		double ms[4];
+		for(int i=0; i<4; ++i){
+			iso.numThreads(i < 2 ? 1 : numThreads);
+			iso.skipEmpty(i & 1);
+			ms[i] = benchmark(iso, vox);
+		}
+		printf("%6g %9d %10.1f %10.1f %10.1f %10.1f\n", levels[l],
+			iso.vertices().size(), ms[0], ms[1], ms[2], ms[3]);
+	}
+
+	printf("\nN = %d\n", numThreads);
+
+	return 0;
+}
@@ -0,0 +1,113 @@
+/*
+Allocore Example: Mesh Weld Benchmark
+
+Description:
+This measures the time to merge duplicate vertices of a mesh with
+Mesh::compress and Mesh::weld. The meshes are grids of unindexed triangles,
+so each vertex appears up to six times. For comparison, the previous
+implementation of compress using nested maps is also timed for meshes of up
+to a million vertices. A second copy of each mesh has vertices displaced by a
+small random amount; these are merged using weld with a tolerance.
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <map>
+#include "allocore/graphics/al_Mesh.hpp"
+#include "allocore/math/al_Random.hpp"
+#include "allocore/system/al_Time.hpp"
+using namespace al;
+
+// Previous implementation of Mesh::compress for vertices only
+void mapCompress(Mesh& m){
+	typedef std::map<float, int> Zmap;
+	typedef std::map<float, Zmap> Ymap;
+	typedef std::map<float, Ymap> Xmap;
+	Xmap xmap;
+
+	Mesh old(m);
+	for(int i=m.vertices().size()-1; i>=0; i--){
+		Mesh::Vertex& v = m.vertices()[i];
+		xmap[v.x][v.y][v.z] = i;
+	}
+
+	std::map<int, int> imap;
+	m.reset();
+	for(int i=0; i<old.vertices().size(); i++){
+		Mesh::Vertex& v = old.vertices()[i];
+		int idx = xmap[v.x][v.y][v.z];
+		std::map<int, int>::iterator it = imap.find(idx);
+		if(it != imap.end()){
+			m.index(it->second);
+		}
+		else{
+			int newidx = m.vertices().size();
+			m.vertex(v);
+			imap[idx] = newidx;
+			m.index(newidx);
+		}
+	}
+}
+
+// Grid of quads in xy plane, each made of two triangles
+void makeGrid(Mesh& m, int numVertices, float jitter, rnd::Random<>& rng){
+	int n = 1;
+	while(n*n*6 < numVertices) ++n;
+	m.reset();
+	for(int j=0; j<n; ++j){
+		for(int i=0; i<n; ++i){
+			Vec3f a(i,j,0), b(i+1,j,0), c(i+1,j+1,0), d(i,j+1,0);
+			Vec3f quad[] = { a, b, c, a, c, d };
+			for(int k=0; k<6; ++k){
+				m.vertex(quad[k] + Vec3f(rng.uniformS(), rng.uniformS(), rng.uniformS())*jitter);
+			}
+		}
+	}
+}
+
+int main(){
+	rnd::Random<> rng(1);
+	Timer timer;
+
+	printf("Time to merge vertices (ms)\n");
+	printf("%10s %10s %10s %10s %10s\n", "vertices", "unique", "map", "compress", "weld");
+
+	for(int n=100000; n<=10000000; n*=10){
+		Mesh src, m;
+		makeGrid(src, n, 0, rng);
+
+		double mapMs = -1;
+		if(n <= 1000000){
+			m = src;
+			timer.start();
+			mapCompress(m);
+			timer.stop();
+			mapMs = timer.elapsedSec() * 1e3;
+		}
+
+		m = src;
+		timer.start();
+		m.compress();
+		timer.stop();
+		double compressMs = timer.elapsedSec() * 1e3;
+		int unique = m.vertices().size();
+
+		// weld tolerance is well above jitter and well below grid spacing
+		makeGrid(m, n, 1e-4, rng);
+		timer.start();
+		m.weld(1e-2);
+		timer.stop();
+		double weldMs = timer.elapsedSec() * 1e3;
+
+		printf("%10d %10d ", src.vertices().size(), unique);
+		if(mapMs >= 0) printf("%10.1f", mapMs);
+		else printf("%10s", "-");
+		printf(" %10.1f %10.1f\n", compressMs, weldMs);
+		if(m.vertices().size() != unique) printf("weld found %d vertices\n", m.vertices().size());
+		fflush(stdout);
+	}
+
+	return 0;
+}
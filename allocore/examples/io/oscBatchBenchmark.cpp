@@ -0,0 +1,116 @@
+/*
+Allocore Example: OSC Batch Benchmark
+
+Description:
+This sends bursts of small OSC packets over the loopback interface from one
+thread and receives them on another, reporting packets per second, the
+median and 99th percentile latency from sending (or queueing) to handling,
+and the packets lost. It is run sending and receiving one packet per system
+call, and then with Send::queue/flush and Recv::batchSize, which use
+sendmmsg and recvmmsg on Linux.
+
+Usage:
+oscBatchBenchmark [packets] [burst] [pause between bursts, in us]
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include "allocore/protocol/al_OSC.hpp"
+#include "allocore/system/al_Time.hpp"
+using namespace al;
+
+const int port = 4120;
+
+struct Sender : public ThreadFunction{
+	int packets, burst;
+	double pause;
+	bool batched;
+	osc::Send::Stats stats;
+
+	void operator()(){
+		osc::Send s(port, "127.0.0.1");
+		for(int i=0; i<packets; ){
+			for(int k=0; k<burst && i<packets; ++k, ++i){
+				s.beginMessage("/state");
+				s << i << al_time() << 1.f << 2.f << 3.f;
+				s.endMessage();
+				if(batched) s.queue();
+				else s.send();
+			}
+			if(batched) s.flush();
+			// pause between bursts, like frames of a simulation
+			if(pause > 0) al_sleep(pause);
+		}
+		stats = s.stats();
+	}
+};
+
+struct Handler : public osc::PacketHandler{
+	std::vector<double> latency;
+	int count, last;
+	double lastTime;
+
+	Handler(): count(0), last(-1), lastTime(0){}
+
+	void onMessageView(osc::MessageView& m){
+		int i; double t;
+		float x, y, z;
+		m >> i >> t >> x >> y >> z;
+		lastTime = al_time();
+		latency.push_back(lastTime - t);
+		last = i;
+		++count;
+	}
+};
+
+void run(int packets, int burst, double pause, bool batched){
+	Handler h;
+	h.latency.reserve(packets);
+	osc::Recv r(port, "127.0.0.1", 0.05);
+	r.handler(h);
+	if(batched) r.batchSize(64);
+
+	Sender sender;
+	sender.packets = packets;
+	sender.burst = burst;
+	sender.pause = pause;
+	sender.batched = batched;
+
+	double t0 = al_time();
+	Thread thread(sender);
+	// receive until nothing arrives for a while
+	double idleSince = al_time();
+	while(al_time() - idleSince < 0.5){
+		if(r.recv()) idleSince = al_time();
+	}
+	thread.join();
+	double sec = h.lastTime - t0;
+
+	std::sort(h.latency.begin(), h.latency.end());
+	double p50 = h.latency.empty() ? 0 : h.latency[h.latency.size()/2];
+	double p99 = h.latency.empty() ? 0 : h.latency[h.latency.size()*99/100];
+	printf("%10s %12.0f %10.1f %10.1f %8d %10llu %10llu\n",
+		batched ? "batched" : "single",
+		h.count / sec, p50*1e6, p99*1e6,
+		packets - h.count,
+		(unsigned long long)sender.stats.calls,
+		(unsigned long long)r.stats().calls
+	);
+}
+
+int main(int argc, char * argv[]){
+	int packets = argc > 1 ? atoi(argv[1]) : 200000;
+	int burst = argc > 2 ? atoi(argv[2]) : 64;
+	double pause = argc > 3 ? atof(argv[3]) * 1e-6 : 0;
+	printf("%d packets in bursts of %d, %g us apart\n", packets, burst, pause*1e6);
+	printf("%10s %12s %10s %10s %8s %10s %10s\n",
+		"", "packets/s", "p50 (us)", "p99 (us)", "lost", "send calls", "recv calls");
+	run(packets, burst, pause, false);
+	run(packets, burst, pause, true);
+	return 0;
+}
@@ -0,0 +1,135 @@
+/*
+Allocore Example: OSC Dispatch Benchmark
+
+Description:
+This times handling bundles of one-float messages three ways: a
+PacketHandler that gets a Message per message and compares its address
+against each known address in turn, a handler that does the same with a
+MessageView read in place, and an osc::Dispatcher with a method registered
+per address. It is run for the 16 navigation addresses of a device server
+and for 256 addresses of the form /agent/<n>/x.
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "allocore/protocol/al_OSC.hpp"
+#include "allocore/system/al_Time.hpp"
+using namespace al;
+
+typedef std::vector<std::string> Addresses;
+
+// The way handlers are usually written
+struct ChainHandler : public osc::PacketHandler{
+	ChainHandler(const Addresses& a): addresses(a), values(a.size()), count(0){}
+	void onMessage(osc::Message& m){
+		++count;
+		for(unsigned i=0; i<addresses.size(); ++i){
+			if(m.addressPattern() == addresses[i]){
+				if(m.typeTags() == "f") m >> values[i];
+				return;
+			}
+		}
+	}
+	const Addresses& addresses;
+	std::vector<float> values;
+	int count;
+};
+
+// The same, but without allocating
+struct ViewChainHandler : public osc::PacketHandler{
+	ViewChainHandler(const Addresses& a): addresses(a), values(a.size()), count(0){}
+	void onMessageView(osc::MessageView& m){
+		++count;
+		for(unsigned i=0; i<addresses.size(); ++i){
+			if(!strcmp(m.addressPattern(), addresses[i].c_str())){
+				if(!strcmp(m.typeTags(), "f")) m >> values[i];
+				return;
+			}
+		}
+	}
+	const Addresses& addresses;
+	std::vector<float> values;
+	int count;
+};
+
+// A method for the Dispatcher
+struct Target{
+	Target(): value(0), count(0){}
+	void set(float v){ value = v; ++count; }
+	float value;
+	int count;
+};
+
+void run(const Addresses& addresses){
+	// bundles of 128 messages, cycling through the addresses
+	const int messagesPerPacket = 128;
+	std::vector<osc::Packet *> packets;
+	for(unsigned i=0; i<addresses.size(); i+=messagesPerPacket){
+		osc::Packet * p = new osc::Packet(8192);
+		p->beginBundle();
+		for(int k=0; k<messagesPerPacket; ++k){
+			p->addMessage(addresses[(i+k) % addresses.size()], float(k));
+		}
+		p->endBundle();
+		packets.push_back(p);
+	}
+	const int numPackets = 20000;
+
+	ChainHandler chain(addresses);
+	ViewChainHandler viewChain(addresses);
+	osc::Dispatcher dispatcher;
+	std::vector<Target> targets(addresses.size());
+	for(unsigned i=0; i<addresses.size(); ++i){
+		dispatcher.add(addresses[i], targets[i], &Target::set);
+	}
+
+	printf("%d addresses, %d messages per packet\n", int(addresses.size()), messagesPerPacket);
+	printf("%28s %14s\n", "method", "messages/s");
+	Timer timer;
+	for(int method=0; method<3; ++method){
+		const char * names[] = {
+			"Message, if-else chain", "MessageView, if-else chain", "Dispatcher"
+		};
+		timer.start();
+		for(int i=0; i<numPackets; ++i){
+			const osc::Packet& p = *packets[i % packets.size()];
+			switch(method){
+			case 0: chain.parse(p.data(), p.size()); break;
+			case 1: viewChain.parse(p.data(), p.size()); break;
+			default: dispatcher.parse(p.data(), p.size());
+			}
+		}
+		timer.stop();
+		printf("%28s %14.0f\n", names[method], double(numPackets)*messagesPerPacket / timer.elapsedSec());
+	}
+
+	int dispatched = 0;
+	for(unsigned i=0; i<targets.size(); ++i) dispatched += targets[i].count;
+	if(chain.count != viewChain.count || chain.count != dispatched){
+		printf("handlers disagree: %d %d %d messages\n", chain.count, viewChain.count, dispatched);
+	}
+	for(unsigned i=0; i<packets.size(); ++i) delete packets[i];
+	printf("\n");
+}
+
+int main(){
+	const char * navigation[] = {
+		"/mx", "/my", "/mz", "/tx", "/ty", "/tz", "/home", "/halt",
+		"/eyeSep", "/near", "/far", "/fovy", "/focalLength", "/ortho", "/speed", "/pose"
+	};
+	run(Addresses(navigation, navigation + 16));
+
+	Addresses agents;
+	for(int i=0; i<256; ++i){
+		char addr[32];
+		sprintf(addr, "/agent/%d/x", i);
+		agents.push_back(addr);
+	}
+	run(agents);
+	return 0;
+}
@@ -0,0 +1,103 @@
+/*
+Allocore Example: OSC Scheduler
+
+Description:
+This sends bundles over the loopback interface every 10 ms, each time
+tagged with the time it is meant to take effect. Before sending, the sender
+waits a random 0 to 4 ms, like a jittery network. The receiver handles the
+messages first as they arrive, then through an osc::Scheduler with a latency
+of 5 ms, run every millisecond as from an audio thread. It prints histograms
+of the error between the time each message was handled and the time it was
+meant to be, and the scheduler's own lateness and arrival margin histograms.
+
+Usage:
+oscScheduler [messages]
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "allocore/math/al_Random.hpp"
+#include "allocore/protocol/al_OSC.hpp"
+#include "allocore/system/al_Time.hpp"
+using namespace al;
+
+const int port = 4140;
+const al_sec period = 0.01;
+const al_sec latency = 0.005;
+
+struct Sender : public ThreadFunction{
+	int messages;
+
+	void operator()(){
+		osc::Send s(port, "127.0.0.1");
+		rnd::Random<> rng(1);
+		al_sec t0 = al_time() + 0.1;
+		for(int i=0; i<messages; ++i){
+			const al_sec t = t0 + i*period;
+			al_sleep_until(t);
+			const osc::TimeTag tag = osc::secToTimeTag(al_time());
+			al_sleep(rng.uniform(0.004));
+			s.clear();
+			s.beginBundle(tag);
+			s.addMessage("/note", i);
+			s.endBundle();
+			s.send();
+		}
+	}
+};
+
+// Records the error between when a message is handled and when it was meant to be
+struct Handler : public osc::PacketHandler{
+	Handler(al_sec offset): error(-0.002, 0.0005, 24), offset(offset), count(0){}
+
+	void onMessageView(osc::MessageView& m){
+		error.add(al_time() - (osc::timeTagToSec(m.timeTag()) + offset));
+		++count;
+	}
+
+	osc::Scheduler::Histogram error;
+	al_sec offset;
+	int count;
+};
+
+void run(int messages, bool scheduled){
+	Handler handler(scheduled ? latency : 0);
+	osc::Scheduler scheduler(handler);
+	scheduler.latency(latency);
+
+	osc::Recv r(port, "", 0.05);
+	if(scheduled) r.handler(scheduler);
+	else r.handler(handler);
+	r.start();
+
+	Sender sender;
+	sender.messages = messages;
+	Thread thread(sender);
+
+	const al_sec end = al_time() + 0.2 + messages*period;
+	while(al_time() < end){
+		if(scheduled) scheduler.run(al_time());
+		al_sleep(0.001);
+	}
+	thread.join();
+	r.stop();
+
+	printf("\n%s, error from intended time:\n", scheduled ? "scheduled" : "on arrival");
+	handler.error.print();
+	if(scheduled){
+		printf("lateness:\n");
+		scheduler.lateness().print();
+		printf("arrival margin:\n");
+		scheduler.margin().print();
+	}
+}
+
+int main(int argc, char * argv[]){
+	int messages = argc > 1 ? atoi(argv[1]) : 500;
+	run(messages, false);
+	run(messages, true);
+	return 0;
+}
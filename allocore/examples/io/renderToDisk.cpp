@@ -37,8 +37,14 @@ public:
 		render.mode(RenderToDisk::NON_REAL_TIME);
 
 		// Set the image type and amount of compression:
-		// The default is "png" with medium compression.
+		// The default is "png" with medium compression. "ppm" images are
+		// written uncompressed, which is fastest if disk space allows.
 		//render.imageFormat("jpg", 50);
+		//render.imageFormat("ppm");
+
+		// Set the number of image encoder threads and frame buffers:
+		// The default is one thread less than the number of processors.
+		//render.encoders(4, 8);
 
 		addDodecahedron(shape);
 		shape.color(HSV(0.1));
@@ -108,6 +114,14 @@ public:
 			//render.toggle(window());
 
 			printf("Rendering %s\n", render.active() ? "started" : "stopped");
+
+			// If frames often had to wait for a free buffer, then encoding
+			// was the bottleneck; try more encoders or a faster format.
+			if(!render.active()){
+				const RenderToDisk::Stats& s = render.stats();
+				printf("%u frames, %u waited for encoders (%.2f s)\n",
+					s.frames, s.waits, s.waitSec);
+			}
 			} break;
 		}
 	}
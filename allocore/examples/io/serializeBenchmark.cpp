@@ -0,0 +1,153 @@
+/*
+Allocore Example: Serialize Benchmark
+
+Description:
+This compares the throughput of Serializer and Deserializer with that of
+ser::Writer and ser::Reader for a large array of floats, an array of Vec3f
+and an array of particle structs. Serializer is given the Vec3f as floats
+and the particles field by field, as it has no other way to take them.
+Writer reuses its buffer between runs and writes each array with one copy.
+Reader is timed both copying the values out and viewing them in place.
+
+Usage:
+serializeBenchmark [number of values] [runs]
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "allocore/protocol/al_Serialize.hpp"
+#include "allocore/system/al_Time.hpp"
+using namespace al;
+
+struct Particle{ Vec3f pos, vel; float mass; int32_t id; };
+
+namespace al{ namespace ser{
+template<> struct Schema<Particle>{
+	template <class F, class P>
+	static void fields(F& f, P& p){ f(p.pos); f(p.vel); f(p.mass); f(p.id); }
+};
+}}
+
+int runs = 20;
+double sink = 0;
+
+void report(const char * name, double bytes, double sec){
+	printf("%28s %10.1f MB/s\n", name, bytes * runs / sec * 1e-6);
+}
+
+void floats(unsigned N){
+	std::vector<float> src(N), dst(N);
+	for(unsigned i=0; i<N; ++i) src[i] = i;
+	const double bytes = N*sizeof(float);
+	printf("%u floats\n", N);
+
+	al_sec t = al_time();
+	for(int r=0; r<runs; ++r){
+		Serializer s;
+		s.add(&src[0], N);
+		Deserializer d(s.buf());
+		d >> dst[0];
+		sink += dst[r];
+	}
+	report("Serializer/Deserializer", bytes, al_time() - t);
+
+	std::vector<char> buf;
+	t = al_time();
+	for(int r=0; r<runs; ++r){
+		ser::Writer w(buf);
+		w.add(&src[0], N);
+		ser::Reader d(w.data(), w.size());
+		d.read(&dst[0], N);
+		sink += dst[r];
+	}
+	report("Writer/Reader", bytes, al_time() - t);
+
+	t = al_time();
+	for(int r=0; r<runs; ++r){
+		ser::Writer w(buf);
+		w.add(&src[0], N);
+		ser::Reader d(w.data(), w.size());
+		sink += d.view<float>()[r];
+	}
+	report("Writer/Reader view", bytes, al_time() - t);
+}
+
+void vecs(unsigned N){
+	std::vector<Vec3f> src(N), dst(N);
+	for(unsigned i=0; i<N; ++i) src[i].set(i, 2*i, 3*i);
+	const double bytes = N*sizeof(Vec3f);
+	printf("%u Vec3f\n", N);
+
+	al_sec t = al_time();
+	for(int r=0; r<runs; ++r){
+		Serializer s;
+		s.add(src[0].elems(), 3*N);
+		Deserializer d(s.buf());
+		d >> dst[0][0];
+		sink += dst[r][0];
+	}
+	report("Serializer/Deserializer", bytes, al_time() - t);
+
+	std::vector<char> buf;
+	t = al_time();
+	for(int r=0; r<runs; ++r){
+		ser::Writer w(buf);
+		w.add(&src[0], N);
+		ser::Reader d(w.data(), w.size());
+		d.read(&dst[0], N);
+		sink += dst[r][0];
+	}
+	report("Writer/Reader", bytes, al_time() - t);
+}
+
+void particles(unsigned N){
+	std::vector<Particle> src(N), dst(N);
+	for(unsigned i=0; i<N; ++i){
+		src[i].pos.set(i, 0, 0);
+		src[i].vel.set(0, i, 0);
+		src[i].mass = 1;
+		src[i].id = i;
+	}
+	const double bytes = N*sizeof(Particle);
+	printf("%u particles\n", N);
+
+	al_sec t = al_time();
+	for(int r=0; r<runs; ++r){
+		Serializer s;
+		for(unsigned i=0; i<N; ++i){
+			const Particle& p = src[i];
+			s.add(p.pos.elems(), 3).add(p.vel.elems(), 3) << p.mass << p.id;
+		}
+		Deserializer d(s.buf());
+		for(unsigned i=0; i<N; ++i){
+			Particle& p = dst[i];
+			d >> p.pos[0] >> p.vel[0] >> p.mass >> p.id;
+		}
+		sink += dst[r].id;
+	}
+	report("Serializer/Deserializer", bytes, al_time() - t);
+
+	std::vector<char> buf;
+	t = al_time();
+	for(int r=0; r<runs; ++r){
+		ser::Writer w(buf);
+		w.add(&src[0], N);
+		ser::Reader d(w.data(), w.size());
+		d.read(&dst[0], N);
+		sink += dst[r].id;
+	}
+	report("Writer/Reader", bytes, al_time() - t);
+}
+
+int main(int argc, char * argv[]){
+	unsigned N = argc > 1 ? atoi(argv[1]) : 1<<20;
+	if(argc > 2) runs = atoi(argv[2]);
+	floats(N);
+	vecs(N);
+	particles(N/8);
+	return sink == 0.5; // keep the results from being optimized away
+}
@@ -0,0 +1,115 @@
+/*
+Allocore Example: State Sync Benchmark
+
+Description:
+This replicates a 1 MB simulation state, 65536 particles of four floats, with
+a StateSender at a fixed frame rate to a StateReceiver polled from another
+thread. It reports the bytes sent per frame, the bandwidth, the median and
+99th percentile latency from sending a frame to it being decoded, and the
+frames lost. It is run sending a full snapshot every frame, which is what
+most projects do, and then sending deltas while a varying fraction of
+the particles move each frame.
+
+Raise net.core.rmem_max on Linux if frames are lost, as a keyframe arrives
+as a burst of several hundred datagrams.
+
+Usage:
+stateSyncBenchmark [frames] [frame rate] [address]
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "allocore/math/al_Random.hpp"
+#include "allocore/protocol/al_StateSync.hpp"
+#include "allocore/system/al_Atomic.hpp"
+#include "allocore/system/al_Thread.hpp"
+#include "allocore/system/al_Time.hpp"
+using namespace al;
+
+const int port = 4130;
+const int feedbackPort = 4131;
+const unsigned numParticles = 65536;
+
+struct State{
+	double sendTime;
+	float pad[2];
+	float particles[numParticles-1][4];
+};
+
+struct Receiver : public ThreadFunction{
+	Receiver(): r(sizeof(State), port, "localhost", feedbackPort), stop(0){}
+
+	void operator()(){
+		while(!stop.load()){
+			if(r.poll(0.01)){
+				const State& s = *(const State *)r.state();
+				latency.push_back(al_time() - s.sendTime);
+			}
+		}
+	}
+
+	StateReceiver r;
+	std::vector<double> latency;
+	Atomic<int> stop;
+};
+
+void run(const char * name, int frames, double fps, const char * address, float moving){
+	Receiver recv;
+	recv.latency.reserve(frames);
+	Thread thread(recv);
+
+	StateSender sender(sizeof(State), port, address, feedbackPort);
+	if(moving >= 1) sender.keyframeInterval(1);
+
+	State * state = new State;
+	memset(state, 0, sizeof(State));
+	rnd::Random<> rng(1);
+	const unsigned numMoving = unsigned(moving * numParticles);
+
+	double t0 = al_time();
+	for(int f=0; f<frames; ++f){
+		// move a random subset of particles
+		for(unsigned i=0; i<numMoving; ++i){
+			float * p = state->particles[rng.uniform(numParticles-1)];
+			for(int k=0; k<4; ++k) p[k] += rng.uniform(0.01f, -0.01f);
+		}
+		state->sendTime = al_time();
+		sender.send(state);
+		al_sleep_until(t0 + (f+1)/fps);
+	}
+	double sec = al_time() - t0;
+	al_sleep(0.2);
+	recv.stop.store(1);
+	thread.join();
+
+	std::vector<double>& l = recv.latency;
+	std::sort(l.begin(), l.end());
+	double p50 = l.empty() ? 0 : l[l.size()/2];
+	double p99 = l.empty() ? 0 : l[l.size()*99/100];
+	const StateSender::Stats& s = sender.stats();
+	printf("%18s %12.0f %10.2f %10.2f %10.2f %7d %6u\n",
+		name, double(s.bytes) / s.frames, s.bytes / sec * 8e-6,
+		p50*1e3, p99*1e3, frames - int(recv.r.stats().frames), s.keyframes
+	);
+	delete state;
+}
+
+int main(int argc, char * argv[]){
+	int frames = argc > 1 ? atoi(argv[1]) : 300;
+	double fps = argc > 2 ? atof(argv[2]) : 60;
+	const char * address = argc > 3 ? argv[3] : "localhost";
+	printf("%d frames of %u bytes at %g fps to %s\n", frames, unsigned(sizeof(State)), fps, address);
+	printf("%18s %12s %10s %10s %10s %7s %6s\n",
+		"", "bytes/frame", "Mbit/s", "p50 (ms)", "p99 (ms)", "lost", "keys");
+	run("snapshots", frames, fps, address, 1);
+	run("delta, 50% moving", frames, fps, address, 0.5);
+	run("delta, 10% moving", frames, fps, address, 0.1);
+	run("delta, 1% moving", frames, fps, address, 0.01);
+	return 0;
+}
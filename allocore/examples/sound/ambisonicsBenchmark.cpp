@@ -0,0 +1,126 @@
+/*
+Allocore Example: Ambisonics Benchmark
+
+Description:
+This measures the throughput of higher order Ambisonics for orders 1 to 7
+using ACN ordering and SN3D normalization. For each order it prints the time
+to compute the spherical harmonics of one direction, the time to build an
+AllRAD decoder, and the number of samples per second encoded by the block
+encoder of the spatializer and decoded to the speakers. The speakers are
+spread evenly over the sphere.
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include "allocore/io/al_AudioIO.hpp"
+#include "allocore/sound/al_Ambisonics.hpp"
+#include "allocore/system/al_Time.hpp"
+using namespace al;
+
+#define BLOCK_SIZE (256)
+#define SAMPLE_RATE (44100)
+#define NUM_BLOCKS (50)
+#define NUM_SOURCES (100)
+#define NUM_SPEAKERS (64)
+
+// Speakers on a spherical Fibonacci lattice
+struct SphereSpeakerLayout : public SpeakerLayout{
+	SphereSpeakerLayout(int n){
+		for(int i=0; i<n; ++i){
+			double z = 1. - (2.*i + 1.) / n;
+			double az = i * M_PI * (3. - sqrt(5.));
+			addSpeaker(Speaker(i, fmod(az * 180./M_PI, 360.), asin(z) * 180./M_PI));
+		}
+	}
+};
+
+int main(){
+	SphereSpeakerLayout layout(NUM_SPEAKERS);
+	AudioIO io(BLOCK_SIZE, SAMPLE_RATE, NULL, NULL, layout.numSpeakers(), 0, AudioIO::DUMMY);
+
+	printf("%d sources, %d speakers, block size %d\n", NUM_SOURCES, NUM_SPEAKERS, BLOCK_SIZE);
+	printf("\n%6s %9s %12s %12s %14s %14s\n",
+		"order", "channels", "harmonic ns", "AllRAD ms", "encode Ms/s", "decode Ms/s");
+
+	for(int order=1; order<=AmbiBase::maxOrder; ++order){
+		Timer timer;
+
+		// Spherical harmonics of one direction
+		float weights[64];
+		float sum = 0;
+		const int numDirs = 100000;
+		timer.start();
+		for(int i=0; i<numDirs; ++i){
+			float z = 2.f * i / numDirs - 1.f;
+			float r = sqrt(1.f - z*z);
+			AmbiBase::encodeWeightsSN3D(weights, 3, order, r * cos(i*0.1f), r * sin(i*0.1f), z);
+			sum += weights[order];
+		}
+		timer.stop();
+		if(sum == 12345) printf(" "); // keep loop from being optimized away
+		double harmonicNs = double(timer.elapsed()) / numDirs;
+
+		// AllRAD decoder
+		AmbisonicsSpatializer ambi(layout, 3, order, 3, AmbiBase::ACN_SN3D);
+		timer.start();
+		ambi.decodeMethod(AmbiDecode::ALLRAD);
+		timer.stop();
+		double allradMs = timer.elapsedSec() * 1e3;
+
+		AudioScene scene(BLOCK_SIZE);
+		scene.createListener(&ambi);
+		scene.useBlockProcessing(true);
+
+		std::vector<SoundSource *> sources;
+		for(int k=0; k<NUM_SOURCES; ++k){
+			sources.push_back(new SoundSource);
+			scene.addSource(*sources.back());
+		}
+
+		// Encoding and decoding of the whole scene
+		al_nsec sceneTime = 0;
+		for(int b=0; b<NUM_BLOCKS; ++b){
+			for(int k=0; k<NUM_SOURCES; ++k){
+				SoundSource& src = *sources[k];
+				double phase = k + b*0.01;
+				src.pos(4*sin(phase), cos(k*1.3), 4*cos(phase));
+				for(int i=0; i<BLOCK_SIZE; ++i){
+					src.writeSample(sin((b*BLOCK_SIZE + i)*0.05 + k) * 0.1);
+				}
+			}
+			io.zeroOut();
+			timer.start();
+			scene.render(io);
+			timer.stop();
+			sceneTime += timer.elapsed();
+		}
+
+		// Decoding alone
+		ambi.prepare();
+		timer.start();
+		for(int b=0; b<NUM_BLOCKS; ++b){
+			ambi.finalize(io);
+		}
+		timer.stop();
+		double decodeSec = timer.elapsedSec();
+		double encodeSec = sceneTime * 1e-9 - decodeSec;
+
+		double samples = double(NUM_BLOCKS) * BLOCK_SIZE;
+		printf("%6d %9d %12.1f %12.2f %14.1f %14.1f\n",
+			order, ambi.decoder().channels(), harmonicNs, allradMs,
+			samples * NUM_SOURCES / encodeSec * 1e-6,
+			samples / decodeSec * 1e-6
+		);
+
+		for(int k=0; k<NUM_SOURCES; ++k){
+			scene.removeSource(*sources[k]);
+			delete sources[k];
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,118 @@
+/*
+Allocore Example: Audio Scene Benchmark
+
+Description:
+This renders an audio scene with an increasing number of moving sound sources
+and prints the average time needed to render one block for the VBAP, DBAP and
+Ambisonics spatializers. Each scene is rendered per sample, per buffer, in
+block processing mode and in block processing mode with several threads. No audio device is opened; the scene renders into the
+buffers of a dummy audio backend.
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include "allocore/io/al_AudioIO.hpp"
+#include "allocore/sound/al_Vbap.hpp"
+#include "allocore/sound/al_Dbap.hpp"
+#include "allocore/sound/al_Ambisonics.hpp"
+#include "allocore/system/al_Time.hpp"
+using namespace al;
+
+#define BLOCK_SIZE (256)
+#define SAMPLE_RATE (44100)
+#define NUM_BLOCKS (20)
+#define NUM_THREADS (4)
+
+// Three rings of speakers above, around and below the listener
+struct DomeSpeakerLayout : public SpeakerLayout{
+	DomeSpeakerLayout(){
+		const int ringSize[] = {8, 12, 8};
+		const float ringElev[] = {40, 0, -30};
+		int chan = 0;
+		for(int r=0; r<3; ++r){
+			for(int i=0; i<ringSize[r]; ++i){
+				addSpeaker(Speaker(chan++, 360./ringSize[r]*i, ringElev[r]));
+			}
+		}
+	}
+};
+
+// Returns average render time of one block, in microseconds
+double benchmark(AudioIO& io, AudioScene& scene, std::vector<SoundSource *>& sources){
+	Timer timer;
+	al_nsec elapsed = 0;
+
+	for(int b=0; b<NUM_BLOCKS; ++b){
+		for(unsigned k=0; k<sources.size(); ++k){
+			SoundSource& src = *sources[k];
+			double phase = k + b*0.01;
+			src.pos(4*sin(phase), cos(k*1.3), 4*cos(phase));
+			for(int i=0; i<BLOCK_SIZE; ++i){
+				src.writeSample(sin((b*BLOCK_SIZE + i)*0.05 + k) * 0.1);
+			}
+		}
+
+		io.zeroOut();
+		timer.start();
+		scene.render(io);
+		timer.stop();
+		elapsed += timer.elapsed();
+	}
+
+	return elapsed * 1e-3 / NUM_BLOCKS;
+}
+
+int main(){
+	DomeSpeakerLayout layout;
+
+	Vbap vbap(layout);
+	Dbap dbap(layout);
+	AmbisonicsSpatializer ambi(layout, 3, 3);
+
+	Spatializer * spatializers[] = { &vbap, &dbap, &ambi };
+	const char * names[] = { "VBAP", "DBAP", "Ambisonics" };
+	const char * modes[] = { "sample", "buffer", "block", "threaded" };
+	const unsigned numSources[] = { 1, 10, 100, 500, 1000, 2000 };
+
+	AudioIO io(BLOCK_SIZE, SAMPLE_RATE, NULL, NULL, layout.numSpeakers(), 0, AudioIO::DUMMY);
+
+	printf("Block size %d, sample rate %d, deadline %.0f us\n",
+		BLOCK_SIZE, SAMPLE_RATE, BLOCK_SIZE * 1e6 / SAMPLE_RATE);
+
+	for(int s=0; s<3; ++s){
+		AudioScene scene(BLOCK_SIZE);
+		scene.createListener(spatializers[s]);
+		std::vector<SoundSource *> sources;
+
+		printf("\n%s (us/block)\n", names[s]);
+		printf("%8s %12s %12s %12s %12s\n", "sources", modes[0], modes[1], modes[2], modes[3]);
+
+		for(int n=0; n<6; ++n){
+			while(sources.size() < numSources[n]){
+				sources.push_back(new SoundSource);
+				scene.addSource(*sources.back());
+			}
+
+			printf("%8d", numSources[n]);
+			for(int m=0; m<4; ++m){
+				scene.usePerSampleProcessing(m == 0);
+				scene.useBlockProcessing(m >= 2);
+				scene.numThreads(m == 3 ? NUM_THREADS : 0);
+				printf(" %12.1f", benchmark(io, scene, sources));
+				fflush(stdout);
+			}
+			printf("\n");
+		}
+
+		for(unsigned k=0; k<sources.size(); ++k){
+			scene.removeSource(*sources[k]);
+			delete sources[k];
+		}
+	}
+
+	return 0;
+}
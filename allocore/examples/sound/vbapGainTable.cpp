@@ -0,0 +1,93 @@
+/*
+Allocore Example: VBAP Gain Table
+
+Description:
+This compares the VBAP gain table against the exact search through the speaker
+triplets. For several table resolutions it prints the memory used, the time
+to build the table, the gain error relative to the exact gains and the time
+to compute the speaker gains of one direction. Directions are either random
+or move slowly, which is the best case for the exact search as it starts
+from the triplet found last.
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <vector>
+#include "allocore/math/al_Random.hpp"
+#include "allocore/sound/al_Vbap.hpp"
+#include "allocore/system/al_Time.hpp"
+using namespace al;
+
+#define NUM_DIRS (100000)
+
+// Three rings of speakers above, around and below the listener
+struct DomeSpeakerLayout : public SpeakerLayout{
+	DomeSpeakerLayout(){
+		const int ringSize[] = {8, 12, 8};
+		const float ringElev[] = {40, 0, -30};
+		int chan = 0;
+		for(int r=0; r<3; ++r){
+			for(int i=0; i<ringSize[r]; ++i){
+				addSpeaker(Speaker(chan++, 360./ringSize[r]*i, ringElev[r]));
+			}
+		}
+	}
+};
+
+// Returns average time to compute gains of one direction, in nanoseconds
+double lookupTime(const Vbap& vbap, const std::vector<Vec3d>& dirs){
+	int speakers[12];
+	float gains[12];
+	float sum = 0;
+	unsigned triplet = 0;
+	Timer timer;
+	timer.start();
+	for(unsigned i=0; i<dirs.size(); ++i){
+		int n = vbap.speakerGains(dirs[i], speakers, gains, &triplet);
+		if(n) sum += gains[0];
+	}
+	timer.stop();
+	if(sum == 12345) printf(" "); // keep loop from being optimized away
+	return double(timer.elapsed()) / dirs.size();
+}
+
+int main(){
+	DomeSpeakerLayout layout;
+	Vbap vbap(layout);
+	AudioScene scene(64);
+	scene.createListener(&vbap);
+
+	// Random and slowly moving directions
+	rnd::Random<> rng(1);
+	std::vector<Vec3d> randomDirs, movingDirs;
+	for(int i=0; i<NUM_DIRS; ++i){
+		randomDirs.push_back(rng.ball<Vec3d>().normalize());
+		double t = i * 0.0005;
+		movingDirs.push_back(Vec3d(cos(t), 0.5*sin(t*0.3), sin(t)).normalize());
+	}
+
+	printf("\n%6s %10s %10s %10s %10s %12s %12s\n",
+		"res", "memory", "build ms", "max err", "rms err", "random ns", "moving ns");
+
+	const int resolutions[] = { 0, 8, 16, 32, 64, 128, 256 };
+
+	for(int r=0; r<7; ++r){
+		Timer timer;
+		timer.start();
+		vbap.gainTableResolution(resolutions[r]);
+		timer.stop();
+
+		double rmsErr = 0;
+		double maxErr = resolutions[r] ? vbap.gainTableError(10000, &rmsErr) : 0;
+
+		printf("%6d %10d %10.2f %10.5f %10.5f %12.1f %12.1f\n",
+			resolutions[r], vbap.gainTableMemory(), timer.elapsedSec()*1e3,
+			maxErr, rmsErr,
+			lookupTime(vbap, randomDirs), lookupTime(vbap, movingDirs)
+		);
+	}
+
+	return 0;
+}
@@ -0,0 +1,107 @@
+/*
+Allocore Example: HashSpace Benchmark
+
+Description:
+This compares the LINKED and SORTED modes of HashSpace on a flocking workload.
+Every frame, each agent moves along its velocity and then matches its
+velocity to the average of its neighbors within a radius. In LINKED mode, the
+voxel lists are updated as agents move; in SORTED mode, agents are sorted by
+voxel after all have moved. Neighbors are found with queryAll, using one
+thread and one thread per processor. The time per frame is split into
+updating the space and finding neighbors.
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <vector>
+#include "allocore/math/al_Random.hpp"
+#include "allocore/spatial/al_HashSpace.hpp"
+#include "allocore/system/al_Info.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
+#include "allocore/system/al_Time.hpp"
+using namespace al;
+
+#define NUM_FRAMES (20)
+#define RADIUS (2)
+
+struct Flock{
+	std::vector<Vec3d> pos, vel, newVel;
+	unsigned long long neighbors;
+
+	// Velocity matching; called by HashSpace::queryAll
+	void operator()(uint32_t id, HashSpace::Query& q){
+		Vec3d sum(0);
+		for(unsigned i=0; i<q.size(); ++i) sum += vel[q[i]->id];
+		newVel[id] = q.size() ? vel[id]*0.9 + sum*(0.1/q.size()) : vel[id];
+	}
+};
+
+void resetFlock(Flock& f, HashSpace& space, int n){
+	rnd::Random<> rng(1);
+	f.pos.resize(n);
+	f.vel.resize(n);
+	f.newVel.resize(n);
+	space.numObjects(n);
+	for(int i=0; i<n; ++i){
+		f.pos[i] = Vec3d(rng.uniform(), rng.uniform(), rng.uniform()) * space.dim();
+		f.vel[i] = Vec3d(rng.uniformS(), rng.uniformS(), rng.uniformS()) * 0.5;
+		space.object(i).id = i;
+		space.move(i, f.pos[i]);
+	}
+	if(space.mode() == HashSpace::SORTED) space.rebuild();
+}
+
+// Returns time per frame in milliseconds of updating space and of queries
+void runFlock(HashSpace& space, Flock& f, ThreadPool * pool, double& updateMs, double& queryMs){
+	Timer timer;
+	double update = 0, query = 0;
+	int n = f.pos.size();
+	for(int frame=0; frame<NUM_FRAMES; ++frame){
+		timer.start();
+		for(int i=0; i<n; ++i){
+			f.pos[i] += f.vel[i];
+			space.move(i, f.pos[i]);
+		}
+		if(space.mode() == HashSpace::SORTED) space.rebuild();
+		timer.stop();
+		update += timer.elapsedSec();
+
+		timer.start();
+		space.queryAll(RADIUS, f, pool);
+		f.vel.swap(f.newVel);
+		timer.stop();
+		query += timer.elapsedSec();
+	}
+	updateMs = update * 1e3 / NUM_FRAMES;
+	queryMs = query * 1e3 / NUM_FRAMES;
+}
+
+int main(){
+	int numThreads = numProcessors();
+	if(numThreads < 2) numThreads = 2;
+	ThreadPool pool(numThreads-1);
+
+	const int sizes[] = { 10000, 100000, 300000 };
+
+	printf("64^3 voxels, radius %d, time per frame (ms)\n", RADIUS);
+	printf("%8s %10s %8s %8s %8s %8s\n", "agents", "mode", "threads", "update", "query", "total");
+
+	for(int s=0; s<3; ++s){
+		for(int m=0; m<3; ++m){
+			HashSpace space(6);
+			space.mode(m ? HashSpace::SORTED : HashSpace::LINKED);
+			Flock f;
+			resetFlock(f, space, sizes[s]);
+			ThreadPool * p = m == 2 ? &pool : NULL;
+			double updateMs, queryMs;
+			runFlock(space, f, p, updateMs, queryMs);
+			printf("%8d %10s %8d %8.1f %8.1f %8.1f\n", sizes[s], m ? "SORTED" : "LINKED",
+				p ? numThreads : 1, updateMs, queryMs, updateMs + queryMs);
+			fflush(stdout);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,93 @@
+/*
+Allocore Example: HashSpace Nearest Neighbor Benchmark
+
+Description:
+This times finding the exact k nearest objects to many points, for k = 1, 8
+and 32. The points are the positions of a subset of the objects, as when
+finding neighbors of particles. It compares brute force, one
+Query::nearest per point, and the batched HashSpace::nearest, which walks
+the voxel shells once for all points in the same voxel, on one thread and
+on one thread per processor.
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+#include "allocore/math/al_Random.hpp"
+#include "allocore/spatial/al_HashSpace.hpp"
+#include "allocore/system/al_Info.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
+#include "allocore/system/al_Time.hpp"
+using namespace al;
+
+#define NUM_OBJECTS (100000)
+#define NUM_POINTS (20000)
+#define NUM_BRUTE (200)	// brute force is timed on fewer points
+
+int main(){
+	int numThreads = numProcessors();
+	if(numThreads < 2) numThreads = 2;
+	ThreadPool pool(numThreads-1);
+
+	rnd::Random<> rng(1);
+	HashSpace space(6, NUM_OBJECTS);
+	for(int i=0; i<NUM_OBJECTS; ++i){
+		space.move(i, Vec3d(rng.uniform(), rng.uniform(), rng.uniform()) * space.dim());
+	}
+	std::vector<Vec3d> points(NUM_POINTS);
+	for(int i=0; i<NUM_POINTS; ++i){
+		points[i] = space.object(rng.uniform(NUM_OBJECTS)).pos;
+	}
+
+	printf("%d objects in 64^3 voxels, %d points, time per point (us)\n", NUM_OBJECTS, NUM_POINTS);
+	printf("%4s %10s %10s %10s %10s\n", "k", "brute", "query", "batched", "threads");
+
+	const uint32_t ks[] = { 1, 8, 32 };
+	for(int j=0; j<3; ++j){
+		const uint32_t k = ks[j];
+		Timer timer;
+		double brute, single, batched, threaded;
+
+		timer.start();
+		std::vector<double> d2(NUM_OBJECTS), kth(NUM_BRUTE);
+		int mismatches = 0;
+		for(int i=0; i<NUM_BRUTE; ++i){
+			for(int o=0; o<NUM_OBJECTS; ++o){
+				d2[o] = space.wrapRelative(space.object(o).pos - points[i]).magSqr();
+			}
+			std::nth_element(d2.begin(), d2.begin()+k-1, d2.end());
+			kth[i] = d2[k-1];
+		}
+		timer.stop();
+		brute = timer.elapsedSec() / NUM_BRUTE;
+
+		timer.start();
+		HashSpace::Query q;
+		for(int i=0; i<NUM_POINTS; ++i){
+			q.nearest(space, points[i], k);
+			if(i < NUM_BRUTE) mismatches += q.distanceSquared(k-1) != kth[i];
+		}
+		timer.stop();
+		single = timer.elapsedSec() / NUM_POINTS;
+
+		std::vector<HashSpace::Query::Result> results;
+		std::vector<uint32_t> counts;
+		timer.start();
+		space.nearest(&points[0], NUM_POINTS, k, results, counts);
+		timer.stop();
+		batched = timer.elapsedSec() / NUM_POINTS;
+
+		timer.start();
+		space.nearest(&points[0], NUM_POINTS, k, results, counts, &pool);
+		timer.stop();
+		threaded = timer.elapsedSec() / NUM_POINTS;
+
+		printf("%4d %10.2f %10.2f %10.2f %10.2f", k, brute*1e6, single*1e6, batched*1e6, threaded*1e6);
+		printf(mismatches ? " (%d mismatches!)\n" : "\n", mismatches);
+	}
+
+	return 0;
+}
@@ -0,0 +1,114 @@
+/*
+Allocore Example: VoxelBricks Benchmark
+
+Description:
+This builds the brick pyramid of a synthetic float volume of a few blobs in
+empty space, on one thread and on a thread pool. It then compares counting
+the voxels within a value range, as when extracting an isosurface, by
+scanning the whole volume and by scanning only the bricks whose range
+overlaps it, and times reading the same region at each level of detail.
+
+Usage:
+voxelBricksBenchmark [size] [brick size]
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <algorithm>
+#include <stdlib.h>
+#include <vector>
+#include "allocore/math/al_Random.hpp"
+#include "allocore/system/al_Info.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
+#include "allocore/system/al_Time.hpp"
+#include "allocore/types/al_VoxelBricks.hpp"
+#include "allocore/types/al_Voxels.hpp"
+using namespace al;
+
+int main(int argc, char * argv[]){
+	const int N = argc > 1 ? atoi(argv[1]) : 384;
+	const int B = argc > 2 ? atoi(argv[2]) : 32;
+
+	// gaussian blobs; most of the volume is near zero
+	rnd::Random<> rng(1);
+	const int numBlobs = 12;
+	float blobs[numBlobs][4];
+	for(int i=0; i<numBlobs; ++i){
+		for(int j=0; j<3; ++j) blobs[i][j] = rng.uniform(0.1f, 0.9f) * N;
+		blobs[i][3] = rng.uniform(0.02f, 0.06f) * N;
+	}
+	Voxels v(AlloFloat32Ty, N, N, N);
+	for(int z=0; z<N; ++z) for(int y=0; y<N; ++y) for(int x=0; x<N; ++x){
+		float d = 0;
+		for(int i=0; i<numBlobs; ++i){
+			float dx = x-blobs[i][0], dy = y-blobs[i][1], dz = z-blobs[i][2];
+			float r2 = (dx*dx + dy*dy + dz*dz) / (blobs[i][3]*blobs[i][3]);
+			if(r2 < 16) d += exp(-r2);
+		}
+		v.elem<float>(0, x,y,z) = d;
+	}
+	printf("%d^3 float volume, %d^3 bricks\n\n", N, B);
+
+	int numThreads = numProcessors();
+	ThreadPool pool(numThreads > 1 ? numThreads-1 : 1);
+	Timer timer;
+
+	VoxelBricks vb(B);
+	timer.start();
+	vb.build(v);
+	timer.stop();
+	double serial = timer.elapsedSec();
+	timer.start();
+	vb.build(v, &pool);
+	timer.stop();
+	printf("pyramid of %d levels built in %.3f s on 1 thread, %.3f s on %d threads\n\n",
+		vb.levels(), serial, timer.elapsedSec(), pool.size()+1);
+
+	// count voxels near the isovalue 0.5
+	const float lo = 0.45f, hi = 0.55f;
+	timer.start();
+	int denseCount = 0;
+	for(int z=0; z<N; ++z) for(int y=0; y<N; ++y){
+		const float * row = &v.elem<float>(0, 0,y,z);
+		for(int x=0; x<N; ++x) denseCount += row[x] >= lo && row[x] <= hi;
+	}
+	timer.stop();
+	double dense = timer.elapsedSec();
+
+	timer.start();
+	std::vector<uint32_t> bricks;
+	vb.bricksInRange(bricks, 0, lo, hi);
+	int brickCount = 0;
+	for(unsigned i=0; i<bricks.size(); ++i){
+		const VoxelBricks::Brick& b = vb.brick(0, bricks[i]);
+		const float * p = (const float *)vb.brickData(0, bricks[i]);
+		// skip the padding of edge bricks
+		int nx = std::min(B, N - int(b.x)*B), ny = std::min(B, N - int(b.y)*B), nz = std::min(B, N - int(b.z)*B);
+		for(int z=0; z<nz; ++z) for(int y=0; y<ny; ++y){
+			const float * row = p + (z*B + y)*B;
+			for(int x=0; x<nx; ++x) brickCount += row[x] >= lo && row[x] <= hi;
+		}
+	}
+	timer.stop();
+	double pruned = timer.elapsedSec();
+	printf("voxels in [%g, %g]: %d dense in %.2f ms, %d in %u of %u bricks in %.2f ms (%.1fx)\n\n",
+		lo, hi, denseCount, dense*1e3, brickCount, unsigned(bricks.size()), vb.numBricks(),
+		pruned*1e3, dense/pruned);
+
+	// the central half of the volume at each level
+	printf("%6s %16s %10s\n", "level", "region", "read (ms)");
+	for(int l=0; l<vb.levels(); ++l){
+		uint32_t n[3], o[3];
+		for(int i=0; i<3; ++i){ n[i] = std::max(1u, vb.dim(i,l)/2); o[i] = vb.dim(i,l)/4; }
+		Array region;
+		timer.start();
+		vb.read(region, l, o[0],o[1],o[2], n[0],n[1],n[2]);
+		timer.stop();
+		char size[32];
+		sprintf(size, "%ux%ux%u", n[0], n[1], n[2]);
+		printf("%6d %16s %10.3f\n", l, size, timer.elapsedSec()*1e3);
+	}
+	return 0;
+}
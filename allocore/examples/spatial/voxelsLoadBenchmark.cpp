@@ -0,0 +1,156 @@
+/*
+Allocore Example: Voxels Load Benchmark
+
+Description:
+This compares ways of loading an MRC volume: reading the whole file and then
+parsing it (readAll + parseMRC), loading directly into the voxels
+(loadFromMRC), mapping the file (mapMRC) and reading 64^3 bricks on demand
+(MRCStream). Each runs in its own process, reporting the time to load, the
+time to then sum every voxel, and the peak resident memory.
+
+Usage:
+voxelsLoadBenchmark [file.mrc]
+voxelsLoadBenchmark -gb <size> [file.mrc]   writes a float volume of <size> GB first
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "allocore/types/al_Voxels.hpp"
+#include "allocore/system/al_Time.hpp"
+using namespace al;
+
+// Write a float volume of about 'gb' gigabytes, n x n x n voxels
+void writeVolume(const char * path, double gb){
+	int n = int(pow(gb * (1<<30) / sizeof(float), 1./3.));
+	MRCHeader h;
+	memset(&h, 0, sizeof(h));
+	h.nx = h.ny = h.nz = n;
+	h.mode = MRC_IMAGE_FLOAT32;
+	h.mapx = 1; h.mapy = 2; h.mapz = 3;
+	h.xlen = h.ylen = h.zlen = 10;
+	FILE * fp = fopen(path, "wb");
+	fwrite(&h, sizeof(h), 1, fp);
+	std::vector<float> plane(size_t(n)*n);
+	for(int z=0; z<n; ++z){
+		for(size_t i=0; i<plane.size(); ++i) plane[i] = float(z + i % n);
+		fwrite(&plane[0], sizeof(float), plane.size(), fp);
+	}
+	fclose(fp);
+	printf("wrote %d^3 floats to %s\n", n, path);
+}
+
+template <class T>
+double sumVoxels(const Array& a){
+	double sum = 0;
+	const char * p = a.data.ptr;
+	for(unsigned z=0; z<a.depth(); ++z)
+	for(unsigned y=0; y<a.height(); ++y){
+		const T * row = (const T *)(p + z*a.stride(2) + y*a.stride(1));
+		for(unsigned x=0; x<a.width(); ++x) sum += row[x];
+	}
+	return sum;
+}
+
+double sumVoxels(const Array& a){
+	switch(a.type()){
+	case AlloSInt8Ty:	return sumVoxels<int8_t>(a);
+	case AlloSInt16Ty:	return sumVoxels<int16_t>(a);
+	case AlloUInt16Ty:	return sumVoxels<uint16_t>(a);
+	case AlloFloat32Ty:	return sumVoxels<float>(a);
+	default:			return 0;
+	}
+}
+
+void run(int method, const char * path){
+	const char * names[] = { "readAll+parseMRC", "loadFromMRC", "mapMRC", "MRCStream 64^3" };
+	Timer timer;
+	double loadSec, sumSec, sum = 0;
+
+	// silence the header printouts
+	fflush(stdout);
+	FILE * out = fdopen(dup(1), "w");
+	if(!freopen("/dev/null", "w", stdout)) return;
+
+	Voxels v;
+	MRCStream stream;
+	timer.start();
+	if(method == 0){
+		File f(path, "rb", true);
+		v.parseMRC(f.readAll());
+	}
+	else if(method == 1) v.loadFromMRC(path);
+	else if(method == 2) v.mapMRC(path);
+	else stream.open(path);
+	timer.stop();
+	loadSec = timer.elapsedSec();
+
+	timer.start();
+	if(method < 3){
+		sum = sumVoxels(v);
+	}
+	else{
+		Array brick;
+		const int B = 64;
+		for(unsigned z=0; z<stream.dim(2); z+=B)
+		for(unsigned y=0; y<stream.dim(1); y+=B)
+		for(unsigned x=0; x<stream.dim(0); x+=B){
+			stream.read(brick, x, y, z,
+				std::min<unsigned>(B, stream.dim(0)-x),
+				std::min<unsigned>(B, stream.dim(1)-y),
+				std::min<unsigned>(B, stream.dim(2)-z));
+			sum += sumVoxels(brick);
+		}
+	}
+	timer.stop();
+	sumSec = timer.elapsedSec();
+
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	#ifdef __APPLE__
+	double rssMB = ru.ru_maxrss / 1048576.;
+	#else
+	double rssMB = ru.ru_maxrss / 1024.;
+	#endif
+	fprintf(out, "%18s %10.3f %10.3f %10.1f   (sum %g)\n", names[method], loadSec, sumSec, rssMB, sum);
+	fclose(out);
+}
+
+int main(int argc, char * argv[]){
+	const char * path = "allocore/share/imod_data/golgi.mrc";
+	int arg = 1;
+	if(argc > 2 && !strcmp(argv[1], "-gb")){
+		path = argc > 3 ? argv[3] : "voxelsLoadBenchmark.mrc";
+		writeVolume(path, atof(argv[2]));
+	}
+	else if(argc > 1){
+		path = argv[arg];
+	}
+
+	printf("%18s %10s %10s %10s\n", "method", "load (s)", "sum (s)", "peak MB");
+	struct stat st;
+	bool large = stat(path, &st) == 0 && st.st_size >= (off_t(1)<<31);
+	for(int method=0; method<4; ++method){
+		// File sizes are ints, so readAll cannot read 2 GB or more
+		if(method == 0 && large){
+			printf("%18s %10s\n", "readAll+parseMRC", "n/a");
+			continue;
+		}
+		// a fresh process for each, so peak memory is its own
+		fflush(stdout);
+		pid_t pid = fork();
+		if(pid == 0){
+			run(method, path);
+			return 0;
+		}
+		waitpid(pid, NULL, 0);
+	}
+	return 0;
+}
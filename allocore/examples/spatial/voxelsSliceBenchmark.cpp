@@ -0,0 +1,102 @@
+/*
+Allocore Example: Voxels Slice Assembly Benchmark
+
+Description:
+This writes a directory of synthetic RGB image slices and times assembling
+them into a volume: the way the Voxels(dir) constructor used to, loading each
+slice and copying it pixel by pixel, then with Voxels::loadFromImages on one
+thread and on a thread pool, taking the red channel and the luminance.
+
+Usage:
+voxelsSliceBenchmark [slices] [size] [directory]
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <algorithm>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "allocore/math/al_Random.hpp"
+#include "allocore/system/al_Info.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
+#include "allocore/system/al_Time.hpp"
+#include "allocore/types/al_Voxels.hpp"
+using namespace al;
+
+// Write n x n RGB slices of noisy concentric rings
+void writeSlices(const std::string& dir, int slices, int n){
+	mkdir(dir.c_str(), 0755);
+	rnd::Random<> rng(1);
+	Array slice(3, AlloUInt8Ty, n, n);
+	for(int z=0; z<slices; ++z){
+		for(int y=0; y<n; ++y) for(int x=0; x<n; ++x){
+			int dx = x - n/2, dy = y - n/2, dz = z - slices/2;
+			uint8_t v = uint8_t(sqrt(double(dx*dx + dy*dy + dz*dz)) * 4);
+			uint8_t rgb[] = { v, uint8_t(v/2 + rng.uniform(32)), uint8_t(255-v) };
+			slice.write(rgb, x, y);
+		}
+		char name[32];
+		sprintf(name, "/slice%05d.png", z);
+		Image::save(dir + name, slice);
+	}
+	printf("wrote %d slices of %d x %d to %s\n", slices, n, n, dir.c_str());
+}
+
+// The slice copy of the original Voxels(dir) constructor
+bool loadPerPixel(Voxels& v, const std::string& dir){
+	std::vector<std::string> files;
+	if(v.getdir(dir, files) != 0 || files.empty()) return false;
+	std::sort(files.begin(), files.end());
+	Image image;
+	if(!image.load(files[0])) return false;
+	v.format(1, AlloUInt8Ty, image.width(), image.height(), files.size());
+	for(unsigned slice=0; slice<files.size(); ++slice){
+		if(!image.load(files[slice])) return false;
+		Array& array(image.array());
+		Image::RGBAPix<uint8_t> pixel;
+		for(size_t row = 0; row < array.height(); ++row){
+			for(size_t col = 0; col < array.width(); ++col){
+				array.read(&pixel, col, row);
+				v.elem<char>(0, col, row, slice) = (char) pixel.r;
+			}
+		}
+	}
+	return true;
+}
+
+int main(int argc, char * argv[]){
+	int slices = argc > 1 ? atoi(argv[1]) : 200;
+	int size = argc > 2 ? atoi(argv[2]) : 512;
+	std::string dir = argc > 3 ? argv[3] : "voxelsSliceBenchmark";
+	writeSlices(dir, slices, size);
+
+	int numThreads = numProcessors();
+	ThreadPool pool(numThreads > 1 ? numThreads-1 : 1);
+
+	printf("%24s %10s %14s\n", "method", "total (s)", "per slice (ms)");
+	Timer timer;
+	for(int method=0; method<5; ++method){
+		const char * names[] = {
+			"per pixel (old)", "red, 1 thread", "red, pool",
+			"luminance, 1 thread", "luminance, pool"
+		};
+		Voxels v;
+		timer.start();
+		bool ok;
+		switch(method){
+		case 0: ok = loadPerPixel(v, dir); break;
+		case 1: ok = v.loadFromImages(dir, Voxels::SLICE_RED); break;
+		case 2: ok = v.loadFromImages(dir, Voxels::SLICE_RED, &pool); break;
+		case 3: ok = v.loadFromImages(dir, Voxels::SLICE_LUMINANCE); break;
+		default: ok = v.loadFromImages(dir, Voxels::SLICE_LUMINANCE, &pool); break;
+		}
+		timer.stop();
+		double sec = timer.elapsedSec();
+		if(ok) printf("%24s %10.3f %14.3f\n", names[method], sec, sec * 1e3 / slices);
+		else printf("%24s failed\n", names[method]);
+	}
+	printf("(%d threads in the pool, plus the calling thread)\n", pool.size());
+	return 0;
+}
@@ -0,0 +1,78 @@
+/*
+Allocore Example: Message Queue Benchmark
+
+Description:
+This compares the two schedulers of MsgQueue, a sorted linked list and a
+binary heap. For an increasing number of messages it prints the time to
+schedule each message and the time to trigger it with update(). Timestamps are
+either increasing, which is the best case for the list, or random, as when
+scheduling many future events of a score or automation.
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <vector>
+#include "allocore/math/al_Random.hpp"
+#include "allocore/system/al_Time.hpp"
+#include "allocore/types/al_MsgQueue.hpp"
+using namespace al;
+
+#define NUM_UPDATES (100)
+
+int numCalls = 0;
+void count(al_sec t, int i){ numCalls += i; }
+
+// Returns average time to schedule and to trigger one message, in nanoseconds
+void benchmark(MsgQueue::Scheduler sched, const std::vector<al_sec>& times, double& schedNs, double& updateNs){
+	MsgQueue q(1024, NULL, NULL, sched);
+	Timer timer;
+
+	timer.start();
+	for(unsigned i=0; i<times.size(); ++i){
+		q.send(times[i], count, 1);
+	}
+	timer.stop();
+	schedNs = double(timer.elapsed()) / times.size();
+
+	timer.start();
+	for(int i=1; i<=NUM_UPDATES; ++i){
+		q.update(double(i) / NUM_UPDATES);
+	}
+	timer.stop();
+	updateNs = double(timer.elapsed()) / times.size();
+}
+
+int main(){
+	const unsigned numMsgs[] = { 100, 1000, 10000, 50000 };
+	const char * schedNames[] = { "list", "heap" };
+	const MsgQueue::Scheduler scheds[] = { MsgQueue::LIST, MsgQueue::HEAP };
+
+	rnd::Random<> rng(1);
+
+	printf("Time per message (ns)\n");
+	printf("%8s %6s %12s %12s %12s %12s\n", "messages", "sched",
+		"inc. send", "inc. update", "rand. send", "rand. update");
+
+	for(int n=0; n<4; ++n){
+		std::vector<al_sec> incTimes, randTimes;
+		for(unsigned i=0; i<numMsgs[n]; ++i){
+			incTimes.push_back(double(i) / numMsgs[n]);
+			randTimes.push_back(rng.uniform());
+		}
+
+		for(int s=0; s<2; ++s){
+			double incSched, incUpdate, randSched, randUpdate;
+			benchmark(scheds[s], incTimes, incSched, incUpdate);
+			benchmark(scheds[s], randTimes, randSched, randUpdate);
+			printf("%8d %6s %12.1f %12.1f %12.1f %12.1f\n", numMsgs[n], schedNames[s],
+				incSched, incUpdate, randSched, randUpdate);
+			fflush(stdout);
+		}
+	}
+
+	if(numCalls == 0) printf("No messages triggered!\n");
+
+	return 0;
+}
@@ -0,0 +1,145 @@
+/*
+Allocore Example: Thread Pool Benchmark
+
+Description:
+This compares a loop run serially, with Threads, which starts a thread for
+each equal part of the loop on every call, and with the work-stealing
+ThreadPool. Each loop is run once per "frame" as a particle or field update
+would be. The fine-grained loop does little work per index, so the cost of
+starting threads dominates. In the imbalanced loop, the work per index grows
+along the range, so with equal parts the last thread does most of the work.
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include "allocore/system/al_Info.hpp"
+#include "allocore/system/al_Thread.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
+#include "allocore/system/al_Time.hpp"
+using namespace al;
+
+#define NUM_FRAMES (200)
+
+std::vector<float> data;
+
+// Work on one index; 'cost' is the number of iterations
+inline void update(int i, int cost){
+	float x = data[i];
+	for(int k=0; k<cost; ++k) x = x*0.999f + 0.001f*sin(x);
+	data[i] = x;
+}
+
+// Fine-grained: same small cost for each index
+struct FineBody{
+	void operator()(int i){ update(i, 1); }
+};
+
+// Imbalanced: cost increases along range
+struct ImbalancedBody{
+	int size;
+	void operator()(int i){ update(i, 1 + (64*i)/size); }
+};
+
+// Thread function for Threads, running body over an equal part of the range
+template <class Body>
+struct Part : public ThreadFunction{
+	Body body;
+	int interval[2];
+	void operator()(){
+		for(int i=interval[0]; i<interval[1]; ++i) body(i);
+	}
+};
+
+// Returns average time per frame in microseconds
+template <class Body>
+double runSerial(Body& body, int size){
+	Timer timer;
+	timer.start();
+	for(int f=0; f<NUM_FRAMES; ++f){
+		for(int i=0; i<size; ++i) body(i);
+	}
+	timer.stop();
+	return timer.elapsed() * 1e-3 / NUM_FRAMES;
+}
+
+template <class Body>
+double runThreads(Body& body, int size, int numThreads){
+	Threads<Part<Body> > threads(numThreads);
+	for(int t=0; t<numThreads; ++t){
+		threads.function(t).body = body;
+		threads.getInterval(threads.function(t).interval, t, size);
+	}
+	Timer timer;
+	timer.start();
+	for(int f=0; f<NUM_FRAMES; ++f){
+		threads.start(); // creates and joins threads
+	}
+	timer.stop();
+	return timer.elapsed() * 1e-3 / NUM_FRAMES;
+}
+
+template <class Body>
+double runPool(Body& body, int size, ThreadPool& pool, int grain){
+	Timer timer;
+	timer.start();
+	for(int f=0; f<NUM_FRAMES; ++f){
+		pool.parallelFor(0, size, grain, body);
+	}
+	timer.stop();
+	return timer.elapsed() * 1e-3 / NUM_FRAMES;
+}
+
+void printStats(ThreadPool& pool){
+	printf("    %8s %8s %8s %8s\n", "thread", "chunks", "steals", "sleeps");
+	for(int i=0; i<=pool.size(); ++i){
+		ThreadPool::Stats s = pool.stats(i);
+		if(i < pool.size()) printf("    %8d", i);
+		else printf("    %8s", "caller");
+		printf(" %8u %8u %8u\n", s.chunks, s.steals, s.sleeps);
+	}
+	pool.resetStats();
+}
+
+int main(){
+	int numThreads = numProcessors();
+	if(numThreads < 2) numThreads = 2;
+	ThreadPool pool(numThreads-1);
+
+	const int sizes[] = { 1000, 10000, 100000 };
+
+	printf("%d threads, time per frame (us)\n", numThreads);
+	printf("\n%12s %8s %10s %10s %10s\n", "loop", "size", "serial", "Threads", "ThreadPool");
+
+	for(int s=0; s<3; ++s){
+		int size = sizes[s];
+		data.assign(size, 0.5f);
+
+		FineBody fine;
+		ImbalancedBody imbalanced;
+		imbalanced.size = size;
+
+		int grain = size / (numThreads * 16);
+		if(grain < 1) grain = 1;
+
+		pool.resetStats();
+		printf("%12s %8d %10.1f %10.1f %10.1f\n", "fine", size,
+			runSerial(fine, size),
+			runThreads(fine, size, numThreads),
+			runPool(fine, size, pool, grain)
+		);
+		printf("%12s %8d %10.1f %10.1f %10.1f\n", "imbalanced", size,
+			runSerial(imbalanced, size),
+			runThreads(imbalanced, size, numThreads),
+			runPool(imbalanced, size, pool, grain)
+		);
+	}
+
+	printf("\nThread pool work of last size\n");
+	printStats(pool);
+
+	return 0;
+}
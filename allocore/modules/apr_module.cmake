@@ -4,6 +4,7 @@ find_package(APR QUIET)
 set(APR_HEADERS
     allocore/io/al_File.hpp
     allocore/io/al_Socket.hpp
+    allocore/protocol/al_StateSync.hpp
     allocore/protocol/al_XML.hpp
     allocore/system/al_Memory.hpp
     allocore/system/al_Time.h
@@ -17,6 +18,7 @@ list(APPEND ALLOCORE_SRC
     src/io/al_File.cpp
     src/io/al_FileAPR.cpp
     src/io/al_SocketAPR.cpp
+    src/protocol/al_StateSync.cpp
     src/protocol/al_XML.cpp
     src/system/al_Memory.cpp
     src/system/al_Time.cpp)
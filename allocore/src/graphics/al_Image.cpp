@@ -59,6 +59,8 @@ public:
 		switch(colorType) {
 			case FIC_MINISBLACK:
 			case FIC_MINISWHITE: {
+					// this would reduce 16-bit and float samples to 8 bits
+					if(FreeImage_GetImageType(mImage) != FIT_BITMAP) break;
 					FIBITMAP *res = FreeImage_ConvertToGreyscale(mImage);
 					FreeImage_Unload(mImage);
 					mImage = res;
@@ -132,6 +134,7 @@ public:
 					}
 					break;
 
+					case AlloUInt16Ty:
 					case AlloFloat32Ty: {
 						char *o_pix = (char *)(arr.data.ptr);
 						int rowstride = arr.stride(1);
@@ -169,6 +172,7 @@ public:
 					}
 					break;
 
+					case AlloUInt16Ty:
 					case AlloFloat32Ty: {
 						char *o_pix = (char *)(arr.data.ptr);
 						int rowstride = arr.stride(1);
@@ -424,6 +428,10 @@ public:
 	AlloTy getDataType() const {
 		FREE_IMAGE_TYPE type = FreeImage_GetImageType(mImage);
 		switch(type) {
+			case FIT_UINT16:
+			case FIT_RGB16:
+			case FIT_RGBA16: return AlloUInt16Ty;
+			case FIT_INT16: return AlloSInt16Ty;
 			case FIT_UINT32: return AlloUInt32Ty;
 			case FIT_INT32: return AlloSInt32Ty;
 
@@ -1,6 +1,8 @@
 #include <math.h>
+#include <algorithm>
 #include "allocore/graphics/al_Isosurface.hpp"
 #include "allocore/graphics/al_Graphics.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
 
 namespace al{
 
@@ -330,7 +332,8 @@ Isosurface::NoVertexAction Isosurface::noVertexAction;
 
 Isosurface::Isosurface(float lev, VertexAction& va)
 :	mIsolevel(lev), mVertexAction(&va),
-	mComputeNormals(true), mNormalize(true), mInBox(false)
+	mComputeNormals(true), mNormalize(true), mInBox(false),
+	mNumThreads(1), mSkipEmpty(false)
 {
 	clear();
 }
@@ -528,6 +531,11 @@ void Isosurface::begin(){
 
 void Isosurface::end(){
 	compressTriangles();
+	finishSurface();
+}
+
+
+void Isosurface::finishSurface(){
 	primitive(Graphics::TRIANGLES); // must be set for proper normal generation
 	if(mComputeNormals) generateNormals(mNormalize);
 	mValidSurface = true;
@@ -632,6 +640,361 @@ bool Isosurface::volumeLengths(double& volLengthX, double& volLengthY, double& v
 }
 
 
+/*
+Generating from a scalar field:
+
+The field is split into slabs of cell layers along z. Each slab is processed
+by one thread, layer by layer from high to low z, which is the order of the
+cell-at-a-time pass. Edge vertices of the current layer are cached in arrays
+covering its two z planes (x and y edges) and the z edges between them, so
+memory is proportional to the area of a z plane rather than the volume.
+
+The z plane between two slabs is processed by both of them. Merging the slabs
+in order, the vertices on the top plane of a slab are replaced by the ones the
+slab above created on its bottom plane. This results in the same vertices in
+the same order as the cell-at-a-time pass.
+*/
+
+// Plane of edge vertex array (0: lower, 1: upper, 2: z edges), offset in
+// x and y from the cell, and direction (0: x, 1: y) of each edge
+static const int sEdgeSlots[12][4] = {
+	{0,0,0,1}, {0,0,1,0}, {0,1,0,1}, {0,0,0,0},
+	{1,0,0,1}, {1,0,1,0}, {1,1,0,1}, {1,0,0,0},
+	{2,0,0,0}, {2,0,1,0}, {2,1,1,0}, {2,1,0,0}
+};
+
+// Cell index bits from corners below level at left (x) and right (x+1) side
+// of cell. Flag bits 0-3 are the corners at (y,z), (y+1,z), (y,z+1) and
+// (y+1,z+1).
+static const unsigned char sLeftBits[16] = {
+	0, 1, 2, 3, 16, 17, 18, 19, 32, 33, 34, 35, 48, 49, 50, 51
+};
+static const unsigned char sRightBits[16] = {
+	0, 8, 4, 12, 128, 136, 132, 140, 64, 72, 68, 76, 192, 200, 196, 204
+};
+
+// Size of octree leaves in cells along each axis, as power of two
+static const int sLeafBits = 3;
+
+struct IsosurfaceSlabTask{
+	Isosurface& iso;
+	const void * field;
+	Isosurface::FieldRow row;
+	void operator()(int i){ iso.generateSlab(iso.mSlabs[i], field, row); }
+};
+
+struct IsosurfaceOctreeTask{
+	Isosurface& iso;
+	const void * field;
+	Isosurface::FieldRow row;
+	void operator()(int bz){ iso.buildOctreeLeaves(bz, field, row); }
+};
+
+
+Isosurface::PoolRef::~PoolRef(){
+	delete pool;
+}
+
+
+Isosurface& Isosurface::numThreads(int n){
+	if(n < 1) n = 1;
+	if(n != mNumThreads){
+		delete mPool.pool;
+		mPool.pool = 0;
+		mNumThreads = n;
+	}
+	return *this;
+}
+
+
+void Isosurface::generateField(const void * field, FieldRow row){
+	mValidSurface = false;
+	reset();
+
+	const int Nx = mNF[0];
+	const int Ny = mNF[1];
+	const int Nz = mNF[2];
+	if(Nx < 2 || Ny < 2 || Nz < 2){
+		finishSurface();
+		return;
+	}
+
+	if(mNumThreads > 1 && !mPool.pool){
+		// calling thread works too
+		mPool.pool = new ThreadPool(mNumThreads - 1);
+	}
+	ThreadPool * pool = mNumThreads > 1 ? mPool.pool : 0;
+
+	if(mSkipEmpty) buildOctree(field, row);
+
+	// Use several slabs per thread to balance uneven surfaces
+	int numSlabs = std::min(Nz - 1, pool ? mNumThreads * 4 : 1);
+	mSlabs.resize(numSlabs);
+	for(int i=0; i<numSlabs; ++i){
+		// first slab has highest z
+		mSlabs[i].z1 = (Nz-1) - (Nz-1) *  i    / numSlabs;
+		mSlabs[i].z0 = (Nz-1) - (Nz-1) * (i+1) / numSlabs;
+	}
+
+	IsosurfaceSlabTask task = { *this, field, row };
+	if(pool) pool->parallelFor(0, numSlabs, 1, task);
+	else task(0);
+
+	// Merge slab vertices, replacing the ones on the top plane of a slab
+	// by the ones of the slab above
+	int numVertices = 0;
+	int numIndices = 0;
+	for(int i=0; i<numSlabs; ++i){
+		Slab& s = mSlabs[i];
+		s.remap.assign(s.vertices.size(), -1);
+		if(i > 0){
+			const Slab& above = mSlabs[i-1];
+			for(unsigned k=0; k<s.top.size(); ++k){
+				if(s.top[k] >= 0){
+					s.remap[s.top[k]] = above.remap[above.bottom[k]];
+				}
+			}
+		}
+		for(unsigned k=0; k<s.remap.size(); ++k){
+			if(s.remap[k] < 0) s.remap[k] = numVertices++;
+		}
+		numIndices += s.indices.size();
+	}
+
+	// The vertex action may add to the mesh, e.g. a color per vertex, so it
+	// is called after adding each vertex
+	bool callAction = mVertexAction != &noVertexAction;
+	if(!callAction) vertices().size(numVertices);
+	indices().size(numIndices);
+
+	int vi = 0;
+	int ii = 0;
+	for(int i=0; i<numSlabs; ++i){
+		const Slab& s = mSlabs[i];
+		for(unsigned k=0; k<s.vertices.size(); ++k){
+			if(s.remap[k] != vi) continue; // already added by slab above
+			if(callAction){
+				Mesh::vertex(s.vertices[k]);
+				(*mVertexAction)(s.edgeVertices[k], *this);
+			}
+			else{
+				vertices()[vi] = s.vertices[k];
+			}
+			++vi;
+		}
+		for(unsigned k=0; k<s.indices.size(); ++k){
+			indices()[ii++] = s.remap[s.indices[k]];
+		}
+	}
+
+	finishSurface();
+}
+
+
+void Isosurface::generateSlab(Slab& s, const void * field, FieldRow row) const {
+	const int Nx = mNF[0];
+	const int Ny = mNF[1];
+	const int Nxy = Nx*Ny;
+	const float lev = level();
+
+	const bool keepEdgeVertices = mVertexAction != &noVertexAction;
+
+	s.vertices.clear();
+	s.edgeVertices.clear();
+	s.indices.clear();
+	s.upper.assign(2*Nxy, -1);
+	s.lower.assign(2*Nxy, -1);
+	s.zEdges.assign(Nxy, -1);
+	s.rows.resize(4*Nx);
+
+	float * bufs[2][2] = {
+		{ &s.rows[0], &s.rows[Nx] }, { &s.rows[2*Nx], &s.rows[3*Nx] }
+	};
+
+	for(int z=s.z1-1; z>=s.z0; --z){
+		int * planes[3] = { &s.lower[0], &s.upper[0], &s.zEdges[0] };
+
+		// rows at y and y+1 of planes z (a, b) and z+1 (c, d)
+		const float * a = row(field,  z   *Nxy, Nx, bufs[0][0]);
+		const float * c = row(field, (z+1)*Nxy, Nx, bufs[1][0]);
+
+		for(int y=0; y<Ny-1; ++y){
+			const float * b = row(field,  z   *Nxy + (y+1)*Nx, Nx, bufs[0][(y+1)&1]);
+			const float * d = row(field, (z+1)*Nxy + (y+1)*Nx, Nx, bufs[1][(y+1)&1]);
+
+			int x = 0;
+			while(x < Nx-1){
+				int xEnd = Nx-1;
+				if(mSkipEmpty){
+					int e = emptyUntil(x, y, z);
+					if(e > x){ x = e; continue; }
+					xEnd = std::min(((x >> sLeafBits) + 1) << sLeafBits, Nx-1);
+				}
+
+				#define CORNER_FLAGS(i) ((a[i]<lev) | ((b[i]<lev)<<1) | ((c[i]<lev)<<2) | ((d[i]<lev)<<3))
+				int left = CORNER_FLAGS(x);
+				for(; x<xEnd; ++x){
+					int right = CORNER_FLAGS(x+1);
+					int idx = sLeftBits[left] | sRightBits[right];
+					left = right;
+
+					const int edgeCode = sEdgeTable[idx];
+					if(!edgeCode) continue;
+
+					const float v8[] = {
+						a[x], a[x+1], b[x], b[x+1], c[x], c[x+1], d[x], d[x+1]
+					};
+
+					// Get or create vertices on intersected edges
+					int edgeVerts[12];
+					for(int e=0; e<12; ++e){
+						if(!(edgeCode & (1<<e))) continue;
+						const int * slot = sEdgeSlots[e];
+						int pos = (x + slot[1]) + Nx*(y + slot[2]);
+						int& v = slot[0] < 2 ? planes[slot[0]][2*pos + slot[3]] : planes[2][pos];
+						if(v < 0){
+							EdgeVertex ev = calcIntersection(x,y,z, e, v8);
+							ev.pos[0] = x;
+							ev.pos[1] = y;
+							ev.pos[2] = z;
+							v = s.vertices.size();
+							s.vertices.push_back(Vertex(ev.x, ev.y, ev.z));
+							if(keepEdgeVertices) s.edgeVertices.push_back(ev);
+						}
+						edgeVerts[e] = v;
+					}
+
+					for(int i=1; i <= sTriTable[idx][0]; ++i){
+						s.indices.push_back(edgeVerts[int(sTriTable[idx][i])]);
+					}
+				}
+				#undef CORNER_FLAGS
+			}
+			a = b;
+			c = d;
+		}
+
+		// lower plane of this layer is upper plane of next one
+		if(z == s.z1-1) s.top = s.upper;
+		s.upper.swap(s.lower);
+		if(z > s.z0){
+			s.lower.assign(2*Nxy, -1);
+			s.zEdges.assign(Nxy, -1);
+		}
+	}
+
+	s.bottom.swap(s.upper);
+}
+
+
+void Isosurface::buildOctree(const void * field, FieldRow row){
+	// leaves
+	mOctreeLevels.resize(1);
+	OctreeLevel * lev = &mOctreeLevels[0];
+	lev->offset = 0;
+	for(int i=0; i<3; ++i){
+		lev->dims[i] = ((mNF[i]-1) + (1<<sLeafBits)-1) >> sLeafBits;
+	}
+	int numNodes = lev->dims[0] * lev->dims[1] * lev->dims[2];
+
+	// coarser levels, down to a single node
+	while(lev->dims[0]*lev->dims[1]*lev->dims[2] > 1){
+		OctreeLevel next;
+		next.offset = numNodes;
+		for(int i=0; i<3; ++i) next.dims[i] = (lev->dims[i] + 1) / 2;
+		numNodes += next.dims[0] * next.dims[1] * next.dims[2];
+		mOctreeLevels.push_back(next);
+		lev = &mOctreeLevels.back();
+	}
+	mOctree.resize(numNodes);
+
+	const OctreeLevel& leaves = mOctreeLevels[0];
+	for(int i=0; i<leaves.dims[0]*leaves.dims[1]*leaves.dims[2]; ++i){
+		mOctree[i].min = 1e30f;
+		mOctree[i].max =-1e30f;
+	}
+
+	IsosurfaceOctreeTask task = { *this, field, row };
+	ThreadPool * pool = mNumThreads > 1 ? mPool.pool : 0;
+	if(pool) pool->parallelFor(0, leaves.dims[2], 1, task);
+	else for(int bz=0; bz<leaves.dims[2]; ++bz) task(bz);
+
+	// each node covers up to 2x2x2 nodes of the level below
+	for(unsigned l=1; l<mOctreeLevels.size(); ++l){
+		const OctreeLevel& fine = mOctreeLevels[l-1];
+		const OctreeLevel& coarse = mOctreeLevels[l];
+		for(int k=0; k<coarse.dims[2]; ++k){
+		for(int j=0; j<coarse.dims[1]; ++j){
+		for(int i=0; i<coarse.dims[0]; ++i){
+			MinMax m = { 1e30f, -1e30f };
+			for(int n=0; n<8; ++n){
+				int fi = 2*i + (n&1), fj = 2*j + ((n>>1)&1), fk = 2*k + (n>>2);
+				if(fi >= fine.dims[0] || fj >= fine.dims[1] || fk >= fine.dims[2]) continue;
+				const MinMax& f = mOctree[fine.offset + fi + fine.dims[0]*(fj + fine.dims[1]*fk)];
+				if(f.min < m.min) m.min = f.min;
+				if(f.max > m.max) m.max = f.max;
+			}
+			mOctree[coarse.offset + i + coarse.dims[0]*(j + coarse.dims[1]*k)] = m;
+		}}}
+	}
+}
+
+
+void Isosurface::buildOctreeLeaves(int bz, const void * field, FieldRow row){
+	const int Nx = mNF[0];
+	const int Ny = mNF[1];
+	const int Nz = mNF[2];
+	const int B = 1<<sLeafBits;
+	const OctreeLevel& leaves = mOctreeLevels[0];
+	std::vector<float> buf(Nx);
+
+	// leaf covers field points [B*i, B*i + B] along each axis
+	int z0 = bz*B;
+	int z1 = std::min(z0 + B, Nz-1);
+	for(int z=z0; z<=z1; ++z){
+		for(int y=0; y<Ny; ++y){
+			const float * r = row(field, (z*Ny + y)*Nx, Nx, &buf[0]);
+
+			// leaves along y containing this row
+			int by0 = y > 0 ? (y-1) >> sLeafBits : 0;
+			int by1 = std::min(y >> sLeafBits, leaves.dims[1]-1);
+
+			for(int bx=0; bx<leaves.dims[0]; ++bx){
+				int x0 = bx*B;
+				int x1 = std::min(x0 + B, Nx-1);
+				float mn = r[x0], mx = r[x0];
+				for(int x=x0+1; x<=x1; ++x){
+					if(r[x] < mn) mn = r[x];
+					if(r[x] > mx) mx = r[x];
+				}
+				for(int by=by0; by<=by1; ++by){
+					MinMax& m = mOctree[bx + leaves.dims[0]*(by + leaves.dims[1]*bz)];
+					if(mn < m.min) m.min = mn;
+					if(mx > m.max) m.max = mx;
+				}
+			}
+		}
+	}
+}
+
+
+int Isosurface::emptyUntil(int x, int y, int z) const {
+	const float lev = level();
+	int bx = x >> sLeafBits;
+	int by = y >> sLeafBits;
+	int bz = z >> sLeafBits;
+
+	// find coarsest node containing cell that is entirely above or below level
+	for(int l=mOctreeLevels.size()-1; l>=0; --l){
+		const OctreeLevel& L = mOctreeLevels[l];
+		const MinMax& m = mOctree[L.offset + (bx>>l) + L.dims[0]*((by>>l) + L.dims[1]*(bz>>l))];
+		if(m.min >= lev || m.max < lev){
+			return std::min(((bx>>l) + 1) << (l + sLeafBits), mNF[0]-1);
+		}
+	}
+	return x;
+}
+
 } // al::
 
 
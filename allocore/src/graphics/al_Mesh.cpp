@@ -1,3 +1,5 @@
+#include <math.h>
+#include <string.h>
 #include <algorithm>
 #include <map>
 #include <string>
@@ -158,72 +160,198 @@ void Mesh::invertNormals() {
 	for(int i=0; i<Nv; ++i) normals()[i] = -normals()[i];
 }
 
-void Mesh::compress() {
+// Hash grid of vertices used for welding. Cells are either unique positions
+// (exact matching) or cubes with an edge length of twice the weld distance,
+// so that vertices within the distance are at most one cell apart on each
+// axis. Each cell stores a list of the vertices kept so far that lie in it.
+namespace{
+
+inline int32_t floatKey(float v){
+	if(v == 0.f) v = 0.f; // make -0 match +0
+	int32_t k;
+	memcpy(&k, &v, sizeof(k));
+	return k;
+}
 
-	int Ni = indices().size();
-	int Nv = vertices().size();
-	if (Ni) {
-		AL_WARN_ONCE("cannot compress Mesh with indices");
-		return;
-	}
-	if (Nv == 0) {
-		AL_WARN_ONCE("cannot compress Mesh with no vertices");
-		return;
+inline int32_t cellKey(float v, float invCellSize){
+	double c = floor(double(v) * invCellSize);
+	if(c < -2147483647.) c = -2147483647.;
+	else if(c > 2147483646.) c = 2147483646.;
+	return int32_t(c);
+}
+
+struct WeldGrid{
+
+	std::vector<int32_t> keys;	// cell key of each vertex added
+	std::vector<int> cells;		// last vertex added to cell, or -1 if empty
+	std::vector<int> next;		// next vertex in same cell
+	uint32_t mask;
+
+	// Allocates tables for up to 'n' vertices
+	WeldGrid(int n){
+		uint32_t cap = 16;
+		while(cap < uint32_t(n) + uint32_t(n)/2) cap <<= 1;
+		keys.resize(3*n);
+		cells.assign(cap, -1);
+		next.assign(n, -1);
+		mask = cap-1;
 	}
 
-	int Nc = colors().size();
-	int Nci = coloris().size();
-	int Nn = normals().size();
-	int Nt2 = texCoord2s().size();
-	int Nt3 = texCoord3s().size();
+	// Mixes all bits of key, since low bits of floats are often zero
+	static uint32_t hash(const int32_t * k){
+		uint32_t h = uint32_t(k[0]);
+		h = (h ^ (h >> 16)) * 0x85ebca6bu + uint32_t(k[1]);
+		h = (h ^ (h >> 13)) * 0xc2b2ae35u + uint32_t(k[2]);
+		h = (h ^ (h >> 16)) * 0x85ebca6bu;
+		return h ^ (h >> 13);
+	}
 
-	// map tree to uniquely ID vertices with same values:
-	typedef std::map<float, int> Zmap;
-	typedef std::map<float, Zmap> Ymap;
-	typedef std::map<float, Ymap> Xmap;
-	Xmap xmap;
+	// Returns cell with key, or an empty one where it would be inserted
+	int& find(const int32_t * k){
+		uint32_t i = hash(k) & mask;
+		for(;;){
+			int& c = cells[i];
+			if(c < 0) return c;
+			const int32_t * kc = &keys[3*c];
+			if(kc[0]==k[0] && kc[1]==k[1] && kc[2]==k[2]) return c;
+			i = (i+1) & mask;
+		}
+	}
 
-	// copy current values:
-	Mesh old(*this);
+	void add(const int32_t * k, int vertex){
+		int& c = find(k);
+		next[vertex] = c;
+		c = vertex;
+		for(int i=0; i<3; ++i) keys[3*vertex+i] = k[i];
+	}
+};
 
-	// walk backward through the vertex list
-	// create a ID for each one
-	for (int i=vertices().size()-1; i>=0; i--) {
-		Vertex& v = vertices()[i];
-		xmap[v.x][v.y][v.z] = i;
+template <int N, class T>
+inline bool near(const Vec<N,T>& a, const Vec<N,T>& b, float eps){
+	for(int i=0; i<N; ++i){
+		if(!(fabs(a[i] - b[i]) <= eps)) return false;
 	}
+	return true;
+}
 
-	// map of old vertex index to new vertex index:
-	typedef std::map<int, int> Imap;
-	Imap imap;
+inline bool near(const Color& a, const Color& b, float eps){
+	return fabs(a.r-b.r) <= eps && fabs(a.g-b.g) <= eps
+		&& fabs(a.b-b.b) <= eps && fabs(a.a-b.a) <= eps;
+}
+}
 
 
-	// reset current mesh:
-	reset();
+int Mesh::weld(float eps, bool matchAttributes){
 
-	// walk forward, inserting if
-	for (int i=0; i<old.vertices().size(); i++) {
-		Vertex& v = old.vertices()[i];
-		int idx = xmap[v.x][v.y][v.z];
-		Imap::iterator it = imap.find(idx);
-		if (it != imap.end()) {
-			// use existing
-			index(it->second);
-		} else {
-			// create new
-			int newidx = vertices().size();
-			vertex(v);
-			if (Nc) color(old.colors()[i]);
-			if (Nci) colori(old.coloris()[i]);
-			if (Nn) normal(old.normals()[i]);
-			if (Nt2) texCoord(old.texCoord2s()[i]);
-			if (Nt3) texCoord(old.texCoord3s()[i]);
-			// store new index:
-			imap[idx] = newidx;
-			// use new index:
-			index(newidx);
+	const int Nv = vertices().size();
+	if(!Nv) return 0;
+
+	// only attributes given per vertex are considered and compacted
+	const bool matchN = matchAttributes && normals().size() == Nv;
+	const bool matchC = matchAttributes && colors().size() == Nv;
+	const bool matchCi= matchAttributes && coloris().size() == Nv;
+	const bool matchT2= matchAttributes && texCoord2s().size() == Nv;
+	const bool matchT3= matchAttributes && texCoord3s().size() == Nv;
+
+	const bool exact = !(eps > 0.f);
+	const float eps2 = eps*eps;
+	const float invCellSize = exact ? 0.f : 0.5f/eps;
+
+	// For each vertex, its new index which is that of the first earlier
+	// vertex it matches, if any
+	std::vector<int> remap(Nv);
+	std::vector<int> kept; // old index of each new vertex
+	kept.reserve(Nv);
+	WeldGrid grid(Nv);
+
+	for(int i=0; i<Nv; ++i){
+		const Vertex& v = vertices()[i];
+		int32_t k[3];		// cell of vertex
+		int32_t lo[3], hi[3];	// range of cells within distance
+		for(int a=0; a<3; ++a){
+			if(exact){
+				k[a] = lo[a] = hi[a] = floatKey(v[a]);
+			}
+			else{
+				k[a] = cellKey(v[a], invCellSize);
+				lo[a] = cellKey(v[a]-eps, invCellSize);
+				hi[a] = cellKey(v[a]+eps, invCellSize);
+			}
 		}
+		int match = -1;
+
+		for(int32_t z=lo[2]; z<=hi[2]; ++z){
+		for(int32_t y=lo[1]; y<=hi[1]; ++y){
+		for(int32_t x=lo[0]; x<=hi[0]; ++x){
+			int32_t kn[3] = { x, y, z };
+			for(int j = grid.find(kn); j >= 0; j = grid.next[j]){
+				if(match >= 0 && j > match) continue;
+				const Vertex& u = vertices()[j];
+				if(exact){
+					if(!(u == v)) continue;
+				}
+				else if((u-v).magSqr() > eps2) continue;
+				if(matchN && !near(normals()[i], normals()[j], eps)) continue;
+				if(matchC && !near(colors()[i], colors()[j], eps)) continue;
+				if(matchCi&& coloris()[i].rgba != coloris()[j].rgba) continue;
+				if(matchT2&& !near(texCoord2s()[i], texCoord2s()[j], eps)) continue;
+				if(matchT3&& !near(texCoord3s()[i], texCoord3s()[j], eps)) continue;
+				match = j;
+			}
+		}}}
+
+		if(match >= 0){
+			remap[i] = remap[match];
+		}
+		else{
+			remap[i] = kept.size();
+			kept.push_back(i);
+			grid.add(k, i);
+		}
+	}
+
+	// Move kept vertices down; new index is never greater than old index
+	const int Nk = kept.size();
+	#define COMPACT(buf)\
+		if(buf.size() == Nv){\
+			for(int i=0; i<Nk; ++i) buf[i] = buf[kept[i]];\
+			buf.size(Nk);\
+		}
+	COMPACT(vertices())
+	COMPACT(normals())
+	COMPACT(colors())
+	COMPACT(coloris())
+	COMPACT(texCoord2s())
+	COMPACT(texCoord3s())
+	#undef COMPACT
+
+	const int Ni = indices().size();
+	if(Ni){
+		for(int i=0; i<Ni; ++i) indices()[i] = remap[indices()[i]];
+	}
+	else{
+		indices().size(Nv);
+		for(int i=0; i<Nv; ++i) indices()[i] = remap[i];
 	}
+
+	return Nv - Nk;
+}
+
+
+void Mesh::compress() {
+
+	int Ni = indices().size();
+	int Nv = vertices().size();
+	if (Ni) {
+		AL_WARN_ONCE("cannot compress Mesh with indices");
+		return;
+	}
+	if (Nv == 0) {
+		AL_WARN_ONCE("cannot compress Mesh with no vertices");
+		return;
+	}
+
+	weld(0, false);
 }
 
 void Mesh::generateNormals(bool normalize, bool equalWeightPerFace) {
@@ -1,5 +1,6 @@
 #include "allocore/io/al_RenderToDisk.hpp"
 #include "allocore/io/al_File.hpp"
+#include "allocore/system/al_Info.hpp"
 #include "allocore/system/al_Time.hpp"
 #include "allocore/types/al_Conversion.hpp"
 
@@ -22,27 +23,21 @@ static void serializeToBigEndian(char * out, float in){
 RenderToDisk::RenderToDisk(Mode m)
 :	mMode(m), mFrameNumber(0), mElapsedSec(0),
 	mGraphicsBuf(-1),
+	mEncoders(0), mNumEncoders(0), mNumFrames(0), mFrameIdx(0),
 	mImageExt("png"), mImageCompress(50),
+	mAudioIO(0), mAudioChannels(0), mAudioFrames(0), mSoundFileRun(0),
 	mActive(false)
 {
 	mPBOs[0] = 0;
 	resetPBOQueue();
+	memset(&mStats, 0, sizeof(mStats));
 
-	/*AudioRing ring;
-	ring.resize(2,2,4);
-
-	for(int j=0; j<8; ++j){
-		float in[4] = {2*j,2*j+1, 20*j,20*j+10};
-		float out[4] = {0,0,0,0};
-
-		ring.write(in);
-		ring.read(out);
-		for(int i=0; i<4; ++i) printf("%f\n", out[i]);
-	}*/
 }
 
 RenderToDisk::~RenderToDisk(){
 	stop();
+	delete mEncoders; // runs any frames left first
+	for(unsigned i=0; i<mFrames.size(); ++i) delete mFrames[i];
 }
 
 RenderToDisk& RenderToDisk::mode(Mode v){
@@ -63,6 +58,19 @@ RenderToDisk& RenderToDisk::imageFormat(const std::string& ext, int compress){
 	return *this;
 }
 
+RenderToDisk& RenderToDisk::encoders(unsigned threads, unsigned buffers){
+	if(!mActive){
+		// the pool runs any frames left before it stops
+		delete mEncoders;
+		mEncoders = 0;
+		for(unsigned i=0; i<mFrames.size(); ++i) delete mFrames[i];
+		mFrames.clear();
+		mNumEncoders = threads;
+		mNumFrames = buffers;
+	}
+	return *this;
+}
+
 bool RenderToDisk::toggle(al::AudioIO& aio, al::Window& win, double fps){
 	return toggle(&aio, &win, fps);
 }
@@ -126,13 +134,17 @@ bool RenderToDisk::start(al::AudioIO * aio, al::Window * win, double fps){
 		//int bytesPerSample = 4;
 		//mAudioBuf.resize(aio.channelsOut() * aio.framesPerBuffer() * bytesPerSample);
 
-		unsigned numBlocks = 8192/aio->framesPerBuffer();
+		mAudioChannels = aio->channelsOut();
+		mAudioFrames = aio->framesPerBuffer();
+		unsigned numBlocks = 8192/mAudioFrames;
 		if(numBlocks < 2) numBlocks = 2; // should buffer at least two (?) blocks
-		mAudioRing.resize(aio->channelsOut(), aio->framesPerBuffer(), numBlocks);
+		mAudioRing.resize(mAudioChannels * mAudioFrames, numBlocks);
+		mAudioBlock.resize(mAudioChannels * mAudioFrames);
 	}
 
 	mAudioIO = aio;
 	mWindow = win;
+	memset(&mStats, 0, sizeof(mStats));
 
 	if(mWindow){
 		mWindowFPS = mWindow->fps();
@@ -147,27 +159,17 @@ bool RenderToDisk::start(al::AudioIO * aio, al::Window * win, double fps){
 	if(mAudioIO){
 		struct F{ static void * threadFunc(void * user){
 			RenderToDisk& outer = *(RenderToDisk*)(user);
-	
-			while(outer.mActive){
-				//printf("SoundFile writer thread\n");
-
-				const int readCode = outer.mAudioRing.read();
-				if(readCode){
-					//printf("SoundFile writer thread: %s\n", readCode>0 ? "read" : "underrun");
-					if(readCode<0) fprintf(stderr, "SoundFile writer thread: underrun\n");
-					outer.mSoundFile.write(
-						reinterpret_cast<const char*>(outer.mAudioRing.readBuffer()),
-						outer.mAudioRing.blockSizeInSamples() * sizeof(float)
-					);
-				}
-				else{
-					//printf("SoundFile writer thread: overrun (sleeping...)\n");
-					al_sleep(0.01);
-				}
+			for(;;){
+				// Check before emptying the ring, so no block is left behind
+				bool run = outer.mSoundFileRun.load() != 0;
+				outer.writeSoundFile();
+				if(!run) break;
+				outer.mAudioWritten.wait();
 			}
 			return NULL;
 		}};
 
+		mSoundFileRun.store(1);
 		mSoundFileThread.start(F::threadFunc, this);
 
 		if(NON_REAL_TIME == mMode){
@@ -199,8 +201,9 @@ void RenderToDisk::stop(){
 
 	if(mWindow){
 		// Empty and reset PBO queue
-		for(int i=0; i<Npbos; ++i) writeImage();
+		for(int i=0; i<Npbos; ++i) saveImage(mWindow->width(), mWindow->height());
 		resetPBOQueue();
+		finishFrames();
 
 		if(0 != mPBOs[0]){
 			glDeleteBuffers(Npbos, mPBOs);
@@ -221,10 +224,12 @@ void RenderToDisk::stop(){
 	}
 
 	if(mAudioIO){
+		mAudioIO->remove(*this);
+
+		mSoundFileRun.store(0);
+		mAudioWritten.post();
 		mSoundFileThread.join();
 		mSoundFile.close();
-
-		mAudioIO->remove(*this);
 	
 		if(NON_REAL_TIME == mMode){
 			mAudioIO->start();
@@ -262,7 +267,8 @@ void RenderToDisk::write(){
 }
 
 void RenderToDisk::onAudioCB(AudioIOData& io){
-	mAudioRing.write(io.outBuffer(0));
+	// If the ring is full, the block is dropped and counted
+	if(mAudioRing.write(io.outBuffer(0))) mAudioWritten.post();
 }
 
 bool RenderToDisk::onFrame(){
@@ -284,8 +290,9 @@ void RenderToDisk::writeAudio(){
 	
 	for(unsigned k=0; k<audioBlocks; ++k){
 
-		// In non-real-time mode, this may write many blocks of audio. The read
-		// thread must check for new samples often enough to avoid underruns.
+		// In non-real-time mode, this may write many blocks of audio, so
+		// wait for the sound file writer rather than drop any.
+		while(!mAudioRing.writable()) mAudioRead.wait();
 		mAudioIO->processAudio();
 		
 		/*
@@ -317,9 +324,6 @@ void RenderToDisk::saveImage(
 	unsigned w, unsigned h, unsigned l, unsigned b, bool usePBO
 ){
 	unsigned numBytes = w*h*3;
-	if(numBytes > mPixels.size()) mPixels.resize(numBytes);
-
-	unsigned char * pixs = &mPixels[0];
 
 	// Set read buffer
 	//glReadBuffer(GL_COLOR_ATTACHMENT0); // for FBO
@@ -334,10 +338,8 @@ void RenderToDisk::saveImage(
 		glReadBuffer(mGraphicsBuf);
 	}
 
-	bool readPixels = false;
-
-	/* Copy pixels out of framebuffer into client memory.
-	A PBO FIFO is used to avoid stalling on glReadPixels. See:
+	/* Copy pixels out of framebuffer straight into a frame buffer of the
+	encoders. A PBO FIFO is used to avoid stalling on glReadPixels. See:
 	http://www.roxlu.com/2014/048/fast-pixel-transfers-with-pixel-buffer-objects
 	https://vec.io/posts/faster-alternatives-to-glreadpixels-and-glteximage2d-in-opengl-es
 	http://www.opengl.org/wiki/Pixel_Buffer_Object
@@ -359,11 +361,12 @@ void RenderToDisk::saveImage(
 		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
 
 		if(mReadPBO){
+			Frame& f = nextFrame(w,h);
 			// This will block until glReadPixels from previous frame finishes
 			void *ptr = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
-			memcpy(pixs, ptr, numBytes);
+			memcpy(f.mImage.pixels<void>(), ptr, numBytes);
 			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
-			readPixels = true;
+			submitFrame(f);
 		}
 
 		// This will not block
@@ -375,153 +378,110 @@ void RenderToDisk::saveImage(
 		mReadPBO = mReadPBO || (mPBOIdx == 0); // written to all PBOs at least once
 	}
 	else{
-		glReadPixels(l,b,w,h, GL_RGB, GL_UNSIGNED_BYTE, pixs);
-		readPixels = true;
+		Frame& f = nextFrame(w,h);
+		glReadPixels(l,b,w,h, GL_RGB, GL_UNSIGNED_BYTE, f.mImage.pixels<void>());
+		submitFrame(f);
 	}
+}
 
-
-	// Launch thread to write pixels out to an image file
-	if(readPixels){
-		//printf("Writing frame %d\n", mFrameNumber);
-
-		// At 40 FPS: 60 x 60 x 40 = 144000 frames/hour
-		std::string name = mPath + "/" + al::toString("%07u", mFrameNumber) + "." + mImageExt;
-		Image::Format format = Image::RGB;
-
-		int i=0;
-		for(; i<Nthreads; ++i){
-			if(mImageWriters[i].run(name, mPixels, w,h, format, mImageCompress)){
-				//printf("Running image writer %d\n", i);
-				break;
-			}
-			//printf("Error: all image writers are busy...\n");
-		}
-		//printf("%d\n", i);
-		// All threaded image writers were busy, so use main thread
-		if(i == Nthreads){
-			al::Image::save(name, pixs, w,h, format, mImageCompress);
+RenderToDisk::Frame& RenderToDisk::nextFrame(unsigned w, unsigned h){
+	if(!mEncoders){
+		unsigned threads = mNumEncoders;
+		if(!threads){
+			int n = numProcessors();
+			threads = n > 1 ? n-1 : 1;
 		}
-	
-		++mFrameNumber;
+		unsigned buffers = mNumFrames ? mNumFrames : 2*threads;
+		mEncoders = new ThreadPool(threads);
+		for(unsigned i=0; i<buffers; ++i) mFrames.push_back(new Frame);
+		mFrameIdx = 0;
 	}
-}
-
-
 
-RenderToDisk::AudioRing::AudioRing()
-:	mChannels(0), mBlockSize(0), mNumBlocks(0), mWriteBlock(0), mReadBlock(0)
-{}
-
-void RenderToDisk::AudioRing::resize(
-	unsigned channels, unsigned blockSize, unsigned numBlocks
-){
-	mChannels  = channels;
-	mBlockSize = blockSize;
-	mNumBlocks = numBlocks;
-
-	// Note: last block is for read buffer
-	mBuffer.resize(channels * blockSize * (numBlocks + 1));
-}
+	// Frames are encoded in about the order submitted, so the oldest is the
+	// next to be free
+	Frame& f = *mFrames[mFrameIdx];
+	mFrameIdx = (mFrameIdx + 1) % mFrames.size();
+	if(!f.done()){
+		// All buffers are in use; this encodes frames meanwhile
+		Timer timer;
+		timer.start();
+		f.wait();
+		timer.stop();
+		++mStats.waits;
+		mStats.waitSec += timer.elapsedSec();
+	}
 
-void RenderToDisk::AudioRing::write(const float * block){
-	unsigned blockSamps = blockSizeInSamples();
-	unsigned wblock = mWriteBlock % mNumBlocks;
-	memcpy(&mBuffer[wblock * blockSamps], block, blockSamps * sizeof(mBuffer[0]));
-	++mWriteBlock;
+	f.mImage.resize<unsigned char>(w,h, Image::RGB);
+	return f;
 }
 
-int RenderToDisk::AudioRing::read(){
-
-	//printf("RenderToDisk::AudioRing::read: r=%d, w=%d\n", mReadBlock, mWriteBlock);
-
-	// Overrun (in general, good)
-	if(mReadBlock == mWriteBlock) return 0;
+void RenderToDisk::submitFrame(Frame& f){
+	//printf("Writing frame %d\n", mFrameNumber);
 
-	int returnCode = 1;
+	// At 40 FPS: 60 x 60 x 40 = 144000 frames/hour
+	f.mPath = mPath + "/" + al::toString("%07u", mFrameNumber) + "." + mImageExt;
+	f.mImage.compression(mImageCompress);
+	mEncoders->submit(f);
 
-	// Underrun (this is bad)
-	if((mWriteBlock - mReadBlock) >= mNumBlocks){
-		//fprintf(stderr, "AudioRing::read underrun (addr=%p)\n", this);
+	++mStats.frames;
+	unsigned pending = 0;
+	for(unsigned i=0; i<mFrames.size(); ++i) pending += !mFrames[i]->done();
+	if(pending > mStats.maxPending) mStats.maxPending = pending;
 
-		// Copy write position since write thread may change it
-		unsigned writeBlock = mWriteBlock;
-
-		// Set read block to oldest block
-		if(writeBlock >= mNumBlocks) mReadBlock = writeBlock - mNumBlocks;
-
-		returnCode = -1;
-	}
+	++mFrameNumber;
+}
 
-	unsigned rblock = mReadBlock % mNumBlocks;
-	const float * src = &mBuffer[rblock * blockSizeInSamples()];
-	float * dst = &mBuffer[blockSizeInSamples() * mNumBlocks];
+void RenderToDisk::finishFrames(){
+	for(unsigned i=0; i<mFrames.size(); ++i) mFrames[i]->wait();
+}
 
-	// Copy samples into read buffer as fast as possible
-	for(unsigned c=0; c<mChannels; ++c){
-		for(unsigned i=0; i<mBlockSize; ++i){
-			dst[i*mChannels + c] = *src++;
+void RenderToDisk::Frame::operator()(){
+	if(mPath.size() > 4 && 0 == mPath.compare(mPath.size()-4, 4, ".ppm")){
+		const Array& a = mImage.array();
+		FILE * fp = fopen(mPath.c_str(), "wb");
+		if(!fp){
+			fprintf(stderr, "RenderToDisk: could not open %s\n", mPath.c_str());
+			return;
 		}
-	}
-
-	// Big-endianize
-	if(true){
-		for(unsigned i=0; i<blockSizeInSamples(); ++i){
-			float& s = dst[i];
-			serializeToBigEndian(reinterpret_cast<char*>(&s), s);
+		fprintf(fp, "P6\n%u %u\n255\n", a.width(), a.height());
+		// PPM rows go from the top, OpenGL rows from the bottom
+		for(unsigned j=a.height(); j-- > 0;){
+			fwrite(a.data.ptr + j*a.stride(1), 3, a.width(), fp);
 		}
+		fclose(fp);
+	}
+	else{
+		mImage.save(mPath);
 	}
-
-	++mReadBlock;
-
-	return returnCode;
-}
-
-const float * RenderToDisk::AudioRing::readBuffer() const {
-	return &mBuffer[blockSizeInSamples() * mNumBlocks];
-}
-
-unsigned RenderToDisk::AudioRing::blockSizeInSamples() const {
-	return mChannels * mBlockSize;
 }
 
 
 
-RenderToDisk::ImageWriter::ImageWriter()
-: mBusy(false)
-{}
-
-bool RenderToDisk::ImageWriter::run(
-	const std::string& path,
-	const std::vector<unsigned char>& pixels, unsigned w, unsigned h,
-	Image::Format format, unsigned compress
-){
-	if(mBusy) return false;
-
-	mBusy = true;
-
-	// Create local copy of pixels
-	mImage.resize<unsigned char>(w,h, format);
-	memcpy(mImage.pixels<void>(), &pixels[0], pixels.size());
-
-	mImage.compression(compress);
-	mPath = path;
-
-	// Wait for any thread function in progress
-	mThread.join();
+void RenderToDisk::writeSoundFile(){
+	const float * src;
+	while((src = mAudioRing.readBlock())){
+		float * dst = &mAudioBlock[0];
 
-	struct F{
-		static void * threadFunc(void * user){
-			ImageWriter& outer = *(ImageWriter*)(user);
-			//outer.mBusy = true;
-			outer.mImage.save(outer.mPath);
-			outer.mBusy = false;
-			return NULL;
+		// Interleave samples
+		for(unsigned c=0; c<mAudioChannels; ++c){
+			for(unsigned i=0; i<mAudioFrames; ++i){
+				dst[i*mAudioChannels + c] = *src++;
+			}
 		}
-	};
+		mAudioRing.commitRead();
+		mAudioRead.post();
 
-	mThread.start(F::threadFunc, this);
+		// Big-endianize
+		for(unsigned i=0; i<mAudioBlock.size(); ++i){
+			float& s = dst[i];
+			serializeToBigEndian(reinterpret_cast<char*>(&s), s);
+		}
 
-	return true;
+		mSoundFile.write(
+			reinterpret_cast<const char*>(dst),
+			mAudioBlock.size() * sizeof(float)
+		);
+	}
 }
 
 }
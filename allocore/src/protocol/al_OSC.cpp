@@ -1,9 +1,26 @@
 #include <ctype.h> // isgraph
 #include <stdio.h> // printf
 #include <string.h>
+#include <algorithm>
+#include <math.h>
+#include "allocore/system/al_Config.h"
 #include "allocore/system/al_Printing.hpp"
+#include "allocore/system/al_Time.hpp"
 #include "allocore/protocol/al_OSC.hpp"
 
+#if defined(AL_LINUX)
+	#include <errno.h>
+	#include <poll.h>
+	#include <sys/epoll.h>
+	#include <sys/eventfd.h>
+	#include <sys/socket.h>
+	#include <unistd.h>
+#elif !defined(AL_WINDOWS)
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <unistd.h>
+#endif
+
 #include "oscpack/osc/OscOutboundPacketStream.h"
 #include "oscpack/osc/OscPacketListener.h"
 #include "oscpack/osc/OscReceivedElements.h"
@@ -260,95 +277,622 @@ Message& Message::operator>> (Blob& v){
 	return *this;
 }
 
-#ifdef VERBOSE
-#include <netinet/in.h>  // for ntohl
-#endif
 
-void PacketHandler::parse(const char *packet, int size, TimeTag timeTag){
-	OSCTRY("PacketHandler::parse",
-#ifdef VERBOSE
-	       printf("PacketHandler::parse(size %d, packet %p)\n", size, packet);
-	       printf("Data to parse: ");
-	       for(int i=0; i<size; ++i) printf("%c", packet[i]); printf("\n");
-#endif
+namespace{
 
+// OSC is big-endian
+inline uint32_t readUInt32(const char * p){
+	const unsigned char * u = (const unsigned char *)p;
+	return (uint32_t(u[0])<<24) | (uint32_t(u[1])<<16) | (uint32_t(u[2])<<8) | u[3];
+}
+inline uint64_t readUInt64(const char * p){
+	return (uint64_t(readUInt32(p))<<32) | readUInt32(p+4);
+}
 
-		// this is the only generic entry point for parsing packets
-		::osc::ReceivedPacket p(packet, size);
-#ifdef VERBOSE
-	       printf("Just made an ::osc::ReceivedPacket that has contents %p and size %d\n",
-		      p.Contents(), p.Size());
-#endif
+// Get end of the padded OSC-string at p, or NULL if it is not terminated
+inline const char * stringEnd(const char * p, const char * end){
+	const char * z = (const char *)memchr(p, '\0', end - p);
+	if(!z) return NULL;
+	return p + ((z - p) / 4 + 1) * 4;
+}
+
+// Get end of argument with tag at p, or NULL if it overruns the message
+const char * argEnd(char tag, const char * p, const char * end){
+	switch(tag){
+		case 'i': case 'f': case 'c': case 'r': case 'm':
+			return end - p >= 4 ? p+4 : NULL;
+		case 'h': case 't': case 'd':
+			return end - p >= 8 ? p+8 : NULL;
+		case 's': case 'S':
+			return stringEnd(p, end);
+		case 'b': {
+			if(end - p < 4) return NULL;
+			uint32_t n = readUInt32(p);
+			if(n > uint32_t(end - p - 4)) return NULL;
+			return p + 4 + (n+3)/4*4;
+		}
+		case 'T': case 'F': case 'N': case 'I':
+			return p;
+		default:
+			return NULL;
+	}
+}
+
+// Whether an address part matches the OSC pattern [p, pend)
+bool matchPart(const char * p, const char * pend, const char * s, const char * send){
+	while(p != pend){
+		switch(*p){
+		case '?':
+			if(s == send) return false;
+			++p; ++s;
+			break;
+		case '*':
+			while(p != pend && *p == '*') ++p;
+			if(p == pend) return true;
+			for(; s != send; ++s){
+				if(matchPart(p, pend, s, send)) return true;
+			}
+			return false;
+		case '[': {
+			if(s == send) return false;
+			const char * q = p+1;
+			bool negate = q != pend && *q == '!';
+			if(negate) ++q;
+			bool found = false;
+			for(; q != pend && *q != ']'; ++q){
+				if(q+2 < pend && q[1] == '-' && q[2] != ']'){
+					if(*q <= *s && *s <= q[2]) found = true;
+					q += 2;
+				}
+				else if(*q == *s) found = true;
+			}
+			if(q == pend || found == negate) return false;
+			p = q+1; ++s;
+			break;
+		}
+		case '{': {
+			const char * close = (const char *)memchr(p, '}', pend - p);
+			if(!close) return false;
+			for(const char * alt = p+1; alt <= close; ){
+				const char * comma = alt;
+				while(comma != close && *comma != ',') ++comma;
+				size_t n = comma - alt;
+				if(size_t(send - s) >= n && !memcmp(alt, s, n)
+					&& matchPart(close+1, pend, s+n, send)) return true;
+				alt = comma+1;
+			}
+			return false;
+		}
+		default:
+			if(s == send || *p != *s) return false;
+			++p; ++s;
+		}
+	}
+	return s == send;
+}
+
+inline bool hasWildcard(const char * p, const char * end){
+	for(; p != end; ++p){
+		if(*p == '?' || *p == '*' || *p == '[' || *p == '{') return true;
+	}
+	return false;
+}
+
+// FNV-1a
+inline uint32_t hashPart(const char * p, const char * end){
+	uint32_t h = 2166136261u;
+	for(; p != end; ++p) h = (h ^ (unsigned char)*p) * 16777619u;
+	return h;
+}
+
+inline const char * partEnd(const char * p){
+	while(*p && *p != '/') ++p;
+	return p;
+}
+
+} // ::
+
+
+MessageView::MessageView()
+:	mData(0), mAddressPattern(0), mTypeTags(""), mArgs(0), mTag(""), mArg(0),
+	mSize(0), mNumArgs(0), mTimeTag(1), mFail(false)
+{}
+
+MessageView::MessageView(const char * message, int size, const TimeTag& timeTag)
+:	mData(message), mAddressPattern(0), mTypeTags(""), mArgs(0), mTag(""), mArg(0),
+	mSize(size), mNumArgs(0), mTimeTag(timeTag), mFail(false)
+{
+	if(size <= 0 || size % 4 || message[0] != '/') return;
+	const char * end = message + size;
+	const char * p = stringEnd(message, end);
+	if(!p) return;
+
+	// messages without type tags have no arguments
+	mArgs = p;
+	if(p != end && *p == ','){
+		const char * tags = p+1;
+		p = stringEnd(p, end);
+		if(!p) return;
+		mArgs = p;
+		for(const char * t = tags; *t; ++t){
+			p = argEnd(*t, p, end);
+			if(!p) return;
+			++mNumArgs;
+		}
+		mTypeTags = tags;
+	}
+	mAddressPattern = message;
+	resetStream();
+}
 
+const char * MessageView::next(char tag){
+	if(mFail || *mTag != tag){
+		mFail = true;
+		return NULL;
+	}
+	const char * p = mArg;
+	mArg = argEnd(tag, p, mData + mSize);
+	++mTag;
+	return p;
+}
+
+MessageView& MessageView::operator>> (int& v){
+	const char * p = next('i');
+	if(p) v = int32_t(readUInt32(p));
+	return *this;
+}
+MessageView& MessageView::operator>> (float& v){
+	const char * p = next('f');
+	if(p){ uint32_t u = readUInt32(p); memcpy(&v, &u, 4); }
+	return *this;
+}
+MessageView& MessageView::operator>> (double& v){
+	const char * p = next('d');
+	if(p){ uint64_t u = readUInt64(p); memcpy(&v, &u, 8); }
+	return *this;
+}
+MessageView& MessageView::operator>> (char& v){
+	const char * p = next('c');
+	if(p) v = char(readUInt32(p));
+	return *this;
+}
+MessageView& MessageView::operator>> (const char*& v){
+	// symbols are strings too
+	if(*mTag == 'S' && !mFail){
+		v = mArg;
+		mArg = argEnd('S', mArg, mData + mSize);
+		++mTag;
+		return *this;
+	}
+	const char * p = next('s');
+	if(p) v = p;
+	return *this;
+}
+MessageView& MessageView::operator>> (std::string& v){
+	const char * r = NULL;
+	(*this) >> r;
+	if(r) v = r;
+	return *this;
+}
+MessageView& MessageView::operator>> (Blob& v){
+	const char * p = next('b');
+	if(p){
+		v.size = readUInt32(p);
+		v.data = p+4;
+	}
+	return *this;
+}
+
+void MessageView::print() const {
+	if(!valid()){
+		printf("invalid message\n");
+		return;
+	}
+	printf("%s, %s %" AL_PRINTF_LL "d\n", addressPattern(), typeTags(), timeTag());
+	printf("\targs = (");
+	const char * p = mArgs;
+	for(const char * t = mTypeTags; *t; ++t){
+		switch(*t){
+			case 'f': {uint32_t u = readUInt32(p); float v; memcpy(&v, &u, 4); printf("%g", v);} break;
+			case 'i': printf("%ld", long(int32_t(readUInt32(p)))); break;
+			case 'h': printf("%" AL_PRINTF_LL "d", (long long)readUInt64(p)); break;
+			case 'c': {char v = char(readUInt32(p)); printf("'%c' (=%3d)", isprint(v) ? v : ' ', v);} break;
+			case 'd': {uint64_t u = readUInt64(p); double v; memcpy(&v, &u, 8); printf("%g", v);} break;
+			case 's': case 'S': printf("%s", p); break;
+			case 'b': printf("blob"); break;
+			default:  printf("?");
+		}
+		if(t[1]) printf(", ");
+		p = argEnd(*t, p, mData + mSize);
+	}
+	printf(")\n");
+}
+
+
+
+void PacketHandler::onMessageView(MessageView& v){
+	Message m(v.data(), v.size(), v.timeTag());
+	onMessage(m);
+}
+
+void PacketHandler::parse(const char *packet, int size, TimeTag timeTag){
+	// this is the only generic entry point for parsing packets
+	if(size >= 16 && !memcmp(packet, "#bundle", 8)){
 		// iterate through all the bundle elements (bundles or messages)
-		if(p.IsBundle()){
+		TimeTag bundleTimeTag = readUInt64(packet + 8);
+		const char * p = packet + 16;
+		const char * end = packet + size;
+		while(end - p >= 4){
+			uint32_t n = readUInt32(p);
+			p += 4;
+			if(n > uint32_t(end - p)){
+				AL_WARN("OSC error: bundle element size exceeds bundle");
+				return;
+			}
+			parse(p, n, bundleTimeTag);
+			p += n;
+		}
+	}
+	else{
+		MessageView m(packet, size, timeTag);
+		if(m.valid()) onMessageView(m);
+		else AL_WARN("OSC error: malformed message");
+	}
+}
 
-#ifdef VERBOSE
-		  printf("It's a bundle\n");
-		  char *afterTimeTag = (char *)packet+16;  // "#bundle\0" plus 8-byte time tag
-		  int firstBundleElementSize = ntohl(* ((int *)  afterTimeTag));
-		  printf("First bundle element has size %d\n", firstBundleElementSize);
-#endif
 
-		  ::osc::ReceivedBundle r(p);
-#ifdef VERBOSE
-		  printf("Just made an ::osc::ReceivedBundle that has time tag at %p and %d elements\n",
-			 r.timeTag_, r.ElementCount() );
-#endif
 
+struct Dispatcher::Node{
+	std::string part;
+	uint32_t hash;
+	std::vector<Node *> literals;	// children sorted by hash
+	std::vector<Node *> patterns;	// children with wildcards
+	std::vector<Method *> methods;	// methods for the address ending here
 
-		  ::osc::ReceivedBundleElementIterator it = r.ElementsBegin();
-#ifdef VERBOSE
-		  printf("Just made an ::osc::ReceivedBundleElementIterator\n");
-#endif
+	Node(const std::string& p = ""): part(p), hash(hashPart(p.data(), p.data()+p.size())){}
 
+	~Node(){
+		for(unsigned i=0; i<literals.size(); ++i) delete literals[i];
+		for(unsigned i=0; i<patterns.size(); ++i) delete patterns[i];
+		for(unsigned i=0; i<methods.size(); ++i) delete methods[i];
+	}
 
-#ifdef VERBOSE
-		  int i = 1;
-#endif
-		  while(it != r.ElementsEnd()){
-		    const ::osc::ReceivedBundleElement& e = *it;
-#ifdef VERBOSE
-		    printf("Just made an ::osc::ReceivedBundleElement with contents %p and size %d\n",
-			   e.Contents(), e.Size());
-#endif
+	static bool lessHash(const Node * n, uint32_t h){ return n->hash < h; }
 
+	bool is(const char * p, const char * end) const {
+		return size_t(end - p) == part.size() && !memcmp(p, part.data(), part.size());
+	}
 
+	Node * child(const std::string& p){
+		const char * b = p.data(), * e = b + p.size();
+		if(hasWildcard(b, e)){
+			for(unsigned i=0; i<patterns.size(); ++i){
+				if(patterns[i]->part == p) return patterns[i];
+			}
+			patterns.push_back(new Node(p));
+			return patterns.back();
+		}
+		uint32_t h = hashPart(b, e);
+		std::vector<Node *>::iterator it = std::lower_bound(literals.begin(), literals.end(), h, lessHash);
+		for(; it != literals.end() && (*it)->hash == h; ++it){
+			if((*it)->is(b, e)) return *it;
+		}
+		return *literals.insert(it, new Node(p));
+	}
+};
 
-#ifdef VERBOSE
-		    printf("After it++, the same ::osc::ReceivedBundleElement has contents %p and size %d\n",
-                           e.Contents(), e.Size());
+Dispatcher::Dispatcher()
+:	mRoot(new Node), mUnhandled(0), mMismatched(0)
+{}
 
+Dispatcher::~Dispatcher(){ delete mRoot; }
 
-		    printf("Parsing bundle element %d\n", i++);
-		    printf("Made an ::osc::ReceivedBundleElement out of the iterator.\n");
-		    printf("\tcontents: %p\n", e.Contents());
-		    printf("\tsize: %d\n",e.Size());
-		    printf("\ttimeTag %ld\n", r.TimeTag());
-		    printf("\tLet's try to parse it...\n");
-#endif
-		    parse(e.Contents(), e.Size(), r.TimeTag());
+void Dispatcher::clear(){
+	delete mRoot;
+	mRoot = new Node;
+	mUnhandled = mMismatched = 0;
+}
+
+Dispatcher& Dispatcher::add(const std::string& address, Callback callback, void * userData, const char * typeTags){
+	return addMethod(address, new CallbackMethod(callback, userData, typeTags));
+}
 
-		    it++;
-		  }
+Dispatcher& Dispatcher::addMethod(const std::string& address, Method * m){
+	if(address.empty() || address[0] != '/'){
+		AL_WARN("OSC error: address \"%s\" does not begin with '/'", address.c_str());
+		delete m;
+		return *this;
+	}
+	Node * n = mRoot;
+	const char * p = address.c_str();
+	while(*p){
+		const char * e = partEnd(p+1);
+		n = n->child(std::string(p+1, e));
+		p = e;
+	}
+	n->methods.push_back(m);
+	return *this;
+}
+
+void Dispatcher::match(const Node& n, const char * addr, MessageView& m, int& calls){
+	if(!*addr){
+		for(unsigned i=0; i<n.methods.size(); ++i){
+			Method& method = *n.methods[i];
+			if(!method.anyTags && method.tags != m.typeTags()){
+				++mMismatched;
+				continue;
+			}
+			m.resetStream();
+			method(m);
+			++calls;
 		}
-		else if(p.IsMessage()){
-#ifdef VERBOSE
-		  printf("Parsing a message\n");
-#endif
-		  Message m(packet, size, timeTag);
-		  onMessage(m);
+		return;
+	}
+
+	const char * b = addr + 1;
+	const char * e = partEnd(b);
+	if(hasWildcard(b, e)){
+		for(unsigned i=0; i<n.literals.size(); ++i){
+			const std::string& part = n.literals[i]->part;
+			if(matchPart(b, e, part.data(), part.data() + part.size())){
+				match(*n.literals[i], e, m, calls);
+			}
+		}
+	}
+	else{
+		uint32_t h = hashPart(b, e);
+		std::vector<Node *>::const_iterator it = std::lower_bound(n.literals.begin(), n.literals.end(), h, Node::lessHash);
+		for(; it != n.literals.end() && (*it)->hash == h; ++it){
+			if((*it)->is(b, e)) match(**it, e, m, calls);
+		}
+		for(unsigned i=0; i<n.patterns.size(); ++i){
+			const std::string& part = n.patterns[i]->part;
+			if(matchPart(part.data(), part.data() + part.size(), b, e)){
+				match(*n.patterns[i], e, m, calls);
+			}
 		}
-	       )
+	}
+}
+
+int Dispatcher::dispatch(MessageView& m){
+	int calls = 0;
+	unsigned mismatched = mMismatched;
+	match(*mRoot, m.addressPattern(), m, calls);
+	// messages whose address matched, but not the type tags, are mismatched
+	if(!calls && mismatched == mMismatched){
+		++mUnhandled;
+		onUnhandled(m);
+	}
+	return calls;
+}
+
+bool Dispatcher::matches(const char * pattern, const char * address){
+	while(*pattern == '/' && *address == '/'){
+		const char * pe = partEnd(pattern+1), * ae = partEnd(address+1);
+		if(!matchPart(pattern+1, pe, address+1, ae)) return false;
+		pattern = pe; address = ae;
+	}
+	return !*pattern && !*address;
+}
+
+
+
+TimeTagClock::TimeTagClock(double bw)
+:	mLocal(0), mWall(0), mRate(1), mReset(true)
+{
+	bandwidth(bw);
+}
+
+TimeTagClock& TimeTagClock::bandwidth(double v){
+	// critically damped, as in DelayLockedLoop
+	mB = v;
+	mC = v*v*0.5;
+	return *this;
 }
 
+void TimeTagClock::update(al_sec local, al_sec wall){
+	const al_sec dt = local - mLocal;
+	const al_sec predicted = mWall + mRate*dt;
+	const al_sec e = wall - predicted;
+
+	// start over on the first update or when either clock jumps
+	if(mReset || fabs(e) > 1. || dt < 0){
+		mLocal = local;
+		mWall = wall;
+		mRate = 1;
+		mReset = false;
+		return;
+	}
+
+	mLocal = local;
+	mWall = predicted + mB*e;
+	if(dt > 0) mRate += mC*e/dt;
+}
 
 
+
+Scheduler::Histogram::Histogram(al_sec min, al_sec width, int bins)
+:	mCounts(bins < 1 ? 1 : bins), mMin(min), mWidth(width)
+{
+	clear();
+}
+
+void Scheduler::Histogram::add(al_sec v){
+	int i = int(floor((v - mMin) / mWidth));
+	if(i < 0) i = 0;
+	else if(i >= size()) i = size()-1;
+	++mCounts[i];
+	if(!mCount || v < mLo) mLo = v;
+	if(!mCount || v > mHi) mHi = v;
+	mSum += v;
+	mSumSqr += v*v;
+	++mCount;
+}
+
+void Scheduler::Histogram::clear(){
+	std::fill(mCounts.begin(), mCounts.end(), 0u);
+	mSum = mSumSqr = mLo = mHi = 0;
+	mCount = 0;
+}
+
+al_sec Scheduler::Histogram::stddev() const {
+	if(!mCount) return 0;
+	const al_sec m = mean();
+	const al_sec v = mSumSqr/mCount - m*m;
+	return v > 0 ? sqrt(v) : 0;
+}
+
+al_sec Scheduler::Histogram::percentile(double fraction) const {
+	const double target = fraction * mCount;
+	unsigned sum = 0;
+	for(int i=0; i<size(); ++i){
+		sum += mCounts[i];
+		if(sum >= target && sum) return binStart(i+1);
+	}
+	return binStart(size());
+}
+
+void Scheduler::Histogram::print() const {
+	printf("%u values, mean %g ms, std. dev. %g ms, min %g ms, max %g ms\n",
+		mCount, mean()*1e3, stddev()*1e3, mLo*1e3, mHi*1e3);
+	for(int i=0; i<size(); ++i){
+		if(!mCounts[i]) continue;
+		printf("\t[%8.3f, %8.3f) ms %8u ", binStart(i)*1e3, binStart(i+1)*1e3, mCounts[i]);
+		int bar = int(ceil(50. * mCounts[i] / mCount));
+		for(int k=0; k<bar; ++k) printf("#");
+		printf("\n");
+	}
+}
+
+
+// Orders slots soonest first, for a heap; ties go in order of arrival
+struct Scheduler::Later{
+	Later(const std::vector<Slot>& s): slots(s){}
+	bool operator()(int a, int b) const {
+		const Slot& sa = slots[a], & sb = slots[b];
+		if(sa.due != sb.due) return sa.due > sb.due;
+		return int(sa.order - sb.order) > 0;
+	}
+	const std::vector<Slot>& slots;
+};
+
+Scheduler::Scheduler(PacketHandler& handler, int capacity, int maxSize)
+:	mHandler(handler),
+	mSlots(capacity < 1 ? 1 : capacity),
+	mMaxSize((maxSize + 3) & ~3),
+	mFree((mSlots.size()+1) * sizeof(int)),
+	mReady((mSlots.size()+1) * sizeof(int)),
+	mMargin(-0.032, 0.001, 64),
+	mLatency(0), mTime(0), mOrder(0), mExecuted(0), mLate(0)
+{
+	mData.resize(mSlots.size() * mMaxSize);
+	mHeap.reserve(mSlots.size());
+	for(int i=0; i<int(mSlots.size()); ++i){
+		mFree.write((const char *)&i, sizeof(i));
+	}
+}
+
+Scheduler::Stats Scheduler::stats() const {
+	Stats s;
+	s.executed = mExecuted;
+	s.late = mLate;
+	s.dropped = mDropped.load();
+	s.tooLarge = mTooLarge.load();
+	return s;
+}
+
+void Scheduler::onMessageView(MessageView& m){
+	if(m.size() > mMaxSize){
+		mTooLarge.fetchAdd(1);
+		return;
+	}
+	int i;
+	if(mFree.read((char *)&i, sizeof(i)) != sizeof(i)){
+		mDropped.fetchAdd(1);
+		return;
+	}
+	Slot& s = mSlots[i];
+	s.timeTag = m.timeTag();
+	s.arrival = al_time();
+	s.size = m.size();
+	memcpy(&mData[i*mMaxSize], m.data(), m.size());
+	mReady.write((const char *)&i, sizeof(i));
+}
+
+int Scheduler::run(al_sec now, al_sec horizon){
+	mClock.update(now, al_time());
+	const Later later(mSlots);
+
+	// take in the messages that have arrived
+	int i;
+	while(mReady.read((char *)&i, sizeof(i)) == sizeof(i)){
+		Slot& s = mSlots[i];
+		const al_sec arrival = mClock.localTime(s.arrival);
+		s.due = s.timeTag == 1 ? arrival : mClock.localTime(s.timeTag) + mLatency;
+		s.order = mOrder++;
+		mMargin.add(s.due - arrival);
+		if(s.due < arrival) ++mLate;
+		mHeap.push_back(i);
+		std::push_heap(mHeap.begin(), mHeap.end(), later);
+	}
+
+	int n = 0;
+	while(!mHeap.empty()){
+		i = mHeap.front();
+		const Slot& s = mSlots[i];
+		if(s.due > now + horizon) break;
+		std::pop_heap(mHeap.begin(), mHeap.end(), later);
+		mHeap.pop_back();
+
+		mLateness.add(now - s.due);
+		mTime = s.due;
+		MessageView m(&mData[i*mMaxSize], s.size, s.timeTag);
+		mHandler.onMessageView(m);
+		mFree.write((const char *)&i, sizeof(i));
+		++n;
+	}
+	mExecuted += n;
+	return n;
+}
+
+
+
+// Batched send and receive buffers
+#ifdef AL_LINUX
+struct Send::Batch{
+	std::vector<mmsghdr> msgs;
+	std::vector<iovec> iovs;
+};
+
+struct Recv::Batch{
+	Batch(): fd(-1), drops(0){}
+	std::vector<mmsghdr> msgs;
+	std::vector<iovec> iovs;
+	std::vector<char> control;	// ancillary data, for the drop count
+	int fd;						// socket the drop count was enabled on
+	uint32_t drops;				// drop count of the socket
+};
+#else
+struct Send::Batch{};
+struct Recv::Batch{};
+#endif
+
+namespace{
+	inline int toMsec(al_sec t){ return t < 0 ? -1 : int(ceil(t * 1000.)); }
+}
+
+
+Send::Send()
+:	mBatch(new Batch)
+{}
+
 Send::Send(uint16_t port, const char * address, al_sec timeout, int size)
 :	SocketClient(port, address, timeout, Socket::UDP),
-	Packet(size)
+	Packet(size), mBatch(new Batch)
 {}
 
+Send::~Send(){ delete mBatch; }
+
 int Send::send(){
 	//int r = Socket::send(Packet::data(), Packet::size());
 	int r = send(*this);
@@ -359,9 +903,106 @@ int Send::send(){
 int Send::send(const Packet& p){
 	int r = 0;
 	OSCTRY("Packet::endMessage", r = Socket::send(p.data(), p.size());)
+	++mStats.calls;
+	if(r == p.size()){
+		++mStats.packets;
+		mStats.bytes += r;
+	}
+	else ++mStats.dropped;
+	return r;
+}
+
+int Send::queue(const char * data, int size){
+	if(size > 0){
+		// the queue keeps its capacity, so this only allocates as it grows
+		size_t end = mQueue.size();
+		mQueue.resize(end + size);
+		memcpy(&mQueue[end], data, size);
+		mQueueSizes.push_back(size);
+	}
+	return queued();
+}
+
+int Send::queue(){
+	int r = queue(Packet::data(), Packet::size());
+	OSCTRY("Send::queue", Packet::clear();)
 	return r;
 }
 
+int Send::queue(const Packet& p){ return queue(p.data(), p.size()); }
+
+int Send::flush(){
+	const int n = queued();
+	int sent = 0;
+	int i = 0;
+
+	#ifdef AL_LINUX
+	const int fd = Socket::fd();
+	if(fd >= 0 && n){
+		Batch& b = *mBatch;
+		if(int(b.msgs.size()) < n){
+			b.msgs.resize(n);
+			b.iovs.resize(n);
+		}
+		char * p = &mQueue[0];
+		for(int k=0; k<n; ++k){
+			b.iovs[k].iov_base = p;
+			b.iovs[k].iov_len = mQueueSizes[k];
+			memset(&b.msgs[k], 0, sizeof(mmsghdr));
+			b.msgs[k].msg_hdr.msg_iov = &b.iovs[k];
+			b.msgs[k].msg_hdr.msg_iovlen = 1;
+			p += mQueueSizes[k];
+		}
+
+		while(i < n){
+			int r = sendmmsg(fd, &b.msgs[i], n - i, 0);
+			++mStats.calls;
+			if(r < 0){
+				if(errno == EINTR) continue;
+				if((errno == EAGAIN || errno == EWOULDBLOCK) && timeout() != 0){
+					// wait for room in the socket buffer
+					pollfd pfd = { fd, POLLOUT, 0 };
+					if(::poll(&pfd, 1, toMsec(timeout())) > 0) continue;
+					break;
+				}
+				if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+				// as when sending one at a time, skip a packet that fails,
+				// e.g., when a previous one was refused by the receiver
+				++i;
+				++mStats.dropped;
+				continue;
+			}
+			for(int k=i; k<i+r; ++k) mStats.bytes += b.msgs[k].msg_len;
+			mStats.packets += r;
+			sent += r;
+			i += r;
+		}
+	}
+	#endif
+
+	// one at a time
+	if(i == 0){
+		const char * p = n ? &mQueue[0] : NULL;
+		for(; i<n; ++i){
+			int r = 0;
+			OSCTRY("Send::flush", r = Socket::send(p, mQueueSizes[i]);)
+			++mStats.calls;
+			if(r == mQueueSizes[i]){
+				++mStats.packets;
+				mStats.bytes += r;
+				++sent;
+			}
+			else ++mStats.dropped;
+			p += mQueueSizes[i];
+		}
+	}
+
+	mStats.dropped += n - i;
+	mQueue.clear();
+	mQueueSizes.clear();
+	return sent;
+}
+
 
 
 static void * recvThreadFunc(void * user){
@@ -374,7 +1015,8 @@ static void * recvThreadFunc(void * user){
 }
 
 Recv::Recv()
-:	mHandler(0), mBuffer(1024), mBackground(false)
+:	mHandler(0), mBuffer(1024), mBufferSize(1024), mBatchSize(1),
+	mBatch(new Batch), mBackground(false)
 {
   // printf("Entering Recv::Recv()\n");
 }
@@ -382,40 +1024,133 @@ Recv::Recv()
 
 Recv::Recv(uint16_t port, const char * address, al_sec timeout)
 :	SocketServer(port, address, timeout, Socket::UDP),
-	mHandler(0), mBuffer(1024), mBackground(false)
+	mHandler(0), mBuffer(1024), mBufferSize(1024), mBatchSize(1),
+	mBatch(new Batch), mBackground(false)
 {
   // printf("Entering Recv::Recv(port=%d, addr=%s)\n", port, address);
 }
 
-int Recv::recv(){
-	int r;
-#ifdef VERBOSE
-        printf("Entering Recv::recv() - mBuffer = %p and mBuffer.size() = %d\n", &mBuffer[0], mBuffer.size());
-#endif
+Recv::~Recv(){
+	stop();
+	delete mBatch;
+}
 
+void Recv::bufferSize(int n){
+	mBufferSize = n;
+	mBuffer.resize(mBufferSize * mBatchSize);
+}
 
-	/*	printf("Here's what's in my buffer before recv...\n");
-	for (int i = 0; i < mBuffer.size(); ++i) {
-	  if (mBuffer[i] != 0)  printf("Byte %d: %d (%c)\n", i, mBuffer[i], mBuffer[i]);
+void Recv::batchSize(int n){
+	#ifndef AL_LINUX
+	if(n > 1){
+		AL_WARN("osc::Recv: batches are only supported on Linux");
+		n = 1;
 	}
-	*/
+	#endif
+	mBatchSize = n < 1 ? 1 : n;
+	mBuffer.resize(mBufferSize * mBatchSize);
+}
+
+int Recv::recv(){
+	int r = 0;
+
+	#ifdef AL_LINUX
+	if(mBatchSize > 1){
+		OSCTRY("Recv::recv", r = recvBatch();)
+		return r;
+	}
+	#endif
 
 	OSCTRY("Packet::endMessage",
-		r = Socket::recv(&mBuffer[0], mBuffer.size());
+		r = Socket::recv(&mBuffer[0], mBufferSize);
+		if(r){
+			++mStats.calls;
+			++mStats.packets;
+			mStats.bytes += r;
+			mStats.maxBatch = 1;
+		}
 		if(r && mHandler){
-#ifdef VERBOSE
-		  printf("Recv:recv() Received %d bytes; parsing...\n", r);
-#endif
 			mHandler->parse(&mBuffer[0], r);
 		}
 	)
-
-#ifdef VERBOSE
-        printf("Exiting Recv::recv() - mBuffer = %p and mBuffer.size() = %d\n", &mBuffer[0], mBuffer.size());
-#endif
 	return r;
 }
 
+int Recv::recvBatch(){
+	#ifdef AL_LINUX
+	const int fd = Socket::fd();
+	if(fd < 0) return 0;
+	Batch& b = *mBatch;
+	const int n = mBatchSize;
+
+	if(b.fd != fd){
+		// have the drop count passed with each packet
+		#ifdef SO_RXQ_OVFL
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one));
+		#endif
+		b.fd = fd;
+		b.drops = 0;
+	}
+
+	const size_t controlSize = CMSG_SPACE(sizeof(uint32_t));
+	if(int(b.msgs.size()) != n){
+		b.msgs.resize(n);
+		b.iovs.resize(n);
+		b.control.resize(n * controlSize);
+	}
+	for(int i=0; i<n; ++i){
+		b.iovs[i].iov_base = &mBuffer[i * mBufferSize];
+		b.iovs[i].iov_len = mBufferSize;
+		memset(&b.msgs[i], 0, sizeof(mmsghdr));
+		msghdr& h = b.msgs[i].msg_hdr;
+		h.msg_iov = &b.iovs[i];
+		h.msg_iovlen = 1;
+		h.msg_control = &b.control[i * controlSize];
+		h.msg_controllen = controlSize;
+	}
+
+	// a blocking socket waits for the first packet only
+	int r = recvmmsg(fd, &b.msgs[0], n, MSG_WAITFORONE, NULL);
+	if(r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && timeout() > 0){
+		pollfd pfd = { fd, POLLIN, 0 };
+		if(::poll(&pfd, 1, toMsec(timeout())) > 0){
+			r = recvmmsg(fd, &b.msgs[0], n, MSG_WAITFORONE, NULL);
+		}
+	}
+	if(r <= 0) return 0;
+
+	++mStats.calls;
+	if(unsigned(r) > mStats.maxBatch) mStats.maxBatch = r;
+	int bytes = 0;
+	for(int i=0; i<r; ++i){
+		msghdr& h = b.msgs[i].msg_hdr;
+		#ifdef SO_RXQ_OVFL
+		for(cmsghdr * c = CMSG_FIRSTHDR(&h); c; c = CMSG_NXTHDR(&h, c)){
+			if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL){
+				uint32_t drops;
+				memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+				mStats.dropped += drops - b.drops;
+				b.drops = drops;
+			}
+		}
+		#endif
+		const int len = b.msgs[i].msg_len;
+		bytes += len;
+		if(h.msg_flags & MSG_TRUNC){
+			++mStats.truncated;
+			continue;
+		}
+		++mStats.packets;
+		mStats.bytes += len;
+		if(mHandler) mHandler->parse(&mBuffer[i * mBufferSize], len);
+	}
+	return bytes;
+	#else
+	return 0;
+	#endif
+}
+
 bool Recv::start(){
   //  printf("Entering Recv::start()\n");
 	mBackground = true;
@@ -434,5 +1169,207 @@ void Recv::stop(){
 }
 
 
+
+// Waits for packets on many sockets, and for a wake up from stop()
+#if defined(AL_LINUX)
+class RecvGroup::Impl{
+public:
+	Impl()
+	:	mEpoll(epoll_create1(EPOLL_CLOEXEC)),
+		mWake(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+		mEvents(16)
+	{
+		epoll_event e;
+		e.events = EPOLLIN;
+		e.data.ptr = NULL;
+		epoll_ctl(mEpoll, EPOLL_CTL_ADD, mWake, &e);
+	}
+
+	~Impl(){
+		::close(mWake);
+		::close(mEpoll);
+	}
+
+	bool add(Recv& r, int size){
+		epoll_event e;
+		e.events = EPOLLIN;
+		e.data.ptr = &r;
+		if(int(mEvents.size()) < size) mEvents.resize(size);
+		return 0 == epoll_ctl(mEpoll, EPOLL_CTL_ADD, r.fd(), &e);
+	}
+
+	void remove(Recv& r){
+		epoll_event e; // ignored, but must be non-null before Linux 2.6.9
+		epoll_ctl(mEpoll, EPOLL_CTL_DEL, r.fd(), &e);
+	}
+
+	template <class F>
+	void wait(al_sec timeout, F& onReady){
+		int n = epoll_wait(mEpoll, &mEvents[0], mEvents.size(), toMsec(timeout));
+		for(int i=0; i<n; ++i){
+			if(mEvents[i].data.ptr) onReady(*(Recv *)mEvents[i].data.ptr);
+			else{
+				uint64_t v;
+				if(::read(mWake, &v, sizeof(v))){}
+			}
+		}
+	}
+
+	void wake(){
+		uint64_t one = 1;
+		if(::write(mWake, &one, sizeof(one))){}
+	}
+
+private:
+	int mEpoll, mWake;
+	std::vector<epoll_event> mEvents;
+};
+
+#elif !defined(AL_WINDOWS)
+class RecvGroup::Impl{
+public:
+	Impl(){
+		if(::pipe(mWake) == 0){
+			fcntl(mWake[0], F_SETFL, O_NONBLOCK);
+			fcntl(mWake[1], F_SETFL, O_NONBLOCK);
+		}
+		pollfd p = { mWake[0], POLLIN, 0 };
+		mFDs.push_back(p);
+		mRecvs.push_back(NULL);
+	}
+
+	~Impl(){
+		::close(mWake[0]);
+		::close(mWake[1]);
+	}
+
+	bool add(Recv& r, int size){
+		pollfd p = { r.fd(), POLLIN, 0 };
+		mFDs.push_back(p);
+		mRecvs.push_back(&r);
+		return true;
+	}
+
+	void remove(Recv& r){
+		for(unsigned i=1; i<mRecvs.size(); ++i){
+			if(mRecvs[i] == &r){
+				mFDs.erase(mFDs.begin() + i);
+				mRecvs.erase(mRecvs.begin() + i);
+				return;
+			}
+		}
+	}
+
+	template <class F>
+	void wait(al_sec timeout, F& onReady){
+		if(::poll(&mFDs[0], mFDs.size(), toMsec(timeout)) <= 0) return;
+		if(mFDs[0].revents){
+			char buf[64];
+			while(::read(mWake[0], buf, sizeof(buf)) > 0){}
+		}
+		for(unsigned i=1; i<mFDs.size(); ++i){
+			if(mFDs[i].revents & POLLIN) onReady(*mRecvs[i]);
+		}
+	}
+
+	void wake(){
+		char c = 0;
+		if(::write(mWake[1], &c, 1)){}
+	}
+
+private:
+	int mWake[2];
+	std::vector<pollfd> mFDs;
+	std::vector<Recv *> mRecvs;
+};
+
+#else
+// Without poll, each socket is checked in turn
+class RecvGroup::Impl{
+public:
+	bool add(Recv& r, int size){ mRecvs.push_back(&r); return true; }
+
+	void remove(Recv& r){
+		mRecvs.erase(std::remove(mRecvs.begin(), mRecvs.end(), &r), mRecvs.end());
+	}
+
+	template <class F>
+	void wait(al_sec timeout, F& onReady){
+		for(unsigned i=0; i<mRecvs.size(); ++i) onReady(*mRecvs[i]);
+		if(!onReady.bytes && timeout != 0) al_sleep(timeout > 0 && timeout < 0.001 ? timeout : 0.001);
+	}
+
+	void wake(){}
+
+private:
+	std::vector<Recv *> mRecvs;
+};
+#endif
+
+
+namespace{
+	struct RecvReady{
+		RecvReady(): bytes(0){}
+		void operator()(Recv& r){ bytes += r.recv(); }
+		int bytes;
+	};
+}
+
+RecvGroup::RecvGroup()
+:	mImpl(new Impl), mBackground(false)
+{}
+
+RecvGroup::~RecvGroup(){
+	stop();
+	delete mImpl;
+}
+
+bool RecvGroup::add(Recv& r){
+	if(!r.opened() || r.background()) return false;
+	r.timeout(0);
+	if(!mImpl->add(r, mRecvs.size() + 2)) return false;
+	mRecvs.push_back(&r);
+	return true;
+}
+
+void RecvGroup::remove(Recv& r){
+	std::vector<Recv *>::iterator it = std::find(mRecvs.begin(), mRecvs.end(), &r);
+	if(it != mRecvs.end()){
+		mImpl->remove(r);
+		mRecvs.erase(it);
+	}
+}
+
+int RecvGroup::poll(al_sec timeout){
+	// level-triggered, so a socket with more packets than one batch is
+	// ready again on the next call
+	RecvReady ready;
+	mImpl->wait(timeout, ready);
+	return ready.bytes;
+}
+
+void * RecvGroup::threadFunc(void * user){
+	RecvGroup * g = static_cast<RecvGroup *>(user);
+	while(g->background()){
+		g->poll(-1);
+	}
+	return NULL;
+}
+
+bool RecvGroup::start(){
+	if(mBackground) return true;
+	mBackground = true;
+	return mThread.start(threadFunc, this);
+}
+
+void RecvGroup::stop(){
+	if(mBackground){
+		mBackground = false;
+		mImpl->wake();
+		mThread.join();
+	}
+}
+
+
 } // osc::
 } // al::
@@ -3,6 +3,7 @@
 
 #ifdef __cplusplus
 #include "allocore/protocol/al_Serialize.hpp"
+#include "allocore/types/al_Array.hpp"
 
 namespace al{
 
@@ -41,6 +42,192 @@ const std::vector<char>& Deserializer::buf() const { return mBuf; }
 
 char * Deserializer::bufDec(){ return &mBuf[mStart]; }
 
+
+
+namespace ser{
+
+// Serialized type of an Array's components
+static uint8_t arrayType(AlloTy ty){
+	switch(ty){
+		case AlloFloat32Ty:	return SER_FLOAT32;
+		case AlloFloat64Ty:	return SER_FLOAT64;
+		case AlloSInt8Ty:	return SER_INT8;
+		case AlloSInt16Ty:	return SER_INT16;
+		case AlloSInt32Ty:	return SER_INT32;
+		case AlloSInt64Ty:	return SER_INT64;
+		case AlloUInt8Ty:	return SER_UINT8;
+		case AlloUInt16Ty:	return SER_UINT16;
+		case AlloUInt32Ty:	return SER_UINT32;
+		case AlloUInt64Ty:	return SER_UINT64;
+		default:			return 0;
+	}
+}
+
+static void copyElems(void * d, const void * s, uint32_t n, int size){
+	switch(size){
+		case 1: serCopy1(d,s,n); break;
+		case 2: serCopy2(d,s,n); break;
+		case 4: serCopy4(d,s,n); break;
+		case 8: serCopy8(d,s,n); break;
+		default:;
+	}
+}
+
+// Copies the rows of an Array to or from packed data
+static void copyRows(const Array& a, char * packed, bool toArray){
+	const int size = allo_type_size(a.type());
+	const uint32_t rowElems = a.components() * a.dim(0);
+	const uint32_t rowBytes = rowElems * size;
+	uint32_t rows = 1;
+	for(int i=1; i<a.dimcount(); ++i) rows *= a.dim(i);
+
+	// rows already packed are copied at once
+	if(a.dimcount() < 2 || a.stride(1) == rowBytes){
+		if(toArray)	copyElems(a.data.ptr, packed, rowElems*rows, size);
+		else		copyElems(packed, a.data.ptr, rowElems*rows, size);
+		return;
+	}
+
+	for(uint32_t r=0; r<rows; ++r){
+		uint32_t idx = r, offset = 0;
+		for(int i=1; i<a.dimcount(); ++i){
+			offset += (idx % a.dim(i)) * a.stride(i);
+			idx /= a.dim(i);
+		}
+		char * row = a.data.ptr + offset;
+		if(toArray)	copyElems(row, packed, rowElems, size);
+		else		copyElems(packed, row, rowElems, size);
+		packed += rowBytes;
+	}
+}
+
+
+Writer::Writer(char * buf, uint32_t capacity)
+:	mBuf(buf), mCap(capacity), mPos(0), mVec(0), mFail(false)
+{}
+
+Writer::Writer(std::vector<char>& buf)
+:	mBuf(buf.empty() ? 0 : &buf[0]), mCap(buf.size()), mPos(0), mVec(&buf), mFail(false)
+{}
+
+Writer& Writer::operator<< (const char * v){
+	return add(v, strlen(v)+1);
+}
+
+Writer& Writer::operator<< (const std::string& v){
+	return add(v.c_str(), v.size()+1);
+}
+
+Writer& Writer::operator<< (const Array& a){
+	// the format, then the cells without padding
+	uint32_t meta[2 + ALLO_ARRAY_MAX_DIMS];
+	const int dims = a.dimcount() < ALLO_ARRAY_MAX_DIMS ? a.dimcount() : ALLO_ARRAY_MAX_DIMS;
+	meta[0] = a.components();
+	meta[1] = a.type();
+	for(int i=0; i<dims; ++i) meta[2+i] = a.dim(i);
+	add(meta, 2 + dims);
+
+	const uint8_t ty = arrayType(a.type());
+	if(!ty){ mFail = true; return *this; }
+	const uint32_t num = a.hasData() && dims ? a.cells() * a.components() : 0;
+	char * d = header(ty, num, num * allo_type_size(a.type()));
+	if(d && num) copyRows(a, d, false);
+	return *this;
+}
+
+char * Writer::alloc(uint32_t bytes){
+	if(mFail) return 0;
+	if(mPos + bytes > mCap){
+		if(!mVec){ mFail = true; return 0; }
+		uint32_t cap = mCap*2;
+		if(cap < mPos + bytes) cap = mPos + bytes;
+		mVec->resize(cap);
+		mBuf = &(*mVec)[0];
+		mCap = cap;
+	}
+	char * p = mBuf + mPos;
+	mPos += bytes;
+	return p;
+}
+
+char * Writer::header(uint8_t type, uint32_t num, uint32_t bytes){
+	char * p = alloc(SER_HEADER_SIZE + bytes);
+	if(!p) return 0;
+	serHeaderWrite(p, type, num);
+	return p + SER_HEADER_SIZE;
+}
+
+
+
+Reader::Reader(const char * buf, uint32_t size)
+:	mBuf(buf), mSize(size), mPos(0), mFail(false)
+{}
+
+Reader::Reader(const std::vector<char>& buf)
+:	mBuf(buf.empty() ? 0 : &buf[0]), mSize(buf.size()), mPos(0), mFail(false)
+{}
+
+Reader& Reader::operator>> (std::string& v){
+	uint32_t num;
+	const char * d = good() ? header(SER_INT8, num, 1) : 0;
+	if(!d){ fail(); return *this; }
+	v.assign(d, (num && !d[num-1]) ? num-1 : num);
+	return *this;
+}
+
+Reader& Reader::operator>> (Array& a){
+	if(!good()) return *this;
+	const uint32_t start = mPos;
+	View<uint32_t> meta = view<uint32_t>();
+	const uint32_t dims = meta.size() - 2;
+	if(meta.size() < 3 || dims > ALLO_ARRAY_MAX_DIMS){ mPos = start; fail(); return *this; }
+
+	AlloArrayHeader h;
+	h.components = meta[0];
+	h.type = meta[1];
+	h.dimcount = dims;
+	uint32_t num = h.components;
+	for(uint32_t i=0; i<ALLO_ARRAY_MAX_DIMS; ++i){
+		h.dim[i] = i < dims ? meta[2+i] : 0;
+		if(i < dims) num *= h.dim[i];
+	}
+
+	uint32_t n;
+	const uint8_t ty = arrayType(h.type);
+	const char * d = ty ? header(ty, n, allo_type_size(h.type)) : 0;
+	if(!d || n != num){ mPos = start; fail(); return *this; }
+
+	allo_array_setstride(&h, AL_ARRAY_DEFAULT_ALIGNMENT);
+	a.format(h);
+	if(num) copyRows(a, const_cast<char *>(d), true);
+	return *this;
+}
+
+Reader& Reader::skip(){
+	uint32_t num;
+	const uint8_t type = peekType();
+	if(!type || !good()){ fail(); return *this; }
+	if(SER_SUB == type){
+		// a sub-structure, its signature and its packed bytes
+		if(!header(SER_SUB, num, 0)) fail();
+		else skip().skip();
+	}
+	else if(!header(type, num, serTypeSize(type))) fail();
+	return *this;
+}
+
+const char * Reader::header(uint8_t type, uint32_t& num, uint32_t elemSize){
+	if(remaining() < SER_HEADER_SIZE || uint8_t(mBuf[mPos]) != type) return 0;
+	num = serGetHeader(mBuf + mPos).num;
+	const uint64_t bytes = uint64_t(num) * elemSize;
+	if(bytes > remaining() - SER_HEADER_SIZE) return 0;
+	const char * d = mBuf + mPos + SER_HEADER_SIZE;
+	mPos += SER_HEADER_SIZE + uint32_t(bytes);
+	return d;
+}
+
+} // ser::
+
 } // al::
 #endif
 
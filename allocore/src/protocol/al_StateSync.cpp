@@ -0,0 +1,477 @@
+#include <string.h>
+#include <algorithm>
+#include "allocore/system/al_Config.h"
+#include "allocore/system/al_Printing.hpp"
+#include "allocore/system/al_Time.hpp"
+#include "allocore/protocol/al_StateSync.hpp"
+
+#ifndef AL_WINDOWS
+	#include <sys/socket.h>
+#endif
+
+/*
+Frame datagram (little-endian):
+
+	magic			2 bytes		0xA15C
+	version			1 byte
+	type			1 byte		KEY or DELTA
+	frame			4 bytes		frame number, from 1
+	key				4 bytes		frame number of keyframe a delta is against
+	index			2 bytes		fragment index
+	count			2 bytes		number of fragments
+	size			4 bytes		size of encoded frame
+	state size		4 bytes
+	offset			4 bytes		offset of fragment in encoded frame
+	fragment		size of datagram - 28 bytes
+
+Feedback datagram (little-endian):
+
+	magic			2 bytes
+	version			1 byte
+	type			1 byte		ACK or KEY_REQUEST
+	receiver		4 bytes		random receiver id
+	key				4 bytes		frame number of receiver's newest keyframe
+*/
+
+namespace al{
+
+namespace{
+
+enum{
+	MAGIC = 0xA15C,
+	VERSION = 1,
+	HEADER_SIZE = 28,
+	FEEDBACK_SIZE = 12
+};
+
+enum{ KEY=0, DELTA, ACK, KEY_REQUEST };
+
+// Frames between keyframe requests from a receiver
+const uint32_t REQUEST_INTERVAL = 8;
+
+// Consecutive datagrams of old frames after which a receiver starts over
+const unsigned STALE_LIMIT = 256;
+
+inline void put16(char * p, uint32_t v){
+	p[0] = char(v); p[1] = char(v>>8);
+}
+inline void put32(char * p, uint32_t v){
+	p[0] = char(v); p[1] = char(v>>8); p[2] = char(v>>16); p[3] = char(v>>24);
+}
+inline uint32_t get16(const char * p){
+	const unsigned char * u = (const unsigned char *)p;
+	return u[0] | (u[1]<<8);
+}
+inline uint32_t get32(const char * p){
+	const unsigned char * u = (const unsigned char *)p;
+	return u[0] | (u[1]<<8) | (u[2]<<16) | (uint32_t(u[3])<<24);
+}
+
+// Whether frame number a is after b, allowing for wrap around
+inline bool after(uint32_t a, uint32_t b){ return int32_t(a - b) > 0; }
+
+inline unsigned putVarint(char * p, uint32_t v){
+	unsigned n = 0;
+	while(v >= 0x80){ p[n++] = char(v | 0x80); v >>= 7; }
+	p[n++] = char(v);
+	return n;
+}
+
+inline bool getVarint(const char *& p, const char * end, uint32_t& v){
+	v = 0;
+	for(unsigned shift=0; shift<35; shift+=7){
+		if(p >= end) return false;
+		const unsigned char c = *p++;
+		v |= uint32_t(c & 0x7f) << shift;
+		if(!(c & 0x80)) return true;
+	}
+	return false;
+}
+
+// Number of leading bytes that are equal, compared 8 at a time
+unsigned equalRun(const char * a, const char * b, unsigned n){
+	unsigned i = 0;
+	for(; i+8 <= n; i+=8){
+		uint64_t x, y;
+		memcpy(&x, a+i, 8);
+		memcpy(&y, b+i, 8);
+		if(x != y) break;
+	}
+	while(i < n && a[i] == b[i]) ++i;
+	return i;
+}
+
+void setBufferSize(int fd, int option, int size){
+	#ifndef AL_WINDOWS
+	if(fd >= 0) setsockopt(fd, SOL_SOCKET, option, &size, sizeof(size));
+	#endif
+}
+
+} // ::
+
+
+unsigned StateDelta::encode(std::vector<char>& dst, const char * state, const char * key, unsigned size){
+	// each pair costs at most 10 bytes besides its differing bytes
+	if(dst.size() < size + 10) dst.resize(size + 10);
+	char * out = &dst[0];
+	unsigned n = 0;
+	unsigned i = 0;
+	while(i < size){
+		const unsigned same = equalRun(state+i, key+i, size-i);
+		const unsigned start = i + same;
+		if(start == size) break;
+
+		// extend the differing run over equal runs too short to pay for a pair
+		unsigned j = start;
+		while(j < size){
+			if(state[j] != key[j]){ ++j; continue; }
+			const unsigned r = equalRun(state+j, key+j, size-j);
+			if(r >= 8 || j+r == size) break;
+			j += r;
+		}
+
+		const unsigned diff = j - start;
+		if(n + 10 + diff >= size) return 0;
+		n += putVarint(out+n, same);
+		n += putVarint(out+n, diff);
+		memcpy(out+n, state+start, diff);
+		n += diff;
+		i = j;
+	}
+	// identical states
+	if(!n){ out[0] = 0; out[1] = 0; n = 2; }
+	return n < size ? n : 0;
+}
+
+bool StateDelta::decode(char * state, const char * key, unsigned size, const char * delta, unsigned deltaSize){
+	memcpy(state, key, size);
+	const char * p = delta;
+	const char * end = delta + deltaSize;
+	unsigned i = 0;
+	while(p < end){
+		uint32_t same, diff;
+		if(!getVarint(p, end, same) || !getVarint(p, end, diff)) return false;
+		if(uint64_t(i) + same + diff > size || diff > unsigned(end - p)) return false;
+		i += same;
+		memcpy(state+i, p, diff);
+		p += diff;
+		i += diff;
+	}
+	return true;
+}
+
+
+
+bool StateSender::Client::onOpen(){
+	#ifndef AL_WINDOWS
+	// needed to connect to a broadcast address
+	int one = 1;
+	if(fd() >= 0) setsockopt(fd(), SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+	#endif
+	setBufferSize(fd(), SO_SNDBUF, 1<<22);
+	return connect();
+}
+
+StateSender::StateSender(
+	unsigned stateSize, uint16_t port, const char * address,
+	uint16_t feedbackPort, unsigned packetSize
+)
+:	mStateSize(stateSize), mPacketSize(packetSize),
+	mKeyInterval(300), mReceiverTimeout(60),
+	mFrame(0), mNewest(0), mRef(0), mDeltas(0), mDeltaBytes(0),
+	mKeyRequested(false)
+{
+	// the fragment count must fit in 16 bits
+	const unsigned minPacket = HEADER_SIZE + stateSize/0xffff + 1;
+	if(mPacketSize < minPacket) mPacketSize = minPacket;
+
+	if(!mSocket.open(port, address, -1, Socket::UDP|Socket::DGRAM)){
+		AL_WARN("StateSender: could not send to %s:%d", address, port);
+	}
+	if(feedbackPort && !mFeedback.open(feedbackPort, "", 0, Socket::UDP|Socket::DGRAM)){
+		AL_WARN("StateSender: could not listen for feedback on port %d", feedbackPort);
+	}
+
+	for(int i=0; i<2; ++i){
+		mKeys[i].resize(stateSize);
+		mKeyFrames[i] = 0;
+	}
+	mPacket.resize(mPacketSize);
+}
+
+void StateSender::readFeedback(){
+	if(mFeedback.opened()){
+		char buf[64];
+		size_t n;
+		while((n = mFeedback.recv(buf, sizeof(buf))) > 0){
+			if(n < FEEDBACK_SIZE || get16(buf) != MAGIC || buf[2] != VERSION) continue;
+			const int type = buf[3];
+			const uint32_t id = get32(buf+4);
+			const uint32_t key = get32(buf+8);
+
+			unsigned i = 0;
+			while(i < mReceivers.size() && mReceivers[i].id != id) ++i;
+			if(i == mReceivers.size()){
+				Receiver r = { id, key, mFrame };
+				mReceivers.push_back(r);
+			}
+			Receiver& r = mReceivers[i];
+			r.seen = mFrame;
+			if(after(key, r.key)) r.key = key;
+
+			// a receiver with the newest keyframe only needs deltas to use it
+			if(type == KEY_REQUEST && key != mKeyFrames[mNewest]) mKeyRequested = true;
+		}
+	}
+
+	// forget silent receivers
+	for(unsigned i=0; i<mReceivers.size(); ){
+		if(mFrame - mReceivers[i].seen > mReceiverTimeout){
+			mReceivers[i] = mReceivers.back();
+			mReceivers.pop_back();
+		}
+		else ++i;
+	}
+	mStats.receivers = mReceivers.size();
+}
+
+unsigned StateSender::send(const void * state){
+	const char * s = (const char *)state;
+	++mFrame;
+	readFeedback();
+
+	bool key = !mKeyFrames[mNewest] || mKeyRequested
+		|| (mKeyInterval && mFrame - mKeyFrames[mNewest] >= mKeyInterval);
+
+	unsigned n = 0;
+	if(!key){
+		// use the newest keyframe once every receiver has it
+		if(mRef != mNewest){
+			bool all = true;
+			for(unsigned i=0; i<mReceivers.size(); ++i){
+				if(after(mKeyFrames[mNewest], mReceivers[i].key)){ all = false; break; }
+			}
+			if(all) mRef = mNewest;
+		}
+		n = StateDelta::encode(mEncoded, s, &mKeys[mRef][0], mStateSize);
+
+		// As changes accumulate, deltas grow. A keyframe costs less over
+		// time once a delta is larger than the mean bytes per frame since
+		// the last keyframe.
+		key = (0 == n)
+			|| uint64_t(n) * (mDeltas + 1) > uint64_t(mStateSize) + mDeltaBytes;
+	}
+
+	mStats.frameBytes = 0;
+	if(key){
+		// replace the keyframe not in use
+		if(mNewest == mRef) mNewest = 1 - mRef;
+		memcpy(&mKeys[mNewest][0], s, mStateSize);
+		mKeyFrames[mNewest] = mFrame;
+		if(mReceivers.empty()) mRef = mNewest;
+		mKeyRequested = false;
+		mDeltas = 0;
+		mDeltaBytes = 0;
+		sendFrame(KEY, mFrame, s, mStateSize);
+		++mStats.keyframes;
+	}
+	else{
+		++mDeltas;
+		mDeltaBytes += n;
+		sendFrame(DELTA, mKeyFrames[mRef], &mEncoded[0], n);
+	}
+	++mStats.frames;
+	return mFrame;
+}
+
+void StateSender::sendFrame(int type, uint32_t key, const char * data, unsigned size){
+	const unsigned payload = mPacketSize - HEADER_SIZE;
+	const unsigned count = size ? (size + payload-1) / payload : 1;
+	char * p = &mPacket[0];
+	put16(p, MAGIC);
+	p[2] = VERSION;
+	p[3] = char(type);
+	put32(p+4, mFrame);
+	put32(p+8, key);
+	put16(p+14, count);
+	put32(p+16, size);
+	put32(p+20, mStateSize);
+
+	for(unsigned i=0; i<count; ++i){
+		const unsigned offset = i*payload;
+		const unsigned len = std::min(payload, size - offset);
+		put16(p+12, i);
+		put32(p+24, offset);
+		memcpy(p+HEADER_SIZE, data+offset, len);
+		const size_t sent = mSocket.send(p, HEADER_SIZE + len);
+		if(sent){
+			++mStats.packets;
+			mStats.bytes += sent;
+			mStats.frameBytes += sent;
+		}
+	}
+}
+
+
+
+StateReceiver::StateReceiver(
+	unsigned stateSize, uint16_t port,
+	const char * senderAddress, uint16_t feedbackPort
+)
+:	mStateSize(stateSize), mRefKey(-1),
+	mAsmFrame(0), mAsmKey(0), mAsmSize(0), mAsmCount(0), mAsmReceived(0),
+	mAsmType(KEY), mAssembling(false),
+	mFrame(0), mLastSeen(0), mRequestFrame(0), mStale(0),
+	mValid(false), mSeen(false), mRequested(false)
+{
+	if(!mSocket.open(port, "", 0, Socket::UDP|Socket::DGRAM)){
+		AL_WARN("StateReceiver: could not listen on port %d", port);
+	}
+	// a keyframe arrives as a burst of datagrams
+	#ifdef AL_LINUX
+	setBufferSize(mSocket.fd(), SO_RCVBUFFORCE, 1<<24);
+	#endif
+	setBufferSize(mSocket.fd(), SO_RCVBUF, 1<<24);
+
+	if(feedbackPort && !mFeedback.open(feedbackPort, senderAddress, 0, Socket::UDP|Socket::DGRAM)){
+		AL_WARN("StateReceiver: could not send feedback to %s:%d", senderAddress, feedbackPort);
+	}
+
+	// distinguishes receivers on the same host
+	mId = uint32_t(al_time_nsec()) ^ uint32_t(size_t(this)) ^ (uint32_t(port) << 16);
+
+	mState.resize(stateSize);
+	mAssembly.resize(stateSize);
+	for(int i=0; i<2; ++i) mKeys[i].state.resize(stateSize);
+	mPacket.resize(1<<16);
+}
+
+bool StateReceiver::poll(al_sec timeout){
+	if(!mSocket.opened()) return false;
+	bool decoded = false;
+	size_t n;
+	if(timeout != 0){
+		mSocket.timeout(timeout);
+		n = mSocket.recv(&mPacket[0], mPacket.size());
+		mSocket.timeout(0);
+		if(!n) return false;
+		decoded |= receive(&mPacket[0], n);
+	}
+	while((n = mSocket.recv(&mPacket[0], mPacket.size())) > 0){
+		decoded |= receive(&mPacket[0], n);
+	}
+	return decoded;
+}
+
+bool StateReceiver::receive(const char * p, unsigned size){
+	++mStats.packets;
+	mStats.bytes += size;
+
+	if(size < HEADER_SIZE || get16(p) != MAGIC || p[2] != VERSION) return false;
+	const int type = p[3];
+	const uint32_t frame = get32(p+4);
+	const uint32_t key = get32(p+8);
+	const unsigned index = get16(p+12);
+	const unsigned count = get16(p+14);
+	const unsigned encSize = get32(p+16);
+	const unsigned offset = get32(p+24);
+	const unsigned len = size - HEADER_SIZE;
+	if(get32(p+20) != mStateSize || (type != KEY && type != DELTA)
+		|| index >= count || encSize > mStateSize
+		|| offset > encSize || len > encSize - offset
+	) return false;
+
+	// a restarted sender numbers frames from the start again
+	if(mSeen && after(mLastSeen, frame) && ++mStale > STALE_LIMIT) mSeen = false;
+
+	if(!mSeen || after(frame, mLastSeen)){
+		mStale = 0;
+		if(mSeen) mStats.lost += frame - mLastSeen - 1;
+		if(mAssembling) ++mStats.incomplete;
+		mSeen = true;
+		mLastSeen = frame;
+		mAssembling = true;
+		mAsmFrame = frame;
+		mAsmKey = key;
+		mAsmType = type;
+		mAsmSize = encSize;
+		mAsmCount = count;
+		mAsmReceived = 0;
+		mHave.assign(count, false);
+	}
+	// fragment of a frame that was completed or dropped
+	else if(!mAssembling || frame != mAsmFrame) return false;
+	// fragment that does not belong to the frame being assembled, such as
+	// one from another sender or a corrupt one
+	else if(count != mAsmCount || encSize != mAsmSize
+		|| type != mAsmType || key != mAsmKey
+	) return false;
+
+	if(mHave[index]) return false;
+	mHave[index] = true;
+	memcpy(&mAssembly[offset], p+HEADER_SIZE, len);
+	if(++mAsmReceived < mAsmCount) return false;
+
+	mAssembling = false;
+	return decode();
+}
+
+bool StateReceiver::decode(){
+	if(mAsmType == KEY){
+		if(mAsmSize != mStateSize) return false;
+		// replace the keyframe not in use
+		const int slot = mRefKey < 0 ? 1 - newestKey() : 1 - mRefKey;
+		Key& k = mKeys[slot];
+		k.state.swap(mAssembly);
+		k.frame = mAsmFrame;
+		k.valid = true;
+		memcpy(&mState[0], &k.state[0], mStateSize);
+		++mStats.keyframes;
+	}
+	else{
+		int slot = -1;
+		for(int i=0; i<2; ++i){
+			if(mKeys[i].valid && mKeys[i].frame == mAsmKey) slot = i;
+		}
+		if(slot < 0){
+			++mStats.missingKey;
+			if(!mRequested || mAsmFrame - mRequestFrame >= REQUEST_INTERVAL){
+				mRequested = true;
+				mRequestFrame = mAsmFrame;
+				++mStats.keyRequests;
+				feedback(KEY_REQUEST, mKeys[newestKey()].frame);
+			}
+			return false;
+		}
+		if(!StateDelta::decode(&mState[0], &mKeys[slot].state[0], mStateSize, &mAssembly[0], mAsmSize)){
+			return false;
+		}
+		mRefKey = slot;
+	}
+
+	mFrame = mAsmFrame;
+	mValid = true;
+	++mStats.frames;
+
+	feedback(ACK, mKeys[newestKey()].frame);
+	return true;
+}
+
+int StateReceiver::newestKey() const {
+	if(!mKeys[1].valid) return 0;
+	if(!mKeys[0].valid) return 1;
+	return after(mKeys[1].frame, mKeys[0].frame) ? 1 : 0;
+}
+
+void StateReceiver::feedback(int type, uint32_t key){
+	if(!mFeedback.opened()) return;
+	char buf[FEEDBACK_SIZE];
+	put16(buf, MAGIC);
+	buf[2] = VERSION;
+	buf[3] = char(type);
+	put32(buf+4, mId);
+	put32(buf+8, key);
+	mFeedback.send(buf, sizeof(buf));
+}
+
+} // al::
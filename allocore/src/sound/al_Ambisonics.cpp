@@ -1,5 +1,13 @@
 #include <string.h>
+#include <vector>
 #include "allocore/sound/al_Ambisonics.hpp"
+#include "allocore/sound/al_Vbap.hpp"
+#include "allocore/system/al_Printing.hpp"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#include <xmmintrin.h>
+	#define AMBI_USE_SSE
+#endif
 
 #ifdef USE_GAMMA
 	#include "scl.h"
@@ -40,8 +48,8 @@ static const double c40_11		= 40./11.;
 
 // AmbiBase
 
-AmbiBase::AmbiBase(int dim, int order)
-:	mDim(dim), mOrder(0), mWeights(0)
+AmbiBase::AmbiBase(int dim, int order, Format format)
+:	mDim(dim), mOrder(-1), mChannels(0), mFormat(format), mWeights(0)
 {	this->order(order); }
 
 AmbiBase::~AmbiBase(){
@@ -49,6 +57,9 @@ AmbiBase::~AmbiBase(){
 }
 
 void AmbiBase::order(int o){
+	int maxO = FUMA == mFormat ? 3 : maxOrder;
+	if(o > maxO) o = maxO;
+	if(o < 0) o = 0;
 	if(o != mOrder){
 		mOrder = o;
 		mChannels = orderToChannels(mDim, mOrder);
@@ -111,6 +122,69 @@ void AmbiBase::encodeWeightsFuMa(float * ws, int dim, int order, float x, float
 }
 
 
+// Real spherical harmonics in ACN order with SN3D or N3D normalization
+static void encodeWeightsACN(float * ws, int dim, int order, double x, double y, double z, bool n3d){
+	// The azimuthal part cos^m(E) e^(imA) is (x + iy)^m, leaving the
+	// associated Legendre function divided by cos^m(E) as a polynomial in z.
+	double cm = 1, sm = 0;	// real and imaginary parts of (x + iy)^m
+	double pmm = 1;			// P_m^m / cos^m(E) = (2m-1)!!
+	double ratio = 1;		// (l-m)! / (l+m)! for l = m
+
+	for(int m=0; m<=order; ++m){
+		if(m > 0){
+			double c = cm*x - sm*y;
+			sm = cm*y + sm*x;
+			cm = c;
+			pmm *= 2*m - 1;
+			ratio /= (2*m - 1) * (2*m);
+		}
+
+		double p = pmm, pPrev = 0, r = ratio;
+		int lmax = 3 == dim ? order : m;
+
+		for(int l=m; l<=lmax; ++l){
+			if(l > m){
+				double pNext = ((2*l - 1) * z * p - (l + m - 1) * pPrev) / (l - m);
+				pPrev = p;
+				p = pNext;
+				r *= double(l - m) / (l + m);
+			}
+
+			double norm = sqrt((m ? 2 : 1) * r);
+			if(n3d) norm *= sqrt(2.*l + 1);
+
+			if(3 == dim){
+				ws[l*l + l + m] = norm * p * cm;
+				if(m) ws[l*l + l - m] = norm * p * sm;
+			}
+			else if(m){
+				ws[2*m    ] = norm * p * cm;
+				ws[2*m - 1] = norm * p * sm;
+			}
+			else{
+				ws[0] = norm * p;
+			}
+		}
+	}
+}
+
+void AmbiBase::encodeWeightsSN3D(float * ws, int dim, int order, float x, float y, float z){
+	encodeWeightsACN(ws, dim, order, x,y,z, false);
+}
+
+void AmbiBase::encodeWeightsN3D(float * ws, int dim, int order, float x, float y, float z){
+	encodeWeightsACN(ws, dim, order, x,y,z, true);
+}
+
+void AmbiBase::encodeWeights(float * ws, Format format, int dim, int order, float x, float y, float z){
+	switch(format){
+	case ACN_SN3D:	encodeWeightsACN(ws, dim, order, x,y,z, false); break;
+	case ACN_N3D:	encodeWeightsACN(ws, dim, order, x,y,z, true); break;
+	default:		encodeWeightsFuMa(ws, dim, order, x,y,z);
+	}
+}
+
+
 void AmbiBase::encodeWeightsFuMa(float * ws, int dim, int order, float az, float el){
 	WRAP(az);
 	WRAP(el);
@@ -190,9 +264,9 @@ float AmbiDecode::flavorWeights[4][5][5] = {
 	}
 };
 
-AmbiDecode::AmbiDecode(int dim, int order, int numSpeakers, int flav)
-	: AmbiBase(dim, order),
-	mNumSpeakers(0), mDecodeMatrix(0), mSpeakers(NULL)
+AmbiDecode::AmbiDecode(int dim, int order, int numSpeakers, int flav, Format format)
+	: AmbiBase(dim, order, format),
+	mNumSpeakers(0), mMethod(PROJECTION), mDecodeMatrix(0), mSpeakers(NULL)
 {
 	resizeArrays(channels(), numSpeakers);
 	flavor(flav);
@@ -203,6 +277,26 @@ AmbiDecode::~AmbiDecode(){
 	//delete[] mSpeakers; // listener now owns speakers and will delete them
 }
 
+// out += in0*w0 + in1*w1 + in2*w2 + in3*w3
+static void addWeighted4(
+	float * out, const float * in0, const float * in1, const float * in2, const float * in3,
+	float w0, float w1, float w2, float w3, int n
+){
+	int i=0;
+	#ifdef AMBI_USE_SSE
+	__m128 v0 = _mm_set1_ps(w0), v1 = _mm_set1_ps(w1);
+	__m128 v2 = _mm_set1_ps(w2), v3 = _mm_set1_ps(w3);
+	for(; i+4<=n; i+=4){
+		__m128 a = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in0+i), v0), _mm_mul_ps(_mm_loadu_ps(in1+i), v1));
+		__m128 b = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in2+i), v2), _mm_mul_ps(_mm_loadu_ps(in3+i), v3));
+		_mm_storeu_ps(out+i, _mm_add_ps(_mm_loadu_ps(out+i), _mm_add_ps(a, b)));
+	}
+	#endif
+	for(; i<n; ++i){
+		out[i] += (in0[i]*w0 + in1[i]*w1) + (in2[i]*w2 + in3[i]*w3);
+	}
+}
+
 void AmbiDecode::decode(float * dec, const float * ambi, int numDecFrames) const {
 
 	// iterate speakers
@@ -211,8 +305,18 @@ void AmbiDecode::decode(float * dec, const float * ambi, int numDecFrames) const
 		if ((*mSpeakers)[s].gain != 0.) {
 			float * out = dec + (*mSpeakers)[s].deviceChannel * numDecFrames;
 
-			// iterate ambi channels
-			for(int c=0; c<channels(); ++c){
+			// iterate ambi channels, four at a time so that each output
+			// sample is loaded and stored once per four channels
+			int c=0;
+			for(; c+4<=channels(); c+=4){
+				const float * in = ambi + c * numDecFrames;
+				addWeighted4(out,
+					in, in + numDecFrames, in + 2*numDecFrames, in + 3*numDecFrames,
+					decodeWeight(s, c), decodeWeight(s, c+1), decodeWeight(s, c+2), decodeWeight(s, c+3),
+					numDecFrames
+				);
+			}
+			for(; c<channels(); ++c){
 				const float * in = ambi + c * numDecFrames;
 				float w = decodeWeight(s, c);
 				for(int i=0; i<numDecFrames; ++i) out[i] += in[i] * w;
@@ -222,15 +326,158 @@ void AmbiDecode::decode(float * dec, const float * ambi, int numDecFrames) const
 }
 
 
+// Legendre polynomial P_n(x); also returns P_{n-1}(x)
+static double legendre(int n, double x, double * pPrev=NULL){
+	double p = 1, p1 = 0;
+	for(int k=1; k<=n; ++k){
+		double pk = ((2*k - 1) * x * p - (k - 1) * p1) / k;
+		p1 = p;
+		p = pk;
+	}
+	if(pPrev) *pPrev = p1;
+	return p;
+}
+
+// Compute weights of each order for basic, in-phase and max-rE decoding
+static void orderWeights(float * w, int flavor, int dim, int order){
+	for(int l=0; l<=order; ++l){
+		double g = 1;
+		switch(flavor){
+		case 2: // in-phase
+			if(3 == dim){	// N!(N+1)! / ((N+l+1)!(N-l)!)
+				for(int k=order-l+1; k<=order; ++k) g *= k;
+				for(int k=order+2; k<=order+l+1; ++k) g /= k;
+			}
+			else{			// N!N! / ((N+l)!(N-l)!)
+				for(int k=order-l+1; k<=order; ++k) g *= k;
+				for(int k=order+1; k<=order+l; ++k) g /= k;
+			}
+			break;
+		case 1: // max-rE
+		case 3:
+			if(3 == dim){
+				// P_l(rE) where rE is the largest root of P_{N+1}
+				int n = order + 1;
+				double x = cos(M_PI * 0.75 / (n + 0.5));
+				for(int it=0; it<8; ++it){
+					double pPrev;
+					double p = legendre(n, x, &pPrev);
+					double dp = n * (x*p - pPrev) / (x*x - 1);
+					x -= p / dp;
+				}
+				g = legendre(l, x);
+			}
+			else{
+				g = cos(l * M_PI / (2*order + 2));
+			}
+			break;
+		default:;
+		}
+		w[l] = g;
+	}
+}
+
 void AmbiDecode::flavor(int type){
 	if(type < 4){
 		mFlavor = type;
-		const int No = sizeof(mWOrder)/sizeof(mWOrder[0]);
-		for(int i=0; i<No; ++i) mWOrder[i] = flavorWeights[flavor()][i][order()];
+		if(FUMA == mFormat){
+			for(int i=0; i<5; ++i) mWOrder[i] = flavorWeights[flavor()][i][order()];
+		}
+		else{
+			orderWeights(mWOrder, flavor(), mDim, order());
+		}
 		updateChanWeights();
 	}
 }
 
+void AmbiDecode::method(Method m){
+	if(ALLRAD == m && (3 != mDim || FUMA == mFormat)){
+		AL_WARN("AllRAD requires a 3D ACN format, using projection instead");
+		m = PROJECTION;
+	}
+	if(m == mMethod) return;
+	mMethod = m;
+
+	if(ALLRAD == mMethod){
+		updateAllRAD();
+	}
+	else{
+		for(int i=0; i<numSpeakers(); ++i){
+			Speaker spkr = (*mSpeakers)[i];
+			setSpeakerRadians(i, spkr.deviceChannel, spkr.azimuth, spkr.elevation, spkr.gain);
+		}
+	}
+}
+
+void AmbiDecode::updateAllRAD(){
+	const int numChans = channels();
+	const double toDeg = 180. / M_PI;
+
+	// Speaker::vec() maps the directions of speakers and virtual speakers in
+	// the same way, so VBAP is unaffected by its convention.
+	SpeakerLayout layout;
+	for(int i=0; i<numSpeakers(); ++i){
+		const Speaker& spkr = (*mSpeakers)[i];
+		layout.addSpeaker(Speaker(i, spkr.azimuth * toDeg, spkr.elevation * toDeg));
+	}
+	Vbap vbap(layout);
+	vbap.findSpeakerTripletsHull(layout.speakers());
+
+	memset(mDecodeMatrix, 0, sizeof(float) * numChans * numSpeakers());
+
+	// Sampling decoder of virtual speakers on a spherical Fibonacci lattice
+	const int numVirtual = 20 * numChans;
+	const double goldenAngle = M_PI * (3. - sqrt(5.));
+	std::vector<float> ws(numChans);
+	std::vector<Vec3f> dirs(numVirtual);
+
+	for(int v=0; v<numVirtual; ++v){
+		double z = 1. - (2.*v + 1.) / numVirtual;
+		double r = sqrt(1. - z*z);
+		double x = r * cos(v * goldenAngle);
+		double y = r * sin(v * goldenAngle);
+		dirs[v].set(x,y,z);
+
+		// N3D harmonics are orthonormal; SN3D inputs are scaled back to N3D
+		encodeWeightsN3D(&ws[0], 3, mOrder, x,y,z);
+		if(ACN_SN3D == mFormat){
+			for(int l=0; l<=mOrder; ++l){
+				float k = sqrt(2.*l + 1);
+				for(int c=l*l; c<(l+1)*(l+1); ++c) ws[c] *= k;
+			}
+		}
+
+		int spkrs[12];
+		float gains[12];
+		Vec3d dir = Speaker(0, atan2(y,x) * toDeg, asin(z) * toDeg).vec();
+		int n = vbap.speakerGains(dir, spkrs, gains);
+		for(int k=0; k<n; ++k){
+			float * row = mDecodeMatrix + spkrs[k] * numChans;
+			for(int c=0; c<numChans; ++c) row[c] += gains[k] * ws[c];
+		}
+	}
+
+	// Normalize to unit energy averaged over directions
+	double energy = 0;
+	for(int v=0; v<numVirtual; ++v){
+		encodeWeights(&ws[0], mFormat, 3, mOrder, dirs[v][0], dirs[v][1], dirs[v][2]);
+		for(int i=0; i<numSpeakers(); ++i){
+			const float * row = mDecodeMatrix + i * numChans;
+			double g = 0;
+			for(int c=0; c<numChans; ++c) g += row[c] * ws[c];
+			energy += g*g;
+		}
+	}
+	if(energy > 0){
+		float norm = sqrt(numVirtual / energy);
+		for(int i=0; i<numSpeakers(); ++i){
+			float * row = mDecodeMatrix + i * numChans;
+			float amp = norm * (*mSpeakers)[i].gain;
+			for(int c=0; c<numChans; ++c) row[c] *= amp;
+		}
+	}
+}
+
 void AmbiDecode::numSpeakers(int num){
 	resizeArrays(channels(), num);
 }
@@ -247,8 +494,15 @@ void AmbiDecode::setSpeakerRadians(int index, int deviceChannel, float az, float
 	(*mSpeakers)[index].deviceChannel = deviceChannel;
 	(*mSpeakers)[index].gain = amp;
 
+	if(ALLRAD == mMethod){
+		updateAllRAD();
+		return;
+	}
+
 	// update encoding weights
-	encodeWeightsFuMa(mDecodeMatrix + index * channels(), mDim, mOrder, az, el);
+	float cosel = cos(el);
+	encodeWeights(mDecodeMatrix + index * channels(), mFormat, mDim, mOrder,
+		cos(az) * cosel, sin(az) * cosel, mDim>=3 ? sin(el) : 0.f);
 	for (int i=0; i<channels(); i++) {
 		mDecodeMatrix[index * channels() + i] *= amp;
 	}
@@ -260,6 +514,15 @@ void AmbiDecode::setSpeaker(int index, int deviceChannel, float az, float el, fl
 
 void AmbiDecode::updateChanWeights(){
 	float * wc = mWeights;
+
+	if(FUMA != mFormat){
+		for(int l=0; l<=mOrder; ++l){
+			int n = 3 == mDim ? 2*l + 1 : (l ? 2 : 1);
+			for(int i=0; i<n; ++i) *wc++ = mWOrder[l];
+		}
+		return;
+	}
+
 	*wc++ = mWOrder[0];
 
 	if(mOrder > 0){
@@ -331,9 +594,9 @@ void AmbiDecode::print(FILE * fp, const char * append) const {
 
 
 AmbisonicsSpatializer::AmbisonicsSpatializer(
-	SpeakerLayout &sl, int dim, int order, int flavor
+	SpeakerLayout &sl, int dim, int order, int flavor, AmbiBase::Format format
 )
-	:	Spatializer(sl), mDecoder(dim, order, sl.numSpeakers(), flavor), mEncoder(dim,order),
+	:	Spatializer(sl), mDecoder(dim, order, sl.numSpeakers(), flavor, format), mEncoder(dim, order, format),
 	  mListener(NULL),  mNumFrames(0)
 {
     setSpeakerLayout(sl);
@@ -360,6 +623,10 @@ void AmbisonicsSpatializer::numSpeakers(int num){
 }
 
 void AmbisonicsSpatializer::setSpeakerLayout(const SpeakerLayout& sl){
+	// compute AllRAD matrix once all speakers are set
+	AmbiDecode::Method method = mDecoder.method();
+	mDecoder.method(AmbiDecode::PROJECTION);
+
 	mDecoder.setSpeakers(&mSpeakers);
 
 	mSpeakers.clear();
@@ -367,20 +634,62 @@ void AmbisonicsSpatializer::setSpeakerLayout(const SpeakerLayout& sl){
 	for(unsigned i=0;i<numSpeakers;++i){
 		mSpeakers.push_back(sl.speakers()[i]);
 
-        mDecoder.setSpeakerRadians(
+		// Speaker angles are in degrees. Azimuth is negated as sources are
+		// encoded in Ambisonic coordinates converted from Speaker::vec().
+        mDecoder.setSpeaker(
 			i,
 			mSpeakers[i].deviceChannel,
-			mSpeakers[i].azimuth,
+			-mSpeakers[i].azimuth,
 			mSpeakers[i].elevation,
 			mSpeakers[i].gain
 		);
 	}
+
+	mDecoder.method(method);
 }
 
 void AmbisonicsSpatializer::prepare(AudioIOData& io){
     zeroAmbi();
 }
 
+void AmbisonicsSpatializer::prepare(){
+	zeroAmbi();
+}
+
+void AmbisonicsSpatializer::performBlock(
+	float ** bus, SoundSource& src, const Vec3d& relposStart, const Vec3d& relposEnd, int numFrames, const float * samples
+) const {
+	static const int maxChannels = (AmbiBase::maxOrder+1)*(AmbiBase::maxOrder+1);
+	float weightsStart[maxChannels], weightsEnd[maxChannels];
+
+	// directions in listener's coordinate frame at start and end of block
+	Vec3d dirStart = mListener->quatHistory()[0].rotateTransposed(relposStart.normalized());
+	Vec3d dirEnd = mListener->quatHistory()[numFrames-1].rotateTransposed(relposEnd.normalized());
+
+	AmbiBase::encodeWeights(weightsStart, mEncoder.format(), mEncoder.dim(), mEncoder.order(), -dirStart[2], -dirStart[0], dirStart[1]);
+	AmbiBase::encodeWeights(weightsEnd, mEncoder.format(), mEncoder.dim(), mEncoder.order(), -dirEnd[2], -dirEnd[0], dirEnd[1]);
+
+	// outer-space, inner-time with weights ramped over the block
+	for(int c = 0; c < mEncoder.channels(); ++c){
+		float w = weightsStart[c];
+		float wInc = (weightsEnd[c] - w) / numFrames;
+		float * ambi = bus[c];
+		int i = 0;
+		#ifdef AMBI_USE_SSE
+		__m128 wv = _mm_setr_ps(w, w + wInc, w + 2*wInc, w + 3*wInc);
+		__m128 wvInc = _mm_set1_ps(4*wInc);
+		for(; i+4 <= numFrames; i+=4){
+			__m128 a = _mm_mul_ps(wv, _mm_loadu_ps(samples+i));
+			_mm_storeu_ps(ambi+i, _mm_add_ps(_mm_loadu_ps(ambi+i), a));
+			wv = _mm_add_ps(wv, wvInc);
+		}
+		#endif
+		for(; i < numFrames; ++i){
+			ambi[i] += (w + wInc*i) * samples[i];
+		}
+	}
+}
+
 void AmbisonicsSpatializer::perform(
 	AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, float *samples
 ){
@@ -424,3 +733,4 @@ void AmbisonicsSpatializer::finalize(AudioIOData& io){
 #undef WRAP
 #undef COS
 #undef SIN
+#undef AMBI_USE_SSE
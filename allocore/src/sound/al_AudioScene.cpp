@@ -1,14 +1,27 @@
 #include "allocore/sound/al_AudioScene.hpp"
+#include "allocore/system/al_Atomic.hpp"
+#include "allocore/system/al_Thread.hpp"
 
 namespace al{
 
-Spatializer::Spatializer(const SpeakerLayout& sl){
+Spatializer::Spatializer(const SpeakerLayout& sl)
+:	mEnabled(true)
+{
 	unsigned numSpeakers = sl.speakers().size();
 	for(unsigned i=0;i<numSpeakers;++i){
 		mSpeakers.push_back(sl.speakers()[i]);
 	}
 };
 
+int Spatializer::busChannels() const {
+	int num = 0;
+	for(unsigned i=0; i<mSpeakers.size(); ++i){
+		int chan = mSpeakers[i].deviceChannel + 1;
+		if(chan > num) num = chan;
+	}
+	return num;
+}
+
 
 
 void AudioSceneObject::updateHistory(){
@@ -60,6 +73,41 @@ SoundSource::SoundSource(
     presenceFilter.set(2700);
 }
 
+void SoundSource::readSamples(float * dst, int numFrames, double index, double indexInc) const {
+	static const int runSize = 64;
+	float frac[runSize], xm1[runSize], x0[runSize], x1[runSize], x2[runSize];
+
+	const float * elems = &mSound[0];
+	const int size = mSound.size();
+	const int pos = mSound.pos();
+
+	#define WRAP(i) ((i) < 0 ? (i)+size : ((i) >= size ? (i)-size : (i)))
+
+	for(int j=0; j<numFrames; j+=runSize){
+		int n = numFrames - j;
+		if(n > runSize) n = runSize;
+
+		// Gather taps around read positions; same taps as readSample()
+		for(int i=0; i<n; ++i){
+			double idx = index + indexInc*(j+i);
+			int idx0 = idx;
+			int e = pos - idx0;
+			frac[i] = idx - idx0;
+			xm1[i] = elems[WRAP(e+1)];
+			x0 [i] = elems[WRAP(e  )];
+			x1 [i] = elems[WRAP(e-1)];
+			x2 [i] = elems[WRAP(e-2)];
+		}
+
+		float * out = dst + j;
+		for(int i=0; i<n; ++i){
+			out[i] = ipl::cubic(frac[i], xm1[i], x0[i], x1[i], x2[i]);
+		}
+	}
+
+	#undef WRAP
+}
+
 /*static*/
 int SoundSource::bufferSize(double samplerate, double speedOfSound, double distance){
 	return (int)ceil(samplerate * distance / speedOfSound);
@@ -67,13 +115,96 @@ int SoundSource::bufferSize(double samplerate, double speedOfSound, double dista
 
 
 
+// Pool of worker threads rendering source groups
+class AudioScene::Workers{
+public:
+
+	Workers(AudioScene& scene, int numWorkers)
+	:	mScene(scene), mThreads(numWorkers), mNumGroups(0), mQuit(0)
+	{
+		for(int i=0; i<mThreads.size(); ++i){
+			mThreads.function(i).workers = this;
+			mThreads.function(i).thread = i+1;
+		}
+		mThreads.start(false);
+	}
+
+	~Workers(){
+		mQuit.store(1);
+		for(int i=0; i<mThreads.size(); ++i) mWake.post();
+		mThreads.join();
+	}
+
+	// Render all groups, returning when all of them are done
+	void render(const Listener& l, int numFrames, double sampleRate, int numGroups){
+		mListener = &l;
+		mNumFrames = numFrames;
+		mSampleRate = sampleRate;
+		mNumGroups = numGroups;
+		mNextGroup.store(0);
+		mNumDone.store(0);
+
+		// posting to the semaphore publishes the job to the workers
+		for(int i=0; i<mThreads.size(); ++i) mWake.post();
+
+		work(0);
+
+		while(mNumDone.load() != mThreads.size()) spinPause();
+	}
+
+private:
+	struct Function : public ThreadFunction{
+		void operator()(){
+			for(;;){
+				workers->mWake.wait();
+				if(workers->mQuit.load()) return;
+				workers->work(thread);
+				workers->mNumDone.fetchAdd(1);
+			}
+		}
+
+		Workers * workers;
+		int thread;
+	};
+
+	// Render groups until none are left
+	void work(int thread){
+		float * buffer = &mScene.mThreadBuffer[thread * mNumFrames];
+		for(;;){
+			int group = mNextGroup.fetchAdd(1);
+			if(group >= mNumGroups) break;
+			mScene.renderGroup(group, *mListener, mNumFrames, mSampleRate, buffer);
+		}
+	}
+
+	AudioScene& mScene;
+	Threads<Function> mThreads;
+	Semaphore mWake;
+
+	// current job
+	const Listener * mListener;
+	int mNumFrames;
+	double mSampleRate;
+	int mNumGroups;
+
+	Atomic<int> mNextGroup;	// next group to render
+	Atomic<int> mNumDone;	// number of workers done with the job
+	Atomic<int> mQuit;
+};
+
+
+
 AudioScene::AudioScene(int numFrames_)
-:   mNumFrames(0), mSpeedOfSound(340), mPerSampleProcessing(false)
+:   mNumFrames(0), mSpeedOfSound(340), mPerSampleProcessing(false),
+	mBlockProcessing(false),
+	mWorkers(NULL), mNumThreads(0), mSourcesPerGroup(32)
 {
 	numFrames(numFrames_);
 }
 
 AudioScene::~AudioScene(){
+	delete mWorkers;
+
 	for(
 		Listeners::iterator it = mListeners.begin();
 		it != mListeners.end();
@@ -83,6 +214,19 @@ AudioScene::~AudioScene(){
 	}
 }
 
+void AudioScene::numThreads(int n){
+	if(n < 0) n = 0;
+	if(n != mNumThreads){
+		delete mWorkers;
+		mWorkers = NULL;
+		mNumThreads = n;
+		if(n > 0){
+			mWorkers = new Workers(*this, n-1);
+			mThreadBuffer.resize(n * mNumFrames);
+		}
+	}
+}
+
 void AudioScene::addSource(SoundSource& src){
 	mSources.push_back(&src);
 }
@@ -94,6 +238,8 @@ void AudioScene::removeSource(SoundSource& src){
 void AudioScene::numFrames(int v){
 	if(mNumFrames != v){
 		mBuffer.resize(v);
+		mDiscard.resize(v);
+		mThreadBuffer.resize(mNumThreads * v);
 
 		Listeners::iterator it = mListeners.begin();
 		while(it != mListeners.end()){
@@ -137,10 +283,57 @@ void AudioScene::render(float **outputBuffers, const int numFrames, const double
 		// update listener history data:
 		l.updateHistory(numFrames);
 
-		// iterate through all sound sources
-		for(Sources::iterator it = mSources.begin(); it != mSources.end(); ++it){
+		// set up bus for block processing
+		bool blockProcessing = !mPerSampleProcessing && mBlockProcessing
+			&& spatializer->supportsBlockProcessing();
+		if(blockProcessing){
+			mBus.resize(spatializer->busChannels());
+			for(unsigned c=0; c<mBus.size(); ++c){
+				#if !ALLOCORE_GENERIC_AUDIOSCENE
+				float * out = c < (unsigned)io.channelsOut() ? io.outBuffer(c) : &mDiscard[0];
+				#else
+				float * out = outputBuffers[c];
+				#endif
+				mBus[c] = spatializer->busBuffer(c, out);
+			}
+		}
+
+		// block processing renders sources in groups into group buses,
+		// using the worker threads if there are any
+		if(blockProcessing){
+			mSourceArray.assign(mSources.begin(), mSources.end());
+			int numGroups = (mSourceArray.size() + mSourcesPerGroup - 1) / mSourcesPerGroup;
+			int busChans = mBus.size();
+
+			mGroupBus.resize(numGroups * busChans * numFrames);
+			mGroupBusChans.resize(numGroups * busChans);
+			for(unsigned j=0; j<mGroupBusChans.size(); ++j){
+				mGroupBusChans[j] = &mGroupBus[j * numFrames];
+			}
+
+			if(mWorkers){
+				mWorkers->render(l, numFrames, sampleRate, numGroups);
+			}
+			else{
+				for(int g=0; g<numGroups; ++g){
+					renderGroup(g, l, numFrames, sampleRate, &mBuffer[0]);
+				}
+			}
+
+			// sum group buses in fixed order
+			for(int c=0; c<busChans; ++c){
+				float * bus = mBus[c];
+				for(int g=0; g<numGroups; ++g){
+					const float * groupBus = mGroupBusChans[g*busChans + c];
+					for(int i=0; i<numFrames; ++i) bus[i] += groupBus[i];
+				}
+			}
+		}
+
+		// iterate through all sound sources, unless already rendered
+		for(Sources::iterator it = mSources.begin(); !blockProcessing && it != mSources.end(); ++it){
 			SoundSource& src = *(*it);
-            
+
 			// scalar factor to convert distances into delayline indices
             double distanceToSample = 0;
             if(src.dopplerType() == DOPPLER_SYMMETRICAL)
@@ -248,6 +441,71 @@ void AudioScene::render(float **outputBuffers, const int numFrames, const double
 	} // end for each listener
 }
 
+void AudioScene::renderGroup(
+	int group, const Listener& l, int numFrames, double sampleRate,
+	float * buffer
+){
+	int busChans = mBus.size();
+	float ** bus = &mGroupBusChans[group * busChans];
+	for(int c=0; c<busChans; ++c){
+		memset(bus[c], 0, sizeof(float) * numFrames);
+	}
+
+	int begin = group * mSourcesPerGroup;
+	int end = begin + mSourcesPerGroup;
+	if(end > (int)mSourceArray.size()) end = mSourceArray.size();
+
+	for(int i=begin; i<end; ++i){
+		SoundSource& src = *mSourceArray[i];
+		src.updateHistory();
+		renderBlock(*l.mSpatializer, l, src, bus, buffer, numFrames, sampleRate);
+	}
+}
+
+void AudioScene::renderBlock(
+	const Spatializer& spatializer, const Listener& l, SoundSource& src,
+	float ** bus, float * buffer, int numFrames, double sampleRate
+) const {
+
+	// Per sample processing interpolates the relative position linearly
+	// over the block, so its endpoints fully describe the trajectory.
+	Vec3d rel3 = src.posHistory()[3] - l.posHistory()[3];
+	Vec3d rel2 = src.posHistory()[2] - l.posHistory()[2];
+	Vec3d rel1 = src.posHistory()[1] - l.posHistory()[1];
+	Vec3d rel0 = src.posHistory()[0] - l.posHistory()[0];
+	Vec3d relposStart = (rel3 + rel2 + rel1)/3.0;
+	Vec3d relposEnd   = (rel2 + rel1 + rel0)/3.0;
+
+	double distStart = relposStart.mag();
+	double distEnd = relposEnd.mag();
+
+	// scalar factor to convert distances into delayline indices
+	double distanceToSample = 0;
+	if(src.dopplerType() != DOPPLER_NONE)
+		distanceToSample = sampleRate / mSpeedOfSound;
+
+	// Delay ramp, including the time delay of the block itself
+	double indexStart = distStart * distanceToSample + numFrames;
+	double indexEnd   = distEnd   * distanceToSample;
+
+	// Is our delay line big enough?
+	double maxIndex = src.maxIndex();
+	if(indexStart > maxIndex && indexEnd > maxIndex) return;
+	if(indexStart > maxIndex) indexStart = maxIndex;
+	if(indexEnd   > maxIndex) indexEnd   = maxIndex;
+
+	src.readSamples(buffer, numFrames, indexStart, (indexEnd - indexStart)/numFrames);
+
+	// Gain ramp
+	float gain = src.attenuation(distStart);
+	float gainInc = (src.attenuation(distEnd) - gain)/numFrames;
+	for(int i=0; i<numFrames; ++i){
+		buffer[i] *= gain + gainInc*i;
+	}
+
+	spatializer.performBlock(bus, src, relposStart, relposEnd, numFrames, buffer);
+}
+
 } // al::
 
 
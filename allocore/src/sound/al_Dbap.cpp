@@ -18,6 +18,26 @@ void Dbap::compile(Listener& listener){
 	}
 }
 
+float Dbap::gain(const Vec3d& relpos, int speaker) const {
+	if(!mEnabled) return 1.f;
+	Vec3d vec = relpos - mSpeakerVecs[speaker];
+	float dist = vec.mag();
+	return powf(1.f / (1.f + dist), mFocus);
+}
+
+void Dbap::performBlock(float ** bus, SoundSource& src, const Vec3d& relposStart, const Vec3d& relposEnd, int numFrames, const float * samples) const {
+	for(int k = 0; k < mNumSpeakers; ++k)
+	{
+		float g = gain(relposStart, k);
+		float gInc = (gain(relposEnd, k) - g) / numFrames;
+
+		float * out = bus[mDeviceChannels[k]];
+		for(int i = 0; i < numFrames; ++i){
+			out[i] += (g + gInc*i) * samples[i];
+		}
+	}
+}
+
 void Dbap::perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, float *samples){
 	for (unsigned k = 0; k < mNumSpeakers; ++k)
 	{
@@ -1,4 +1,7 @@
 #include "allocore/sound/al_Vbap.hpp"
+#include <algorithm>
+#include "allocore/math/al_Random.hpp"
+#include "allocore/system/al_Thread.hpp"
 
 namespace al{
 
@@ -16,12 +19,37 @@ void SpeakerTriple::loadVectors(const std::vector<Speaker>& spkrs){
 			s2Vec[0],s2Vec[1],s2Vec[2],
 			s3Vec[0],s3Vec[1],s3Vec[2]
 			);
+
+	if(s3!=-1){
+		matInv = mat;
+		invert(matInv);
+	}
+	else{
+		// Pairs span the horizontal (x-z) plane, so invert the 2x2 basis of
+		// their x and z components. The vertical component of a direction
+		// is ignored.
+		Mat<2,double> pair(
+			s1Vec[0], s1Vec[2],
+			s2Vec[0], s2Vec[2]
+		);
+		matInv.set(0.);
+		if(fabs(determinant(pair)) > 1e-6 && invert(pair)){
+			matInv(0,0) = pair(0,0); matInv(0,1) = pair(0,1);
+			matInv(2,0) = pair(1,0); matInv(2,1) = pair(1,1);
+		}
+		else{
+			// speakers are opposite; fall back to projections
+			matInv(0,0) = s1Vec[0]; matInv(0,1) = s2Vec[0];
+			matInv(2,0) = s1Vec[2]; matInv(2,1) = s2Vec[2];
+		}
+	}
 }
 
 
 
-Vbap::Vbap(const SpeakerLayout &sl)
-:	Spatializer(sl), mCachedTripletIndex(0), mIs3D(true)
+Vbap::Vbap(const SpeakerLayout &sl, bool is3D)
+:	Spatializer(sl), mNumTriplets(0), mListener(NULL), mCachedTripletIndex(0), mIs3D(is3D),
+	mTableRes(0), mTriangulation(TRIANGULATION_HULL), mTriangulationThreads(1)
 {}
 
 void Vbap::addTriple(const SpeakerTriple& st) {
@@ -29,14 +57,13 @@ void Vbap::addTriple(const SpeakerTriple& st) {
 	++mNumTriplets;
 }
 
-Vec3d Vbap::computeGains(const Vec3d& vecA, const SpeakerTriple& speak) {
-	const Mat3d& mat = speak.mat;
-	unsigned dimensions = mIs3D ? 3 : 2;
+Vec3d Vbap::computeGains(const Vec3d& vecA, const SpeakerTriple& speak) const {
+	const Mat3d& mat = speak.matInv;
 	Vec3d vec(0., 0., 0.);
 
-	// For each node, insert speaker coordinates in matrix
-	for (unsigned i = 0; i < dimensions; i++){
-		for (unsigned j = 0; j < dimensions; j++){
+	// Gains are the direction in the basis of the speaker vectors
+	for (unsigned i = 0; i < 3; i++){
+		for (unsigned j = 0; j < 3; j++){
 			vec[i] += vecA[j] * mat(j,i);
 		}
 	}
@@ -108,112 +135,113 @@ bool Vbap::isCrossing(Vec3d c, Vec3d v, const SpeakerTriple& trip){
 	return (a1==a2 && a3==a4);
 }
 
-void Vbap::findSpeakerTriplets(const std::vector<Speaker>& spkrs){
-	std::list<SpeakerTriple> triplets;
-
-	unsigned numSpeakers = spkrs.size();
-	int numSpeakersSigned = (int)numSpeakers;
-
-	// form all possible triples
-	for (unsigned i = 0; i < numSpeakers; i++){
-		for (unsigned j = i+1; j < numSpeakers; j++){
-			for (unsigned k = j+1; k < numSpeakers; k++){
-				SpeakerTriple triplet;
-				triplet.s1=i;
-				triplet.s2=j;
-				triplet.s3=k;
-				triplet.loadVectors(spkrs);
-				triplets.push_back(triplet);
-			}
-		}
-	}
-	printf("Speaker-count=%d, Initial triplet-count=%d\n",numSpeakers,(unsigned)triplets.size());
-
-
-	// remove too narrow triples
-	for(std::list<SpeakerTriple>::iterator it = triplets.begin(); it != triplets.end();++it){
-		SpeakerTriple trip = (*it);
-
-		Vec3d xprod = cross(trip.s1Vec,trip.s2Vec);
-		float volume = fabs(xprod.dot(trip.s3Vec));
-		float length = fabs(angle(trip.s1Vec , trip.s2Vec) ) + fabs(angle(trip.s1Vec , trip.s3Vec) ) + fabs(angle(trip.s2Vec , trip.s3Vec) );
-		float ratio;
-
-		if (length > MIN_LENGTH){
-			ratio =  volume / length;
-		}else{
-			ratio = 0.0;
-		}
-
-		if (ratio < MIN_VOLUME_TO_LENGTH_RATIO) {
-			//printf("v=%f, l=%f, r=%f x=(%f,%f,%f)\n",volume,length,ratio,xprod[0],xprod[1],xprod[2]);
-			triplets.erase(it);
-			--it;
-		}
+// Whether triple of speakers is narrow, having little volume for its length
+static bool isNarrow(const SpeakerTriple& trip){
+	Vec3d xprod = cross(trip.s1Vec,trip.s2Vec);
+	float volume = fabs(xprod.dot(trip.s3Vec));
+	float length = fabs(angle(trip.s1Vec , trip.s2Vec) ) + fabs(angle(trip.s1Vec , trip.s3Vec) ) + fabs(angle(trip.s2Vec , trip.s3Vec) );
+	float ratio;
+
+	if (length > MIN_LENGTH){
+		ratio =  volume / length;
+	}else{
+		ratio = 0.0;
 	}
 
+	return ratio < MIN_VOLUME_TO_LENGTH_RATIO;
+}
 
-	for(std::list<SpeakerTriple>::iterator it = triplets.begin(); it != triplets.end();++it){
-		SpeakerTriple trip = (*it);
-		bool remove = false;
-		for(std::list<SpeakerTriple>::iterator it2 = triplets.begin(); it2 != triplets.end();++it2){
-			SpeakerTriple trip2 = (*it2);
-			for (unsigned j = 0; j < 3; ++j) {
-				Vec3d v = trip2.vec[j];
-				Vec3d c = cross(cross(trip.s1Vec, trip.s2Vec),cross(trip.s3Vec,v));
-				if (isCrossing(c,v,trip) || isCrossing(-c,v, trip)) {
+// Tests triples of speakers with first speaker in [begin, end) with stride
+struct TripletSearch : public ThreadFunction{
+	const std::vector<Speaker> * spkrs;
+	int begin, end, stride;
+	std::vector<SpeakerTriple> found;
+
+	void operator()(){
+		const std::vector<Speaker>& s = *spkrs;
+		const int numSpeakers = s.size();
+
+		for(int i = begin; i < end; i += stride){
+		for(int j = i+1; j < numSpeakers; ++j){
+		for(int k = j+1; k < numSpeakers; ++k){
+			SpeakerTriple trip;
+			trip.s1 = i;
+			trip.s2 = j;
+			trip.s3 = k;
+			trip.loadVectors(s);
+
+			if(isNarrow(trip)) continue;
+
+			// Remove triangles with other speakers beyond them. The gains of a
+			// speaker direction sum to more than one if the speaker lies
+			// farther from the listener than the plane of the triangle, which
+			// includes speakers inside the triangle.
+			bool remove = false;
+			for(int jj = 0; jj < numSpeakers; ++jj){
+				if(jj == i || jj == j || jj == k) continue;
+
+				Vec3d v = s[jj].vec() * trip.matInv;
+
+				// 1e-4 is a magic number
+				if(v.sum() > 1 + 1e-4){
 					remove = true;
-					printf("Removing v=(%f,%f,%f) c=(%f,%f,%f)\n",v[0],v[1],v[2],c[0],c[1],c[2]);
 					break;
 				}
 			}
-		}
 
-		if (remove) {
-			triplets.erase(it);
-			--it;
-		}
+			if(!remove) found.push_back(trip);
+		}}}
 	}
+};
 
-	// remove triangles that contain other Speakers
-	for(std::list<SpeakerTriple>::iterator it = triplets.begin(); it != triplets.end();++it){
-		SpeakerTriple trip = (*it);
-		Mat3d invMat = Mat3d(trip.mat).transpose();
-
-		for (int jj = 0; jj < numSpeakersSigned; ++jj) {
-			// check to see if the current speaker is one of the nodes of the triple
-			if ((jj == trip.s1) || (jj == trip.s2) || (jj == trip.s3) )
-				continue;
-
-			Vec3d sVec = spkrs[jj].vec();
-			Vec3d v = sVec * invMat;
-
-			// inside if positive or negative near zero, -1e-4 is a magic number
-			bool x_inside = v[0] >= -1e-4;
-			bool y_inside = v[1] >= -1e-4;
-			bool z_inside = v[2] >= -1e-4;
+void Vbap::findSpeakerTriplets(const std::vector<Speaker>& spkrs){
+	const int numSpeakers = spkrs.size();
+	const int numThreads = mTriangulationThreads > 1 ? mTriangulationThreads : 1;
+
+	// Interleave first speaker of triples over threads to balance work
+	Threads<TripletSearch> threads(numThreads);
+	for(int t = 0; t < numThreads; ++t){
+		TripletSearch& f = threads.function(t);
+		f.spkrs = &spkrs;
+		f.begin = t;
+		f.end = numSpeakers;
+		f.stride = numThreads;
+	}
 
-			if (x_inside && y_inside && (mIs3D || z_inside)){
-				//printf("Removing v=(%f,%f,%f)\n",v[0],v[1],v[2]);
-				triplets.erase(it);
-				--it;
-				break;
-			}
-		}
+	if(numThreads > 1){
+		threads.start();
+	}
+	else{
+		threads.function(0)();
 	}
 
-	for(std::list<SpeakerTriple>::iterator it = triplets.begin(); it != triplets.end(); ++it) {
-		addTriple(*it);
+	// Add triplets in same order regardless of number of threads
+	std::vector<unsigned> next(numThreads, 0);
+	for(int i = 0; i < numSpeakers; ++i){
+		const std::vector<SpeakerTriple>& found = threads.function(i % numThreads).found;
+		unsigned& k = next[i % numThreads];
+		while(k < found.size() && found[k].s1 == i){
+			addTriple(found[k++]);
+		}
 	}
 }
 
 void Vbap::compile(Listener& listener){
 	this->mListener = &listener;
 
+	mTriplets.clear();
+	mNumTriplets = 0;
+	mCachedTripletIndex = 0;
+
 	//Check if 3D...
 	if(mIs3D){
 		printf("Finding triplets\n");
-		findSpeakerTriplets(mSpeakers);
+		if(TRIANGULATION_HULL == mTriangulation){
+			findSpeakerTripletsHull(mSpeakers);
+		}
+		else{
+			findSpeakerTriplets(mSpeakers);
+		}
 	}
 	else{
 		printf("Finding pairs\n");
@@ -226,55 +254,371 @@ void Vbap::compile(Listener& listener){
 		printf("No SpeakerSets found. Check mode setting or speaker layout.\n");
 		throw -1;
 	}
+
+	buildGainTable();
 }
 
 void Vbap::perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample){
-	unsigned currentTripletIndex = mCachedTripletIndex; // Cached source placement, so it starts searching from there.
+	//Rotate vector according to listener-rotation
+	Vec3d vec = mListener->pose().quat().rotate(relpos);
 
-	Vec3d vec = Vec3d(relpos);
-	//printf("(%f,%f,%f)\n",vec[0],vec[1],vec[2]);
+	int speakers[12];
+	float gains[12];
+	int numSpeakers = speakerGains(vec, speakers, gains, &mCachedTripletIndex);
 
-	//Rotate vector according to listener-rotation
-	Quatd srcRot = this->mListener->pose().quat();
-	vec = srcRot.rotate(vec);
+	float s = sample / relpos.mag();
+	for(int k = 0; k < numSpeakers; ++k){
+		io.out(mSpeakers[speakers[k]].deviceChannel, frameIndex) += gains[k] * s;
+	}
+}
+
+// Face of convex hull with outward normal
+struct HullFace{
+	int v[3];
+	Vec3d normal;
+	bool visible;
+};
+
+static HullFace makeHullFace(const std::vector<Vec3d>& p, int a, int b, int c){
+	HullFace f;
+	f.v[0] = a; f.v[1] = b; f.v[2] = c;
+	f.normal = cross(p[b]-p[a], p[c]-p[a]).normalize();
+	f.visible = false;
+	return f;
+}
 
-	//Silent by default
-	Vec3d gains;
-	Vec3d gainsTemp;
+void Vbap::findSpeakerTripletsHull(const std::vector<Speaker>& spkrs){
+	const double eps = 1e-8;
+	const int numSpeakers = spkrs.size();
+
+	// Speaker directions
+	std::vector<Vec3d> p(numSpeakers);
+	for(int i = 0; i < numSpeakers; ++i){
+		p[i] = spkrs[i].vec().normalize();
+	}
+
+	// Find initial tetrahedron from speakers farthest apart
+	int t[4] = {0, -1, -1, -1};
+	double maxVal = eps;
+	for(int i = 1; i < numSpeakers; ++i){
+		double d = (p[i]-p[t[0]]).mag();
+		if(d > maxVal){ maxVal = d; t[1] = i; }
+	}
+	if(t[1] < 0) return;
+	maxVal = eps;
+	for(int i = 1; i < numSpeakers; ++i){
+		double a = cross(p[t[1]]-p[t[0]], p[i]-p[t[0]]).mag();
+		if(a > maxVal){ maxVal = a; t[2] = i; }
+	}
+	if(t[2] < 0) return;
+	Vec3d n = cross(p[t[1]]-p[t[0]], p[t[2]]-p[t[0]]).normalize();
+	maxVal = eps;
+	for(int i = 1; i < numSpeakers; ++i){
+		double d = fabs(n.dot(p[i]-p[t[0]]));
+		if(d > maxVal){ maxVal = d; t[3] = i; }
+	}
+	if(t[3] < 0) return; // all speakers on a plane
+
+	std::vector<HullFace> faces;
+	Vec3d centroid = (p[t[0]] + p[t[1]] + p[t[2]] + p[t[3]]) * 0.25;
+	const int tetra[4][3] = { {0,1,2}, {0,3,1}, {1,3,2}, {0,2,3} };
+	for(int i = 0; i < 4; ++i){
+		HullFace f = makeHullFace(p, t[tetra[i][0]], t[tetra[i][1]], t[tetra[i][2]]);
+		if(f.normal.dot(centroid - p[f.v[0]]) > 0){
+			f = makeHullFace(p, f.v[0], f.v[2], f.v[1]);
+		}
+		faces.push_back(f);
+	}
+
+	// Add remaining speakers one at a time
+	std::vector<int> horizon;
+	for(int i = 0; i < numSpeakers; ++i){
+		if(i == t[0] || i == t[1] || i == t[2] || i == t[3]) continue;
+
+		bool anyVisible = false;
+		for(unsigned k = 0; k < faces.size(); ++k){
+			HullFace& f = faces[k];
+			f.visible = f.normal.dot(p[i] - p[f.v[0]]) > eps;
+			if(f.visible) anyVisible = true;
+		}
+		if(!anyVisible) continue;
+
+		// Find horizon; edges of visible faces shared with hidden faces
+		horizon.clear();
+		for(unsigned k = 0; k < faces.size(); ++k){
+			const HullFace& f = faces[k];
+			if(!f.visible) continue;
+			for(int e = 0; e < 3; ++e){
+				int a = f.v[e], b = f.v[(e+1)%3];
+				for(unsigned m = 0; m < faces.size(); ++m){
+					const HullFace& g = faces[m];
+					if(g.visible) continue;
+					if(	(g.v[0]==b && g.v[1]==a) ||
+						(g.v[1]==b && g.v[2]==a) ||
+						(g.v[2]==b && g.v[0]==a)
+					){
+						horizon.push_back(a);
+						horizon.push_back(b);
+						break;
+					}
+				}
+			}
+		}
+
+		// Replace visible faces with cone from horizon to speaker
+		unsigned numKept = 0;
+		for(unsigned k = 0; k < faces.size(); ++k){
+			if(!faces[k].visible) faces[numKept++] = faces[k];
+		}
+		faces.resize(numKept);
+		for(unsigned k = 0; k < horizon.size(); k += 2){
+			faces.push_back(makeHullFace(p, horizon[k], horizon[k+1], i));
+		}
+	}
+
+	// Faces facing away from the listener become triplets
+	for(unsigned k = 0; k < faces.size(); ++k){
+		const HullFace& f = faces[k];
+		if(f.normal.dot(p[f.v[0]]) <= eps) continue;
+
+		SpeakerTriple triplet;
+		triplet.s1 = f.v[0];
+		triplet.s2 = f.v[1];
+		triplet.s3 = f.v[2];
+
+		// sort speakers in ascending order as in the exhaustive search
+		if(triplet.s1 > triplet.s2) std::swap(triplet.s1, triplet.s2);
+		if(triplet.s2 > triplet.s3) std::swap(triplet.s2, triplet.s3);
+		if(triplet.s1 > triplet.s2) std::swap(triplet.s1, triplet.s2);
+
+		// narrow faces are kept; dropping them would leave holes in the hull
+		triplet.loadVectors(spkrs);
+		addTriple(triplet);
+	}
+}
+
+int Vbap::findTriplet(const Vec3d& vec, Vec3d& gains, unsigned start) const {
+	unsigned index = start < mNumTriplets ? start : 0;
 
-	// Search thru the triplets array in search of a match for the source position.
 	for (unsigned count = 0; count < mNumTriplets; ++count) {
-		gainsTemp = computeGains(vec, mTriplets[currentTripletIndex]);
-		if ((gainsTemp[0] >= 0) && (gainsTemp[1] >= 0) && (!mIs3D || (gainsTemp[2] >= 0)) ){
-			//printf("Gainstemp: (%f,%f,%f)\n",gainsTemp[0],gainsTemp[1],gainsTemp[2]);
-			gainsTemp.normalize();
-			gains = gainsTemp*sample/relpos.mag();
-			//printf("Found: (%d,%d,%d) \n", mTriplets[currentTripletIndex].s1, mTriplets[currentTripletIndex].s2, mTriplets[currentTripletIndex].s3);
-			break;
+		gains = computeGains(vec, mTriplets[index]);
+		if ((gains[0] >= 0) && (gains[1] >= 0) && (!mIs3D || (gains[2] >= 0)) ){
+			gains.normalize();
+			return index;
+		}
+		if (++index >= mNumTriplets){
+			index = 0;
+		}
+	}
+	return -1;
+}
+
+int Vbap::speakerGains(const Vec3d& dir, int * speakers, float * gains, unsigned * triplet) const {
+	if(!mTable.empty()){
+		return tableGains(dir, speakers, gains);
+	}
+
+	Vec3d g;
+	int index = findTriplet(dir, g, triplet ? *triplet : mCachedTripletIndex);
+	if(index < 0) return 0;
+	if(triplet) *triplet = index;
+
+	const SpeakerTriple& triple = mTriplets[index];
+	speakers[0] = triple.s1;
+	speakers[1] = triple.s2;
+	speakers[2] = triple.s3;
+	for(int j = 0; j < 3; ++j) gains[j] = g[j];
+	return mIs3D ? 3 : 2;
+}
+
+int Vbap::tableGains(const Vec3d& dir, int * speakers, float * gains) const {
+
+	// Find cube face from axis of largest magnitude
+	int axis = 0;
+	if(fabs(dir[1]) > fabs(dir[axis])) axis = 1;
+	if(fabs(dir[2]) > fabs(dir[axis])) axis = 2;
+	if(dir[axis] == 0) return 0;
+
+	int face = 2*axis + (dir[axis] < 0 ? 1 : 0);
+	double scale = 0.5 * mTableRes / fabs(dir[axis]);
+
+	// Position on face in cells
+	double x = (dir[(axis+1)%3] + fabs(dir[axis])) * scale;
+	double y = (dir[(axis+2)%3] + fabs(dir[axis])) * scale;
+	int ix = x; if(ix >= mTableRes) ix = mTableRes-1;
+	int iy = y; if(iy >= mTableRes) iy = mTableRes-1;
+	float fx = x - ix;
+	float fy = y - iy;
+
+	const int stride = mTableRes + 1;
+	const TableEntry * e = &mTable[(face*stride + iy)*stride + ix];
+	const TableEntry * corners[4] = { e, e+1, e+stride, e+stride+1 };
+	const float weights[4] = { (1-fx)*(1-fy), fx*(1-fy), (1-fx)*fy, fx*fy };
+
+	// Sum gains of corners per speaker
+	int numSpeakers = 0;
+	for(int c = 0; c < 4; ++c){
+		const TableEntry& entry = *corners[c];
+		if(entry.triplet < 0 || weights[c] == 0) continue;
+
+		const SpeakerTriple& triple = mTriplets[entry.triplet];
+		const int s[3] = { triple.s1, triple.s2, triple.s3 };
+
+		for(int j = 0; j < 3; ++j){
+			int k = 0;
+			while(k < numSpeakers && speakers[k] != s[j]) ++k;
+			if(k == numSpeakers){
+				speakers[k] = s[j];
+				gains[k] = 0;
+				++numSpeakers;
+			}
+			gains[k] += weights[c] * entry.gains[j];
+		}
+	}
+
+	// Normalize to unit power
+	float power = 0;
+	for(int k = 0; k < numSpeakers; ++k) power += gains[k]*gains[k];
+	if(power > 0){
+		float norm = 1.f / sqrt(power);
+		for(int k = 0; k < numSpeakers; ++k) gains[k] *= norm;
+	}
+
+	return numSpeakers;
+}
+
+void Vbap::gainTableResolution(int n){
+	mTableRes = n > 0 ? n : 0;
+	buildGainTable();
+}
+
+void Vbap::gainTableMemory(int bytes){
+	int n = int(sqrt(double(bytes) / (6 * sizeof(TableEntry)))) - 1;
+	gainTableResolution(n);
+}
+
+void Vbap::buildGainTable(){
+	mTable.clear();
+	if(0 == mTableRes || !mIs3D || 0 == mNumTriplets) return;
+
+	const int stride = mTableRes + 1;
+	mTable.resize(6*stride*stride);
+
+	unsigned triplet = 0;
+
+	for(int face = 0; face < 6; ++face){
+		int axis = face/2;
+		for(int iy = 0; iy < stride; ++iy){
+			for(int ix = 0; ix < stride; ++ix){
+				Vec3d dir;
+				dir[axis] = face & 1 ? -1 : 1;
+				dir[(axis+1)%3] = 2. * ix / mTableRes - 1.;
+				dir[(axis+2)%3] = 2. * iy / mTableRes - 1.;
+
+				TableEntry& entry = mTable[(face*stride + iy)*stride + ix];
+				Vec3d gains;
+				entry.triplet = findTriplet(dir, gains, triplet);
+				if(entry.triplet >= 0) triplet = entry.triplet;
+				for(int j = 0; j < 3; ++j){
+					entry.gains[j] = entry.triplet >= 0 ? gains[j] : 0;
+				}
+			}
+		}
+	}
+}
+
+double Vbap::gainTableError(int numDirs, double * rmsError) const {
+	double maxErr = 0, sumSqr = 0;
+	std::vector<float> exact(mSpeakers.size()), table(mSpeakers.size());
+	rnd::Random<> rng(1);
+
+	for(int i = 0; i < numDirs; ++i){
+		Vec3d dir = rng.ball<Vec3d>().normalize();
+
+		for(unsigned k = 0; k < exact.size(); ++k) exact[k] = table[k] = 0;
+
+		Vec3d g;
+		int index = findTriplet(dir, g, 0);
+		if(index >= 0){
+			const SpeakerTriple& triple = mTriplets[index];
+			exact[triple.s1] = g[0];
+			exact[triple.s2] = g[1];
+			if(mIs3D) exact[triple.s3] = g[2];
+		}
+
+		int speakers[12];
+		float gains[12];
+		int n = mTable.empty() ? 0 : tableGains(dir, speakers, gains);
+		for(int k = 0; k < n; ++k) table[speakers[k]] = gains[k];
+
+		for(unsigned k = 0; k < exact.size(); ++k){
+			double err = fabs(table[k] - exact[k]);
+			if(err > maxErr) maxErr = err;
+			sumSqr += err*err;
 		}
+	}
+
+	if(rmsError) *rmsError = sqrt(sumSqr / (double(numDirs) * exact.size()));
+	return maxErr;
+}
+
+void Vbap::perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, float *samples){
+	Vec3d vec = mListener->pose().quat().rotate(relpos);
+
+	int speakers[12];
+	float gains[12];
+	int numSpeakers = speakerGains(vec, speakers, gains, &mCachedTripletIndex);
 
-		++currentTripletIndex;
-		if (currentTripletIndex >= mNumTriplets){
-			currentTripletIndex = 0;
+	float scale = 1. / relpos.mag();
+	for(int k = 0; k < numSpeakers; ++k){
+		float g = gains[k] * scale;
+		float * out = io.outBuffer(mSpeakers[speakers[k]].deviceChannel);
+		for(int i = 0; i < numFrames; ++i){
+			out[i] += g * samples[i];
 		}
-		//printf("Index: %d\n",count);
 	}
-	//printf("Gains: (%f,%f,%f)\n",gains[0],gains[1],gains[2]);
+}
+
+void Vbap::performBlock(float ** bus, SoundSource& src, const Vec3d& relposStart, const Vec3d& relposEnd, int numFrames, const float * samples) const {
+	const Quatd& rot = mListener->pose().quat();
 
-	SpeakerTriple triple = mTriplets[currentTripletIndex];
+	// Speakers at the start and end of the block. If the source crosses into
+	// another triplet, the gains cross-fade between the two.
+	int speakers[24];
+	float gainStart[24], gainEnd[24];
 
-	if(mCachedTripletIndex!=currentTripletIndex){
-		printf("Triple: (%d,%d,%d)\n",triple.s1,triple.s2,triple.s3);
-		printf("Gains: (%f,%f,%f)\n",gains[0],gains[1],gains[2]);
-		printf("Gains-temp: (%f,%f,%f)\n",gainsTemp[0],gainsTemp[1],gainsTemp[2]);
+	int s[12];
+	float g[12];
+	unsigned triplet = mCachedTripletIndex;
+
+	int numSpeakers = speakerGains(rot.rotate(relposStart), s, g, &triplet);
+	float scale = 1. / relposStart.mag();
+	for(int k = 0; k < numSpeakers; ++k){
+		speakers[k] = s[k];
+		gainStart[k] = g[k] * scale;
+		gainEnd[k] = 0;
 	}
 
-	mCachedTripletIndex = currentTripletIndex; // Store the new index
+	int n = speakerGains(rot.rotate(relposEnd), s, g, &triplet);
+	scale = 1. / relposEnd.mag();
+	for(int j = 0; j < n; ++j){
+		int k = 0;
+		while(k < numSpeakers && speakers[k] != s[j]) ++k;
+		if(k == numSpeakers){
+			speakers[k] = s[j];
+			gainStart[k] = 0;
+			++numSpeakers;
+		}
+		gainEnd[k] = g[j] * scale;
+	}
 
-	io.out(triple.s1,frameIndex) += gains[0];
-	io.out(triple.s2,frameIndex) += gains[1];
-	if(mIs3D){
-		io.out(triple.s3, frameIndex) += gains[2];
+	for(int k = 0; k < numSpeakers; ++k){
+		float g = gainStart[k];
+		float gInc = (gainEnd[k] - g) / numFrames;
+		float * out = bus[mSpeakers[speakers[k]].deviceChannel];
+		for(int i = 0; i < numFrames; ++i){
+			out[i] += (g + gInc*i) * samples[i];
+		}
 	}
 }
 
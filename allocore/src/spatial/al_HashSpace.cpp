@@ -3,6 +3,22 @@
 
 using namespace al;
 
+namespace{
+
+// Adds a result to a max-heap of the k nearest so far
+inline void offerNearest(HashSpace::Query::Result * heap, uint32_t& count, uint32_t k, const HashSpace::Query::Result& r){
+	if (count < k) {
+		heap[count++] = r;
+		std::push_heap(heap, heap+count, HashSpace::Query::Result::nearer);
+	} else if (r.distanceSquared < heap[0].distanceSquared) {
+		std::pop_heap(heap, heap+k, HashSpace::Query::Result::nearer);
+		heap[k-1] = r;
+		std::push_heap(heap, heap+k, HashSpace::Query::Result::nearer);
+	}
+}
+
+}
+
 // resolution can be 1 to 10; the dim is 2^resolution i.e. 2..1024
 // (the limit is 10 so that the hash can fit inside a uint32_t integer)
 // default 5 implies 32 units per side
@@ -14,7 +30,8 @@ HashSpace :: HashSpace(uint32_t resolution, uint32_t numObjects)
 	mDim3(mDim2*mDim),
 	mDimHalf(mDim/2),
 	mWrap(mDim-1),
-	mWrap3(mDim3-1)
+	mWrap3(mDim3-1),
+	mMode(LINKED)
 {
 	//printf("shift %d shift2 %d dim %d dim3 %d wrap %d wrap3 %d\n",
 //		mShift, mShift2, mDim, mDim3, mWrap, mWrap3);
@@ -50,7 +67,8 @@ HashSpace :: HashSpace(uint32_t resolution, uint32_t numObjects)
 				//double d = distanceSquared(x-0.5, y-0.5, z-0.5);
 				//printf("%04d %04d %04d -> %8d\n", x, y, z, d);
 				// if this is within the valid query radius:
-				if (d < mMaxHalfD2) {
+				// (the one corner voxel at mMaxHalfD2 is kept for nearest())
+				if (d <= mMaxHalfD2) {
 					// store the hash (voxel index) in the corresponding shell:
 					//uint32_t h = hash(x+0.5, y+0.5, z+0.5);
 					uint32_t h = hash(x, y, z);
@@ -70,8 +88,8 @@ HashSpace :: HashSpace(uint32_t resolution, uint32_t numObjects)
 		std::vector<uint32_t>& shell = shells[d];
 		if (!shell.empty()) {
 			mDistanceToVoxelIndices[d] = mVoxelIndices.size();
-			mVoxelIndicesToDistance[mVoxelIndices.size()] = d;
 			for (unsigned j=0; j<shell.size(); j++) {
+				mVoxelIndicesToDistance[mVoxelIndices.size()] = d;
 				mVoxelIndices.push_back(shell[j]);
 			}
 		} else {
@@ -80,6 +98,12 @@ HashSpace :: HashSpace(uint32_t resolution, uint32_t numObjects)
 	}
 	// store last shell:
 	mDistanceToVoxelIndices[mMaxHalfD2] = mVoxelIndices.size();
+	// append the corner, so that all voxels are listed:
+	std::vector<uint32_t>& corner = shells[mMaxHalfD2];
+	for (unsigned j=0; j<corner.size(); j++) {
+		mVoxelIndicesToDistance[mVoxelIndices.size()] = mMaxHalfD2;
+		mVoxelIndices.push_back(corner[j]);
+	}
 
 //	// dump the lists:
 //	uint32_t offset = hash(0, 1, 0);
@@ -99,3 +123,200 @@ HashSpace :: HashSpace(uint32_t resolution, uint32_t numObjects)
 
 HashSpace :: ~HashSpace() {}
 
+HashSpace& HashSpace :: mode(Mode m) {
+	if (m == mMode) return *this;
+	mMode = m;
+	for (unsigned i=0; i<mVoxels.size(); i++) {
+		mVoxels[i].mObjects = NULL;
+	}
+	for (unsigned i=0; i<mObjects.size(); i++) {
+		Object& o = mObjects[i];
+		o.next = o.prev = NULL;
+		if (m == LINKED && o.hash != invalidHash()) mVoxels[o.hash].add(&o);
+	}
+	mCellStart.clear();
+	return *this;
+}
+
+void HashSpace :: rebuild() {
+	// count objects per voxel, offset by one
+	mCellStart.assign(mDim3+1, 0);
+	for (unsigned i=0; i<mObjects.size(); i++) {
+		uint32_t h = mObjects[i].hash;
+		if (h != invalidHash()) mCellStart[h+1]++;
+	}
+	// convert counts to start of each voxel
+	for (unsigned h=0; h<mDim3; h++) {
+		mCellStart[h+1] += mCellStart[h];
+	}
+	uint32_t count = mCellStart[mDim3];
+	mSortIds.resize(count);
+	mSortX.resize(count);
+	mSortY.resize(count);
+	mSortZ.resize(count);
+
+	// place objects, advancing start of each voxel to its end
+	for (unsigned i=0; i<mObjects.size(); i++) {
+		const Object& o = mObjects[i];
+		if (o.hash == invalidHash()) continue;
+		uint32_t j = mCellStart[o.hash]++;
+		mSortIds[j] = i;
+		mSortX[j] = o.pos.x;
+		mSortY[j] = o.pos.y;
+		mSortZ[j] = o.pos.z;
+	}
+	// now each start is that of the next voxel, so shift back
+	for (unsigned h=mDim3; h>0; h--) {
+		mCellStart[h] = mCellStart[h-1];
+	}
+	mCellStart[0] = 0;
+}
+
+int HashSpace::Query :: nearest(const HashSpace& space, const Vec3d& center, uint32_t k) {
+	mObjects.resize(k);
+	uint32_t which = 0, count = 0;
+	if (k) space.nearest(&center, &which, 1, k, NULL, &mObjects[0], &count);
+	mObjects.resize(count);
+	return count;
+}
+
+int HashSpace::Query :: nearest(const HashSpace& space, const Object * obj, uint32_t k) {
+	mObjects.resize(k);
+	uint32_t which = 0, count = 0;
+	if (k) space.nearest(&obj->pos, &which, 1, k, obj, &mObjects[0], &count);
+	mObjects.resize(count);
+	return count;
+}
+
+// Walks the voxel shells outward from the points' voxel. An object in a
+// voxel at offset v (in voxels) is at least |v| - sqrt(3) away, even across
+// the toroidal wrap, so a point is done once its k-th distance is within
+// that bound for the next shell.
+void HashSpace :: nearest(
+	const Vec3d * points, const uint32_t * which, int n, uint32_t k,
+	const Object * exclude, Query::Result * heaps, uint32_t * counts
+) const {
+	for (int j=0; j<n; j++) counts[which[j]] = 0;
+	if (!n || !k || mObjects.empty()) return;
+	if (mMode == SORTED && mCellStart.empty()) return;
+
+	// points still searching, swapped to the front
+	std::vector<uint32_t> active(which, which+n);
+	int numActive = n;
+
+	Object * objects = const_cast<Object *>(&mObjects[0]);
+	const Vec3d p0 = wrap(points[which[0]]);
+	const uint32_t cx = p0.x, cy = p0.y, cz = p0.z;
+	const double root3 = sqrt(3.);
+	uint32_t shell = mVoxelIndicesToDistance[0];
+
+	for (unsigned i=0; i<mVoxelIndices.size(); i++) {
+		uint32_t d = mVoxelIndicesToDistance[i];
+		if (d != shell) {
+			shell = d;
+			double bound = sqrt(double(d)) - root3;
+			if (bound > 0) {
+				double bound2 = bound*bound;
+				for (int j=0; j<numActive; ) {
+					uint32_t w = active[j];
+					if (counts[w] == k && heaps[w*k].distanceSquared <= bound2) {
+						std::swap(active[j], active[--numActive]);
+					} else {
+						j++;
+					}
+				}
+				if (!numActive) break;
+			}
+		}
+
+		uint32_t index = hash(cx, cy, cz, mVoxelIndices[i]);
+		if (mMode == SORTED) {
+			uint32_t end = mCellStart[index+1];
+			for (uint32_t s = mCellStart[index]; s < end; s++) {
+				Object * o = objects + mSortIds[s];
+				if (o == exclude) continue;
+				Vec3d pos(mSortX[s], mSortY[s], mSortZ[s]);
+				for (int j=0; j<numActive; j++) {
+					uint32_t w = active[j];
+					Query::Result r;
+					r.object = o;
+					r.distanceSquared = wrapRelative(pos - points[w]).magSqr();
+					offerNearest(heaps + w*k, counts[w], k, r);
+				}
+			}
+		} else {
+			Object * head = mVoxels[index].mObjects;
+			if (!head) continue;
+			Object * o = head;
+			do {
+				if (o != exclude) {
+					for (int j=0; j<numActive; j++) {
+						uint32_t w = active[j];
+						Query::Result r;
+						r.object = o;
+						r.distanceSquared = wrapRelative(o->pos - points[w]).magSqr();
+						offerNearest(heaps + w*k, counts[w], k, r);
+					}
+				}
+				o = o->next;
+			} while (o != head);
+		}
+	}
+
+	for (int j=0; j<n; j++) {
+		Query::Result * heap = heaps + which[j]*k;
+		std::sort_heap(heap, heap + counts[which[j]], Query::Result::nearer);
+	}
+}
+
+struct HashSpace::NearestBody : public ThreadPool::LoopBody {
+	NearestBody(
+		const HashSpace& s, const Vec3d * p, uint32_t k_,
+		const std::vector<uint32_t>& o, const std::vector<uint32_t>& g,
+		Query::Result * h, uint32_t * c
+	)
+	:	space(s), points(p), k(k_), order(o), groups(g), heaps(h), counts(c) {}
+
+	void operator()(int begin, int end) {
+		for (int g=begin; g<end; g++) {
+			space.nearest(points, &order[groups[g]], groups[g+1]-groups[g], k, NULL, heaps, counts);
+		}
+	}
+
+	const HashSpace& space;
+	const Vec3d * points;
+	uint32_t k;
+	const std::vector<uint32_t>& order;	// point indices sorted by voxel
+	const std::vector<uint32_t>& groups;// start of each voxel in order
+	Query::Result * heaps;
+	uint32_t * counts;
+};
+
+void HashSpace :: nearest(
+	const Vec3d * points, int n, uint32_t k,
+	std::vector<Query::Result>& results, std::vector<uint32_t>& counts,
+	ThreadPool * pool
+) const {
+	results.resize(size_t(n)*k);
+	counts.assign(n, 0);
+	if (!n || !k) return;
+
+	// group points by voxel
+	std::vector<std::pair<uint32_t, uint32_t> > keys(n);
+	for (int i=0; i<n; i++) {
+		keys[i].first = hash(wrap(points[i]));
+		keys[i].second = i;
+	}
+	std::sort(keys.begin(), keys.end());
+	std::vector<uint32_t> order(n), groups;
+	for (int i=0; i<n; i++) {
+		if (!i || keys[i].first != keys[i-1].first) groups.push_back(i);
+		order[i] = keys[i].second;
+	}
+	int numGroups = groups.size();
+	groups.push_back(n);
+
+	NearestBody body(*this, points, k, order, groups, &results[0], &counts[0]);
+	if (pool) pool->runLoop(0, numGroups, 16, body);
+	else body(0, numGroups);
+}
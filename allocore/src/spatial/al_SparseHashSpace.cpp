@@ -0,0 +1,365 @@
+#include <math.h>
+#include <algorithm>
+#include "allocore/spatial/al_SparseHashSpace.hpp"
+
+using namespace al;
+
+namespace{
+
+const int32_t NUM_CELLS = 1<<21;			// cells per axis
+const int32_t CELL_OFFSET = NUM_CELLS/2;	// cell coordinate of origin
+const int MIN_TABLE_BITS = 4;
+
+// Squared distances from a point to the nearest and farthest points of a cell
+void cellDistances(
+	const Vec<3,uint32_t>& c, const Vec3d& p, double cellSize,
+	double& near2, double& far2
+){
+	near2 = far2 = 0;
+	for(int a=0; a<3; ++a){
+		double lo = (double(c[a]) - CELL_OFFSET) * cellSize;
+		double hi = lo + cellSize;
+		double gap = p[a] < lo ? lo - p[a] : (p[a] > hi ? p[a] - hi : 0);
+		double span = std::max(p[a] - lo, hi - p[a]);
+		near2 += gap*gap;
+		far2 += span*span;
+	}
+}
+
+// The k nearest objects found so far, kept in a max-heap
+struct NearestHeap{
+	SparseHashSpace::Query::Results& results;
+	uint32_t k;
+	double limit2;	// squared distance an object must be within to be added
+	bool full;
+
+	NearestHeap(SparseHashSpace::Query::Results& r, uint32_t k_, double maxr2)
+	:	results(r), k(k_), limit2(maxr2), full(false) {}
+
+	// whether something at squared distance d2 could be added
+	bool admits(double d2) const { return full ? d2 < limit2 : d2 <= limit2; }
+
+	// offer the circular list of objects starting at head
+	void add(
+		SparseHashSpace::Object * objects, uint32_t head,
+		const Vec3d& center, const SparseHashSpace::Object * exclude
+	){
+		uint32_t j = head;
+		do {
+			SparseHashSpace::Object * o = objects + j;
+			double d2 = (o->pos - center).magSqr();
+			if (o != exclude && admits(d2)) {
+				if (full) {
+					std::pop_heap(results.begin(), results.end());
+					results.back() = SparseHashSpace::Query::Result(o, d2);
+				} else {
+					results.push_back(SparseHashSpace::Query::Result(o, d2));
+				}
+				std::push_heap(results.begin(), results.end());
+				if (results.size() == k) {
+					full = true;
+					limit2 = results.front().distanceSquared;
+				}
+			}
+			j = o->next;
+		} while (j != head);
+	}
+};
+
+}
+
+SparseHashSpace :: SparseHashSpace(double cellSize, uint32_t numObjects)
+:	mCellSize(cellSize > 0 ? cellSize : 1),
+	mInvCellSize(1./mCellSize),
+	mNumCells(0),
+	mSlotShift(64)
+{
+	rehash(MIN_TABLE_BITS);
+	mObjects.resize(numObjects);
+	for (unsigned i=0; i<mObjects.size(); i++) {
+		mObjects[i].id = i;
+	}
+}
+
+SparseHashSpace :: ~SparseHashSpace() {}
+
+void SparseHashSpace :: numObjects(int numObjects) {
+	mObjects.clear();
+	mObjects.resize(numObjects);
+	for (unsigned i=0; i<mObjects.size(); i++) {
+		mObjects[i].id = i;
+	}
+	// release all cells:
+	mCells.clear();
+	mNumCells = 0;
+	rehash(MIN_TABLE_BITS);
+}
+
+Vec3d SparseHashSpace :: clamp(const Vec3d& v) const {
+	const double e = extent();
+	return Vec3d(
+		v.x < -e ? -e : (v.x > e ? e : v.x),
+		v.y < -e ? -e : (v.y > e ? e : v.y),
+		v.z < -e ? -e : (v.z > e ? e : v.z)
+	);
+}
+
+int32_t SparseHashSpace :: cellCoord(double x) const {
+	// clip in floating point, so that any finite input is safe to convert
+	double c = floor(x * mInvCellSize) + CELL_OFFSET;
+	if (!(c >= 0)) return 0;
+	if (c >= NUM_CELLS) return NUM_CELLS-1;
+	return int32_t(c);
+}
+
+uint32_t SparseHashSpace :: findCell(uint64_t key) const {
+	const uint32_t mask = mCells.size()-1;
+	for (uint32_t i = slot(key); ; i = (i+1) & mask) {
+		if (mCells[i].key == key) return i;
+		if (mCells[i].key == invalidCell()) return invalidObject();
+	}
+}
+
+uint32_t SparseHashSpace :: insertCell(uint64_t key) {
+	// keep load at most 1/2:
+	if ((mNumCells+1)*2 > mCells.size()) rehash(65 - mSlotShift);
+	const uint32_t mask = mCells.size()-1;
+	for (uint32_t i = slot(key); ; i = (i+1) & mask) {
+		Cell& c = mCells[i];
+		if (c.key == key) return i;
+		if (c.key == invalidCell()) {
+			c.key = key;
+			c.first = invalidObject();
+			mNumCells++;
+			return i;
+		}
+	}
+}
+
+void SparseHashSpace :: eraseCell(uint32_t i) {
+	// shift back later cells of the probe run, so no tombstones are needed
+	const uint32_t mask = mCells.size()-1;
+	for (uint32_t j = (i+1) & mask; mCells[j].key != invalidCell(); j = (j+1) & mask) {
+		uint32_t k = slot(mCells[j].key);
+		// leave cells whose home slot lies cyclically in (i, j]
+		bool stays = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+		if (!stays) {
+			mCells[i] = mCells[j];
+			i = j;
+		}
+	}
+	mCells[i] = Cell();
+	mNumCells--;
+	// release memory when load falls below 1/8:
+	int bits = 64 - mSlotShift;
+	if (bits > MIN_TABLE_BITS && mNumCells*8 < mCells.size()) rehash(bits-1);
+}
+
+void SparseHashSpace :: rehash(int bits) {
+	std::vector<Cell> old(size_t(1)<<bits);
+	old.swap(mCells);
+	mSlotShift = 64 - bits;
+	const uint32_t mask = mCells.size()-1;
+	for (unsigned j=0; j<old.size(); j++) {
+		if (old[j].key == invalidCell()) continue;
+		uint32_t i = slot(old[j].key);
+		while (mCells[i].key != invalidCell()) i = (i+1) & mask;
+		mCells[i] = old[j];
+	}
+}
+
+void SparseHashSpace :: link(uint32_t objectId, uint64_t key) {
+	Object& o = mObjects[objectId];
+	Cell& c = mCells[insertCell(key)];
+	if (c.first == invalidObject()) {
+		c.first = o.next = o.prev = objectId;
+	} else {
+		// add to tail:
+		Object& first = mObjects[c.first];
+		uint32_t last = first.prev;
+		mObjects[last].next = objectId;
+		o.prev = last;
+		o.next = c.first;
+		first.prev = objectId;
+	}
+	o.cell = key;
+}
+
+void SparseHashSpace :: unlink(uint32_t objectId) {
+	Object& o = mObjects[objectId];
+	uint32_t i = findCell(o.cell);
+	if (o.next == objectId) {	// cell only has 1 item
+		eraseCell(i);
+	} else {
+		mObjects[o.prev].next = o.next;
+		mObjects[o.next].prev = o.prev;
+		if (mCells[i].first == objectId) mCells[i].first = o.next;
+	}
+	// leave the object clean:
+	o.next = o.prev = invalidObject();
+	o.cell = invalidCell();
+}
+
+SparseHashSpace& SparseHashSpace :: moveObject(uint32_t objectId, const Vec3d& pos) {
+	Object& o = mObjects[objectId];
+	o.pos = clamp(pos);
+	uint64_t key = morton(cellCoord(o.pos.x), cellCoord(o.pos.y), cellCoord(o.pos.z));
+	if (key != o.cell) {
+		if (o.cell != invalidCell()) unlink(objectId);
+		link(objectId, key);
+	}
+	return *this;
+}
+
+SparseHashSpace& SparseHashSpace :: remove(uint32_t objectId) {
+	if (mObjects[objectId].cell != invalidCell()) unlink(objectId);
+	return *this;
+}
+
+
+int SparseHashSpace::Query :: operator()(const SparseHashSpace& space, const Vec3d& center, double maxRadius, double minRadius) {
+	return query(space, center, NULL, maxRadius, minRadius);
+}
+
+int SparseHashSpace::Query :: operator()(const SparseHashSpace& space, const Object * obj, double maxRadius, double minRadius) {
+	return query(space, obj->pos, obj, maxRadius, minRadius);
+}
+
+int SparseHashSpace::Query :: nearest(const SparseHashSpace& space, const Vec3d& center, uint32_t k, double maxRadius) {
+	return knn(space, center, NULL, k, maxRadius);
+}
+
+int SparseHashSpace::Query :: nearest(const SparseHashSpace& space, const Object * obj, uint32_t k, double maxRadius) {
+	return knn(space, obj->pos, obj, k, maxRadius);
+}
+
+int SparseHashSpace::Query :: query(const SparseHashSpace& space, const Vec3d& center, const Object * exclude, double maxRadius, double minRadius) {
+	const unsigned start = mObjects.size();
+	if (start >= mMaxResults || !space.mNumCells) return 0;
+	const double maxr2 = maxRadius*maxRadius;
+	const double minr2 = minRadius*minRadius;
+	Object * objects = const_cast<Object *>(&space.mObjects[0]);
+
+	// either probe every cell overlapping the query box,
+	// or scan the occupied cells, whichever is fewer
+	int32_t lo[3], hi[3];
+	double boxCells = 1;
+	for (int a=0; a<3; a++) {
+		lo[a] = space.cellCoord(center[a] - maxRadius);
+		hi[a] = space.cellCoord(center[a] + maxRadius);
+		boxCells *= double(hi[a] - lo[a] + 1);
+	}
+	bool probe = boxCells <= space.mNumCells;
+	uint32_t x = lo[0], y = lo[1], z = lo[2];
+	uint32_t slot = 0;
+
+	while (mObjects.size() < mMaxResults) {
+		// next cell to visit:
+		uint32_t i;
+		if (probe) {
+			if (int32_t(z) > hi[2]) break;
+			i = space.findCell(morton(x, y, z));
+			if (int32_t(++x) > hi[0]) { x = lo[0]; if (int32_t(++y) > hi[1]) { y = lo[1]; ++z; } }
+			if (i == invalidObject()) continue;
+		} else {
+			if (slot == space.mCells.size()) break;
+			i = slot++;
+			if (space.mCells[i].key == invalidCell()) continue;
+			double near2, far2;
+			cellDistances(unmorton(space.mCells[i].key), center, space.mCellSize, near2, far2);
+			if (near2 > maxr2 || far2 < minr2) continue;
+		}
+		// now add any objects in this cell to the result...
+		uint32_t head = space.mCells[i].first;
+		uint32_t j = head;
+		do {
+			Object * o = objects + j;
+			if (o != exclude) {
+				double d2 = (o->pos - center).magSqr();
+				if (d2 >= minr2 && d2 <= maxr2) {
+					mObjects.push_back(Result(o, d2));
+				}
+			}
+			j = o->next;
+		} while (j != head && mObjects.size() < mMaxResults);
+	}
+	return mObjects.size() - start;
+}
+
+// Searches cubic shells of cells outward from the center's cell, keeping the
+// k nearest objects so far in a max-heap. The search stops once the nearest
+// unvisited cell is farther than the k-th nearest object, or falls back to
+// scanning the occupied cells once that would be cheaper than the next shell.
+int SparseHashSpace::Query :: knn(const SparseHashSpace& space, const Vec3d& center, const Object * exclude, uint32_t k, double maxRadius) {
+	mObjects.clear();
+	if (!k || !space.mNumCells) return 0;
+	const double maxr2 = maxRadius*maxRadius;
+	const double cs = space.mCellSize;
+	Object * objects = const_cast<Object *>(&space.mObjects[0]);
+
+	NearestHeap nearest(mObjects, k, maxr2);
+
+	// the clamped center gives a lower bound on distances to the true center
+	const Vec3d inside = space.clamp(center);
+	int32_t c0[3];
+	for (int a=0; a<3; a++) c0[a] = space.cellCoord(inside[a]);
+
+	double probed = 0;
+	bool scan = false;
+	int32_t s = 0;
+
+	for (;; s++) {
+		double side = 2*s+1;
+		double shellCells = s ? side*side*side - (side-2)*(side-2)*(side-2) : 1;
+		if (probed + shellCells > space.mNumCells) { scan = true; break; }
+		probed += shellCells;
+
+		// visit cells on the surface of the cube of side 2s+1:
+		for (int32_t dz=-s; dz<=s; dz++) {
+			int32_t z = c0[2] + dz;
+			if (z < 0 || z >= NUM_CELLS) continue;
+			for (int32_t dy=-s; dy<=s; dy++) {
+				int32_t y = c0[1] + dy;
+				if (y < 0 || y >= NUM_CELLS) continue;
+				int32_t step = (dz == -s || dz == s || dy == -s || dy == s) ? 1 : 2*s;
+				for (int32_t dx=-s; dx<=s; dx+=step) {
+					int32_t x = c0[0] + dx;
+					if (x < 0 || x >= NUM_CELLS) continue;
+					uint32_t i = space.findCell(morton(x, y, z));
+					if (i == invalidObject()) continue;
+					nearest.add(objects, space.mCells[i].first, center, exclude);
+				}
+			}
+		}
+
+		// distance from center to the nearest cell outside the visited cube:
+		double gap = DBL_MAX;
+		for (int a=0; a<3; a++) {
+			double lo = (double(c0[a] - s) - CELL_OFFSET) * cs;
+			double hi = (double(c0[a] + s + 1) - CELL_OFFSET) * cs;
+			if (c0[a] - s > 0) gap = std::min(gap, inside[a] - lo);
+			if (c0[a] + s < NUM_CELLS-1) gap = std::min(gap, hi - inside[a]);
+		}
+		if (gap == DBL_MAX) break;
+		if (!nearest.admits(gap*gap)) break;
+	}
+
+	if (scan) {
+		// visit occupied cells outside the shells visited so far
+		for (unsigned i=0; i<space.mCells.size(); i++) {
+			const Cell& cell = space.mCells[i];
+			if (cell.key == invalidCell()) continue;
+			Vec<3,uint32_t> c = unmorton(cell.key);
+			int32_t ring = 0;
+			for (int a=0; a<3; a++) ring = std::max(ring, std::abs(int32_t(c[a]) - c0[a]));
+			if (ring < s) continue;
+			double near2, far2;
+			cellDistances(c, center, cs, near2, far2);
+			if (!nearest.admits(near2)) continue;
+			nearest.add(objects, cell.first, center, exclude);
+		}
+	}
+
+	std::sort_heap(mObjects.begin(), mObjects.end());
+	return mObjects.size();
+}
@@ -9,6 +9,15 @@
 	#define USE_PTHREAD
 #endif
 
+#ifdef USE_PTHREAD
+	#ifdef AL_OSX
+		#include <dispatch/dispatch.h>
+	#else
+		#include <errno.h>
+		#include <semaphore.h>
+	#endif
+#endif
+
 namespace al {
 
 #ifdef USE_PTHREAD
@@ -84,6 +93,35 @@ struct Thread::Impl{
 };
 
 
+#ifdef AL_OSX
+
+// OS X does not implement unnamed POSIX semaphores
+class Semaphore::Impl{
+public:
+	Impl(unsigned count): mSem(dispatch_semaphore_create(count)){}
+	~Impl(){ dispatch_release(mSem); }
+	void post(){ dispatch_semaphore_signal(mSem); }
+	void wait(){ dispatch_semaphore_wait(mSem, DISPATCH_TIME_FOREVER); }
+	dispatch_semaphore_t mSem;
+};
+
+#else
+
+class Semaphore::Impl{
+public:
+	Impl(unsigned count){ sem_init(&mSem, 0, count); }
+	~Impl(){ sem_destroy(&mSem); }
+	void post(){ sem_post(&mSem); }
+	void wait(){
+		// restart if interrupted by a signal
+		while(sem_wait(&mSem) != 0 && errno == EINTR){}
+	}
+	sem_t mSem;
+};
+
+#endif
+
+
 void * Thread::current(){
 	// pthread_t pthread_self(void);
 	static pthread_t r;
@@ -145,10 +183,37 @@ struct Thread::Impl{
 	}
 };
 
+class Semaphore::Impl{
+public:
+	Impl(unsigned count): mSem(CreateSemaphore(NULL, count, 0x7fffffff, NULL)){}
+	~Impl(){ CloseHandle(mSem); }
+	void post(){ ReleaseSemaphore(mSem, 1, NULL); }
+	void wait(){ WaitForSingleObject(mSem, INFINITE); }
+	HANDLE mSem;
+};
+
 #endif
 
 
 
+Semaphore::Semaphore(unsigned count)
+:	mImpl(new Impl(count))
+{}
+
+Semaphore::~Semaphore(){
+	delete mImpl;
+}
+
+void Semaphore::post(){
+	mImpl->post();
+}
+
+void Semaphore::wait(){
+	mImpl->wait();
+}
+
+
+
 Thread::Thread()
 :	mImpl(new Impl), mJoinOnDestroy(false)
 {}
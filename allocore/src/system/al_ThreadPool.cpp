@@ -0,0 +1,425 @@
+#include "allocore/system/al_Config.h"
+#include "allocore/system/al_Info.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
+
+#if defined(AL_WINDOWS)
+	#include <windows.h>
+	#define AL_THREAD_LOCAL __declspec(thread)
+#else
+	#if defined(AL_LINUX)
+		#include <pthread.h>
+		#include <sched.h>
+	#endif
+	#if __cplusplus >= 201103L
+		#define AL_THREAD_LOCAL thread_local
+	#else
+		#define AL_THREAD_LOCAL __thread
+	#endif
+#endif
+
+namespace al{
+
+// Worker running on the current thread, if any
+static AL_THREAD_LOCAL void * currentWorker = 0;
+
+// Number of times an idle worker checks for work before sleeping
+static const int spinCount = 256;
+
+static bool pinToProcessor(int i){
+	#if defined(AL_LINUX)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(i, &set);
+		return 0 == pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	#elif defined(AL_WINDOWS)
+		return 0 != SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << i);
+	#else
+		return false;
+	#endif
+}
+
+static inline uint64_t packRange(uint32_t lo, uint32_t hi){
+	return (uint64_t(hi) << 32) | lo;
+}
+
+static inline void unpackRange(uint64_t r, uint32_t& lo, uint32_t& hi){
+	lo = uint32_t(r);
+	hi = uint32_t(r >> 32);
+}
+
+
+void ThreadPool::Task::wait(){
+	while(!done()){
+		if(!mPool || !mPool->helpOnce()) spinPause();
+	}
+}
+
+
+bool ThreadPool::TaskDeque::push(Task * t){
+	int64_t b = mBottom.loadRelaxed();
+	if(b - mTop.load() >= CAPACITY) return false;
+	mTasks[b & (CAPACITY-1)].storeRelaxed(t);
+	// sequentially consistent so that the task is visible before any
+	// sleeping worker is checked for
+	mBottom.exchange(b+1);
+	return true;
+}
+
+ThreadPool::Task * ThreadPool::TaskDeque::pop(){
+	int64_t b = mBottom.loadRelaxed() - 1;
+	mBottom.exchange(b);
+	int64_t t = mTop.load();
+	if(t > b){ // empty
+		mBottom.storeRelaxed(b+1);
+		return 0;
+	}
+	Task * task = mTasks[b & (CAPACITY-1)].loadRelaxed();
+	if(t == b){ // last task; race against thieves
+		if(!mTop.compareExchange(t, t+1)) task = 0;
+		mBottom.storeRelaxed(b+1);
+	}
+	return task;
+}
+
+ThreadPool::Task * ThreadPool::TaskDeque::steal(){
+	int64_t t = mTop.fetchAdd(0); // full barrier before reading bottom
+	int64_t b = mBottom.load();
+	if(t >= b) return 0;
+	Task * task = mTasks[t & (CAPACITY-1)].loadRelaxed();
+	if(!mTop.compareExchange(t, t+1)) return 0;
+	return task;
+}
+
+
+ThreadPool::TaskQueue::TaskQueue()
+:	mHead(0), mTail(0)
+{
+	for(unsigned i=0; i<CAPACITY; ++i) mSeqs[i].store(i);
+}
+
+bool ThreadPool::TaskQueue::push(Task * t){
+	unsigned pos = mTail.loadRelaxed();
+	for(;;){
+		unsigned i = pos & (CAPACITY-1);
+		int dif = int(mSeqs[i].load() - pos);
+		if(0 == dif){
+			if(mTail.compareExchange(pos, pos+1)){
+				mTasks[i] = t;
+				mSeqs[i].store(pos+1);
+				return true;
+			}
+		}
+		else if(dif < 0) return false; // full
+		else pos = mTail.loadRelaxed();
+	}
+}
+
+ThreadPool::Task * ThreadPool::TaskQueue::pop(){
+	unsigned pos = mHead.loadRelaxed();
+	for(;;){
+		unsigned i = pos & (CAPACITY-1);
+		int dif = int(mSeqs[i].load() - (pos+1));
+		if(0 == dif){
+			if(mHead.compareExchange(pos, pos+1)){
+				Task * t = mTasks[i];
+				mSeqs[i].store(pos + CAPACITY);
+				return t;
+			}
+		}
+		else if(dif < 0) return 0; // empty
+		else pos = mHead.loadRelaxed();
+	}
+}
+
+
+void ThreadPool::Worker::operator()(){
+	currentWorker = this;
+	if(pool->mPin) pinToProcessor(index % numProcessors());
+	pool->work(*this);
+}
+
+
+ThreadPool::ThreadPool(int numThreads, bool pinThreads)
+:	mSize(numThreads), mPin(pinThreads), mWorkers(0), mSleepers(0), mQuit(0),
+	mLoopBody(0), mLoopBusy(0), mLoopOpen(0), mLoopGen(0), mLoopUsers(0),
+	mLoopChunksDone(0)
+{
+	if(mSize <= 0){
+		mSize = numProcessors() - 1;
+		if(mSize < 1) mSize = 1;
+	}
+	mLoopRanges = new Atomic<uint64_t>[mSize+1];
+	mWorkers = new Worker[mSize];
+	for(int i=0; i<mSize; ++i){
+		Worker& w = mWorkers[i];
+		w.pool = this;
+		w.index = i;
+		w.loopGen = 0;
+	}
+	resetStats();
+	for(int i=0; i<mSize; ++i) mWorkers[i].thread.start(mWorkers[i]);
+}
+
+ThreadPool::~ThreadPool(){
+	mQuit.exchange(1);
+	wakeAll();
+	for(int i=0; i<mSize; ++i) mWorkers[i].thread.join();
+	delete[] mWorkers;
+	delete[] mLoopRanges;
+}
+
+
+void ThreadPool::submit(Task& task){
+	task.mDone.store(0);
+	task.mPool = this;
+
+	Worker * w = (Worker *)currentWorker;
+	bool queued = (w && w->pool == this && w->tasks.push(&task))
+		|| mShared.push(&task);
+
+	if(queued){
+		wakeOne();
+	}
+	else{ // queues full
+		runTask(&task, w && w->pool == this ? w->counters : mExternal);
+	}
+}
+
+void ThreadPool::runTask(Task * t, Counters& c){
+	(*t)();
+	c.tasks.fetchAdd(1);
+	t->mDone.store(1); // t may be destroyed from here on
+}
+
+ThreadPool::Task * ThreadPool::findTask(Worker * w, Counters& c){
+	Task * t = w ? w->tasks.pop() : 0;
+	if(t) return t;
+	t = mShared.pop();
+	if(t) return t;
+
+	// steal from other workers, starting at the next one
+	int start = w ? w->index+1 : 0;
+	for(int i=0; i<mSize; ++i){
+		Worker& v = mWorkers[(start + i) % mSize];
+		if(&v == w) continue;
+		t = v.tasks.steal();
+		if(t){
+			c.steals.fetchAdd(1);
+			return t;
+		}
+	}
+	return 0;
+}
+
+bool ThreadPool::hasWork(const Worker& w) const {
+	if(mLoopGen.load() != w.loopGen && mLoopOpen.load()) return true;
+	if(!mShared.empty()) return true;
+	for(int i=0; i<mSize; ++i){
+		if(!mWorkers[i].tasks.empty()) return true;
+	}
+	return false;
+}
+
+bool ThreadPool::helpOnce(){
+	Worker * w = (Worker *)currentWorker;
+	if(w && w->pool != this) w = 0;
+	Counters& c = w ? w->counters : mExternal;
+	Task * t = findTask(w, c);
+	if(!t) return false;
+	runTask(t, c);
+	return true;
+}
+
+void ThreadPool::wakeOne(){
+	int s = mSleepers.load();
+	while(s > 0){
+		if(mSleepers.compareExchange(s, s-1)){
+			mWake.post();
+			return;
+		}
+	}
+}
+
+void ThreadPool::wakeAll(){
+	int s = mSleepers.exchange(0);
+	for(int i=0; i<s; ++i) mWake.post();
+}
+
+void ThreadPool::work(Worker& w){
+	for(;;){
+		if(joinLoop(w)) continue;
+
+		Task * t = findTask(&w, w.counters);
+		if(t){
+			runTask(t, w.counters);
+			continue;
+		}
+
+		// spin briefly, as more work often follows soon
+		bool found = false;
+		for(int i=0; i<spinCount && !found; ++i){
+			spinPause();
+			found = hasWork(w);
+		}
+		if(found) continue;
+
+		if(mQuit.load()) return;
+
+		// Announce sleep, then check for work once more. Whoever adds work
+		// does so before checking for sleepers, so either we see the work
+		// or they see us and post to the semaphore.
+		mSleepers.fetchAdd(1);
+		if(hasWork(w) || mQuit.load()){
+			int s = mSleepers.load();
+			while(s > 0 && !mSleepers.compareExchange(s, s-1)){}
+			// if we were already counted as woken, consume the post
+			if(s <= 0) mWake.wait();
+			continue;
+		}
+		w.counters.sleeps.fetchAdd(1);
+		mWake.wait();
+	}
+}
+
+
+bool ThreadPool::joinLoop(Worker& w){
+	unsigned gen = mLoopGen.load();
+	if(gen == w.loopGen) return false;
+	w.loopGen = gen;
+	mLoopUsers.fetchAdd(1);
+	// the loop may have ended since reading its generation
+	if(mLoopOpen.load() && mLoopGen.load() == gen){
+		loopWork(w.index, w.counters);
+	}
+	mLoopUsers.fetchSub(1);
+	return true;
+}
+
+bool ThreadPool::takeChunk(int slot, int& chunk){
+	Atomic<uint64_t>& range = mLoopRanges[slot];
+	uint64_t r = range.load();
+	for(;;){
+		uint32_t lo, hi;
+		unpackRange(r, lo, hi);
+		if(lo >= hi) return false;
+		if(range.compareExchange(r, packRange(lo+1, hi))){
+			chunk = lo;
+			return true;
+		}
+	}
+}
+
+bool ThreadPool::stealChunks(int slot){
+	for(;;){
+		// pick the thread with the most chunks left
+		int victim = -1;
+		uint32_t most = 0;
+		uint64_t r = 0;
+		for(int i=0; i<=mSize; ++i){
+			if(i == slot) continue;
+			uint64_t ri = mLoopRanges[i].load();
+			uint32_t lo, hi;
+			unpackRange(ri, lo, hi);
+			if(lo < hi && hi-lo > most){
+				most = hi-lo;
+				victim = i;
+				r = ri;
+			}
+		}
+		if(victim < 0) return false;
+
+		// take upper half of its chunks
+		uint32_t lo, hi;
+		unpackRange(r, lo, hi);
+		uint32_t mid = hi - (hi-lo+1)/2;
+		if(mLoopRanges[victim].compareExchange(r, packRange(lo, mid))){
+			mLoopRanges[slot].store(packRange(mid, hi));
+			return true;
+		}
+	}
+}
+
+void ThreadPool::loopWork(int slot, Counters& c){
+	unsigned chunks = 0, steals = 0;
+	for(;;){
+		int chunk;
+		while(takeChunk(slot, chunk)){
+			int b = mLoopBegin + chunk * mLoopGrain;
+			int e = b + mLoopGrain;
+			if(e > mLoopEnd) e = mLoopEnd;
+			(*mLoopBody)(b, e);
+			++chunks;
+		}
+		if(!stealChunks(slot)) break;
+		++steals;
+	}
+	c.chunks.fetchAdd(chunks);
+	c.steals.fetchAdd(steals);
+	mLoopChunksDone.fetchAdd(chunks);
+}
+
+void ThreadPool::runLoop(int begin, int end, int grain, LoopBody& body){
+	if(grain < 1) grain = 1;
+	if(end <= begin) return;
+	int numChunks = (end - begin + grain-1) / grain;
+
+	int idle = 0;
+	if(numChunks < 2 || currentWorker || !mLoopBusy.compareExchange(idle, 1)){
+		body(begin, end);
+		return;
+	}
+
+	mLoopBody = &body;
+	mLoopBegin = begin;
+	mLoopEnd = end;
+	mLoopGrain = grain;
+	mLoopChunksDone.store(0);
+
+	// distribute chunks evenly, with the calling thread in the last slot
+	int numSlots = mSize+1;
+	for(int i=0; i<numSlots; ++i){
+		uint32_t lo = uint64_t(numChunks) * i / numSlots;
+		uint32_t hi = uint64_t(numChunks) * (i+1) / numSlots;
+		mLoopRanges[i].store(packRange(lo, hi));
+	}
+
+	// open before publishing generation, so a worker that sees the new
+	// generation also sees the loop open
+	mLoopOpen.exchange(1);
+	mLoopGen.fetchAdd(1);
+	wakeAll();
+
+	loopWork(mSize, mExternal);
+
+	// wait for chunks taken by workers
+	while(mLoopChunksDone.load() != numChunks) spinPause();
+
+	// close loop and wait for workers to leave it
+	mLoopOpen.exchange(0);
+	while(mLoopUsers.load() != 0) spinPause();
+
+	mLoopBusy.store(0);
+}
+
+
+ThreadPool::Stats ThreadPool::stats(int i) const {
+	const Counters& c = i < mSize ? mWorkers[i].counters : mExternal;
+	Stats s;
+	s.tasks  = c.tasks.loadRelaxed();
+	s.chunks = c.chunks.loadRelaxed();
+	s.steals = c.steals.loadRelaxed();
+	s.sleeps = c.sleeps.loadRelaxed();
+	return s;
+}
+
+void ThreadPool::resetStats(){
+	for(int i=0; i<=mSize; ++i){
+		Counters& c = i < mSize ? mWorkers[i].counters : mExternal;
+		c.tasks.store(0);
+		c.chunks.store(0);
+		c.steals.store(0);
+		c.sleeps.store(0);
+	}
+}
+
+} // al::
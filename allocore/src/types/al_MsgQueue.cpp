@@ -7,61 +7,58 @@
 
 namespace al{
 
-MsgQueue :: MsgQueue(int size, malloc_func mfunc, free_func ffunc)
-:	mHead(NULL), mTail(NULL), mPool(NULL),
-	mLen(0), mChunkSize(0), mNow(0),
-	mMalloc(mfunc ? mfunc : malloc), mFree(ffunc ? ffunc : free)
+MsgQueue :: MsgQueue(int size, malloc_func mfunc, free_func ffunc, Scheduler sched)
+:	mHead(NULL), mTail(NULL), mPool(NULL), mSlabs(NULL), mHeap(NULL),
+	mLen(0), mChunkSize(size > 0 ? size : 1), mHeapSize(0), mOrder(0), mNow(0),
+	mMalloc(mfunc ? mfunc : malloc), mFree(ffunc ? ffunc : free),
+	mScheduler(sched)
 {
-	growPool(size);
+	growPool(mChunkSize);
 }
 
 MsgQueue :: ~MsgQueue() {
-	Msg * m;
-	while (mHead) {
-		m = mHead->next;
-		recycle(mHead);
-		mHead = m;
-	}
-	while (mPool) {
-		m = mPool->next;
-		mFree(mPool);
-		mPool = m;
+	clear();
+	while (mSlabs) {
+		Msg * m = mSlabs->next;
+		mFree(mSlabs);
+		mSlabs = m;
 	}
+	if (mHeap) mFree(mHeap);
 }
 
+/* allocate a slab of messages and add them to the pool */
 void MsgQueue :: growPool(int size) {
-	assert(!mPool); // LJP
-	mPool = (Msg *)mMalloc(sizeof(Msg));
-	Msg * m = mPool;
-	while (size--) {
-		m->next = (Msg *)mMalloc(sizeof(Msg));
-		m = m->next;
+	// the first message of the slab only links the slabs together
+	Msg * slab = (Msg *)mMalloc(sizeof(Msg) * (size+1));
+	slab->next = mSlabs;
+	mSlabs = slab;
+	for (int i=size; i>=1; --i) {
+		slab[i].next = mPool;
+		mPool = slab + i;
 	}
-	m->next = NULL;
 }
 
 /* push a message back into the pool */
 void MsgQueue :: recycle(Msg * m) {
-	assert(mLen); // LJP
-	m->next = mPool;
-	mPool = m;
 	if (m->isBigMessage()) {
 		char * args = *(char **)(m->mArgs);
 		mFree(args);
 	}
-	mLen--;
+	m->next = mPool;
+	mPool = m;
 }
 
 /* schedule a new message */
 void MsgQueue :: sched(al_sec at, msg_func func, char * data, size_t size) {
-	assert(mPool);
 	// get a message-holder from the pool:
+	if (mPool == NULL) growPool(mChunkSize);
 	Msg * m = mPool;
 	mPool= m->next;
 
 	// prepare Msg:
 	m->next = NULL;
 	m->t = at;
+	m->order = mOrder++;
 	m->func = func;
 	m->size = size;
 	if (m->isBigMessage()) {
@@ -73,13 +70,18 @@ void MsgQueue :: sched(al_sec at, msg_func func, char * data, size_t size) {
 		memcpy(m->mArgs, data, size);
 	}
 
-	// insert into queue
+	if (HEAP == mScheduler) insertHeap(m);
+	else insertList(m);
+	mLen++;
+}
+
+void MsgQueue :: insertList(Msg * m) {
+	const al_sec at = m->t;
 
 	// empty queue? set as new head and tail:
 	if (mHead == NULL) {
 		mHead = m;
 		mTail = m;
-		mLen = 1;
 		return;
 	}
 
@@ -87,7 +89,6 @@ void MsgQueue :: sched(al_sec at, msg_func func, char * data, size_t size) {
 	if (at < mHead->t) {
 		m->next = mHead;
 		mHead = m;
-		mLen++;
 		return;
 	}
 
@@ -95,7 +96,6 @@ void MsgQueue :: sched(al_sec at, msg_func func, char * data, size_t size) {
 	if (at >= mTail->t) {
 		mTail->next = m;
 		mTail = m;
-		mLen++;
 		return;
 	}
 
@@ -109,13 +109,69 @@ void MsgQueue :: sched(al_sec at, msg_func func, char * data, size_t size) {
 	}
 	m->next = n;
 	p->next = m;
-	mLen++;
+}
+
+void MsgQueue :: insertHeap(Msg * m) {
+	// grow heap array by doubling:
+	if (mLen == mHeapSize) {
+		int size = mHeapSize ? mHeapSize*2 : mChunkSize;
+		Msg ** heap = (Msg **)mMalloc(sizeof(Msg *) * size);
+		if (mHeap) {
+			memcpy(heap, mHeap, sizeof(Msg *) * mLen);
+			mFree(mHeap);
+		}
+		mHeap = heap;
+		mHeapSize = size;
+	}
+
+	// sift up:
+	int i = mLen;
+	while (i > 0) {
+		int parent = (i-1)/2;
+		if (!before(m, mHeap[parent])) break;
+		mHeap[i] = mHeap[parent];
+		i = parent;
+	}
+	mHeap[i] = m;
+}
+
+/* remove earliest message from heap; mLen must still include it */
+MsgQueue::Msg * MsgQueue :: popHeap() {
+	Msg * top = mHeap[0];
+	Msg * last = mHeap[mLen-1];
+	int n = mLen-1;
+
+	// sift down:
+	int i = 0;
+	for (;;) {
+		int c = 2*i + 1;
+		if (c >= n) break;
+		if (c+1 < n && before(mHeap[c+1], mHeap[c])) ++c;
+		if (!before(mHeap[c], last)) break;
+		mHeap[i] = mHeap[c];
+		i = c;
+	}
+	mHeap[i] = last;
+	return top;
 }
 
 void MsgQueue :: update(al_sec until, bool defer) {
+	if (HEAP == mScheduler) {
+		while (mLen && mHeap[0]->t <= until) {
+			Msg * m = popHeap();
+			mLen--;
+			mNow = AL_MAX(mNow, m->t);
+			(m->func)(mNow, m->args());
+			recycle(m);
+		}
+		mNow = until;
+		return;
+	}
+
 	Msg * m = mHead;
 	while (m && m->t <= until) {
 		mHead = m->next;
+		mLen--;
 
 //		if (defer && m->retry > 0.) {
 //			m->msg.t = x->now + m->retry;
@@ -136,12 +192,16 @@ void MsgQueue :: update(al_sec until, bool defer) {
 
 void MsgQueue :: clear() {
 	// recycle everything:
+	if (HEAP == mScheduler) {
+		for (int i=0; i<mLen; ++i) recycle(mHeap[i]);
+	}
 	Msg * m = mHead;
 	while (m) {
 		mHead = m->next;
 		recycle(m);
 		m = mHead;
 	}
+	mLen = 0;
 	// reset clock:
 	mNow = 0;
 	mHead = NULL;
@@ -0,0 +1,245 @@
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "allocore/system/al_Printing.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
+#include "allocore/types/al_VoxelBricks.hpp"
+
+namespace al{
+
+namespace{
+
+// mean of 8 voxels, rounded for integer types
+template <class T> inline T average8(double sum){ return T(floor(sum * 0.125 + 0.5)); }
+template <> inline float average8<float>(double sum){ return float(sum * 0.125); }
+
+} // ::
+
+
+// Fills bricks [begin, end) of a level, from the source volume for level 0
+// or else from the next finer level
+struct VoxelBricks::BuildBody : public ThreadPool::LoopBody{
+	const Array * src;
+	const Level * finer;
+	Level * level;
+	uint32_t B;
+	void (*fill)(const BuildBody& b, uint32_t index);
+
+	void operator()(int begin, int end){
+		for(int i=begin; i<end; ++i) fill(*this, i);
+	}
+
+	template <class T>
+	static void fillBrick(const BuildBody& b, uint32_t index){
+		const uint32_t B = b.B;
+		Level& l = *b.level;
+		Brick& m = l.meta[index];
+		m.x = index % l.bricks[0];
+		m.y = (index / l.bricks[0]) % l.bricks[1];
+		m.z = index / (l.bricks[0] * l.bricks[1]);
+		T * dst = (T *)&l.data[0] + size_t(index)*B*B*B;
+
+		// voxels of the brick within the level; the rest are padding
+		const uint32_t x0 = m.x*B, y0 = m.y*B, z0 = m.z*B;
+		const uint32_t nx = std::min(B, l.dim[0] - x0);
+		const uint32_t ny = std::min(B, l.dim[1] - y0);
+		const uint32_t nz = std::min(B, l.dim[2] - z0);
+
+		float lo = FLT_MAX, hi = -FLT_MAX;
+		double sum = 0;
+
+		for(uint32_t lz=0; lz<B; ++lz){
+			for(uint32_t ly=0; ly<B; ++ly){
+				T * row = dst + (lz*B + ly)*B;
+				if(lz >= nz || ly >= ny){
+					// repeat the last row or slice
+					const uint32_t sz = std::min(lz, nz-1), sy = std::min(ly, ny-1);
+					memcpy(row, dst + (sz*B + sy)*B, B*sizeof(T));
+					continue;
+				}
+				const uint32_t z = z0 + lz, y = y0 + ly;
+
+				if(b.src){
+					const Array& s = *b.src;
+					const char * p = s.data.ptr + z*s.stride(2) + y*s.stride(1) + x0*s.stride(0);
+					if(s.stride(0) == sizeof(T)){
+						memcpy(row, p, nx*sizeof(T));
+					}
+					else{
+						for(uint32_t lx=0; lx<nx; ++lx) row[lx] = *(const T *)(p + lx*s.stride(0));
+					}
+				}
+				else{
+					// average 2x2x2 voxels of the finer level; as B is even,
+					// they are in one brick, whose padding repeats the edge
+					const Level& f = *b.finer;
+					const uint32_t fz = 2*z, fy = 2*y;
+					const size_t bzy = f.bricks[0]*((fy/B) + f.bricks[1]*(fz/B));
+					const size_t zy = ((fz%B)*B + (fy%B))*B;
+					for(uint32_t lx=0; lx<nx; ++lx){
+						const uint32_t fx = 2*(x0 + lx);
+						const T * c = (const T *)&f.data[0] + (bzy + fx/B)*B*B*B + zy + (fx%B);
+						double s = double(c[0]) + c[1] + c[B] + c[B+1]
+							+ c[B*B] + c[B*B+1] + c[B*B+B] + c[B*B+B+1];
+						row[lx] = average8<T>(s);
+					}
+				}
+
+				for(uint32_t lx=0; lx<nx; ++lx){
+					const float v = row[lx];
+					if(v < lo) lo = v;
+					if(v > hi) hi = v;
+					sum += v;
+				}
+				// repeat the last voxel
+				for(uint32_t lx=nx; lx<B; ++lx) row[lx] = row[nx-1];
+			}
+		}
+
+		m.min = lo;
+		m.max = hi;
+		m.mean = float(sum / (double(nx)*ny*nz));
+	}
+};
+
+
+VoxelBricks::VoxelBricks(int brickSize)
+:	mBrickSize(brickSize < 2 ? 2 : (brickSize + 1) & ~1), mType(AlloVoidTy)
+{}
+
+void VoxelBricks::clear(){
+	mLevels.clear();
+	mType = AlloVoidTy;
+}
+
+bool VoxelBricks::build(const Array& src, ThreadPool * pool){
+	clear();
+
+	void (*fill)(const BuildBody&, uint32_t);
+	switch(src.type()){
+		case AlloSInt8Ty:	fill = BuildBody::fillBrick<int8_t>; break;
+		case AlloUInt8Ty:	fill = BuildBody::fillBrick<uint8_t>; break;
+		case AlloSInt16Ty:	fill = BuildBody::fillBrick<int16_t>; break;
+		case AlloUInt16Ty:	fill = BuildBody::fillBrick<uint16_t>; break;
+		case AlloFloat32Ty:	fill = BuildBody::fillBrick<float>; break;
+		default:
+			AL_WARN("VoxelBricks: unsupported voxel type");
+			return false;
+	}
+	if(src.components() != 1 || !src.hasData()){
+		AL_WARN("VoxelBricks: volume must have one component");
+		return false;
+	}
+	mType = src.type();
+
+	// levels down to one that fits in a brick
+	const uint32_t B = mBrickSize;
+	uint32_t dim[3];
+	for(int i=0; i<3; ++i) dim[i] = std::max(src.dim(i), 1u);
+	while(true){
+		mLevels.push_back(Level());
+		Level& l = mLevels.back();
+		size_t n = 1;
+		for(int i=0; i<3; ++i){
+			l.dim[i] = dim[i];
+			l.bricks[i] = (dim[i] + B-1) / B;
+			n *= l.bricks[i];
+		}
+		l.meta.resize(n);
+		l.data.resize(n*B*B*B*allo_type_size(mType));
+		if(dim[0] <= B && dim[1] <= B && dim[2] <= B) break;
+		for(int i=0; i<3; ++i) dim[i] = (dim[i] + 1) / 2;
+	}
+
+	// each level depends on the previous, so only bricks within a level
+	// are built in parallel
+	for(unsigned i=0; i<mLevels.size(); ++i){
+		BuildBody body;
+		body.src = i ? NULL : &src;
+		body.finer = i ? &mLevels[i-1] : NULL;
+		body.level = &mLevels[i];
+		body.B = B;
+		body.fill = fill;
+		int n = mLevels[i].meta.size();
+		if(pool) pool->runLoop(0, n, 1, body);
+		else body(0, n);
+	}
+	return true;
+}
+
+double VoxelBricks::value(int level, uint32_t x, uint32_t y, uint32_t z) const {
+	const uint32_t B = mBrickSize;
+	const char * p = brickData(level, brickIndex(level, x/B, y/B, z/B));
+	const size_t i = ((z%B)*B + (y%B))*B + (x%B);
+	switch(mType){
+		case AlloSInt8Ty:	return ((const int8_t *)p)[i];
+		case AlloUInt8Ty:	return ((const uint8_t *)p)[i];
+		case AlloSInt16Ty:	return ((const int16_t *)p)[i];
+		case AlloUInt16Ty:	return ((const uint16_t *)p)[i];
+		case AlloFloat32Ty:	return ((const float *)p)[i];
+		default:			return 0;
+	}
+}
+
+uint32_t VoxelBricks::bricksInRange(std::vector<uint32_t>& indices, int level, float lo, float hi) const {
+	indices.clear();
+	const std::vector<Brick>& meta = mLevels[level].meta;
+	for(uint32_t i=0; i<meta.size(); ++i){
+		if(meta[i].overlaps(lo, hi)) indices.push_back(i);
+	}
+	return indices.size();
+}
+
+bool VoxelBricks::read(Array& dst, int level, uint32_t x0, uint32_t y0, uint32_t z0,
+	uint32_t nx, uint32_t ny, uint32_t nz) const {
+	if(level < 0 || level >= levels()) return false;
+	const Level& l = mLevels[level];
+	if(uint64_t(x0)+nx > l.dim[0] || uint64_t(y0)+ny > l.dim[1] || uint64_t(z0)+nz > l.dim[2]) return false;
+
+	const uint32_t B = mBrickSize;
+	const size_t ts = allo_type_size(mType);
+	dst.format(1, mType, nx, ny, nz);
+	for(uint32_t z=z0; z<z0+nz; ++z){
+		for(uint32_t y=y0; y<y0+ny; ++y){
+			char * o = dst.data.ptr + (z-z0)*dst.stride(2) + (y-y0)*dst.stride(1);
+			// copy runs of the row within each brick
+			for(uint32_t x=x0; x<x0+nx; ){
+				const uint32_t lx = x%B;
+				const uint32_t run = std::min(B - lx, x0+nx - x);
+				const char * p = brickData(level, brickIndex(level, x/B, y/B, z/B));
+				memcpy(o, p + (((z%B)*B + (y%B))*B + lx)*ts, run*ts);
+				o += run*ts;
+				x += run;
+			}
+		}
+	}
+	return true;
+}
+
+uint32_t VoxelBricks::atlas(Array& dst, int level, const std::vector<uint32_t>& indices, uint32_t side) const {
+	const uint32_t n = indices.size();
+	if(!side){
+		side = 1;
+		while(side*side*side < n) ++side;
+	}
+	const uint32_t layers = std::max(1u, (n + side*side-1) / (side*side));
+
+	const uint32_t B = mBrickSize;
+	const size_t rowSize = B*allo_type_size(mType);
+	dst.format(1, mType, side*B, side*B, layers*B);
+	for(uint32_t i=0; i<n; ++i){
+		const uint32_t sx = (i % side)*B, sy = ((i / side) % side)*B, sz = (i / (side*side))*B;
+		const char * p = brickData(level, indices[i]);
+		for(uint32_t z=0; z<B; ++z){
+			for(uint32_t y=0; y<B; ++y){
+				char * o = dst.data.ptr + (sz+z)*dst.stride(2) + (sy+y)*dst.stride(1) + sx*dst.stride(0);
+				memcpy(o, p, rowSize);
+				p += rowSize;
+			}
+		}
+	}
+	return side;
+}
+
+} // al::
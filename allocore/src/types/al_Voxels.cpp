@@ -1,14 +1,31 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include "allocore/types/al_Voxels.hpp"
 #include "allocore/io/al_File.hpp"
+#include "allocore/system/al_Atomic.hpp"
 #include "allocore/system/al_Printing.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
+
+#ifdef AL_WINDOWS
+  #include <io.h>
+  #include <windows.h>
+#else
+  #include <sys/mman.h>
+  #include <unistd.h>
+#endif
 
 namespace al {
 
-MRCHeader& Voxels::parseMRC(const char * mrcData) {
-  MRCHeader& mrcHeader = *(MRCHeader *)mrcData;
+namespace {
 
+// Checks for foreign byte order and swaps the header to native order;
+// returns whether it was swapped
+bool decodeMRCHeader(MRCHeader& mrcHeader) {
   // check for byte swap:
   bool swapped =
     (mrcHeader.nx <= 0 || mrcHeader.ny <= 0 || mrcHeader.nz <= 0 ||
@@ -19,7 +36,6 @@ MRCHeader& Voxels::parseMRC(const char * mrcData) {
 
   // ugh.
   if (swapped) {
-    printf("swapping byte order...\n");
     swapBytes(&mrcHeader.nx, 10);
     swapBytes(&mrcHeader.xlen, 6);
     swapBytes(&mrcHeader.mapx, 3);
@@ -36,90 +52,153 @@ MRCHeader& Voxels::parseMRC(const char * mrcData) {
     swapBytes(&mrcHeader.rms, 1);
     swapBytes(&mrcHeader.nlabl, 1);
   }
+  return swapped;
+}
 
-  printf("NX %d NY %d NZ %d\n", mrcHeader.nx, mrcHeader.ny, mrcHeader.nz);
-  printf("mode ");
+// Array type of voxels in an MRC mode, or AlloVoidTy if not supported
+AlloTy mrcType(int32_t mode) {
+  switch (mode) {
+    case MRC_IMAGE_SINT8:   return Array::type<int8_t>();
+    case MRC_IMAGE_SINT16:  return Array::type<int16_t>();
+    case MRC_IMAGE_FLOAT32: return Array::type<float_t>();
+    case MRC_IMAGE_UINT16:  return Array::type<uint16_t>();
+    default:                return AlloVoidTy;
+  }
+}
 
-  AlloTy ty;
+// Voxel data follows the header and any extended header
+size_t mrcDataOffset(const MRCHeader& mrcHeader) {
+  return 1024 + (mrcHeader.next > 0 ? mrcHeader.next : 0);
+}
 
-  // set type:
+void printMRCHeader(const MRCHeader& mrcHeader) {
+  printf("NX %d NY %d NZ %d\n", mrcHeader.nx, mrcHeader.ny, mrcHeader.nz);
+  printf("mode ");
   switch (mrcHeader.mode) {
-    case MRC_IMAGE_SINT8:
-      printf("signed int 8\n");
-      ty = Array::type<int8_t>();
-      break;
-    case MRC_IMAGE_SINT16:
-      printf("signed int 16\n");
-      ty = Array::type<int16_t>();
-      break;
-    case MRC_IMAGE_FLOAT32:
-      printf("float\n");
-      ty = Array::type<float_t>();
-      break;
-    case MRC_IMAGE_UINT16:
-      printf("unsigned int 16\n");
-      ty = Array::type<uint16_t>();
-      break;
-    default:
-      printf("MRC mode not supported\n");
-      break;
+    case MRC_IMAGE_SINT8:   printf("signed int 8\n"); break;
+    case MRC_IMAGE_SINT16:  printf("signed int 16\n"); break;
+    case MRC_IMAGE_FLOAT32: printf("float\n"); break;
+    case MRC_IMAGE_UINT16:  printf("unsigned int 16\n"); break;
+    default:                printf("MRC mode not supported\n"); break;
   }
-
   printf("cell dimensions X %f Y %f Z %f\n", mrcHeader.xlen, mrcHeader.ylen, mrcHeader.zlen);
   printf("axis X %d axis Y %d axis Z %d\n", mrcHeader.mapx, mrcHeader.mapy, mrcHeader.mapz);
   printf("density min %f max %f mean %f\n", mrcHeader.amin, mrcHeader.amax, mrcHeader.amean);
   printf("origin %f %f %f\n", mrcHeader.origin[0], mrcHeader.origin[1], mrcHeader.origin[2]);
-  printf("map %s\n", mrcHeader.cmap);
-  printf("machine stamp %s\n", mrcHeader.machinestamp);
+  printf("map %.4s\n", mrcHeader.cmap);
+  printf("machine stamp %.4s\n", mrcHeader.machinestamp);
   printf("rms %f\n", mrcHeader.rms);
   printf("labels %d\n", mrcHeader.nlabl);
-  for (int i=0; i<mrcHeader.nlabl; i++) {
-    //printf("\t%02d: %s\n", i, mrcHeader.labels[i]);
+}
+
+// Swaps byte order of count voxels of a given size in place
+void swapVoxels(char * data, size_t typeSize, size_t count) {
+  // swapBytes takes an unsigned count, so go in chunks
+  const size_t chunk = 1<<24;
+  for (size_t i=0; i<count; i+=chunk) {
+    unsigned n = count-i < chunk ? count-i : chunk;
+    switch (typeSize) {
+      case 2: swapBytes((uint16_t *)data + i, n); break;
+      case 4: swapBytes((uint32_t *)data + i, n); break;
+      case 8: swapBytes((uint64_t *)data + i, n); break;
+      default: return;
+    }
   }
+}
 
-  const char * start = mrcData + 1024;
+// Reads n bytes at an offset into a file, without moving its file position
+bool readAt(int fd, char * dst, size_t n, uint64_t offset) {
+  while (n) {
+    size_t chunk = n < (size_t(1)<<30) ? n : (size_t(1)<<30);
+#ifdef AL_WINDOWS
+    // no pread; ReadFile reads at the offset given in the OVERLAPPED struct
+    HANDLE h = (HANDLE)_get_osfhandle(fd);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    OVERLAPPED ol;
+    memset(&ol, 0, sizeof(ol));
+    ol.Offset = DWORD(offset);
+    ol.OffsetHigh = DWORD(offset >> 32);
+    DWORD r = 0;
+    if (!ReadFile(h, dst, DWORD(chunk), &r, &ol) || r == 0) return false;
+#else
+    ssize_t r = pread(fd, dst, chunk, off_t(offset));
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) return false;
+#endif
+    dst += r;
+    n -= r;
+    offset += r;
+  }
+  return true;
+}
+
+int openRead(const std::string& filename) {
+#ifdef AL_WINDOWS
+  return _open(filename.c_str(), _O_RDONLY | _O_BINARY);
+#else
+  return ::open(filename.c_str(), O_RDONLY);
+#endif
+}
+
+void closeFile(int fd) {
+#ifdef AL_WINDOWS
+  _close(fd);
+#else
+  ::close(fd);
+#endif
+}
+
+} // ::
+
+MRCHeader& Voxels::parseMRC(const char * mrcData) {
+  MRCHeader& mrcHeader = *(MRCHeader *)mrcData;
+
+  bool swapped = decodeMRCHeader(mrcHeader);
+  if (swapped) printf("swapping byte order...\n");
+  printMRCHeader(mrcHeader);
+
+  AlloTy ty = mrcType(mrcHeader.mode);
+
+  const char * start = mrcData + mrcDataOffset(mrcHeader);
 
   formatAligned(1, ty, mrcHeader.nx, mrcHeader.ny, mrcHeader.nz, 0);
   memcpy(data.ptr, start, size());
 
   if (swapped) {
-    // set type:
-    switch (mrcHeader.mode) {
-      case MRC_IMAGE_SINT8:
-        swapBytes((int8_t *)data.ptr, cells());
-        break;
-      case MRC_IMAGE_SINT16:
-        swapBytes((int16_t *)data.ptr, cells());
-        break;
-      case MRC_IMAGE_FLOAT32:
-        swapBytes((float_t *)data.ptr, cells());
-        break;
-      case MRC_IMAGE_UINT16:
-        swapBytes((uint16_t *)data.ptr, cells());
-        break;
-      default:
-        break;
-    }
+    swapVoxels(data.ptr, allo_type_size(ty), size() / allo_type_size(ty));
   }
 
   return mrcHeader;
 }
 
+void Voxels::setFromMRCHeader(const MRCHeader& header) {
+  m_units = VOX_NANOMETERS; // default to nanometers
+  m_voxWidth[0] = header.xlen * 0.1f;
+  m_voxWidth[1] = header.ylen * 0.1f;
+  m_voxWidth[2] = header.zlen * 0.1f;
+}
+
 bool Voxels::loadFromMRC(std::string filename, bool update) {
+  unmap();
   zero();
 
-  File data_file(filename, "rb", true);
-
-  printf("Reading Data File: %s\n", data_file.path().c_str());
+  printf("Reading Data File: %s\n", filename.c_str());
 
-  if(!data_file.opened()) {
+  // read voxels straight into this array, rather than copying the file
+  MRCStream stream;
+  if (!stream.open(filename)) {
     AL_WARN("Cannot open MRC file");
     exit(EXIT_FAILURE);
   }
 
-  MRCHeader header = parseMRC(data_file.readAll());
+  MRCHeader header = stream.header();
+  if (stream.swapped()) printf("swapping byte order...\n");
+  printMRCHeader(header);
 
-  data_file.close();
+  if (!stream.read(*this, 0, 0, 0, header.nx, header.ny, header.nz)) {
+    AL_WARN("Cannot read MRC file");
+    return false;
+  }
 
   if (update) {
     // convert into angstrom
@@ -129,10 +208,7 @@ bool Voxels::loadFromMRC(std::string filename, bool update) {
 
     writeToMRC(filename + "_new", header);
   } else {
-    m_units = VOX_NANOMETERS; // default to nanometers
-    m_voxWidth[0] = header.xlen * 0.1f;
-    m_voxWidth[1] = header.ylen * 0.1f;
-    m_voxWidth[2] = header.zlen * 0.1f;
+    setFromMRCHeader(header);
   }
 
   m_min = header.amin;
@@ -184,6 +260,7 @@ bool Voxels::writeToMRC(std::string filename, MRCHeader& header) {
 }
 
 bool Voxels::loadFromFile(std::string filename) {
+  unmap();
   zero();
 
   File data_file(filename, "rb", true);
@@ -241,9 +318,403 @@ bool Voxels::writeToFile(std::string filename) {
   return true;
 }
   
+namespace {
+
+// luminance with weights 0.299, 0.587 and 0.114; the integer weights sum to
+// 256, so grey pixels keep their value
+inline uint8_t luminance(uint8_t r, uint8_t g, uint8_t b) {
+  return uint8_t((77u*r + 150u*g + 29u*b + 128u) >> 8);
+}
+inline uint16_t luminance(uint16_t r, uint16_t g, uint16_t b) {
+  return uint16_t((77u*r + 150u*g + 29u*b + 128u) >> 8);
+}
+inline int16_t luminance(int16_t r, int16_t g, int16_t b) {
+  return int16_t((77*r + 150*g + 29*b + 128) >> 8);
+}
+inline float luminance(float r, float g, float b) {
+  return 0.299f*r + 0.587f*g + 0.114f*b;
+}
+
+// Copy a channel, or the luminance, of a row of n pixels. The number of
+// planes is a template parameter so that the compiler can vectorize the
+// loops over interleaved samples.
+template <class T, int planes>
+void sliceRow(T * dst, const T * src, unsigned n, int channel) {
+  if (channel == Voxels::SLICE_LUMINANCE) {
+    for (unsigned i = 0; i < n; ++i) {
+      const T * p = src + i*planes;
+      dst[i] = luminance(p[0], p[1], p[2]);
+    }
+  } else {
+    for (unsigned i = 0; i < n; ++i) dst[i] = src[i*planes + channel];
+  }
+}
+
+template <class T>
+void copySlice(Array& dst, unsigned z, const Array& src, int channel) {
+  const unsigned nx = src.width(), ny = src.height();
+  const int planes = src.components();
+  for (unsigned y = 0; y < ny; ++y) {
+    T * d = (T *)(dst.data.ptr + z*dst.stride(2) + y*dst.stride(1));
+    const T * s = (const T *)(src.data.ptr + y*src.stride(1));
+    switch (planes) {
+      case 1: memcpy(d, s, nx*sizeof(T)); break;
+      case 3: sliceRow<T,3>(d, s, nx, channel); break;
+      default: sliceRow<T,4>(d, s, nx, channel); break;
+    }
+  }
+}
+
+// Copy a decoded slice into a volume of its sample type
+void copySlice(Array& dst, unsigned z, const Array& src, int channel) {
+  switch (src.type()) {
+    case AlloUInt8Ty:   copySlice<uint8_t>(dst, z, src, channel); break;
+    case AlloUInt16Ty:  copySlice<uint16_t>(dst, z, src, channel); break;
+    case AlloSInt16Ty:  copySlice<int16_t>(dst, z, src, channel); break;
+    case AlloFloat32Ty: copySlice<float>(dst, z, src, channel); break;
+    default: break;
+  }
+}
+
+enum SliceError {
+  SLICE_OK = 0,
+  SLICE_UNREADABLE,
+  SLICE_MISMATCH,
+  SLICE_CANCELLED
+};
+
+// Decodes and copies slices [begin, end) into the volume, on any thread
+struct SliceLoader : public ThreadPool::LoopBody {
+  SliceLoader(const vector<string>& files_, Array& volume_, const Array& first, int channel_,
+              Voxels::SliceProgress progress_, void * userData_)
+  : files(files_), volume(volume_), channel(channel_),
+    progress(progress_), userData(userData_),
+    type(first.type()), planes(first.components()),
+    nx(first.width()), ny(first.height()),
+    done(1), failed(-1), error(SLICE_OK) {}
+
+  void operator()(int begin, int end) {
+    Image image;
+    for (int z = begin; z < end; ++z) {
+      // stop at the first failure
+      if (failed.load() >= 0) return;
+
+      if (!image.load(files[z])) {
+        fail(z, SLICE_UNREADABLE);
+        return;
+      }
+      const Array& a = image.array();
+      if (a.width() != nx || a.height() != ny || a.type() != type || a.components() != planes) {
+        fail(z, SLICE_MISMATCH);
+        return;
+      }
+      copySlice(volume, z, a, channel);
+
+      int n = done.fetchAdd(1) + 1;
+      if (progress && !progress(n, files.size(), userData)) {
+        fail(z, SLICE_CANCELLED);
+        return;
+      }
+    }
+  }
+
+  void fail(int z, SliceError e) {
+    int none = -1;
+    if (failed.compareExchange(none, z)) error.store(e);
+  }
+
+  const vector<string>& files;
+  Array& volume;
+  int channel;
+  Voxels::SliceProgress progress;
+  void * userData;
+  AlloTy type;
+  int planes;
+  unsigned nx, ny;
+  Atomic<int> done;   // number of slices copied
+  Atomic<int> failed; // first slice to fail, or -1
+  Atomic<int> error;  // why it failed
+};
+
+} // ::
+
+bool Voxels::loadFromImages(const std::string& dir, SliceChannel channel,
+                            ThreadPool * pool, SliceProgress progress, void * userData) {
+  unmap();
+  allo_array_destroy(this);
+  header.components = 1;
+
+  vector<string> files;
+  if (getdir(dir, files) != 0) {
+    AL_WARN("Cannot read directory %s", dir.c_str());
+    return false;
+  }
+  if (files.empty()) {
+    AL_WARN("No slices in directory %s", dir.c_str());
+    return false;
+  }
+  // readdir returns files in no particular order
+  std::sort(files.begin(), files.end());
+
+  // the first slice sets the format of the volume
+  Image first;
+  if (!first.load(files[0])) {
+    AL_WARN("Cannot read slice %s", files[0].c_str());
+    return false;
+  }
+  const Array& a = first.array();
+  switch (a.type()) {
+    case AlloUInt8Ty: case AlloUInt16Ty: case AlloSInt16Ty: case AlloFloat32Ty: break;
+    default:
+      AL_WARN("Unsupported sample type in slice %s", files[0].c_str());
+      return false;
+  }
+  if (a.components() == 1) {
+    channel = SLICE_RED;
+  } else if (channel >= int(a.components()) && channel != SLICE_LUMINANCE) {
+    AL_WARN("Slice %s has no alpha channel", files[0].c_str());
+    return false;
+  }
+
+  float vx = 1.;
+  float vy = 1.;
+  float vz = 1.;
+  UnitsTy units = VOX_NANOMETERS;
+  vector<string> info;
+  if (parseInfo(dir, info) == 0) {
+    if (info.size() == 4) {
+      units = atoi(info[0].c_str());
+      vx = atof(info[1].c_str());
+      vy = atof(info[2].c_str());
+      vz = atof(info[3].c_str());
+    } else {
+      AL_WARN("%s/info.txt should have 4 lines, using 1 nm voxels", dir.c_str());
+    }
+  }
+
+  printf("Assembling %d slices of %d x %d from %s\n", int(files.size()), int(a.width()), int(a.height()), dir.c_str());
+  format(1, a.type(), a.width(), a.height(), files.size());
+  init(vx, vy, vz, units);
+
+  SliceLoader loader(files, *this, a, channel, progress, userData);
+  copySlice(*this, 0, a, channel);
+  if (progress && !progress(1, files.size(), userData)) {
+    loader.fail(0, SLICE_CANCELLED);
+  }
+  else if (pool) {
+    // one slice per chunk, so each thread decodes one slice at a time
+    pool->runLoop(1, files.size(), 1, loader);
+  } else {
+    loader(1, files.size());
+  }
+
+  int z = loader.failed.load();
+  if (z >= 0) {
+    switch (loader.error.load()) {
+      case SLICE_UNREADABLE: AL_WARN("Cannot read slice %s", files[z].c_str()); break;
+      case SLICE_MISMATCH: AL_WARN("Slice %s does not match the size or format of %s", files[z].c_str(), files[0].c_str()); break;
+      default: AL_WARN("Assembling slices from %s cancelled", dir.c_str()); break;
+    }
+    allo_array_destroy(this);
+    header.components = 1;
+    return false;
+  }
+  return true;
+}
+
 void Voxels::print(FILE * fp) {
   Array::print(fp);
   fprintf(fp,"  cell:   %s, %s, %s\n", printVoxWidth(0).c_str(), printVoxWidth(1).c_str(), printVoxWidth(2).c_str());
 }
 
+
+bool Voxels::mapWhole(const std::string& filename) {
+  unmap();
+  dataFree();
+#ifdef AL_WINDOWS
+  AL_WARN("Mapping files is not supported on Windows");
+  return false;
+#else
+  int fd = openRead(filename);
+  if (fd < 0) {
+    AL_WARN("Cannot open file %s", filename.c_str());
+    return false;
+  }
+  struct stat st;
+  void * map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    // private and writable, so voxels can be changed (or byte-swapped)
+    // without changing the file
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  }
+  closeFile(fd);
+  if (map == MAP_FAILED) {
+    AL_WARN("Cannot map file %s", filename.c_str());
+    return false;
+  }
+  m_map = map;
+  m_mapSize = st.st_size;
+  return true;
+#endif
+}
+
+bool Voxels::viewMapped(size_t offset, const AlloArrayHeader& h) {
+  char * start = (char *)m_map + offset;
+  if (offset > m_mapSize || allo_array_size_from_header(&h) > m_mapSize - offset) {
+    AL_WARN("Mapped file is too short for its voxels");
+    unmap();
+    return false;
+  }
+  if (uintptr_t(start) % allo_type_size(h.type)) {
+    AL_WARN("Mapped voxels are not aligned; use a load function instead");
+    unmap();
+    return false;
+  }
+  configure(h);
+  data.ptr = start;
+  return true;
+}
+
+void Voxels::unmap() {
+  if (!m_map) return;
+#ifndef AL_WINDOWS
+  munmap(m_map, m_mapSize);
+#endif
+  m_map = NULL;
+  m_mapSize = 0;
+  // leave an empty array, as from Array()
+  allo_array_clear(this);
+  header.components = 1;
+}
+
+bool Voxels::mapMRC(std::string filename) {
+  if (!mapWhole(filename)) return false;
+
+  MRCHeader header;
+  if (m_mapSize < sizeof(MRCHeader)) {
+    AL_WARN("MRC file is too short");
+    unmap();
+    return false;
+  }
+  memcpy(&header, m_map, sizeof(MRCHeader));
+  bool swapped = decodeMRCHeader(header);
+
+  AlloArrayHeader h;
+  h.type = mrcType(header.mode);
+  h.components = 1;
+  h.dimcount = 3;
+  h.dim[0] = header.nx;
+  h.dim[1] = header.ny;
+  h.dim[2] = header.nz;
+  h.dim[3] = 0;
+  deriveStride(h, 1);
+  if (h.type == AlloVoidTy) {
+    AL_WARN("MRC mode not supported");
+    unmap();
+    return false;
+  }
+  if (!viewMapped(mrcDataOffset(header), h)) return false;
+
+  if (swapped) {
+    swapVoxels(data.ptr, allo_type_size(h.type), size() / allo_type_size(h.type));
+  }
+
+  setFromMRCHeader(header);
+  m_min = header.amin;
+  m_max = header.amax;
+  m_mean = header.amean;
+  m_rms = header.rms;
+  return true;
+}
+
+bool Voxels::mapFile(std::string filename) {
+  if (!mapWhole(filename)) return false;
+
+  // layout as written by writeToFile()
+  const char * p = (const char *)m_map;
+  const size_t offset = 12 + sizeof(AlloArrayHeader) + sizeof(UnitsTy) + 3*sizeof(float);
+  if (m_mapSize < offset || strcmp(p, "Allo Voxels") != 0) {
+    AL_WARN("Not a voxel file: %s", filename.c_str());
+    unmap();
+    return false;
+  }
+  AlloArrayHeader h;
+  memcpy(&h, p + 12, sizeof(AlloArrayHeader));
+  p += 12 + sizeof(AlloArrayHeader);
+  memcpy(&m_units, p, sizeof(UnitsTy));
+  memcpy(m_voxWidth, p + sizeof(UnitsTy), 3*sizeof(float));
+
+  return viewMapped(offset, h);
+}
+
+
+MRCStream::MRCStream()
+: m_type(AlloVoidTy), m_swapped(false), m_fd(-1), m_offset(0)
+{
+  memset(&m_header, 0, sizeof(m_header));
+}
+
+MRCStream::~MRCStream() {
+  close();
+}
+
+bool MRCStream::open(std::string filename) {
+  close();
+  m_fd = openRead(filename);
+  if (m_fd < 0) return false;
+  if (!readAt(m_fd, (char *)&m_header, sizeof(MRCHeader), 0)) {
+    close();
+    return false;
+  }
+  m_swapped = decodeMRCHeader(m_header);
+  m_type = mrcType(m_header.mode);
+  m_offset = mrcDataOffset(m_header);
+  if (m_type == AlloVoidTy) {
+    AL_WARN("MRC mode not supported");
+    close();
+    return false;
+  }
+  return true;
+}
+
+void MRCStream::close() {
+  if (m_fd >= 0) closeFile(m_fd);
+  m_fd = -1;
+}
+
+bool MRCStream::read(Array& dst, uint32_t x0, uint32_t y0, uint32_t z0, uint32_t nx, uint32_t ny, uint32_t nz) const {
+  const uint64_t NX = m_header.nx, NY = m_header.ny, NZ = m_header.nz;
+  if (!opened() || !nx || !ny || !nz ||
+    uint64_t(x0) + nx > NX || uint64_t(y0) + ny > NY || uint64_t(z0) + nz > NZ) {
+    return false;
+  }
+
+  // rows are packed, like the file
+  dst.formatAligned(1, m_type, nx, ny, nz, 1);
+
+  const size_t typeSize = allo_type_size(m_type);
+  const size_t row = nx * typeSize;
+  char * out = dst.data.ptr;
+  uint64_t plane = m_offset + (uint64_t(z0) * NY * NX + uint64_t(y0) * NX + x0) * typeSize;
+
+  if (nx == NX && ny == NY) {
+    // the block is contiguous in the file
+    if (!readAt(m_fd, out, row * ny * nz, plane)) return false;
+  } else {
+    for (uint32_t z=0; z<nz; z++, plane += NY * NX * typeSize) {
+      if (nx == NX) {
+        if (!readAt(m_fd, out, row * ny, plane)) return false;
+        out += row * ny;
+      } else {
+        for (uint32_t y=0; y<ny; y++, out += row) {
+          if (!readAt(m_fd, out, row, plane + y * NX * typeSize)) return false;
+        }
+      }
+    }
+  }
+
+  if (m_swapped) swapVoxels(dst.data.ptr, typeSize, size_t(nx) * ny * nz);
+  return true;
+}
+
 }
\ No newline at end of file
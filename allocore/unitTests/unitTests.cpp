@@ -24,10 +24,12 @@ int main (int argc, char * const argv[]) {
 	RUNTEST(MathSpherical);
 	RUNTEST(Types);
 	RUNTEST(TypesConversion);
+	RUNTEST(TypesCommandQueue);
 	RUNTEST(Spatial);
 	RUNTEST(System);
 	RUNTEST(ProtocolOSC);
 	RUNTEST(ProtocolSerialize);
+	RUNTEST(ProtocolStateSync);
 
 	RUNTEST(IOSocket);
 	RUNTEST(File);
@@ -37,6 +39,8 @@ int main (int argc, char * const argv[]) {
 
 #ifndef ALLOCORE_TESTS_NO_AUDIO
 	RUNTEST(IOAudioIO);
+	RUNTEST(SoundAmbisonics);
+	RUNTEST(SoundAudioScene);
 #endif
 
 #ifndef ALLOCORE_TESTS_NO_GUI
@@ -25,10 +25,14 @@ int utGraphicsDraw();
 int utGraphicsMesh();
 int utProtocolOSC();
 int utProtocolSerialize();
+int utProtocolStateSync();
+int utSoundAmbisonics();
+int utSoundAudioScene();
 int utSpatial();
 int utSystem();
 int utTypes();
 int utTypesConversion();
+int utTypesCommandQueue();
 int utThread();
 int utFile();
 int utAsset();
@@ -1,4 +1,5 @@
 #include "utAllocore.h"
+#include "allocore/graphics/al_Isosurface.hpp"
 
 int utGraphicsMesh(){
 
@@ -43,5 +44,87 @@ int utGraphicsMesh(){
 
 	}
 
+	// Compress and weld
+	{
+		// two triangles of a quad sharing an edge
+		Mesh m;
+		m.vertex(0,0,0); m.vertex(1,0,0); m.vertex(1,1,0);
+		m.vertex(0,0,0); m.vertex(1,1,0); m.vertex(0,1,0);
+		for(int i=0; i<6; ++i) m.color(i<3 ? Color(1,0,0) : Color(0,1,0));
+
+		Mesh c(m);
+		c.compress();
+		assert(c.vertices().size() == 4);
+		assert(c.colors().size() == 4);
+		assert(c.colors()[0] == Color(1,0,0));	// first vertex is kept
+		unsigned ind[] = {0,1,2, 0,2,3};
+		for(int i=0; i<6; ++i) assert(c.indices()[i] == ind[i]);
+
+		// -0 is equal to +0
+		Mesh z;
+		z.vertex(0,0,0); z.vertex(-0.f,0,-0.f);
+		z.compress();
+		assert(z.vertices().size() == 1);
+
+		// shared vertices have different colors
+		Mesh w(m);
+		assert(w.weld() == 0);
+		assert(w.vertices().size() == 6);
+		for(int i=0; i<6; ++i) assert(w.indices()[i] == unsigned(i));
+
+		// weld within distance, remapping existing indices
+		w = m;
+		w.vertices()[3] += Vec3f(0.01, 0, 0);
+		w.vertices()[4] += Vec3f(0, -0.01, 0);
+		assert(w.weld(0.001, false) == 0);
+		assert(w.weld(0.02, false) == 2);
+		assert(w.vertices().size() == 4);
+		for(int i=0; i<6; ++i) assert(w.indices()[i] == ind[i]);
+	}
+
+	// Isosurface from field must match cell-at-a-time mode for any number of
+	// threads and with empty regions skipped
+	{
+		const int Nx=21, Ny=13, Nz=17;
+		std::vector<float> field(Nx*Ny*Nz);
+		for(int k=0; k<Nz; ++k){
+		for(int j=0; j<Ny; ++j){
+		for(int i=0; i<Nx; ++i){
+			float x = i-8.f, y = j-6.f, z = k-9.f;
+			field[i + Nx*(j + Ny*k)] = sqrt(x*x + y*y + z*z) + 0.5f*sin(i*1.7f + j*0.3f);
+		}}}
+
+		Isosurface ref(5);
+		ref.fieldDims(Nx,Ny,Nz).cellLengths(1,1,1);
+		ref.begin();
+		for(int k=Nz-2; k>=0; --k){
+		for(int j=0; j<Ny-1; ++j){
+		for(int i=0; i<Nx-1; ++i){
+			#define F(x,y,z) field[(i+x) + Nx*((j+y) + Ny*(k+z))]
+			float v8[] = { F(0,0,0), F(1,0,0), F(0,1,0), F(1,1,0), F(0,0,1), F(1,0,1), F(0,1,1), F(1,1,1) };
+			#undef F
+			int i3[] = {i,j,k};
+			ref.addCell(i3, v8);
+		}}}
+		ref.end();
+		assert(ref.vertices().size() > 0);
+
+		for(int t=1; t<=3; ++t){
+			for(int skip=0; skip<2; ++skip){
+				Isosurface iso(5);
+				iso.numThreads(t).skipEmpty(skip);
+				iso.generate(&field[0], Nx,Ny,Nz, 1,1,1);
+				assert(iso.vertices().size() == ref.vertices().size());
+				assert(iso.indices().size() == ref.indices().size());
+				for(int i=0; i<ref.vertices().size(); ++i){
+					assert(iso.vertices()[i] == ref.vertices()[i]);
+				}
+				for(int i=0; i<ref.indices().size(); ++i){
+					assert(iso.indices()[i] == ref.indices()[i]);
+				}
+			}
+		}
+	}
+
 	return 0;
 }
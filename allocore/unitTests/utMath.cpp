@@ -253,6 +253,17 @@ int utMath(){
 			assert(invert(m));
 		}
 
+		{
+			Mat<2,double> m(
+				1,2,
+				3,4
+			);
+
+			assert(invert(m));
+			assert(m(0,0) == -2 && m(0,1) == 1);
+			assert(m(1,0) == 1.5 && m(1,1) == -0.5);
+		}
+
 		{
 			Mat<3,int> m(
 				2,5,7,
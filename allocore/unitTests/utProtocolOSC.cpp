@@ -12,6 +12,25 @@ struct PacketData{
 	void print() const { printf("%x %g %g %d\n", i, f, d, c); }
 };
 
+struct DispatchTarget{
+	DispatchTarget(): calls(0), x(0), y(0), n(0), s(""){}
+	void bang(){ ++calls; }
+	void position(float x_, float y_){ ++calls; x=x_; y=y_; }
+	void count(int n_){ ++calls; n=n_; }
+	void label(const char * s_, int n_){ ++calls; s=s_; n=n_; }
+	void name(const std::string& s_){ ++calls; str=s_; }
+	void title(std::string s_, int n_){ ++calls; str+=s_; n=n_; }
+	int calls;
+	float x, y;
+	int n;
+	const char * s;
+	std::string str;
+};
+
+static void countMessage(osc::MessageView& m, void * user){
+	++*(int *)user;
+}
+
 int utProtocolOSC(){
 
 	using namespace al::osc;
@@ -84,6 +103,160 @@ int utProtocolOSC(){
 	assert(!p.isMessage());
 
 
+	// Read messages in place
+	{
+		struct ViewHandler : public osc::PacketHandler{
+			ViewHandler(): count(0){}
+			void onMessageView(osc::MessageView& m){
+				assert(m.valid());
+				if(!strcmp(m.addressPattern(), "/message11")){
+					assert(!strcmp(m.typeTags(), "ifds"));
+					assert(m.numArgs() == 4);
+					assert(m.timeTag() == 12345);
+					int i=0; float f=0; double d=0; const char * s=0;
+					m >> i >> f >> d >> s;
+					assert(m.good());
+					assert(i == 0x12345678 && f == 1 && d == 1);
+					assert(!strcmp(s, "hello world!"));
+					// wrong type fails and leaves the value
+					m.resetStream();
+					m >> f;
+					assert(!m.good() && f == 1);
+				}
+				else if(!strcmp(m.addressPattern(), "/message31")){
+					assert(m.timeTag() == 12347);
+				}
+				++count;
+			}
+			int count;
+		} handler;
+		handler.parse(p.data(), p.size());
+		assert(handler.count == 6);
+
+		// truncated packets are rejected, not read past
+		osc::MessageView bad(p.data() + 20, 4);
+		assert(!bad.valid());
+	}
+
+	// Match address patterns
+	{
+		assert(osc::Dispatcher::matches("/a/b", "/a/b"));
+		assert(!osc::Dispatcher::matches("/a/b", "/a/bc"));
+		assert(!osc::Dispatcher::matches("/a", "/a/b"));
+		assert(osc::Dispatcher::matches("/a/*", "/a/bc"));
+		assert(osc::Dispatcher::matches("/a/*c", "/a/bbc"));
+		assert(!osc::Dispatcher::matches("/*", "/a/b"));
+		assert(osc::Dispatcher::matches("/a?c", "/abc"));
+		assert(osc::Dispatcher::matches("/[a-c]x", "/bx"));
+		assert(!osc::Dispatcher::matches("/[!a-c]x", "/bx"));
+		assert(osc::Dispatcher::matches("/{foo,bar}/1", "/bar/1"));
+		assert(!osc::Dispatcher::matches("/{foo,bar}/1", "/baz/1"));
+	}
+
+	// Dispatch to methods by address
+	{
+		DispatchTarget t;
+		int counted = 0;
+		osc::Dispatcher d;
+		d.add("/bang", t, &DispatchTarget::bang);
+		d.add("/agent/pos", t, &DispatchTarget::position);
+		d.add("/count", t, &DispatchTarget::count);
+		d.add("/label", t, &DispatchTarget::label);
+		d.add("/name", t, &DispatchTarget::name);
+		d.add("/title", t, &DispatchTarget::title);
+		d.add("/agent/*", countMessage, &counted);
+		d.add("/message{12,13,21}", countMessage, &counted, "i");
+
+		Packet q(4096);
+		q.beginBundle();
+			q.addMessage("/bang");
+			q.addMessage("/agent/pos", 1.f, 2.f);
+			q.addMessage("/count", 7);
+			q.addMessage("/name", "six");
+			q.addMessage("/title", std::string("teen"), 16);
+			q.addMessage("/label", "seven", 8);
+			q.addMessage("/agent/vel", 3.f);
+			q.addMessage("/count", 1.f);		// wrong type
+			q.addMessage("/nothing", 1);		// no method
+			q.addMessage("/ag?nt/*", 5.f, 6.f);	// wildcards in the message
+		q.endBundle();
+		d.parse(q.data(), q.size());
+		assert(t.calls == 7);
+		assert(t.x == 5 && t.y == 6);
+		assert(t.n == 8 && !strcmp(t.s, "seven"));
+		assert(t.str == "sixteen");
+		assert(counted == 2);
+		assert(d.mismatched() == 1);
+		assert(d.unhandled() == 1);
+
+		// three messages of the bundle above match "/message{12,13,21}"
+		// with an int
+		d.parse(p.data(), p.size());
+		assert(counted == 2 + 3);
+		assert(d.mismatched() == 1);
+		assert(d.unhandled() == 1 + 3);
+	}
+
+	// Send and receive in batches
+	{
+		struct CountHandler : public osc::PacketHandler{
+			CountHandler(): count(0), sum(0){}
+			void onMessageView(osc::MessageView& m){
+				int i=0;
+				m >> i;
+				++count;
+				sum += i;
+			}
+			int count, sum;
+		} handler1, handler2;
+
+		osc::Recv r1(4111, "127.0.0.1", 0.1);
+		osc::Recv r2(4112, "127.0.0.1", 0.1);
+		r1.handler(handler1);
+		r2.handler(handler2);
+		r1.batchSize(16);
+		osc::Send s1(4111, "127.0.0.1");
+		osc::Send s2(4112, "127.0.0.1");
+
+		const int N = 50;
+		for(int i=0; i<N; ++i){
+			s1.addMessage("/i", i);
+			assert(s1.queue() == i+1);
+		}
+		assert(s1.flush() == N);
+		assert(s1.queued() == 0);
+		assert(s1.stats().packets == N && s1.stats().dropped == 0);
+
+		for(int i=0; i<100 && handler1.count < N; ++i) r1.recv();
+		assert(handler1.count == N);
+		assert(handler1.sum == N*(N-1)/2);
+		assert(r1.stats().packets == N);
+		#ifdef AL_LINUX
+		assert(r1.stats().calls < unsigned(N));
+		assert(r1.stats().maxBatch > 1);
+		#endif
+
+		// one thread receiving on both sockets
+		osc::RecvGroup group;
+		assert(group.add(r1));
+		assert(group.add(r2));
+		assert(group.size() == 2);
+		s1.send("/i", 1);
+		s2.send("/i", 2);
+		for(int i=0; i<100 && (handler1.count < N+1 || handler2.count < 1); ++i){
+			group.poll(0.1);
+		}
+		assert(handler1.count == N+1 && handler2.count == 1);
+
+		group.start();
+		s2.send("/i", 3);
+		for(int i=0; i<100 && handler2.count < 2; ++i) al_sleep(0.01);
+		group.stop();
+		assert(handler2.sum == 5);
+		group.remove(r1);
+		assert(group.size() == 1);
+	}
+
 	PacketData data;
 	{
 		struct OSCHandler : public osc::PacketHandler{
@@ -130,5 +303,88 @@ int utProtocolOSC(){
 		}
 	}
 
+	// Time tags and scheduled execution
+	{
+		const al_sec t = 1234567890.25;
+		assert(osc::timeTagToSec(osc::secToTimeTag(t)) == t);
+		assert((osc::secToTimeTag(t) >> 32) == 1234567890ULL + 2208988800ULL);
+
+		// follow a local clock that is offset, running fast and read with jitter
+		osc::TimeTagClock clock;
+		for(int i=0; i<2000; ++i){
+			al_sec wall = 1e9 + i*0.01;
+			al_sec local = 5 + i*0.01*1.001;
+			clock.update(local, wall + ((i*7919)%11 - 5)*1e-5);
+		}
+		assert(fabs(clock.rate() - 1/1.001) < 1e-4);
+		assert(fabs(clock.localTime(1e9 + 20.) - (5 + 20.*1.001)) < 1e-4);
+
+		struct Recorder : public osc::PacketHandler{
+			std::vector<int> order;
+			std::vector<al_sec> times;
+			osc::Scheduler * scheduler;
+			void onMessageView(osc::MessageView& m){
+				int i = -1;
+				m >> i;
+				order.push_back(i);
+				times.push_back(scheduler->time());
+			}
+		} rec;
+
+		osc::Scheduler sched(rec, 4, 64);
+		rec.scheduler = &sched;
+		sched.latency(0.001);
+
+		const al_sec now = al_time();
+		const al_sec offsets[] = { 0.3, 0.1, 0.2 };
+		const int ids[] = { 3, 1, 2 };
+		osc::Packet p;
+		for(int k=0; k<3; ++k){
+			p.clear();
+			p.beginBundle(osc::secToTimeTag(now + offsets[k]));
+			p.addMessage("/sched", ids[k]);
+			p.endBundle();
+			sched.parse(p.data(), p.size());
+		}
+		p.clear();
+		p.addMessage("/sched", 0);
+		sched.parse(p.data(), p.size());
+
+		// pool is full
+		sched.parse(p.data(), p.size());
+		assert(sched.stats().dropped == 1);
+
+		p.clear();
+		p.addMessage("/sched/a/long/address/that/does/not/fit/in/sixty/four/bytes", 0);
+		sched.parse(p.data(), p.size());
+		assert(sched.stats().tooLarge == 1);
+
+		// only the message without a time tag is due
+		assert(sched.run(al_time()) == 1);
+		assert(sched.pending() == 3);
+		assert(sched.run(al_time(), 0.15) == 1);
+		assert(fabs(rec.times[1] - (now + 0.101)) < 0.005);
+		assert(sched.run(al_time(), 1) == 2);
+		assert(rec.order.size() == 4);
+		for(int i=0; i<4; ++i) assert(rec.order[i] == i);
+
+		// a message that arrives late runs at once
+		p.clear();
+		p.beginBundle(osc::secToTimeTag(al_time() - 0.5));
+		p.addMessage("/sched", 4);
+		p.endBundle();
+		sched.parse(p.data(), p.size());
+		assert(sched.run(al_time()) == 1);
+		assert(rec.order.back() == 4);
+
+		osc::Scheduler::Stats st = sched.stats();
+		assert(st.executed == 5);
+		assert(st.late == 1);
+		assert(sched.lateness().count() == 5);
+		assert(sched.lateness().max() > 0.4);
+		assert(sched.margin().count() == 5);
+		assert(sched.margin().min() < -0.4);
+	}
+
 	return 0;
 }
@@ -1,5 +1,26 @@
 #include "utAllocore.h"
 
+namespace{
+	struct Particle{ Vec3f pos, vel; float mass; int32_t id; };
+	struct Padded{ int8_t c; double d; Vec2f v; };
+	struct Group{ Particle p; Padded q; };
+}
+
+namespace al{ namespace ser{
+	template<> struct Schema<Particle>{
+		template <class F, class P>
+		static void fields(F& f, P& p){ f(p.pos); f(p.vel); f(p.mass); f(p.id); }
+	};
+	template<> struct Schema<Padded>{
+		template <class F, class P>
+		static void fields(F& f, P& p){ f(p.c); f(p.d); f(p.v); }
+	};
+	template<> struct Schema<Group>{
+		template <class F, class P>
+		static void fields(F& f, P& p){ f(p.p); f(p.q); }
+	};
+}}
+
 int utProtocolSerialize(){
 
 	// Serialization
@@ -91,5 +112,175 @@ int utProtocolSerialize(){
 		}
 	}
 
+	// Writer and Reader
+	{	using namespace ser;
+
+		// numbers and strings, read back and by Deserializer
+		{
+			std::vector<char> buf;
+			Writer w(buf);
+			float f[] = {1,2,3};
+			w << 1.5f << 2.5 << int8_t(-3) << int16_t(-4) << int32_t(-5) << int64_t(-6)
+				<< uint8_t(7) << uint16_t(8) << uint32_t(9) << uint64_t(10) << true
+				<< "str" << std::string("string");
+			w.add(f, 3);
+			assert(w.good());
+			assert(buf.size() >= w.size());
+
+			Serializer s;
+			s << 1.5f << 2.5 << int8_t(-3) << int16_t(-4) << int32_t(-5) << int64_t(-6)
+				<< uint8_t(7) << uint16_t(8) << uint32_t(9) << uint64_t(10) << true
+				<< "str" << std::string("string");
+			s.add(f, 3);
+			assert(s.buf().size() == w.size());
+			assert(0 == memcmp(&s.buf()[0], w.data(), w.size()));
+
+			float of; double od; int8_t oh; int16_t oH; int32_t oi; int64_t oI;
+			uint8_t ot; uint16_t oT; uint32_t ou; uint64_t oU; bool ob;
+			std::string ostr1, ostr2;
+			float ofn[3];
+			Reader r(w.data(), w.size());
+			r >> of >> od >> oh >> oH >> oi >> oI >> ot >> oT >> ou >> oU >> ob >> ostr1 >> ostr2;
+			assert(r.read(ofn, 3) == 3);
+			assert(r.good() && 0 == r.remaining());
+			assert(of == 1.5f && od == 2.5 && oh == -3 && oH == -4 && oi == -5 && oI == -6);
+			assert(ot == 7 && oT == 8 && ou == 9 && oU == 10 && ob);
+			assert(ostr1 == "str" && ostr2 == "string");
+			assert(ofn[0] == 1 && ofn[1] == 2 && ofn[2] == 3);
+
+			// a type mismatch fails and leaves the value unchanged
+			Reader r2(w.data(), w.size());
+			int32_t x = 99;
+			r2 >> x;
+			assert(!r2.good() && x == 99 && 0 == r2.position());
+
+			// too many values
+			Reader r3(w.data(), w.size());
+			for(int i=0; i<13; ++i) r3.skip();
+			assert(r3.good());
+			assert(r3.read(ofn, 2) == 0 && !r3.good());
+		}
+
+		// a fixed buffer that is too small
+		{
+			char buf[32];
+			Writer w(buf, sizeof(buf));
+			w << 1.0 << 2.0;
+			assert(w.good() && w.size() == 26);
+			w << 3.0;
+			assert(!w.good() && w.size() == 26);
+			w.reset();
+			assert(w.good() && w.size() == 0);
+		}
+
+		// Vecs, Buffers and values written in place
+		{
+			std::vector<char> buf;
+			Writer w(buf);
+			Buffer<Vec3f> b(100);
+			for(int i=0; i<b.size(); ++i) b[i] = Vec3f(i, 2*i, 3*i);
+			w << Vec4d(1,2,3,4) << b;
+			const float xy[] = {0,1,2,3};
+			memcpy(w.reserve<Vec2f>(2), xy, sizeof(xy));
+			assert(w.good());
+
+			Reader r(w.data(), w.size());
+			Vec4d v4;
+			Buffer<Vec3f> ob;
+			r >> v4 >> ob;
+			assert(v4 == Vec4d(1,2,3,4));
+			assert(ob.size() == 100);
+			for(int i=0; i<ob.size(); ++i) assert(ob[i] == b[i]);
+			View<Vec2f> v = r.view<Vec2f>();
+			assert(r.good() && v.size() == 2);
+			assert(v[0] == Vec2f(0,1) && v[1] == Vec2f(2,3));
+			assert(0 == r.remaining());
+
+			// the floats of the Vecs may be read as floats
+			Reader r2(w.data(), w.size());
+			r2.skip();
+			View<float> vf = r2.view<float>();
+			assert(vf.size() == 300 && vf[299] == 99*3);
+			// but not as a Vec of another size
+			Reader r3(w.data(), w.size());
+			r3.skip();
+			r3.view<Vec<7,float> >();
+			assert(!r3.good());
+		}
+
+		// Arrays
+		{
+			Array a(3, AlloSInt16Ty, 3, 5);
+			for(int j=0; j<5; ++j){
+			for(int i=0; i<3; ++i){
+				int16_t * c = a.cell<int16_t>(i,j);
+				c[0] = i; c[1] = j;
+			}}
+			assert(a.stride(1) > 3*2*3); // rows are padded
+
+			std::vector<char> buf;
+			Writer w(buf);
+			w << a;
+			assert(w.good());
+			Array b;
+			Reader r(w.data(), w.size());
+			r >> b;
+			assert(r.good() && 0 == r.remaining());
+			assert(b.isFormat(a.header));
+			for(int j=0; j<5; ++j){
+			for(int i=0; i<3; ++i){
+				assert(b.cell<int16_t>(i,j)[0] == i);
+				assert(b.cell<int16_t>(i,j)[1] == j);
+			}}
+		}
+
+		// structs with a Schema
+		{
+			Particle ps[10];
+			for(int i=0; i<10; ++i){
+				ps[i].pos.set(i, i+1, i+2);
+				ps[i].vel.set(-i, 0, 1);
+				ps[i].mass = i*0.5f;
+				ps[i].id = i;
+			}
+			Padded pd[3];
+			for(int i=0; i<3; ++i){ pd[i].c = i; pd[i].d = i*0.25; pd[i].v.set(i, -i); }
+			Group g;
+			g.p = ps[3]; g.q = pd[2];
+
+			std::vector<char> buf;
+			Writer w(buf);
+			w.add(ps, 10);
+			w.add(pd, 3);
+			w << g << 7;
+			assert(w.good());
+
+			Reader r(w.data(), w.size());
+			View<Particle> vp = r.view<Particle>();
+			assert(vp.size() == 10);
+			assert(vp[4].pos == ps[4].pos && vp[4].id == 4);
+			if(vp.ptr()) assert(vp.ptr()[9].mass == ps[9].mass);
+
+			Padded opd[3];
+			assert(r.read(opd, 3) == 3);
+			for(int i=0; i<3; ++i){
+				assert(opd[i].c == pd[i].c && opd[i].d == pd[i].d && opd[i].v == pd[i].v);
+			}
+			assert(r.view<Padded>().size() == 0 && !r.good()); // no Padded here
+
+			Reader r2(w.data(), w.size());
+			Group og; int seven;
+			r2.skip().skip() >> og >> seven;
+			assert(r2.good() && seven == 7);
+			assert(og.p.pos == g.p.pos && og.p.id == g.p.id && og.q.d == g.q.d && og.q.v == g.q.v);
+
+			// a struct is not read as one with other fields
+			Reader r3(w.data(), w.size());
+			Padded p1;
+			r3 >> p1;
+			assert(!r3.good());
+		}
+	}
+
 	return 0;
 }
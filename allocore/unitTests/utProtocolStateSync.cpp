@@ -0,0 +1,180 @@
+#include <string>
+#include <vector>
+#include "utAllocore.h"
+
+// Forward the datagrams that have arrived, except those whose bit in drop is set
+static int forward(SocketServer& from, SocketClient& to, unsigned drop){
+	char buf[2048];
+	int i = 0;
+	size_t n;
+	while((n = from.recv(buf, sizeof(buf))) > 0){
+		if(!((drop >> i) & 1)) to.send(buf, n);
+		++i;
+	}
+	return i;
+}
+
+// Receive the datagrams that have arrived
+static std::vector<std::string> gather(SocketServer& from){
+	std::vector<std::string> res;
+	char buf[2048];
+	size_t n;
+	while((n = from.recv(buf, sizeof(buf))) > 0) res.push_back(std::string(buf, n));
+	return res;
+}
+
+// Poll until a frame is decoded
+static bool pollFrame(StateReceiver& r){
+	for(int i=0; i<5; ++i){
+		if(r.poll(0.1)) return true;
+	}
+	return false;
+}
+
+int utProtocolStateSync(){
+
+	// Delta codec
+	{
+		const unsigned N = 1000;
+		std::vector<char> key(N), state, out(N), delta;
+		for(unsigned i=0; i<N; ++i) key[i] = char(i*7);
+		state = key;
+
+		unsigned n = StateDelta::encode(delta, &state[0], &key[0], N);
+		assert(n && n < 8);
+		assert(StateDelta::decode(&out[0], &key[0], N, &delta[0], n));
+		assert(out == state);
+
+		++state[0]; ++state[500]; ++state[501]; ++state[503]; ++state[N-1];
+		n = StateDelta::encode(delta, &state[0], &key[0], N);
+		assert(n && n < 32);
+		assert(StateDelta::decode(&out[0], &key[0], N, &delta[0], n));
+		assert(out == state);
+
+		// changes spanning more than the state
+		for(unsigned i=0; i<N; ++i) state[i] = ~key[i];
+		assert(0 == StateDelta::encode(delta, &state[0], &key[0], N));
+
+		// runs past the end of the state or the delta
+		const char bad1[] = { char(0xe8), 0x07, 0x01, 0x00 };
+		assert(!StateDelta::decode(&out[0], &key[0], N, bad1, sizeof(bad1)));
+		const char bad2[] = { 0x00, 0x08, 0x00 };
+		assert(!StateDelta::decode(&out[0], &key[0], N, bad2, sizeof(bad2)));
+	}
+
+	// Sender and receiver with feedback
+	{
+		const unsigned N = 100000;
+		std::vector<char> state(N, 0);
+		StateSender s(N, 4120, "localhost", 4121);
+		s.receiverTimeout(3);
+		{
+			StateReceiver r(N, 4120, "localhost", 4121);
+			assert(!r.valid());
+			for(int f=1; f<=20; ++f){
+				state[(f*997) % N] = char(f);
+				assert(unsigned(f) == s.send(&state[0]));
+				assert(pollFrame(r));
+				assert(r.valid());
+				assert(r.frame() == unsigned(f));
+				assert(0 == memcmp(r.state(), &state[0], N));
+			}
+			assert(s.stats().frames == 20);
+			assert(s.stats().keyframes == 1);
+			assert(s.stats().receivers == 1);
+			assert(s.stats().frameBytes < 200);
+			assert(r.stats().frames == 20);
+			assert(r.stats().keyframes == 1);
+			assert(r.stats().lost == 0);
+			assert(r.stats().incomplete == 0);
+		}
+
+		// frames sent while no one listens
+		for(int f=0; f<3; ++f){
+			state[f] = char(f);
+			s.send(&state[0]);
+		}
+
+		// a receiver that joins late has no keyframe and asks for one
+		StateReceiver r(N, 4120, "localhost", 4121);
+		bool synced = false;
+		for(int f=0; f<20 && !synced; ++f){
+			state[f*11] = char(f);
+			s.send(&state[0]);
+			if(r.poll(0.1)) synced = 0 == memcmp(r.state(), &state[0], N);
+		}
+		assert(synced);
+		assert(r.stats().missingKey >= 1);
+		assert(r.stats().keyRequests >= 1);
+		assert(s.stats().keyframes >= 2);
+	}
+
+	// Losses, through a proxy that drops datagrams
+	{
+		const unsigned N = 10000;
+		std::vector<char> state(N, 0);
+		StateSender s(N, 4123, "localhost", 0, 1000);
+		SocketServer proxyIn(4123, "", 0);
+		SocketClient proxyOut(4124, "localhost");
+		StateReceiver r(N, 4124);
+
+		s.send(&state[0]);
+		assert(forward(proxyIn, proxyOut, 0) == 11);
+		assert(pollFrame(r));
+
+		// a delta of several datagrams, missing one
+		for(unsigned i=0; i<4000; ++i) state[i] = char(i);
+		s.send(&state[0]);
+		assert(forward(proxyIn, proxyOut, 1<<1) > 2);
+		assert(!r.poll(0.1));
+
+		state[5000] = 1;
+		s.send(&state[0]);
+		forward(proxyIn, proxyOut, 0);
+		assert(pollFrame(r));
+		assert(r.frame() == 3);
+		assert(0 == memcmp(r.state(), &state[0], N));
+
+		// a frame missing entirely
+		state[6000] = 1;
+		s.send(&state[0]);
+		forward(proxyIn, proxyOut, ~0u);
+		state[7000] = 1;
+		s.send(&state[0]);
+		forward(proxyIn, proxyOut, 0);
+		assert(pollFrame(r));
+		assert(r.frame() == 5);
+		assert(0 == memcmp(r.state(), &state[0], N));
+
+		assert(r.stats().frames == 3);
+		assert(r.stats().incomplete == 1);
+		assert(r.stats().lost == 1);
+
+		// fragments not matching the frame being assembled are dropped
+		for(unsigned i=0; i<4000; ++i) state[i] = char(i+1);
+		s.send(&state[0]);
+		std::vector<std::string> d = gather(proxyIn);
+		assert(d.size() > 2);
+		proxyOut.send(d[0].data(), d[0].size());
+		std::string bad = d[1];
+		bad[12] = bad[13] = bad[14] = bad[15] = char(0xff);	// index, count
+		bad[13] = char(0xfe);
+		proxyOut.send(bad.data(), bad.size());
+		bad = d[1];
+		bad[8] ^= 1; bad[28] ^= 1;		// key, data
+		proxyOut.send(bad.data(), bad.size());
+		bad = d[1];
+		bad[3] = 0; bad[28] ^= 1;		// type, data
+		proxyOut.send(bad.data(), bad.size());
+		bad = d[1];
+		bad[24] = 0;					// offset 0xffffff00 wraps
+		bad[25] = bad[26] = bad[27] = char(0xff);
+		proxyOut.send(bad.data(), bad.size());
+		for(unsigned i=1; i<d.size(); ++i) proxyOut.send(d[i].data(), d[i].size());
+		assert(pollFrame(r));
+		assert(r.frame() == 6);
+		assert(0 == memcmp(r.state(), &state[0], N));
+	}
+
+	return 0;
+}
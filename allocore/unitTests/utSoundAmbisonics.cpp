@@ -0,0 +1,125 @@
+#include "utAllocore.h"
+#include "utSpeakerLayout.h"
+
+// Unit vector of i-th point on spherical Fibonacci lattice of n points
+static Vec3d latticePoint(int i, int n){
+	double z = 1. - (2.*i + 1.) / n;
+	double r = sqrt(1. - z*z);
+	double a = i * M_PI * (3. - sqrt(5.));
+	return Vec3d(r*cos(a), r*sin(a), z);
+}
+
+int utSoundAmbisonics(){
+
+	// Spherical harmonics in ACN ordering
+	{
+		float ws[64];
+		float x = 0.3, y = -0.5, z = sqrt(1. - 0.34);
+
+		// SN3D up to 2nd order in closed form
+		AmbiBase::encodeWeightsSN3D(ws, 3, 2, x,y,z);
+		const float sq3 = sqrt(3.);
+		const float expected[] = {
+			1, y, z, x,
+			sq3*x*y, sq3*y*z, 0.5f*(3*z*z-1), sq3*x*z, 0.5f*sq3*(x*x-y*y)
+		};
+		for(int i=0; i<9; ++i) assert(fabs(ws[i] - expected[i]) < 1e-5);
+
+		// 2D has only harmonics with |m| = l
+		AmbiBase::encodeWeightsSN3D(ws, 2, 2, 0.6, 0.8, 0);
+		assert(fabs(ws[0] - 1) < 1e-5);
+		assert(fabs(ws[1] - 0.8) < 1e-5 && fabs(ws[2] - 0.6) < 1e-5);
+		assert(fabs(ws[3] - sq3*0.6*0.8) < 1e-5);
+		assert(fabs(ws[4] - 0.5*sq3*(0.36-0.64)) < 1e-5);
+
+		// N3D harmonics up to 7th order are orthonormal over the sphere
+		const int order = 7;
+		const int numChans = (order+1)*(order+1);
+		const int numPoints = 10000;
+		std::vector<double> gram(numChans*numChans, 0.);
+		for(int k=0; k<numPoints; ++k){
+			Vec3d p = latticePoint(k, numPoints);
+			AmbiBase::encodeWeightsN3D(ws, 3, order, p[0], p[1], p[2]);
+			for(int i=0; i<numChans; ++i){
+				for(int j=0; j<numChans; ++j){
+					gram[i*numChans + j] += ws[i]*ws[j] / numPoints;
+				}
+			}
+		}
+		for(int i=0; i<numChans; ++i){
+			for(int j=0; j<numChans; ++j){
+				assert(fabs(gram[i*numChans + j] - (i==j ? 1 : 0)) < 1e-3);
+			}
+		}
+	}
+
+	// Decoders; energy of a source should point at the source
+	{
+		SpeakerLayout layout = alloSphereSpeakerLayout();
+		const Speakers& speakers = layout.speakers();
+		const int numSpeakers = speakers.size();
+
+		for(int method=0; method<2; ++method){
+			AmbisonicsSpatializer ambi(layout, 3, 5, 3, AmbiBase::ACN_SN3D);
+			if(method) ambi.decodeMethod(AmbiDecode::ALLRAD);
+			const AmbiDecode& dec = ambi.decoder();
+			assert(dec.channels() == 36);
+			assert(dec.method() == (method ? AmbiDecode::ALLRAD : AmbiDecode::PROJECTION));
+
+			float ws[36];
+			double meanError = 0;
+			int numDirs = 0;
+			for(int k=0; k<1000; ++k){
+				// Ambisonic coordinates; skip the floor with no speakers
+				Vec3d dir = latticePoint(k, 1000);
+				if(dir[2] < -0.4) continue;
+				AmbiBase::encodeWeightsSN3D(ws, 3, 5, dir[0], dir[1], dir[2]);
+
+				Vec3d energy(0,0,0);
+				for(int s=0; s<numSpeakers; ++s){
+					double g = 0;
+					for(int c=0; c<dec.channels(); ++c) g += dec.decodeWeight(s,c) * ws[c];
+					// speaker direction from Speaker::vec() in Ambisonic coordinates
+					Vec3d v = speakers[s].vec();
+					energy += Vec3d(-v[2], -v[0], v[1]) * (g*g);
+				}
+				meanError += acos(energy.normalize().dot(dir));
+				++numDirs;
+			}
+			meanError /= numDirs;
+			assert(meanError < 10. * M_PI/180.);
+		}
+	}
+
+	// Ambisonic bus is cleared for each buffer rendered by a scene, so
+	// output falls silent once the source does
+	for(int block=0; block<2; ++block){
+		const int numFrames = 64;
+		SpeakerLayout layout = OctalSpeakerLayout();
+		AmbisonicsSpatializer ambi(layout, 2, 1);
+		AudioIO io(numFrames, 44100, NULL, NULL, layout.numSpeakers(), 0, AudioIO::DUMMY);
+		AudioScene scene(numFrames);
+		scene.createListener(&ambi);
+		scene.usePerSampleProcessing(!block);
+		scene.useBlockProcessing(block);
+		SoundSource src;
+		src.pos(1, 0, -2);
+		scene.addSource(src);
+
+		bool sounded = false;
+		for(int b=0; b<32; ++b){
+			for(int i=0; i<numFrames; ++i) src.writeSample(b < 4 ? 1 : 0);
+			io.zeroOut();
+			scene.render(io);
+			for(int c=0; c<io.channelsOut(); ++c){
+				for(int i=0; i<numFrames; ++i){
+					if(io.out(c,i) != 0) sounded = true;
+					if(b >= 24) assert(io.out(c,i) == 0);
+				}
+			}
+		}
+		assert(sounded);
+	}
+
+	return 0;
+}
@@ -0,0 +1,295 @@
+#include <algorithm>
+#include "utAllocore.h"
+#include "utSpeakerLayout.h"
+
+// Render a fixed scene of moving sources and return the output
+static std::vector<float> renderScene(int numThreads){
+	const int numFrames = 64;
+	const int numSources = 100;
+	const int numBlocks = 8;
+
+	SpeakerLayout layout = OctalSpeakerLayout();
+	AmbisonicsSpatializer spatializer(layout, 2, 1);
+	AudioIO io(numFrames, 44100, NULL, NULL, layout.numSpeakers(), 0, AudioIO::DUMMY);
+
+	AudioScene scene(numFrames);
+	scene.createListener(&spatializer);
+	scene.useBlockProcessing(true);
+	scene.sourcesPerGroup(8);
+	scene.numThreads(numThreads);
+
+	std::vector<SoundSource> sources(numSources);
+	for(int k=0; k<numSources; ++k) scene.addSource(sources[k]);
+
+	std::vector<float> output;
+
+	for(int b=0; b<numBlocks; ++b){
+		for(int k=0; k<numSources; ++k){
+			double phase = k + b*0.1;
+			sources[k].pos(cos(phase), 0.5*k/numSources, sin(phase));
+			for(int i=0; i<numFrames; ++i){
+				sources[k].writeSample(sin((b*numFrames + i)*0.01*(k+1)));
+			}
+		}
+
+		io.zeroOut();
+		scene.render(io);
+
+		for(int c=0; c<io.channelsOut(); ++c){
+			output.insert(output.end(), io.outBuffer(c), io.outBuffer(c) + numFrames);
+		}
+	}
+
+	return output;
+}
+
+// Render slowly moving sources with a spatializer of given type (0 DBAP,
+// 1 VBAP, 2 Ambisonics) per sample or in blocks and return the output
+static std::vector<float> renderMoving(int type, bool block){
+	const int numFrames = 64;
+	const int numSources = 4;
+	const int numBlocks = 32;
+
+	SpeakerLayout layout = alloSphereSpeakerLayout();
+	Dbap dbap(layout);
+	Vbap vbap(layout);
+	AmbisonicsSpatializer ambi(layout, 3, 1);
+	Spatializer * spatializers[] = { &dbap, &vbap, &ambi };
+	int numChannels = 0;
+	for(int i=0; i<layout.numSpeakers(); ++i){
+		numChannels = std::max(numChannels, int(layout.speakers()[i].deviceChannel) + 1);
+	}
+	AudioIO io(numFrames, 44100, NULL, NULL, numChannels, 0, AudioIO::DUMMY);
+
+	AudioScene scene(numFrames);
+	scene.createListener(spatializers[type]);
+	scene.usePerSampleProcessing(!block);
+	scene.useBlockProcessing(block);
+
+	std::vector<SoundSource> sources(numSources);
+	for(int k=0; k<numSources; ++k) scene.addSource(sources[k]);
+
+	std::vector<float> output;
+
+	for(int b=0; b<numBlocks; ++b){
+		for(int k=0; k<numSources; ++k){
+			// stay clear of azimuth +-90 degrees, where speakers nearly
+			// coincide and VBAP gains change too fast to ramp over a block
+			double phase = 1.6*k + 0.8 + b*0.01;
+			sources[k].pos(3*cos(phase), 0.3*k - 0.5, 3*sin(phase));
+			for(int i=0; i<numFrames; ++i){
+				sources[k].writeSample(sin((b*numFrames + i)*0.02*(k+1)));
+			}
+		}
+
+		io.zeroOut();
+		scene.render(io);
+
+		for(int c=0; c<io.channelsOut(); ++c){
+			output.insert(output.end(), io.outBuffer(c), io.outBuffer(c) + numFrames);
+		}
+	}
+
+	return output;
+}
+
+// Find VBAP triplets of layout
+static std::vector<SpeakerTriple> vbapTriplets(const SpeakerLayout& layout, Vbap::Triangulation method, int numThreads=1){
+	Vbap vbap(layout);
+	vbap.triangulation(method, numThreads);
+	AudioScene scene(64);
+	scene.createListener(&vbap);
+	return vbap.triplets();
+}
+
+// Get exact VBAP gains of every speaker for a direction
+static std::vector<double> vbapGains(const Vbap& vbap, int numSpeakers, const Vec3d& dir){
+	std::vector<double> gains(numSpeakers, 0.);
+	int s[12]; float g[12];
+	int n = vbap.speakerGains(dir, s, g);
+	for(int k=0; k<n; ++k) gains[s[k]] = g[k];
+	return gains;
+}
+
+int utSoundAudioScene(){
+
+	// Threaded rendering
+	{
+		std::vector<float> serial = renderScene(0);
+		bool nonZero = false;
+		for(unsigned i=0; i<serial.size(); ++i){
+			if(serial[i] != 0) nonZero = true;
+		}
+		assert(nonZero);
+
+		for(int n=1; n<=4; ++n){
+			std::vector<float> threaded = renderScene(n);
+			assert(threaded.size() == serial.size());
+			assert(0 == memcmp(&threaded[0], &serial[0], sizeof(float)*serial.size()));
+		}
+	}
+
+	// Block processing matches per sample processing for moving sources,
+	// apart from ramping the delay, gains and position linearly. VBAP
+	// differs most, where sources cross from one triplet to another.
+	for(int type=0; type<3; ++type){
+		std::vector<float> perSample = renderMoving(type, false);
+		std::vector<float> block = renderMoving(type, true);
+		assert(perSample.size() == block.size());
+
+		double sum = 0, err = 0;
+		for(unsigned i=0; i<block.size(); ++i){
+			sum += perSample[i]*perSample[i];
+			err += (block[i]-perSample[i])*(block[i]-perSample[i]);
+		}
+		assert(sum > 0);
+		assert(sqrt(err/sum) < 5e-3);
+	}
+
+	// Per sample VBAP writes to the device channels of the speakers. The
+	// AlloSphere has no speakers on channels 12 to 15, 46 and 47.
+	{
+		std::vector<float> out = renderMoving(1, false);
+		const int numFrames = 64;
+		const int numChannels = 60;
+		assert(out.size() % (numFrames*numChannels) == 0);
+		bool nonZero = false;
+		for(unsigned i=0; i<out.size(); ++i){
+			int c = (i / numFrames) % numChannels;
+			if((c >= 12 && c < 16) || c == 46 || c == 47) assert(out[i] == 0);
+			else if(out[i] != 0) nonZero = true;
+		}
+		assert(nonZero);
+	}
+
+	// VBAP gain table interpolates exact gains of grid directions
+	{
+		SpeakerLayout layout = alloSphereSpeakerLayout();
+		const int numSpeakers = layout.numSpeakers();
+		AudioScene scene(64);
+		Vbap exact(layout), table(layout);
+		scene.createListener(&exact);
+		scene.createListener(&table);
+
+		const int res = 32;
+		table.gainTableResolution(res);
+		assert(table.gainTableResolution() == res);
+		assert(table.gainTableMemory() > 0);
+
+		rnd::Random<> rng(5);
+		for(int i=0; i<2000; ++i){
+			Vec3d dir = rng.ball<Vec3d>().normalize();
+
+			// bilinear weights of grid directions on cube face
+			int axis = 0;
+			if(fabs(dir[1]) > fabs(dir[axis])) axis = 1;
+			if(fabs(dir[2]) > fabs(dir[axis])) axis = 2;
+			double scale = 0.5 * res / fabs(dir[axis]);
+			double x = (dir[(axis+1)%3] + fabs(dir[axis])) * scale;
+			double y = (dir[(axis+2)%3] + fabs(dir[axis])) * scale;
+			int ix = std::min(int(x), res-1);
+			int iy = std::min(int(y), res-1);
+			double fx = x - ix, fy = y - iy;
+
+			std::vector<double> expected(numSpeakers, 0.);
+			for(int c=0; c<4; ++c){
+				Vec3d grid;
+				grid[axis] = dir[axis] < 0 ? -1 : 1;
+				grid[(axis+1)%3] = 2. * (ix + (c&1)) / res - 1.;
+				grid[(axis+2)%3] = 2. * (iy + (c>>1)) / res - 1.;
+				double w = (c&1 ? fx : 1-fx) * (c>>1 ? fy : 1-fy);
+				std::vector<double> g = vbapGains(exact, numSpeakers, grid);
+				for(int k=0; k<numSpeakers; ++k) expected[k] += w * g[k];
+			}
+			double power = 0;
+			for(int k=0; k<numSpeakers; ++k) power += expected[k]*expected[k];
+
+			std::vector<double> lookup = vbapGains(table, numSpeakers, dir);
+			for(int k=0; k<numSpeakers; ++k){
+				assert(fabs(lookup[k] - expected[k]/sqrt(power)) < 1e-4);
+			}
+		}
+
+		// error against exact gains falls as the resolution rises
+		double rms, rmsFine;
+		table.gainTableError(10000, &rms);
+		table.gainTableResolution(4*res);
+		table.gainTableError(10000, &rmsFine);
+		assert(rmsFine < 0.5*rms);
+	}
+
+	// 2D VBAP pans between neighbouring pairs of a ring
+	{
+		OctalSpeakerLayout layout;
+		const std::vector<Speaker>& speakers = layout.speakers();
+		Vbap vbap(layout, false);
+		AudioScene scene(64);
+		scene.createListener(&vbap);
+		assert(!vbap.is3D());
+		assert(vbap.triplets().size() == 8);
+
+		for(int a=0; a<720; ++a){
+			double az = a*M_PI/360;
+			Vec3d dir(sin(az), 0, -cos(az));
+			int s[12]; float g[12];
+			assert(2 == vbap.speakerGains(dir, s, g));
+			int d = abs(s[0] - s[1]);
+			assert(d == 1 || d == 7);
+
+			// gains pan to the direction
+			assert(g[0] >= 0 && g[1] >= 0);
+			Vec3d v = speakers[s[0]].vec() * g[0] + speakers[s[1]].vec() * g[1];
+			assert(v.dot(dir) > 0);
+			assert(cross(v, dir).mag() < 1e-6 * v.mag());
+
+			// elevation is ignored
+			int s2[12]; float g2[12];
+			assert(2 == vbap.speakerGains(dir + Vec3d(0, 0.5, 0), s2, g2));
+			assert(s2[0] == s[0] && s2[1] == s[1]);
+			assert(fabs(g2[0] - g[0]) < 1e-6 && fabs(g2[1] - g[1]) < 1e-6);
+		}
+	}
+
+	// VBAP triangulation
+	{
+		SpeakerLayout layout = alloSphereSpeakerLayout();
+		const std::vector<Speaker>& speakers = layout.speakers();
+
+		std::vector<SpeakerTriple> search = vbapTriplets(layout, Vbap::TRIANGULATION_SEARCH);
+		std::vector<SpeakerTriple> searchThreaded = vbapTriplets(layout, Vbap::TRIANGULATION_SEARCH, 3);
+
+		// threads do not change result or order of triplets
+		assert(search.size() == searchThreaded.size());
+		for(unsigned i=0; i<search.size(); ++i){
+			assert(search[i].s1 == searchThreaded[i].s1);
+			assert(search[i].s2 == searchThreaded[i].s2);
+			assert(search[i].s3 == searchThreaded[i].s3);
+		}
+
+		// hull covers every direction, including those near speakers that
+		// nearly coincide, such as 13 and 40 or 25 and 28
+		Vbap vbap(layout);
+		vbap.triangulation(Vbap::TRIANGULATION_HULL);
+		AudioScene scene(64);
+		scene.createListener(&vbap);
+
+		for(int e=-180; e<=180; ++e)
+		for(int a=0; a<720; ++a){
+			double az = a*M_PI/360, el = e*M_PI/360;
+			Vec3d dir(sin(az)*cos(el), sin(el), -cos(az)*cos(el));
+			int s[12]; float g[12];
+			assert(3 == vbap.speakerGains(dir, s, g));
+
+			// gains pan to the direction
+			Vec3d v(0,0,0);
+			for(int k=0; k<3; ++k){
+				assert(g[k] >= 0);
+				v += speakers[s[k]].vec() * g[k];
+			}
+			assert(v.dot(dir) > 0);
+			assert(cross(v, dir).mag() < 1e-6 * v.mag());
+		}
+	}
+
+	return 0;
+}
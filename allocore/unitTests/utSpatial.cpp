@@ -1,4 +1,17 @@
 #include "utAllocore.h"
+#include "allocore/spatial/al_HashSpace.hpp"
+#include "allocore/spatial/al_SparseHashSpace.hpp"
+#include <algorithm>
+
+// Sums ids of neighbors found by HashSpace::queryAll
+struct NeighborSum{
+	std::vector<unsigned> sums;
+	void operator()(uint32_t id, HashSpace::Query& q){
+		unsigned s = 0;
+		for(unsigned i=0; i<q.size(); ++i) s += q[i]->id;
+		sums[id] = s;
+	}
+};
 
 int utSpatial(){
 
@@ -17,5 +30,198 @@ int utSpatial(){
 		a.step(0.5);	assert(a.vec() == Vec3d(2.5,0,0));
 	}
 
+	// HashSpace linked and sorted modes
+	{
+		rnd::Random<> rng(7);
+		HashSpace space(5, 400);
+		for(unsigned i=0; i<space.numObjects(); ++i){
+			space.move(i, space.dim()*rng.uniform(), space.dim()*rng.uniform(), space.dim()*rng.uniform());
+		}
+		space.remove(3);
+
+		HashSpace::Query qa(1000), qb(1000);
+		const Vec3d center(3, 30, 16);
+
+		// results are counted and can be aggregated
+		int n1 = qa(space, center, 6);
+		assert(n1 > 0 && int(qa.size()) == n1);
+		int n2 = qa(space, center + Vec3d(8,0,0), 6);
+		assert(int(qa.size()) == n1+n2);
+		qa.clear();
+		assert(qa.size() == 0);
+
+		// sorted mode finds same objects as linked mode
+		NeighborSum linked, sorted;
+		linked.sums.assign(space.numObjects(), 0);
+		sorted.sums.assign(space.numObjects(), 0);
+		space.queryAll(5, linked);
+		int nl = qa(space, center, 6, 2);
+		space.mode(HashSpace::SORTED).rebuild();
+		int ns = qb(space, center, 6, 2);
+		assert(nl == ns);
+		for(int i=0; i<nl; ++i){
+			bool found = false;
+			for(int j=0; j<ns; ++j) found |= qa[i] == qb[j];
+			assert(found);
+		}
+		ThreadPool pool(2);
+		space.queryAll(5, sorted, &pool);
+		for(unsigned i=0; i<space.numObjects(); ++i){
+			assert(linked.sums[i] == sorted.sums[i]);
+		}
+		assert(sorted.sums[3] == 0);
+
+		// moving objects takes effect after rebuild
+		space.move(0, center);
+		qb.clear();
+		qb(space, center, 0.5);
+		bool found = false;
+		for(unsigned j=0; j<qb.size(); ++j) found |= qb[j]->id == 0;
+		assert(!found);
+		space.rebuild();
+		qb.clear();
+		qb(space, center, 0.5);
+		found = false;
+		for(unsigned j=0; j<qb.size(); ++j) found |= qb[j]->id == 0;
+		assert(found);
+
+		// back to linked mode
+		space.mode(HashSpace::LINKED);
+		qa.clear();
+		qa(space, center, 0.5);
+		assert(qa.size() == qb.size());
+	}
+
+	// HashSpace exact nearest neighbors
+	{
+		rnd::Random<> rng(11);
+		const int N = 300;
+		HashSpace space(4, N);
+		for(int i=0; i<N; ++i){
+			space.move(i, space.dim()*rng.uniform(), space.dim()*rng.uniform(), space.dim()*rng.uniform());
+		}
+		space.remove(9);
+
+		// points near the middle and the edges, to cross the wrap
+		const int P = 40;
+		std::vector<Vec3d> points(P);
+		for(int i=0; i<P; ++i){
+			points[i] = Vec3d(rng.uniform(), rng.uniform(), rng.uniform()) * (i%2 ? 2. : 16.);
+		}
+		points[1] = points[0]; // shares a voxel
+
+		for(int m=0; m<2; ++m){
+			if(m) space.mode(HashSpace::SORTED).rebuild();
+
+			const uint32_t ks[] = { 1, 8, 32, N };
+			for(int j=0; j<4; ++j){
+				const uint32_t k = ks[j];
+				std::vector<HashSpace::Query::Result> results;
+				std::vector<uint32_t> counts;
+				ThreadPool pool(2);
+				space.nearest(&points[0], P, k, results, counts, m ? &pool : NULL);
+
+				for(int i=0; i<P; ++i){
+					std::vector<double> d2;
+					for(int o=0; o<N; ++o){
+						if(o != 9) d2.push_back(space.wrapRelative(space.object(o).pos - points[i]).magSqr());
+					}
+					std::sort(d2.begin(), d2.end());
+					unsigned n = std::min(k, unsigned(N-1));
+
+					HashSpace::Query q;
+					assert(q.nearest(space, points[i], k) == int(n));
+					assert(counts[i] == n);
+					for(unsigned r=0; r<n; ++r){
+						assert(q.distanceSquared(r) == d2[r]);
+						assert(results[i*k + r].distanceSquared == d2[r]);
+					}
+				}
+			}
+
+			// an object is not its own neighbor
+			HashSpace::Query q;
+			HashSpace::Object * o = &space.object(4);
+			assert(q.nearest(space, o, 5) == 5);
+			for(unsigned r=0; r<q.size(); ++r) assert(q[r] != o);
+			assert(q.nearest(space, o) == q[0]);
+
+			// radius results can be sorted
+			q.clear();
+			q(space, points[2], 5);
+			q.sort();
+			for(unsigned r=1; r<q.size(); ++r) assert(q.distanceSquared(r-1) <= q.distanceSquared(r));
+		}
+	}
+
+	// SparseHashSpace
+	{
+		// Morton codes interleave and separate coordinates
+		uint32_t c = (1<<21)-1;
+		assert(SparseHashSpace::morton(c, c, c) == (uint64_t(1)<<63)-1);
+		assert(SparseHashSpace::morton(1, 2, 4) == 1+16+256);
+		assert((SparseHashSpace::unmorton(SparseHashSpace::morton(12345, 2000000, 7)) == Vec<3,uint32_t>(12345, 2000000, 7)));
+
+		rnd::Random<> rng(3);
+		const int N = 500;
+		SparseHashSpace space(10, N);
+
+		// a few dense clusters kilometres apart
+		for(int i=0; i<N; ++i){
+			Vec3d p(rng.uniformS(), rng.uniformS(), rng.uniformS());
+			p = p*30 + Vec3d(i%4 * 5000., i%3 * -3000., 0);
+			space.move(i, p);
+		}
+		space.remove(7);
+		assert(space.numCells() > 4 && space.numCells() < 4*6*6*6);
+		assert(space.cellCapacity() <= 8*space.numCells());
+
+		// positions are clamped to the bounds
+		space.move(0, Vec3d(1e300, 0, -1e300));
+		assert(space.object(0).pos == Vec3d(space.extent(), 0, -space.extent()));
+
+		// brute force distances from a point
+		const Vec3d center(4990, -20, 10);
+		std::vector<double> d2(N);
+		for(int i=0; i<N; ++i) d2[i] = (space.object(i).pos - center).magSqr();
+
+		// radius queries of any size find exactly the objects within range
+		const double radii[] = { 0, 25, 400, 1e4, 1e7 };
+		for(int r=0; r<5; ++r){
+			SparseHashSpace::Query q(N);
+			int n = q(space, center, radii[r], radii[r]*0.25);
+			int expected = 0;
+			for(int i=0; i<N; ++i){
+				expected += i != 7 && d2[i] <= radii[r]*radii[r] && d2[i] >= radii[r]*radii[r]/16;
+			}
+			assert(n == expected);
+			for(int i=0; i<n; ++i) assert(q[i]->id != 7);
+		}
+
+		// k nearest are exact and sorted, for small and large k
+		const unsigned ks[] = { 1, 5, 130, N };
+		std::vector<double> sorted;
+		for(int i=0; i<N; ++i) if(i != 7) sorted.push_back(d2[i]);
+		std::sort(sorted.begin(), sorted.end());
+		for(int j=0; j<4; ++j){
+			SparseHashSpace::Query q;
+			unsigned n = q.nearest(space, center, ks[j]);
+			assert(n == std::min(ks[j], unsigned(N-1)));
+			for(unsigned i=0; i<n; ++i) assert(q.distanceSquared(i) == sorted[i]);
+		}
+
+		// nearest to an object excludes it and respects maxRadius
+		SparseHashSpace::Query q;
+		assert(q.nearest(space, &space.object(5), 3) == 3);
+		assert(q[0] != &space.object(5));
+		assert(q.nearest(space, Vec3d(2500, 0, 0), 10, 100) == 0);
+
+		// cells are released as objects leave them
+		for(int i=0; i<N; ++i) space.remove(i);
+		assert(space.numCells() == 0);
+		assert(space.cellCapacity() <= 16);
+		assert(q.nearest(space, center, 4) == 0);
+	}
+
 	return 0;
 }
@@ -1,4 +1,6 @@
 #include "utAllocore.h"
+#include "allocore/system/al_ThreadPool.hpp"
+#include "allocore/types/al_BlockRing.hpp"
 
 void * threadFunc(void * user){
 	*(int *)user = 1; return NULL;
@@ -12,6 +14,60 @@ struct MyThreadFunc : public ThreadFunction{
 	int& x;
 };
 
+struct CountIndices{
+	CountIndices(int * c): counts(c){}
+	void operator()(int i){
+		// uneven cost per index
+		volatile int x = 0;
+		for(int k=0; k<(i%7)*50; ++k) x += k;
+		++counts[i];
+	}
+	int * counts;
+};
+
+struct SumTask : public ThreadPool::Task{
+	void operator()(){
+		sum = 0;
+		for(int i=begin; i<end; ++i) sum += i;
+	}
+	int begin, end;
+	long sum;
+};
+
+// Task that splits itself into subtasks from within the pool
+struct SplitTask : public ThreadPool::Task{
+	void operator()(){
+		SumTask sub[4];
+		int n = 1000;
+		for(int i=0; i<4; ++i){
+			sub[i].begin = i*n/4;
+			sub[i].end = (i+1)*n/4;
+			pool->submit(sub[i]);
+		}
+		sum = 0;
+		for(int i=0; i<4; ++i){
+			sub[i].wait();
+			sum += sub[i].sum;
+		}
+	}
+	ThreadPool * pool;
+	long sum;
+};
+
+// Writes numbered blocks to a ring, retrying when it is full
+struct BlockWriter : public ThreadFunction{
+	void operator()(){
+		std::vector<unsigned> block(ring->blockSize());
+		for(unsigned n=0; n<count; ){
+			for(unsigned i=0; i<block.size(); ++i) block[i] = n*block.size() + i;
+			if(ring->write(&block[0])) ++n;
+			else al_sleep(1e-5);
+		}
+	}
+	BlockRing<unsigned> * ring;
+	unsigned count;
+};
+
 int utThread() {
 
 	//UT_PRINTF("system: thread\n");
@@ -54,5 +110,93 @@ int utThread() {
 		assert(1 == x);
 	}
 
+	// Block ring
+	{
+		BlockRing<unsigned> ring(4, 3);
+		assert(ring.numBlocks() == 4);
+		assert(ring.readable() == 0 && ring.writable() == 4);
+		unsigned block[4] = {0,1,2,3};
+		assert(!ring.read(block) && ring.underruns() == 1);
+		for(int i=0; i<4; ++i) assert(ring.write(block));
+		assert(!ring.write(block) && ring.overruns() == 1);
+		assert(ring.writeBlock() == NULL && ring.overruns() == 2);
+		assert(ring.readBlock() != NULL && ring.underruns() == 1);
+		assert(ring.readable() == 4);
+
+		// one writer and one reader thread; every block arrives whole and in order
+		ring.resize(64, 8);
+		BlockWriter writer;
+		writer.ring = &ring;
+		writer.count = 10000;
+		Thread t(writer);
+		std::vector<unsigned> dst(ring.blockSize());
+		for(unsigned n=0; n<writer.count; ){
+			// alternate between copying out and reading in place
+			if(n & 1){
+				const unsigned * src = ring.readBlock();
+				if(!src){ al_sleep(1e-5); continue; }
+				for(unsigned i=0; i<dst.size(); ++i) dst[i] = src[i];
+				ring.commitRead();
+			}
+			else if(!ring.read(&dst[0])){ al_sleep(1e-5); continue; }
+			for(unsigned i=0; i<dst.size(); ++i) assert(dst[i] == n*dst.size() + i);
+			++n;
+		}
+		t.join();
+		assert(ring.readable() == 0);
+	}
+
+	// Thread pool
+	{
+		ThreadPool pool(3);
+		assert(pool.size() == 3);
+
+		// Loops
+		const int N = 10000;
+		int counts[N];
+		for(int r=0; r<20; ++r){
+			for(int i=0; i<N; ++i) counts[i] = 0;
+			CountIndices f(counts);
+			pool.parallelFor(0, N, 16 + r, f);
+			for(int i=0; i<N; ++i) assert(counts[i] == 1);
+		}
+
+		pool.resetStats();
+		{
+			for(int i=0; i<N; ++i) counts[i] = 0;
+			CountIndices f(counts);
+			pool.parallelFor(100, N, 10, f);
+			for(int i=0; i<100; ++i) assert(counts[i] == 0);
+			for(int i=100; i<N; ++i) assert(counts[i] == 1);
+
+			unsigned chunks = 0;
+			for(int i=0; i<=pool.size(); ++i) chunks += pool.stats(i).chunks;
+			assert(chunks == (N-100)/10);
+		}
+
+		// Tasks
+		SumTask tasks[100];
+		for(int i=0; i<100; ++i){
+			tasks[i].begin = 0;
+			tasks[i].end = i;
+			pool.submit(tasks[i]);
+		}
+		for(int i=0; i<100; ++i){
+			tasks[i].wait();
+			assert(tasks[i].done());
+			assert(tasks[i].sum == i*(i-1)/2);
+		}
+
+		SplitTask split[8];
+		for(int i=0; i<8; ++i){
+			split[i].pool = &pool;
+			pool.submit(split[i]);
+		}
+		for(int i=0; i<8; ++i){
+			split[i].wait();
+			assert(split[i].sum == 1000*999/2);
+		}
+	}
+
 	return 0;
 }
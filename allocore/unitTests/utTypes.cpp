@@ -1,7 +1,23 @@
+#include <algorithm>
+#include <sys/stat.h>
 #include "utAllocore.h"
+#include "allocore/system/al_ThreadPool.hpp"
+#include "allocore/types/al_MsgQueue.hpp"
+#include "allocore/types/al_VoxelBricks.hpp"
+#include "allocore/types/al_Voxels.hpp"
 
 typedef double data_t;
 
+static int msgCount = 0;
+static int msgIDs[64];
+static void msgRecord(al_sec t, int id){ msgIDs[msgCount++] = id; }
+
+static int sliceCalls = 0;
+static bool sliceProgress(int done, int total, void * cancelAt){
+	++sliceCalls;
+	return done != *(int *)cancelAt;
+}
+
 int utTypes(){
 
 
@@ -286,6 +302,248 @@ int utTypes(){
 		assert(a.read(3) == 2);
 	}
 
+
+	// Voxels mapped and streamed from files
+	for(int swap=0; swap<2; ++swap){
+		const char * path = "utVoxels.mrc";
+		const int nx=5, ny=4, nz=3;
+
+		MRCHeader h;
+		memset(&h, 0, sizeof(h));
+		h.nx = nx; h.ny = ny; h.nz = nz;
+		h.mode = MRC_IMAGE_SINT16;
+		h.mapx = 1; h.mapy = 2; h.mapz = 3;
+		h.next = 8; // extended header
+		int16_t vals[nz][ny][nx];
+		for(int z=0; z<nz; ++z) for(int y=0; y<ny; ++y) for(int x=0; x<nx; ++x)
+			vals[z][y][x] = z*1000 + y*100 + x - 300;
+		if(swap){
+			swapBytes(&h.nx, 10);
+			swapBytes(&h.mapx, 3);
+			swapBytes(&h.next, 1);
+			swapBytes(&vals[0][0][0], nx*ny*nz);
+		}
+		char ext[8] = {0};
+		File f(path, "wb");
+		assert(f.open());
+		f.write(&h, sizeof(h));
+		f.write(ext, sizeof(ext));
+		f.write(vals, sizeof(vals));
+		f.close();
+
+		Voxels v;
+		assert(v.mapMRC(path) && v.mapped());
+		assert(v.isType<int16_t>() && v.width() == nx && v.height() == ny && v.depth() == nz);
+		assert(v.elem<int16_t>(0, 0,0,0) == -300);
+		assert(v.elem<int16_t>(0, 4,3,2) == 2004);
+
+		Array brick;
+		MRCStream stream;
+		assert(stream.open(path) && stream.swapped() == bool(swap));
+		assert(stream.dim(0) == nx && stream.dim(2) == nz);
+		assert(stream.read(brick, 1,2,1, 3,2,2));
+		assert(brick.width() == 3 && brick.height() == 2 && brick.depth() == 2);
+		for(int z=0; z<2; ++z) for(int y=0; y<2; ++y) for(int x=0; x<3; ++x)
+			assert(brick.elem<int16_t>(0, x,y,z) == v.elem<int16_t>(0, x+1,y+2,z+1));
+		assert(!stream.read(brick, 3,0,0, 3,1,1));
+		stream.close();
+
+		// voxel files written by writeToFile map back the same
+		v.writeToFile("utVoxels.vox");
+		Voxels w;
+		assert(w.mapFile("utVoxels.vox"));
+		assert(w.isFormat(v) && !memcmp(w.data.ptr, v.data.ptr, v.size()));
+
+		// copies of mapped voxels own their data
+		{
+			Voxels c(w);
+			assert(!c.mapped() && c.data.ptr != w.data.ptr);
+			assert(c.isFormat(w) && !memcmp(c.data.ptr, w.data.ptr, w.size()));
+		}
+		assert(w.mapped() && w.elem<int16_t>(0, 4,3,2) == 2004);
+
+		// assigning to mapped voxels releases the mapping
+		{
+			Voxels c(AlloFloat32Ty, 2,2,2);
+			Voxels m;
+			assert(m.mapFile("utVoxels.vox"));
+			m = c;
+			assert(!m.mapped() && m.isFormat(c));
+			m = w;
+			assert(!m.mapped() && m.elem<int16_t>(0, 4,3,2) == 2004);
+		}
+		w.unmap();
+		assert(!w.mapped() && !w.hasData());
+
+		// loading after mapping replaces the mapping
+		v.loadFromMRC(path);
+		assert(!v.mapped() && v.elem<int16_t>(0, 4,3,2) == 2004);
+
+		::remove(path);
+		::remove("utVoxels.vox");
+	}
+
+	// Voxels assembled from image slices
+	{
+		const std::string dir = "utVoxelsSlices";
+		const int nx=5, ny=4, nz=3;
+		mkdir(dir.c_str(), 0755);
+		Array slice(3, AlloUInt8Ty, nx, ny);
+		for(int z=0; z<nz; ++z){
+			for(int y=0; y<ny; ++y) for(int x=0; x<nx; ++x){
+				uint8_t rgb[] = { uint8_t(z*50 + x), uint8_t(y*10), 200 };
+				slice.write(rgb, x, y);
+			}
+			char name[32];
+			sprintf(name, "/slice%d.png", z);
+			assert(Image::save(dir + name, slice));
+		}
+
+		Voxels v;
+		ThreadPool pool(2);
+		assert(v.loadFromImages(dir, Voxels::SLICE_RED, &pool));
+		assert(v.isType<uint8_t>() && v.width() == nx && v.height() == ny && v.depth() == nz);
+		for(int z=0; z<nz; ++z) for(int y=0; y<ny; ++y) for(int x=0; x<nx; ++x)
+			assert(v.elem<uint8_t>(0, x,y,z) == z*50 + x);
+
+		assert(v.loadFromImages(dir, Voxels::SLICE_GREEN));
+		assert(v.elem<uint8_t>(0, 1,3,2) == 30);
+
+		assert(v.loadFromImages(dir, Voxels::SLICE_LUMINANCE, &pool));
+		for(int z=0; z<nz; ++z) for(int y=0; y<ny; ++y) for(int x=0; x<nx; ++x)
+			assert(v.elem<uint8_t>(0, x,y,z) == (77*(z*50 + x) + 150*(y*10) + 29*200 + 128) >> 8);
+
+		// RGB slices have no alpha
+		assert(!v.loadFromImages(dir, Voxels::SLICE_ALPHA) && !v.hasData());
+
+		// progress can cancel
+		int cancelAt = 2;
+		sliceCalls = 0;
+		assert(!v.loadFromImages(dir, Voxels::SLICE_RED, NULL, sliceProgress, &cancelAt));
+		assert(sliceCalls == 2 && !v.hasData());
+		cancelAt = -1;
+		sliceCalls = 0;
+		assert(v.loadFromImages(dir, Voxels::SLICE_RED, &pool, sliceProgress, &cancelAt));
+		assert(sliceCalls == nz);
+
+		// slices must all be the same size
+		Array small(3, AlloUInt8Ty, nx-1, ny);
+		assert(Image::save(dir + "/slice3.png", small));
+		assert(!v.loadFromImages(dir, Voxels::SLICE_RED, &pool) && !v.hasData());
+
+		for(int z=0; z<=nz; ++z){
+			char name[32];
+			sprintf(name, "/slice%d.png", z);
+			::remove((dir + name).c_str());
+		}
+		::remove(dir.c_str());
+	}
+
+	// VoxelBricks
+	{
+		const int nx=37, ny=20, nz=9, B=8;
+		Voxels v(AlloUInt16Ty, nx, ny, nz);
+		for(int z=0; z<nz; ++z) for(int y=0; y<ny; ++y) for(int x=0; x<nx; ++x)
+			v.elem<uint16_t>(0, x,y,z) = (x*7 + y*13 + z*101) % 1000;
+
+		VoxelBricks vb(B), vbp(B);
+		ThreadPool pool(2);
+		assert(vb.build(v) && vbp.build(v, &pool));
+		// 37x20x9, 19x10x5, 10x5x3, 5x3x2
+		assert(vb.levels() == 4 && vb.type() == AlloUInt16Ty);
+		assert(vb.dim(0,1) == 19 && vb.dim(2,1) == 5 && vb.dim(0,3) == 5);
+		assert(vb.bricks(0) == 5 && vb.bricks(1) == 3 && vb.bricks(2) == 2);
+
+		for(int l=0; l<vb.levels(); ++l){
+			assert(vb.numBricks(l) == vbp.numBricks(l));
+			assert(!memcmp(vb.brickData(l,0), vbp.brickData(l,0), vb.numBricks(l)*vb.brickVoxels()*2));
+		}
+
+		for(int z=0; z<nz; ++z) for(int y=0; y<ny; ++y) for(int x=0; x<nx; ++x)
+			assert(vb.value(0, x,y,z) == v.elem<uint16_t>(0, x,y,z));
+
+		// coarser levels average 2x2x2 voxels, repeating the edges
+		for(int z=0; z<5; ++z) for(int y=0; y<10; ++y) for(int x=0; x<19; ++x){
+			double sum = 0;
+			for(int k=0; k<8; ++k){
+				int fx = std::min(2*x + (k&1), nx-1);
+				int fy = std::min(2*y + ((k>>1)&1), ny-1);
+				int fz = std::min(2*z + (k>>2), nz-1);
+				sum += v.elem<uint16_t>(0, fx,fy,fz);
+			}
+			assert(vb.value(1, x,y,z) == floor(sum/8 + 0.5));
+		}
+
+		// metadata and range queries
+		for(uint32_t i=0; i<vb.numBricks(); ++i){
+			const VoxelBricks::Brick& b = vb.brick(0, i);
+			assert(vb.brickIndex(0, b.x, b.y, b.z) == i);
+			double lo = 1e9, hi = -1e9, sum = 0;
+			int n = 0;
+			for(int z=b.z*B; z<std::min<int>(nz, b.z*B+B); ++z)
+			for(int y=b.y*B; y<std::min<int>(ny, b.y*B+B); ++y)
+			for(int x=b.x*B; x<std::min<int>(nx, b.x*B+B); ++x){
+				double val = v.elem<uint16_t>(0, x,y,z);
+				lo = std::min(lo, val); hi = std::max(hi, val); sum += val; ++n;
+			}
+			assert(b.min == lo && b.max == hi && fabs(b.mean - sum/n) < 1e-3);
+		}
+		std::vector<uint32_t> inRange;
+		vb.bricksInRange(inRange, 0, 990, 2000);
+		for(uint32_t i=0, j=0; i<vb.numBricks(); ++i){
+			bool expect = vb.brick(0,i).max >= 990;
+			if(expect) assert(inRange[j++] == i);
+			if(i == vb.numBricks()-1) assert(j == inRange.size());
+		}
+
+		// regions across bricks
+		Array region;
+		assert(vb.read(region, 0, 5,3,2, 20,15,7));
+		assert(region.width() == 20 && region.height() == 15 && region.depth() == 7);
+		for(int z=0; z<7; ++z) for(int y=0; y<15; ++y) for(int x=0; x<20; ++x)
+			assert(region.elem<uint16_t>(0, x,y,z) == v.elem<uint16_t>(0, x+5,y+3,z+2));
+		assert(vb.read(region, 2, 0,0,0, 10,5,3));
+		assert(region.elem<uint16_t>(0, 9,4,2) == vb.value(2, 9,4,2));
+		assert(!vb.read(region, 0, 30,0,0, 8,1,1));
+
+		// texture atlas
+		std::vector<uint32_t> some;
+		some.push_back(3); some.push_back(0); some.push_back(29);
+		Array atlas;
+		uint32_t side = vb.atlas(atlas, 0, some);
+		assert(side == 2 && atlas.width() == 2*B && atlas.height() == 2*B && atlas.depth() == B);
+		assert(atlas.elem<uint16_t>(0, 1,2,3) == vb.value(0, 3*B+1,2,3));
+		assert(atlas.elem<uint16_t>(0, B+1,2,3) == vb.value(0, 1,2,3));
+		const VoxelBricks::Brick& b29 = vb.brick(0, 29);
+		assert(atlas.elem<uint16_t>(0, 0,B,0) == vb.value(0, b29.x*B, b29.y*B, b29.z*B));
+	}
+
+	// MsgQueue
+	for(int k=0; k<2; ++k){
+		// small pool so that it has to grow
+		MsgQueue q(4, NULL, NULL, k ? MsgQueue::HEAP : MsgQueue::LIST);
+
+		// ids in order of time; equal times keep order of insertion
+		const double times[] = { 5, 1, 3, 3, 0, 8, 3, 2, 9, 7 };
+		const int ids[]      = { 6, 1, 3, 4, 0, 8, 5, 2, 9, 7 };
+		for(int i=0; i<10; ++i) q.send(times[i], msgRecord, ids[i]);
+		assert(q.len() == 10);
+
+		msgCount = 0;
+		q.update(3);
+		assert(msgCount == 6);
+		assert(q.len() == 4);
+		assert(q.now() == 3);
+		q.update(10);
+		assert(msgCount == 10);
+		assert(q.len() == 0);
+		for(int i=0; i<10; ++i) assert(msgIDs[i] == i);
+
+		q.send(20, msgRecord, 0);
+		q.clear();
+		assert(q.len() == 0);
+	}
+
 	return 0;
 }
 
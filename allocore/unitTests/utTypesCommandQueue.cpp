@@ -0,0 +1,169 @@
+#include <new>
+#include <stdlib.h>
+#include "utAllocore.h"
+#include "allocore/types/al_CommandQueue.hpp"
+
+#if defined(AL_WINDOWS)
+	#define UT_THREAD_LOCAL __declspec(thread)
+#elif __cplusplus >= 201103L
+	#define UT_THREAD_LOCAL thread_local
+#else
+	#define UT_THREAD_LOCAL __thread
+#endif
+
+// Count allocations made through operator new by the thread that enabled
+// counting. Other threads and tests just get malloc and free.
+namespace{
+	UT_THREAD_LOCAL bool gCountAllocs = false;
+	UT_THREAD_LOCAL int gNumAllocs = 0;
+}
+
+#if __cplusplus >= 201103L
+	#define UT_THROW_BAD_ALLOC
+	#define UT_THROW_NONE noexcept
+#else
+	#define UT_THROW_BAD_ALLOC throw(std::bad_alloc)
+	#define UT_THROW_NONE throw()
+#endif
+
+void * operator new(size_t size) UT_THROW_BAD_ALLOC {
+	if(gCountAllocs) ++gNumAllocs;
+	void * p = malloc(size ? size : 1);
+	if(!p) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void * p) UT_THROW_NONE {
+	free(p);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void * p, size_t) UT_THROW_NONE {
+	free(p);
+}
+#endif
+
+
+#define NUM_PRODUCERS (4)
+#define NUM_COMMANDS (20000)
+
+namespace{
+	int gExpected[NUM_PRODUCERS];
+	bool gInOrder = true;
+	uint64_t gFrames[16];
+	int gNumFrames = 0;
+}
+
+static void receive(uint64_t frame, int producer, int count){
+	if(producer < 0 || producer >= NUM_PRODUCERS
+		|| count != gExpected[producer] || frame != uint64_t(count)
+	){
+		gInOrder = false;
+		return;
+	}
+	++gExpected[producer];
+}
+
+static void stamp(uint64_t frame){
+	gFrames[gNumFrames++] = frame;
+}
+
+struct Producer : public ThreadFunction{
+	CommandQueue * queue;
+	Atomic<int> * go;
+	int id;
+
+	void operator()(){
+		while(!go->load()) spinPause();
+		for(int i=0; i<NUM_COMMANDS; ++i){
+			// retry until consumer has made room
+			while(!queue->send(uint64_t(i), receive, id, i)){
+				al_sleep(1e-5);
+			}
+		}
+	}
+};
+
+
+int utTypesCommandQueue(){
+
+	// Single thread
+	{
+		CommandQueue q(5, 16);
+		assert(q.capacity() == 8);
+		assert(q.argSize() == 16);
+		assert(q.size() == 0);
+
+		uint64_t t;
+		assert(!q.nextTime(t));
+		assert(!q.executeNext());
+
+		for(int i=0; i<8; ++i) assert(q.send(10*i, stamp));
+		assert(!q.send(80, stamp));
+		assert(q.overflows() == 1);
+		assert(q.highWater() == 8);
+		assert(q.size() == 8);
+
+		// arguments larger than a slot are rejected, but do not overflow
+		char big[17] = {0};
+		assert(!q.sendData(0, 0, big, sizeof(big)));
+		assert(q.overflows() == 1);
+
+		// execute up to, but not including, frame 25
+		assert(q.nextTime(t) && t == 0);
+		assert(q.executeUntil(25) == 3);
+		assert(gNumFrames == 3);
+		assert(gFrames[0] == 0 && gFrames[1] == 10 && gFrames[2] == 20);
+		assert(q.nextTime(t) && t == 30);
+		assert(q.size() == 5);
+
+		// freed slots are reused
+		assert(q.send(80, stamp));
+		assert(q.executeUntil(1000) == 6);
+		assert(gNumFrames == 9);
+		assert(gFrames[7] == 70 && gFrames[8] == 80);
+		assert(!q.nextTime(t));
+		assert(q.size() == 0);
+
+		q.resetStats();
+		assert(q.overflows() == 0 && q.highWater() == 0);
+	}
+
+	// Multiple producers, one consumer
+	{
+		CommandQueue q(64);
+		Atomic<int> go(0);
+		Threads<Producer> producers(NUM_PRODUCERS);
+		for(int i=0; i<NUM_PRODUCERS; ++i){
+			Producer& p = producers.function(i);
+			p.queue = &q;
+			p.go = &go;
+			p.id = i;
+			gExpected[i] = 0;
+		}
+		producers.start(false);
+
+		// consumer must not allocate
+		gNumAllocs = 0;
+		gCountAllocs = true;
+		go.store(1);
+
+		int received = 0;
+		while(received < NUM_PRODUCERS*NUM_COMMANDS){
+			int n = q.executeUntil(NUM_COMMANDS);
+			if(!n) al_sleep(1e-5);
+			received += n;
+		}
+
+		gCountAllocs = false;
+		producers.join();
+
+		assert(gInOrder);
+		for(int i=0; i<NUM_PRODUCERS; ++i) assert(gExpected[i] == NUM_COMMANDS);
+		assert(gNumAllocs == 0);
+		assert(q.size() == 0);
+		assert(q.highWater() <= q.capacity());
+	}
+
+	return 0;
+}
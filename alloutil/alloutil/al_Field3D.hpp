@@ -44,9 +44,12 @@
 */
 
 
+#include <math.h>
+#include <vector>
 #include "allocore/types/al_Array.hpp"
 #include "allocore/math/al_Functions.hpp"
 #include "allocore/math/al_Random.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
 
 namespace al {
 
@@ -135,6 +138,13 @@ public:
 	// diffusion
 	void diffuse(T diffusion=T(0.01), unsigned passes=14);
 
+	/// Diffusion using red-black ordered Gauss-Seidel
+
+	/// This solves the same system as diffuse(), but updates every other cell
+	/// in each half-pass, so cells can be updated in any order and planes are
+	/// processed in parallel if a thread pool is given.
+	void diffuseRedBlack(T diffusion=T(0.01), unsigned passes=14, ThreadPool * pool=NULL);
+
 	/// Diffusion with arbitrary kernel:
 	/// the kernel layout:
 	enum CellIndex {
@@ -172,6 +182,35 @@ public:
 	void advect(const Array& velocities, T rate = T(1.));
 	static void advect(Array& dst, const Array& src, const Array& velocities, T rate = T(1.));
 
+	/// Treatment of samples outside the field during advection
+	enum Edge {
+		WRAP = 0,	///< wrap around to opposite edge
+		CLAMP = 1,	///< use nearest cell on edge
+		ZERO = 2	///< values outside are zero
+	};
+
+	/// Advect a field with given edge treatment
+
+	/// Each cell is traced back along the velocity at the cell and the
+	/// source is sampled there with trilinear interpolation. Planes are
+	/// processed in parallel if a thread pool is given. If correct is true,
+	/// the MacCormack scheme is used: the result is advected backward to
+	/// estimate the error of the forward step, which is then subtracted,
+	/// limited to the range of the sampled cells. This greatly reduces
+	/// numerical diffusion at about three times the cost, but then the
+	/// velocities must not be the back buffer.
+	void advect(const Array& velocities, T rate, Edge edge, bool correct=false, ThreadPool * pool=NULL);
+
+	/// Advect src into dst with given edge treatment
+
+	/// dst must have the same layout as src and must not be src.
+	static void advect(Array& dst, const Array& src, const Array& velocities, T rate, Edge edge, ThreadPool * pool=NULL);
+
+	/// Advect src into dst using the MacCormack scheme
+
+	/// scratch is formatted as needed to hold the backward advected field.
+	static void advectMacCormack(Array& dst, const Array& src, const Array& velocities, Array& scratch, T rate, Edge edge, ThreadPool * pool=NULL);
+
 	/*
 		Clever part of Jos Stam's work.
 			A velocity field can become divergent (have regions that are purely emanating or aggregating)
@@ -187,11 +226,142 @@ public:
 	void relax(double a, int iterations);
 
 protected:
+	// Half-pass of diffuseRedBlack over one plane
+	struct RedBlackPass{
+		const Field3D * field;
+		const char * iptr;
+		char * optr;
+		T diffusion, div;
+		int color;
+		void operator()(int z);
+	};
+
+	// Advection of one plane; if back is not NULL, the MacCormack
+	// correction is applied using the backward advected field
+	struct AdvectPass{
+		Array * dst;
+		const Array * src;
+		const Array * vel;
+		const Array * back;
+		T rate;
+		Edge edge;
+		void operator()(int z);
+		template<int C> void plane(int z);
+		template<int C, int E> void plane(int z);
+	};
+
+	static bool advectFormatOK(const Array& src, const Array& velocities);
+	static void advectPlanes(AdvectPass& pass, ThreadPool * pool);
+
 	size_t mDimX, mDimY, mDimZ, mDim3, mDimWrapX, mDimWrapY, mDimWrapZ;
 	volatile int mFront;	// which one is the front buffer?
 	Array mArray0, mArray1; //mArrays[2];	// double-buffering
+	Array mScratch;			// for MacCormack advection
 };
 
+/// Multigrid solver for the Poisson equation on a periodic grid
+
+/// This solves -L p = f, where L is the 7-point Laplacian in grid units and
+/// the grid wraps around at its edges, as in Field3D. Each V-cycle smooths
+/// the error using red-black Gauss-Seidel passes, restricts the residual to a
+/// grid of half the size and recursively solves for its correction. The grid
+/// is coarsened while all dimensions are even and at least 4.
+///
+/// The right hand side should sum to zero; its mean is removed since
+/// otherwise there is no solution. The solution is unique up to a constant.
+/// Any grid size is accepted and the result does not depend on whether a
+/// thread pool is used.
+template<typename T=float>
+class Poisson3D {
+public:
+
+	Poisson3D()
+	:	mPool(NULL), mPreSmooth(2), mPostSmooth(2), mCoarseSmooth(16),
+		mCycles(0), mResidual(0), mInitialResidual(0)
+	{}
+
+	/// Set thread pool used to process planes of the grid in parallel
+	Poisson3D& threadPool(ThreadPool * v){ mPool=v; return *this; }
+
+	/// Set number of relaxation passes before and after coarse grid correction
+	Poisson3D& smoothing(int pre, int post){ mPreSmooth=pre; mPostSmooth=post; return *this; }
+
+	/// Solve for p using V-cycles
+
+	/// @param[in,out] p		initial guess and solution; 1-component array
+	/// @param[in] f			right hand side; same layout as p
+	/// @param[in] tolerance	stop when residual relative to f is below this
+	/// @param[in] maxCycles	maximum number of V-cycles
+	/// \returns number of V-cycles done
+	int solve(Array& p, const Array& f, T tolerance=T(1e-3), int maxCycles=10);
+
+	/// Solve for p using red-black Gauss-Seidel passes on the full grid only
+
+	/// This is for comparison with solve(); it updates residual() but not
+	/// cycles().
+	void relax(Array& p, const Array& f, int passes);
+
+	/// Get number of V-cycles done by last solve
+	int cycles() const { return mCycles; }
+
+	/// Get RMS residual, relative to RMS of right hand side, after last solve
+	T residual() const { return mResidual; }
+
+	/// Get RMS residual, relative to RMS of right hand side, before last solve
+	T initialResidual() const { return mInitialResidual; }
+
+	/// Compute RMS residual of p, relative to RMS of f, for arbitrary arrays
+	static T residual(const Array& p, const Array& f);
+
+protected:
+
+	struct Level{
+		int nx, ny, nz;
+		T h2;					// squared cell size in finest grid units
+		std::vector<T> p, f, r;	// solution, right hand side, residual
+		std::vector<double> sums;	// per plane sums for reductions
+		int index(int x, int y, int z) const { return x + nx*(y + ny*z); }
+		void resize(int x, int y, int z, T h2_);
+	};
+
+	// Parallel operations on the planes of a level
+	struct Relax{
+		Level * L; int color;
+		void operator()(int z);
+	};
+	struct Residual{
+		Level * L;
+		void operator()(int z);
+	};
+	struct Restrict{
+		const Level * fine; Level * coarse;
+		void operator()(int z);
+	};
+	struct Prolong{
+		Level * fine; const Level * coarse;
+		void operator()(int z);
+	};
+
+	std::vector<Level> mLevels;
+	ThreadPool * mPool;
+	int mPreSmooth, mPostSmooth, mCoarseSmooth;
+	int mCycles;
+	T mResidual, mInitialResidual;
+
+	template <class Func>
+	void forPlanes(int nz, Func& func){
+		if(mPool) mPool->parallelFor(0, nz, 1, func);
+		else for(int z=0; z<nz; ++z) func(z);
+	}
+
+	void setup(const Array& p, const Array& f);
+	void copyOut(Array& p) const;
+	void relax(Level& L, int passes);
+	double residual(Level& L);		// returns sum of squared residuals
+	void vcycle(int l);
+};
+
+
 template<typename T=float>
 class Fluid3D {
 public:
@@ -201,6 +371,12 @@ public:
 		FIELD = 2
 	};
 
+	/// Method used to diffuse velocities and project them
+	enum Solver {
+		GAUSS_SEIDEL = 0,	///< fixed number of Gauss-Seidel passes
+		MULTIGRID = 1		///< red-black diffusion and multigrid projection
+	};
+
 	Fluid3D(int dimx=32, int dimy=32, int dimz=32)
 	:	velocities(3, dimx, dimy, dimz),
 		gradient(1, dimx, dimy, dimz),
@@ -210,7 +386,15 @@ public:
 		selfadvection(0.9),
 		selfdecay(0.99),
 		selfbackgroundnoise(0.001),
-		mBoundaryMode(CLAMP)
+		mBoundaryMode(CLAMP),
+		mSolver(GAUSS_SEIDEL),
+		mPool(NULL),
+		mTolerance(1e-3),
+		mMaxCycles(4),
+		mCycles(0),
+		mResidual(0),
+		mAdvectEdge(Field3D<T>::WRAP),
+		mAdvectCorrect(false)
 	{
 		// set all values to T(1):
 		T one = 1;
@@ -249,7 +433,8 @@ public:
 		velocities.adduniformS(rng, selfbackgroundnoise);
 		// assume new data is in front();
 		// smoothen the new data:
-		velocities.diffuse(viscocity, passes);
+		if(mSolver == MULTIGRID) velocities.diffuseRedBlack(viscocity, passes, mPool);
+		else velocities.diffuse(viscocity, passes);
 		// zero velocities at boundaries:
 		boundary();
 		// (diffused data now in velocities.front())
@@ -257,7 +442,13 @@ public:
 		project();
 		// (projected data now in velocities.front())
 		// advect velocities:
-		velocities.advect(velocities.back(), selfadvection);
+		if (mAdvectCorrect) {
+			// MacCormack advection writes the back buffer more than once,
+			// so trace along the projected velocities instead
+			velocities.advect(velocities.front(), selfadvection, mAdvectEdge, true, mPool);
+		} else {
+			velocities.advect(velocities.back(), selfadvection, mAdvectEdge, false, mPool);
+		}
 		// zero velocities at boundaries:
 		boundary();
 		// (advected data now in velocities.front())
@@ -286,6 +477,10 @@ public:
 	}
 
 	void project() {
+		if(mSolver == MULTIGRID){
+			projectMultigrid();
+			return;
+		}
 		gradient.back().zero();
 		// prepare new gradient data:
 		velocities.calculateGradientMagnitude(gradient.front());
@@ -297,12 +492,48 @@ public:
 
 	void boundary(BoundaryMode b) { mBoundaryMode = b; }
 
+	/// Set method used to diffuse and project velocities
+	void solver(Solver v){ mSolver = v; }
+
+	/// Set thread pool used by multigrid solver and advection (may be NULL)
+	void threadPool(ThreadPool * v){ mPool = v; mPoisson.threadPool(v); }
+
+	/// Set treatment of field edges and whether to use MacCormack correction
+	/// during advection
+	void advection(typename Field3D<T>::Edge edge, bool correct=false){
+		mAdvectEdge = edge; mAdvectCorrect = correct;
+	}
+
+	/// Set residual relative to divergence at which projection stops, and
+	/// maximum number of V-cycles per projection
+	void tolerance(T tol, int maxCycles=4){ mTolerance = tol; mMaxCycles = maxCycles; }
+
+	/// Get total number of V-cycles done by last multigrid projection
+	int cycles() const { return mCycles; }
+
+	/// Get largest relative residual of last multigrid projection
+	T residual() const { return mResidual; }
+
 	Field3D<T> velocities, gradient;
 	Array boundaries;
 	unsigned passes;
 	T viscocity, selfadvection, selfdecay, selfbackgroundnoise;
 	rnd::Random<> rng;
 	BoundaryMode mBoundaryMode;
+
+protected:
+	Solver mSolver;
+	ThreadPool * mPool;
+	Poisson3D<T> mPoisson;
+	Array mSubP, mSubF;
+	T mTolerance;
+	int mMaxCycles;
+	int mCycles;
+	T mResidual;
+	typename Field3D<T>::Edge mAdvectEdge;
+	bool mAdvectCorrect;
+
+	void projectMultigrid();
 };
 
 
@@ -342,7 +573,7 @@ public:
 		densities.diffuse(diffusion, Super::passes);
 		//(diffused data now in densities.front())
 		// and advect:
-		densities.advect(Super::velocities.front());
+		densities.advect(Super::velocities.front(), T(1), Super::mAdvectEdge, Super::mAdvectCorrect, Super::mPool);
 		//(advected data now in densities.front())
 		// fade, etc.
 		densities.scale(decay);
@@ -668,6 +899,74 @@ inline void Field3D<T> :: diffuse(T diffusion, unsigned passes) {
 	#undef INDEX
 }
 
+template<typename T>
+inline void Field3D<T>::RedBlackPass::operator()(int z) {
+	const Field3D& f = *field;
+	const size_t stride0 = f.stride(0);
+	const size_t stride1 = f.stride(1);
+	const size_t stride2 = f.stride(2);
+	const size_t components = f.components();
+	const size_t zo = z*stride2;
+	const size_t zm = ((z-1)&f.mDimWrapZ)*stride2;
+	const size_t zp = ((z+1)&f.mDimWrapZ)*stride2;
+
+	for (size_t y=0;y<f.mDimY;y++) {
+		// rows of cell and its neighbors along y and z
+		const size_t yo = y*stride1;
+		const size_t ym = ((y-1)&f.mDimWrapY)*stride1;
+		const size_t yp = ((y+1)&f.mDimWrapY)*stride1;
+		const char * rowPrev = iptr + yo + zo;
+		char * row = optr + yo + zo;
+		const char * rowY0 = optr + ym + zo;
+		const char * rowY1 = optr + yp + zo;
+		const char * rowZ0 = optr + yo + zm;
+		const char * rowZ1 = optr + yo + zp;
+
+		for (size_t x=(y+z+color)&1;x<f.mDimX;x+=2) {
+			const size_t xo = x*stride0;
+			const size_t xm = ((x-1)&f.mDimWrapX)*stride0;
+			const size_t xp = ((x+1)&f.mDimWrapX)*stride0;
+			const T * prev = (const T *)(rowPrev + xo);
+			T *		  next = (T *)(row + xo);
+			const T * va00 = (const T *)(row + xm);
+			const T * vb00 = (const T *)(row + xp);
+			const T * v0a0 = (const T *)(rowY0 + xo);
+			const T * v0b0 = (const T *)(rowY1 + xo);
+			const T * v00a = (const T *)(rowZ0 + xo);
+			const T * v00b = (const T *)(rowZ1 + xo);
+			for (size_t k=0;k<components;k++) {
+				next[k] = div*(
+					prev[k] +
+					diffusion * (
+						va00[k] + vb00[k] +
+						v0a0[k] + v0b0[k] +
+						v00a[k] + v00b[k]
+					)
+				);
+			}
+		}
+	}
+}
+
+// Red-black Gauss-Seidel relaxation scheme:
+template<typename T>
+inline void Field3D<T> :: diffuseRedBlack(T diffusion, unsigned passes, ThreadPool * pool) {
+	swap();
+	RedBlackPass pass;
+	pass.field = this;
+	pass.iptr = back().data.ptr;
+	pass.optr = front().data.ptr;
+	pass.diffusion = diffusion;
+	pass.div = 1.0/((1.+6.*diffusion));
+
+	for (unsigned n=0 ; n<passes ; n++) {
+		for (pass.color=0; pass.color<2; ++pass.color) {
+			if (pool) pool->parallelFor(0, mDimZ, 1, pass);
+			else for (size_t z=0;z<mDimZ;z++) pass(z);
+		}
+	}
+}
+
 // Gauss-Seidel relaxation scheme:
 template<typename T>
 inline void Field3D<T> :: diffuse(const Kernel3& kernel, T diffusion, unsigned passes) {
@@ -852,53 +1151,198 @@ inline void Field3D<T> :: relax( double diffusion, int iterations) {
 }
 
 template<typename T>
-inline void Field3D<T> :: advect(Array& dst, const Array& src, const Array& velocities, T rate) {
-	const size_t stride0 = src.stride(0);
-	const size_t stride1 = src.stride(1);
-	const size_t stride2 = src.stride(2);
-	const size_t dim0 = src.dim(0);
-	const size_t dim1 = src.dim(1);
-	const size_t dim2 = src.dim(2);
-	const size_t dimwrap0 = dim0-1;
-	const size_t dimwrap1 = dim1-1;
-	const size_t dimwrap2 = dim2-1;
-
+inline bool Field3D<T> :: advectFormatOK(const Array& src, const Array& velocities) {
 	if (velocities.header.type != src.header.type ||
 		velocities.header.components < 3 ||
-		velocities.header.dim[0] != dim0 ||
-		velocities.header.dim[1] != dim1 ||
-		velocities.header.dim[2] != dim2)
+		velocities.header.dim[0] != src.dim(0) ||
+		velocities.header.dim[1] != src.dim(1) ||
+		velocities.header.dim[2] != src.dim(2))
 	{
 		printf("Array format mismatch\n");
-		return;
+		return false;
 	}
-	char * outptr = dst.data.ptr;
-	char * velptr = velocities.data.ptr;
+	return true;
+}
 
-	const size_t vstride0 = velocities.stride(0);
-	const size_t vstride1 = velocities.stride(1);
-	const size_t vstride2 = velocities.stride(2);
+// Find the two cells and weights along one axis for sampling at p;
+// wrap is dim-1 if dim is a power of two and otherwise 0
+template<typename T, int E>
+inline void advectAxis(
+	T p, int dim, int wrap, size_t stride,
+	size_t& o0, size_t& o1, T& w0, T& w1, bool& outside
+){
+	// keep traced position within range of int
+	const T lim = T(1 << 20);
+	p = p > -lim ? p : -lim;
+	p = p < lim ? p : lim;
+	int i0 = int(p);
+	if (p < T(i0)) --i0;
+	int i1 = i0+1;
+	w1 = p - T(i0);
+	w0 = T(1) - w1;
+
+	if (E == Field3D<T>::CLAMP) {
+		if (i0 < 0) { i0 = i1 = 0; w0 = 1; w1 = 0; }
+		else if (i1 >= dim) { i0 = i1 = dim-1; w0 = 1; w1 = 0; }
+	}
+	else if (E == Field3D<T>::ZERO) {
+		if (i0 < 0 || i0 >= dim) { i0 = i0 < 0 ? 0 : dim-1; w0 = 0; outside = true; }
+		if (i1 < 0 || i1 >= dim) { i1 = i1 < 0 ? 0 : dim-1; w1 = 0; outside = true; }
+	}
+	else if (wrap) {
+		i0 &= wrap;
+		i1 &= wrap;
+	}
+	else {
+		i0 %= dim;
+		if (i0 < 0) i0 += dim;
+		i1 = i0+1;
+		if (i1 == dim) i1 = 0;
+	}
+	o0 = i0*stride;
+	o1 = i1*stride;
+}
 
-	#define CELL(p, x, y, z, k) (((T *)((p) + (((x)&dimwrap0)*stride0) +  (((y)&dimwrap1)*stride1) +  (((z)&dimwrap2)*stride2)))[(k)])
-	#define VCELL(p, x, y, z, k) (((T *)((p) + (((x)&dimwrap0)*vstride0) +  (((y)&dimwrap1)*vstride1) +  (((z)&dimwrap2)*vstride2)))[(k)])
+template<typename T>
+inline void Field3D<T>::AdvectPass::operator()(int z) {
+	// specialize for common numbers of components
+	switch (src->header.components) {
+	case 1: plane<1>(z); break;
+	case 3: plane<3>(z); break;
+	default: plane<0>(z);
+	}
+}
 
-	for (size_t z=0;z<dim2;z++) {
-		for (size_t y=0;y<dim1;y++) {
-			for (size_t x=0;x<dim0;x++) {
-				// back trace: (current cell offset by vector at cell)
-				T * bp  = &(CELL(outptr, x, y, z, 0));
-				T * vp	= &(VCELL(velptr, x, y, z, 0));
-				T vx = x - rate * vp[0];
-				T vy = y - rate * vp[1];
-				T vz = z - rate * vp[2];
-
-				// read interpolated input field value into back-traced location:
-				src.read_interp(bp, vx, vy, vz);
+template<typename T>
+template<int C>
+inline void Field3D<T>::AdvectPass::plane(int z) {
+	switch (edge) {
+	case CLAMP:	plane<C, CLAMP>(z); break;
+	case ZERO:	plane<C, ZERO>(z); break;
+	default:	plane<C, WRAP>(z);
+	}
+}
+
+template<typename T>
+template<int C, int E>
+inline void Field3D<T>::AdvectPass::plane(int z) {
+	const int dim0 = src->dim(0), dim1 = src->dim(1), dim2 = src->dim(2);
+	const int wrap0 = (dim0 & (dim0-1)) ? 0 : dim0-1;
+	const int wrap1 = (dim1 & (dim1-1)) ? 0 : dim1-1;
+	const int wrap2 = (dim2 & (dim2-1)) ? 0 : dim2-1;
+	const size_t stride0 = src->stride(0);
+	const size_t stride1 = src->stride(1);
+	const size_t stride2 = src->stride(2);
+	const size_t vstride0 = vel->stride(0);
+	const int components = C ? C : src->header.components;
+	const char * sptr = src->data.ptr;
+	const char * bptr = back ? back->data.ptr : NULL;
+
+	for (int y=0; y<dim1; y++) {
+		const char * vrow = vel->data.ptr + y*vel->stride(1) + z*vel->stride(2);
+		const size_t row = y*stride1 + z*stride2;
+
+		for (int x=0; x<dim0; x++) {
+			// back trace: (current cell offset by vector at cell)
+			const T * v = (const T *)(vrow + x*vstride0);
+			size_t xa, xb, ya, yb, za, zb;
+			T xaf, xbf, yaf, ybf, zaf, zbf;
+			bool outside = false;
+			advectAxis<T,E>(T(x) - rate*v[0], dim0, wrap0, stride0, xa, xb, xaf, xbf, outside);
+			advectAxis<T,E>(T(y) - rate*v[1], dim1, wrap1, stride1, ya, yb, yaf, ybf, outside);
+			advectAxis<T,E>(T(z) - rate*v[2], dim2, wrap2, stride2, za, zb, zaf, zbf, outside);
+
+			// get the cell addresses for each neighbor:
+			const T * paaa = (const T *)(sptr + xa + ya + za);
+			const T * pbaa = (const T *)(sptr + xb + ya + za);
+			const T * paba = (const T *)(sptr + xa + yb + za);
+			const T * pbba = (const T *)(sptr + xb + yb + za);
+			const T * paab = (const T *)(sptr + xa + ya + zb);
+			const T * pbab = (const T *)(sptr + xb + ya + zb);
+			const T * pabb = (const T *)(sptr + xa + yb + zb);
+			const T * pbbb = (const T *)(sptr + xb + yb + zb);
+			const size_t o = row + x*stride0;
+			T * out = (T *)(dst->data.ptr + o);
+
+			// read interpolated input field value at back-traced location:
+			for (int k=0; k<components; k++) {
+				T val = zaf * (yaf * (xaf*paaa[k] + xbf*pbaa[k]) + ybf * (xaf*paba[k] + xbf*pbba[k]))
+					  + zbf * (yaf * (xaf*paab[k] + xbf*pbab[k]) + ybf * (xaf*pabb[k] + xbf*pbbb[k]));
+				if (bptr) {
+					// add half the error found by advecting backward,
+					// limited to range of sampled values
+					val += T(0.5) * (((const T *)(sptr + o))[k] - ((const T *)(bptr + o))[k]);
+					const T c[8] = { paaa[k], pbaa[k], paba[k], pbba[k], paab[k], pbab[k], pabb[k], pbbb[k] };
+					T lo = outside ? T(0) : c[0];
+					T hi = lo;
+					for (int m=0; m<8; m++) {
+						if (c[m] < lo) lo = c[m];
+						if (c[m] > hi) hi = c[m];
+					}
+					if (val < lo) val = lo;
+					else if (val > hi) val = hi;
+				}
+				out[k] = val;
 			}
 		}
 	}
-	#undef CELL
-	#undef VCELL
+}
+
+template<typename T>
+inline void Field3D<T> :: advectPlanes(AdvectPass& pass, ThreadPool * pool) {
+	const int dim2 = pass.src->dim(2);
+	if (pool) pool->parallelFor(0, dim2, 1, pass);
+	else for (int z=0; z<dim2; z++) pass(z);
+}
+
+template<typename T>
+inline void Field3D<T> :: advect(Array& dst, const Array& src, const Array& velocities, T rate, Edge edge, ThreadPool * pool) {
+	if (!advectFormatOK(src, velocities)) return;
+	AdvectPass pass;
+	pass.dst = &dst;
+	pass.src = &src;
+	pass.vel = &velocities;
+	pass.back = NULL;
+	pass.rate = rate;
+	pass.edge = edge;
+	advectPlanes(pass, pool);
+}
+
+template<typename T>
+inline void Field3D<T> :: advectMacCormack(Array& dst, const Array& src, const Array& velocities, Array& scratch, T rate, Edge edge, ThreadPool * pool) {
+	if (!advectFormatOK(src, velocities)) return;
+	if (velocities.data.ptr == dst.data.ptr) {
+		printf("Velocities must not be destination of MacCormack advection\n");
+		return;
+	}
+	scratch.format(src.header);
+
+	AdvectPass pass;
+	pass.vel = &velocities;
+	pass.edge = edge;
+
+	// forward step into dst, then backward step into scratch
+	pass.dst = &dst;
+	pass.src = &src;
+	pass.back = NULL;
+	pass.rate = rate;
+	advectPlanes(pass, pool);
+	pass.dst = &scratch;
+	pass.src = &dst;
+	pass.rate = -rate;
+	advectPlanes(pass, pool);
+
+	// forward step again with correction
+	pass.dst = &dst;
+	pass.src = &src;
+	pass.back = &scratch;
+	pass.rate = rate;
+	advectPlanes(pass, pool);
+}
+
+template<typename T>
+inline void Field3D<T> :: advect(Array& dst, const Array& src, const Array& velocities, T rate) {
+	advect(dst, src, velocities, rate, WRAP);
 }
 
 template<typename T>
@@ -907,6 +1351,13 @@ inline void Field3D<T> :: advect(const Array& velocities, T rate) {
 	advect(front(), back(), velocities, rate);
 }
 
+template<typename T>
+inline void Field3D<T> :: advect(const Array& velocities, T rate, Edge edge, bool correct, ThreadPool * pool) {
+	swap();
+	if (correct) advectMacCormack(front(), back(), velocities, mScratch, rate, edge, pool);
+	else advect(front(), back(), velocities, rate, edge, pool);
+}
+
 template<typename T>
 inline void Field3D<T> :: calculateGradientMagnitude(Array& gradient) {
 	gradient.format(1, Array::type<T>(), mDimX, mDimY, mDimZ);
@@ -1065,5 +1516,309 @@ inline void Field3D<T> :: add(T * force) {
 }
 
 
+template<typename T>
+inline void Poisson3D<T>::Level::resize(int x, int y, int z, T h2_) {
+	nx = x; ny = y; nz = z; h2 = h2_;
+	p.assign(nx*ny*nz, T(0));
+	f.assign(nx*ny*nz, T(0));
+	r.assign(nx*ny*nz, T(0));
+	sums.assign(nz, 0.);
+}
+
+// Updates cells of one color of a plane
+template<typename T>
+inline void Poisson3D<T>::Relax::operator()(int z) {
+	Level& l = *L;
+	const int nx = l.nx;
+	const T h2 = l.h2;
+	const T sixth = T(1)/T(6);
+	for (int y=0; y<l.ny; ++y) {
+		T * p = &l.p[l.index(0, y, z)];
+		const T * f = &l.f[l.index(0, y, z)];
+		const T * py0 = &l.p[l.index(0, (y+l.ny-1)%l.ny, z)];
+		const T * py1 = &l.p[l.index(0, (y+1)%l.ny, z)];
+		const T * pz0 = &l.p[l.index(0, y, (z+l.nz-1)%l.nz)];
+		const T * pz1 = &l.p[l.index(0, y, (z+1)%l.nz)];
+		#define RELAX(x, xm, xp) p[x] = sixth * (h2*f[x] + p[xm] + p[xp] + py0[x] + py1[x] + pz0[x] + pz1[x])
+
+		// wrapping cells at ends of row are done separately so that the
+		// inner loop has unit stride neighbors
+		int x = (y+z+color)&1;
+		if (x == 0) { RELAX(0, nx-1, 1%nx); x = 2; }
+		for (; x<nx-1; x+=2) { RELAX(x, x-1, x+1); }
+		if (x == nx-1) { RELAX(nx-1, nx-2, 0); }
+		#undef RELAX
+	}
+}
+
+// Computes residual of a plane and sum of its squares
+template<typename T>
+inline void Poisson3D<T>::Residual::operator()(int z) {
+	Level& l = *L;
+	const int nx = l.nx;
+	const T invh2 = T(1)/l.h2;
+	double sum = 0;
+	for (int y=0; y<l.ny; ++y) {
+		const T * p = &l.p[l.index(0, y, z)];
+		const T * f = &l.f[l.index(0, y, z)];
+		T * r = &l.r[l.index(0, y, z)];
+		const T * py0 = &l.p[l.index(0, (y+l.ny-1)%l.ny, z)];
+		const T * py1 = &l.p[l.index(0, (y+1)%l.ny, z)];
+		const T * pz0 = &l.p[l.index(0, y, (z+l.nz-1)%l.nz)];
+		const T * pz1 = &l.p[l.index(0, y, (z+1)%l.nz)];
+		for (int x=0; x<nx; ++x) {
+			const int xm = x ? x-1 : nx-1;
+			const int xp = x<nx-1 ? x+1 : 0;
+			r[x] = f[x] - invh2 * (T(6)*p[x] - p[xm] - p[xp] - py0[x] - py1[x] - pz0[x] - pz1[x]);
+			sum += double(r[x])*r[x];
+		}
+	}
+	l.sums[z] = sum;
+}
+
+// Averages residual of 2x2x2 fine cells into right hand side of coarse cell
+template<typename T>
+inline void Poisson3D<T>::Restrict::operator()(int z) {
+	const Level& F = *fine;
+	Level& C = *coarse;
+	for (int y=0; y<C.ny; ++y) {
+		T * f = &C.f[C.index(0, y, z)];
+		const T * r00 = &F.r[F.index(0, 2*y  , 2*z  )];
+		const T * r10 = &F.r[F.index(0, 2*y+1, 2*z  )];
+		const T * r01 = &F.r[F.index(0, 2*y  , 2*z+1)];
+		const T * r11 = &F.r[F.index(0, 2*y+1, 2*z+1)];
+		for (int x=0; x<C.nx; ++x) {
+			const int i = 2*x;
+			f[x] = T(0.125) * (
+				r00[i] + r00[i+1] + r10[i] + r10[i+1] +
+				r01[i] + r01[i+1] + r11[i] + r11[i+1]
+			);
+		}
+		for (int x=0; x<C.nx; ++x) C.p[C.index(x, y, z)] = T(0);
+	}
+}
+
+// Adds trilinear interpolation of coarse correction to fine solution. Fine
+// cells lie a quarter of a coarse cell from the coarse cell centers.
+template<typename T>
+inline void Poisson3D<T>::Prolong::operator()(int z) {
+	Level& F = *fine;
+	const Level& C = *coarse;
+	const int cz0 = z>>1;
+	const int cz1 = (z&1) ? (cz0+1)%C.nz : (cz0+C.nz-1)%C.nz;
+	for (int y=0; y<F.ny; ++y) {
+		const int cy0 = y>>1;
+		const int cy1 = (y&1) ? (cy0+1)%C.ny : (cy0+C.ny-1)%C.ny;
+		const T * e00 = &C.p[C.index(0, cy0, cz0)];
+		const T * e10 = &C.p[C.index(0, cy1, cz0)];
+		const T * e01 = &C.p[C.index(0, cy0, cz1)];
+		const T * e11 = &C.p[C.index(0, cy1, cz1)];
+		T * p = &F.p[F.index(0, y, z)];
+		for (int x=0; x<F.nx; ++x) {
+			const int cx0 = x>>1;
+			const int cx1 = (x&1) ? (cx0+1)%C.nx : (cx0+C.nx-1)%C.nx;
+			// weights are 3/4 for near and 1/4 for far cell along each axis
+			const T near = T(9)*e00[cx0] + T(3)*(e10[cx0] + e01[cx0]) + e11[cx0];
+			const T far  = T(9)*e00[cx1] + T(3)*(e10[cx1] + e01[cx1]) + e11[cx1];
+			p[x] += T(1./64.) * (T(3)*near + far);
+		}
+	}
+}
+
+template<typename T>
+inline void Poisson3D<T>::setup(const Array& p, const Array& f) {
+	const int nx = f.dim(0), ny = f.dim(1), nz = f.dim(2);
+	if (mLevels.empty() || mLevels[0].nx != nx || mLevels[0].ny != ny || mLevels[0].nz != nz) {
+		mLevels.clear();
+		int x = nx, y = ny, z = nz;
+		T h2 = 1;
+		for (;;) {
+			mLevels.push_back(Level());
+			mLevels.back().resize(x, y, z, h2);
+			if (x < 4 || y < 4 || z < 4 || (x|y|z)&1) break;
+			x /= 2; y /= 2; z /= 2; h2 *= 4;
+		}
+	}
+
+	// copy into contiguous arrays, removing mean of right hand side
+	Level& L = mLevels[0];
+	double mean = 0;
+	for (int k=0; k<nz; ++k)
+	for (int j=0; j<ny; ++j)
+	for (int i=0; i<nx; ++i) {
+		const int idx = L.index(i, j, k);
+		L.p[idx] = *p.cell<T>(i, j, k);
+		L.f[idx] = *f.cell<T>(i, j, k);
+		mean += L.f[idx];
+	}
+	mean /= L.f.size();
+	for (unsigned i=0; i<L.f.size(); ++i) L.f[i] -= mean;
+}
+
+template<typename T>
+inline void Poisson3D<T>::copyOut(Array& p) const {
+	const Level& L = mLevels[0];
+	for (int k=0; k<L.nz; ++k)
+	for (int j=0; j<L.ny; ++j)
+	for (int i=0; i<L.nx; ++i) {
+		*p.cell<T>(i, j, k) = L.p[L.index(i, j, k)];
+	}
+}
+
+template<typename T>
+inline void Poisson3D<T>::relax(Level& L, int passes) {
+	Relax task;
+	task.L = &L;
+	// With an odd number of planes, cells of the same color touch across the
+	// wrap between the first and last plane, so the last plane is updated
+	// after all others rather than in parallel with the first.
+	const int nz = L.nz & ~1;
+	for (int n=0; n<passes; ++n) {
+		for (task.color=0; task.color<2; ++task.color) {
+			forPlanes(nz, task);
+			if (nz != L.nz) task(L.nz-1);
+		}
+	}
+}
+
+template<typename T>
+inline double Poisson3D<T>::residual(Level& L) {
+	Residual task;
+	task.L = &L;
+	forPlanes(L.nz, task);
+	double sum = 0;
+	for (int z=0; z<L.nz; ++z) sum += L.sums[z];
+	return sum;
+}
+
+template<typename T>
+inline void Poisson3D<T>::vcycle(int l) {
+	Level& L = mLevels[l];
+	if (l == int(mLevels.size())-1) {
+		relax(L, mCoarseSmooth);
+		return;
+	}
+	Level& C = mLevels[l+1];
+	relax(L, mPreSmooth);
+	residual(L);
+	Restrict down;
+	down.fine = &L;
+	down.coarse = &C;
+	forPlanes(C.nz, down);
+	vcycle(l+1);
+	Prolong up;
+	up.fine = &L;
+	up.coarse = &C;
+	forPlanes(L.nz, up);
+	relax(L, mPostSmooth);
+}
+
+template<typename T>
+inline int Poisson3D<T>::solve(Array& p, const Array& f, T tolerance, int maxCycles) {
+	setup(p, f);
+	Level& L = mLevels[0];
+	double norm = 0;
+	for (unsigned i=0; i<L.f.size(); ++i) norm += double(L.f[i])*L.f[i];
+
+	mCycles = 0;
+	if (norm == 0) {
+		// solution is constant
+		L.p.assign(L.p.size(), T(0));
+		mResidual = mInitialResidual = 0;
+	}
+	else {
+		mResidual = mInitialResidual = sqrt(residual(L) / norm);
+		while (mCycles < maxCycles && mResidual > tolerance) {
+			vcycle(0);
+			++mCycles;
+			mResidual = sqrt(residual(L) / norm);
+		}
+	}
+	copyOut(p);
+	return mCycles;
+}
+
+template<typename T>
+inline void Poisson3D<T>::relax(Array& p, const Array& f, int passes) {
+	setup(p, f);
+	Level& L = mLevels[0];
+	double norm = 0;
+	for (unsigned i=0; i<L.f.size(); ++i) norm += double(L.f[i])*L.f[i];
+	if (norm == 0) norm = 1;
+	mInitialResidual = sqrt(residual(L) / norm);
+	relax(L, passes);
+	mResidual = sqrt(residual(L) / norm);
+	copyOut(p);
+}
+
+template<typename T>
+inline T Poisson3D<T>::residual(const Array& p, const Array& f) {
+	const int nx = f.dim(0), ny = f.dim(1), nz = f.dim(2);
+	double mean = 0;
+	for (int k=0; k<nz; ++k)
+	for (int j=0; j<ny; ++j)
+	for (int i=0; i<nx; ++i) mean += *f.cell<T>(i, j, k);
+	mean /= double(nx)*ny*nz;
+
+	double sum = 0, norm = 0;
+	for (int k=0; k<nz; ++k)
+	for (int j=0; j<ny; ++j)
+	for (int i=0; i<nx; ++i) {
+		#define P(x,y,z) double(*p.cell<T>(((x)+nx)%nx, ((y)+ny)%ny, ((z)+nz)%nz))
+		const double fi = *f.cell<T>(i, j, k) - mean;
+		const double r = fi - (6.*P(i,j,k)
+			- P(i-1,j,k) - P(i+1,j,k) - P(i,j-1,k) - P(i,j+1,k) - P(i,j,k-1) - P(i,j,k+1));
+		#undef P
+		sum += r*r;
+		norm += fi*fi;
+	}
+	return norm > 0 ? T(sqrt(sum/norm)) : T(0);
+}
+
+// The divergence and gradient use central differences, so the pressure at a
+// cell only couples to the cells two apart along each axis. The grid is
+// split into 8 sub-grids of alternate cells, each solved separately with the
+// 7-point Laplacian; this removes the divergence as measured by
+// calculateGradientMagnitude to within the tolerance.
+template<typename T>
+inline void Fluid3D<T>::projectMultigrid() {
+	Array& p = gradient.front();
+	Array& f = gradient.back();
+	f.zero();
+	velocities.calculateGradientMagnitude(f);
+
+	const int sx = velocities.dimx() > 1 ? 2 : 1;
+	const int sy = velocities.dimy() > 1 ? 2 : 1;
+	const int sz = velocities.dimz() > 1 ? 2 : 1;
+	const int nx = velocities.dimx()/sx;
+	const int ny = velocities.dimy()/sy;
+	const int nz = velocities.dimz()/sz;
+	mSubP.format(1, Array::type<T>(), nx, ny, nz);
+	mSubF.format(1, Array::type<T>(), nx, ny, nz);
+	mCycles = 0;
+	mResidual = 0;
+
+	for (int oz=0; oz<sz; ++oz)
+	for (int oy=0; oy<sy; ++oy)
+	for (int ox=0; ox<sx; ++ox) {
+		// start from previous pressure; the sub-grid Laplacian has spacing 2
+		for (int k=0; k<nz; ++k)
+		for (int j=0; j<ny; ++j)
+		for (int i=0; i<nx; ++i) {
+			*mSubP.cell<T>(i, j, k) = *p.cell<T>(ox+sx*i, oy+sy*j, oz+sz*k);
+			*mSubF.cell<T>(i, j, k) = T(4) * *f.cell<T>(ox+sx*i, oy+sy*j, oz+sz*k);
+		}
+		mCycles += mPoisson.solve(mSubP, mSubF, mTolerance, mMaxCycles);
+		if (mPoisson.residual() > mResidual) mResidual = mPoisson.residual();
+		for (int k=0; k<nz; ++k)
+		for (int j=0; j<ny; ++j)
+		for (int i=0; i<nx; ++i) {
+			*p.cell<T>(ox+sx*i, oy+sy*j, oz+sz*k) = *mSubP.cell<T>(i, j, k);
+		}
+	}
+
+	velocities.subtractGradientMagnitude(p);
+}
+
 }; // al
 #endif
@@ -45,7 +45,10 @@
 
 #include <stdio.h>
 #include "allocore/io/al_AudioIO.hpp"
+#include "allocore/system/al_Atomic.hpp"
+#include "allocore/system/al_Thread.hpp"
 #include "allocore/types/al_Array.hpp"
+#include "allocore/types/al_BlockRing.hpp"
 #include "Gamma/SoundFile.h"
 
 namespace al {
@@ -63,7 +66,7 @@ public:
 	// path should have a trailing slash:
 	void setPath(std::string path);
 
-	///! Start & stop recording:
+	///! Start & stop recording; stop waits until the sound file is written:
 	void start(AudioIO * io);
 	void stop();
 
@@ -73,6 +76,9 @@ public:
 	unsigned frame() { return mImageFrame; }
 	unsigned savedFrame() { return mImageCount; }
 
+	///! number of audio buffers dropped because the sound file fell behind:
+	unsigned audioOverruns() const { return mAudioRing.overruns(); }
+
 	virtual void onAudioCB(AudioIOData& io);
 
 protected:
@@ -98,9 +104,10 @@ protected:
 
 	// audio settings:
 	AudioIO * mAudio;
-	std::vector<float> mAudioRing;
-	sampletime mAudioReadIndex, mAudioWriteIndex;
-	unsigned mAudioOverflows, mAudioUnderflows;
+	BlockRing<float> mAudioRing;	// interleaved audio buffers
+	Semaphore mAudioWake;			// posted for each buffer, and on start/stop
+	Semaphore mAudioStopped;		// posted by the writer when it has stopped
+	Atomic<int> mRecording;			// 0 idle, 1 recording, 2 stopping
 	unsigned mAudioChans, mAudioFrames;
 	double mSR;
 
@@ -110,7 +117,7 @@ protected:
 	unsigned mImageFrame, mImageCount;
 
 	Thread audioThread, imageThread;
-	bool mActive;
+	Atomic<int> mActive;
 };
 
 
@@ -118,13 +125,10 @@ inline VCR::VCR(int channels, double sampleRate, int bufferSize, double sleep)
 :	mSleep(sleep),
 
 	mAudio(0),
-	mAudioOverflows(0),
-	mAudioUnderflows(0),
+	mRecording(0),
 	mAudioChans(channels),
 	mAudioFrames(bufferSize),
 	mSR(sampleRate),
-	mAudioReadIndex(0),
-	mAudioWriteIndex(0),
 
 	mImageReadIndex(0),
 	mImageWriteIndex(0),
@@ -133,16 +137,17 @@ inline VCR::VCR(int channels, double sampleRate, int bufferSize, double sleep)
 
 {
 	mPath = "/";
-	mAudioRing.resize(mAudioFrames*mAudioChans);
 	mImageRing.resize(32);
 
-	mActive = 1;
+	mActive.store(1);
 	audioThread.start(audioThreadFunc, this);
 	imageThread.start(imageThreadFunc, this);
 }
 
 inline VCR::~VCR() {
-	mActive = 0;
+	stop();
+	mActive.store(0);
+	mAudioWake.post();
 	audioThread.join();
 	imageThread.join();
 }
@@ -154,7 +159,12 @@ inline void VCR::start(AudioIO * io) {
 	if (mAudio == 0) {
 		mImageCount = 0;
 		mImageFrame = 0;
+		// about bufferSize frames, in blocks of the i/o buffer size
+		unsigned blocks = mAudioFrames / io->framesPerBuffer();
+		mAudioRing.resize(io->framesPerBuffer() * mAudioChans, blocks < 2 ? 2 : blocks);
 		mAudio = io;
+		mRecording.store(1);
+		mAudioWake.post();
 		mAudio->append(*this);
 	}
 }
@@ -163,56 +173,41 @@ inline void VCR::stop() {
 	if (mAudio) {
 		mAudio->remove(*this);
 		mAudio = 0;
+		// the ring may only be resized by start() once the writer is done
+		mRecording.store(2);
+		mAudioWake.post();
+		mAudioStopped.wait();
 	}
 }
 
 inline void VCR::onAudioCB(AudioIOData& io) {
-	// cached, because it may be being used in a different thread
-	sampletime r = mAudioReadIndex;
-	sampletime w = mAudioWriteIndex;
+	// if the sound file writer has fallen behind, the buffer is dropped and
+	// counted in audioOverruns()
+	float * dst = mAudioRing.writeBlock();
+	if (dst == 0) return;
 
 	unsigned channels = io.channelsOut();
 	if (channels > mAudioChans) channels = mAudioChans;
-
+	unsigned blockFrames = mAudioRing.blockSize() / mAudioChans;
 	unsigned numAudioFrames = io.framesPerBuffer();
-	unsigned numSamples = numAudioFrames * channels;
-	unsigned length = mAudioRing.size();
-
-	sampletime ahead = w - r;	// how much writer is ahead of reader
-	if (ahead > (length - numSamples)) {
-		// not enough space left in ringbuffer!
-		fprintf(stderr, "audio underflow\n");
-		mAudioUnderflows++;
-		return;
-	}
-
-	sampletime wnext = w + numSamples;
-	unsigned wu = (unsigned)(w % length);
+	if (numAudioFrames > blockFrames) numAudioFrames = blockFrames;
 
-	//printf("writing %u samples to %llu\n", numSamples, wnext);
-
-	for (unsigned c=0; c < channels; c++) {
-		float * src = io.outBuffer(c);
-		float * dst = &mAudioRing[0];
-
-		unsigned wc = wu + c;
-		unsigned srcIdx = 0;
-
-		while (srcIdx < numAudioFrames) {
-			dst[wc] = src[srcIdx];
-			srcIdx++;
-			wc += mAudioChans;
-			if (wc >= length) wc -= length;
+	// interleave; missing channels are silent
+	for (unsigned c=0; c < mAudioChans; c++) {
+		const float * src = c < channels ? io.outBuffer(c) : 0;
+		for (unsigned i=0; i < blockFrames; i++) {
+			dst[i*mAudioChans + c] = (src && i < numAudioFrames) ? src[i] : 0.f;
 		}
 	}
 
-	// update write head position
-	mAudioWriteIndex = wnext;
+	mAudioRing.commitWrite();
+	mAudioWake.post();
 }
 
 inline void * VCR::audioThreadMethod() {
-	while (mActive) {
-		if (mAudio) {
+	while (mActive.load()) {
+		int state = mRecording.load();
+		if (state == 1) {
 			// create & open soundfile:
 			gam::SoundFile sf(mPath + "test.wav");
 			sf.format(gam::SoundFile::WAV);
@@ -222,64 +217,31 @@ inline void * VCR::audioThreadMethod() {
 			sf.openWrite();
 			printf("started recording audio\n");
 
-			while (mAudio) {
+			while (mRecording.load() == 1) {
 				writeToOpenSoundFile(sf);
-				al_sleep(mSleep);
+				mAudioWake.wait();
 			}
 
 			// write any remaining samples!
 			writeToOpenSoundFile(sf);
 			sf.close();
-			printf("finished recording; with %u overflows\n", mAudioOverflows);
+			printf("finished recording; with %u overruns\n", mAudioRing.overruns());
+		} else if (state == 2) {
+			// acknowledge stop, also if recording was stopped before it began
+			mRecording.store(0);
+			mAudioStopped.post();
 		} else {
-			al_sleep(mSleep);
+			mAudioWake.wait();
 		}
 	}
 	return 0;
 }
 
 inline void VCR::writeToOpenSoundFile(gam::SoundFile& sf) {
-	// cached, because it may be being used in a different thread
-	sampletime r = mAudioReadIndex;
-	sampletime w = mAudioWriteIndex;
-
-	unsigned length = mAudioRing.size();
-
-	// how much is there to write?
-	sampletime ahead = w - r;	// how much writer is ahead of reader
-	if (ahead > length) {
-		// buffer is over-full!
-		fprintf(stderr, "audio overflow\n");
-		mAudioOverflows++;
-
-		ahead = length;
-		r = w - length;
-	}
-
-	// copy this many samples into the soundfile:
-	if (ahead > 0) {
-		unsigned written = 0;
-		// copy in two passes, to handle ringbuffer boundary.
-		unsigned ru = (unsigned)(r % length);
-		unsigned wu = (unsigned)(w % length);
-
-		if (ru > wu) {
-			// read to end of ring buffer, then let the next block capture the remainder
-			int frames = (length - ru)/mAudioChans;
-			int copied = mAudioChans * sf.write(&mAudioRing[ru], frames);
-			ru = (ru + copied) % length;
-			written += copied;
-		}
-		if (ru < wu) {
-			// let read head catch up to write head:
-			int frames = (wu - ru)/mAudioChans;
-			int copied = mAudioChans * sf.write(&mAudioRing[ru], frames);
-			ru = (ru + copied) % length;
-			written += copied;
-		}
-
-		// update read index:
-		mAudioReadIndex = r + written;
+	const float * src;
+	while ((src = mAudioRing.readBlock())) {
+		sf.write(src, mAudioRing.blockSize() / mAudioChans);
+		mAudioRing.commitRead();
 	}
 }
 
@@ -327,7 +289,7 @@ inline void VCR::writeImages(Image& image) {
 
 inline void * VCR::imageThreadMethod() {
 	Image image;
-	while (mActive) {
+	while (mActive.load()) {
 		if (mAudio) {
 			writeImages(image);
 		} else {
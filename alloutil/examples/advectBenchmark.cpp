@@ -0,0 +1,89 @@
+/*
+Allocore Example: Advection Benchmark
+
+Description:
+This measures the throughput of Field3D::advect in millions of cells per
+second for a density field (1 component) and a velocity field (3
+components), moved by random velocities of a few cells per step. The
+previous implementation, which samples the source through
+Array::read_interp, is shown for comparison, then the current one with one
+thread and one thread per processor, and the MacCormack scheme, which does
+three advection steps per call.
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include "allocore/system/al_Info.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
+#include "allocore/system/al_Time.hpp"
+#include "alloutil/al_Field3D.hpp"
+using namespace al;
+
+#define NUM_RUNS (4)
+
+// Previous implementation of Field3D::advect
+void interpAdvect(Array& dst, const Array& src, const Array& velocities, float rate){
+	for(unsigned z=0; z<src.dim(2); ++z){
+	for(unsigned y=0; y<src.dim(1); ++y){
+	for(unsigned x=0; x<src.dim(0); ++x){
+		const float * v = velocities.cell<float>(x,y,z);
+		src.read_interp(dst.cell<float>(x,y,z), x - rate*v[0], y - rate*v[1], z - rate*v[2]);
+	}}}
+}
+
+// Returns throughput in millions of cells per second
+double benchmark(int method, Array& dst, const Array& src, const Array& vel, Array& scratch, ThreadPool * pool){
+	Timer timer;
+	timer.start();
+	for(int i=0; i<NUM_RUNS; ++i){
+		switch(method){
+		case 0: interpAdvect(dst, src, vel, 1); break;
+		case 1: Field3D<float>::advect(dst, src, vel, 1, Field3D<float>::WRAP, pool); break;
+		default: Field3D<float>::advectMacCormack(dst, src, vel, scratch, 1, Field3D<float>::WRAP, pool);
+		}
+	}
+	timer.stop();
+	double cells = double(src.dim(0)) * src.dim(1) * src.dim(2) * NUM_RUNS;
+	return cells / timer.elapsedSec() * 1e-6;
+}
+
+int main(){
+	int numThreads = numProcessors();
+	if(numThreads < 2) numThreads = 2;
+	ThreadPool pool(numThreads-1);
+
+	rnd::Random<> rng(1);
+
+	const int sizes[] = { 64, 128, 256 };
+	const char * names[] = { "read_interp", "1 thread", "N threads", "MacCormack N" };
+
+	for(int s=0; s<3; ++s){
+		int N = sizes[s];
+		Field3D<float> vel(3, N,N,N);
+		vel.front().zero();
+		vel.adduniformS(rng, 3);
+
+		printf("\n%d x %d x %d grid, throughput (Mcells/s)\n", N, N, N);
+		printf("%14s %10s %10s\n", "method", "1 comp", "3 comp");
+
+		Array src1(1, Array::type<float>(), N,N,N), dst1 = src1, scratch;
+		Array src3(3, Array::type<float>(), N,N,N), dst3 = src3;
+		src1.zero();
+		src3 = vel.front();
+
+		for(int m=0; m<4; ++m){
+			int method = m < 2 ? m : m-1;
+			ThreadPool * p = m >= 2 ? &pool : NULL;
+			double t1 = benchmark(method, dst1, src1, vel.front(), scratch, p);
+			double t3 = benchmark(method, dst3, src3, vel.front(), scratch, p);
+			printf("%14s %10.1f %10.1f\n", names[m], t1, t3);
+		}
+		fflush(stdout);
+	}
+
+	printf("\nN = %d\n", numThreads);
+
+	return 0;
+}
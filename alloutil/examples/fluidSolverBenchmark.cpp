@@ -0,0 +1,91 @@
+/*
+Allocore Example: Fluid Solver Benchmark
+
+Description:
+This compares the solvers Fluid3D can use to remove the divergence of its
+velocity field. Gauss-Seidel is the default: a fixed number of diffusion
+passes over the divergence. Multigrid solves the Poisson equation for the
+pressure with V-cycles until the residual is below a tolerance, using one
+thread and one thread per processor. The velocities are smoothed random
+noise. For each solver, the time of one projection, the relative residual of
+the pressure and the divergence left afterwards (relative to the starting
+divergence) are shown.
+
+Author:
+AlloSystem contributors, 2016
+*/
+
+#include <stdio.h>
+#include <math.h>
+#include "allocore/system/al_Info.hpp"
+#include "allocore/system/al_ThreadPool.hpp"
+#include "allocore/system/al_Time.hpp"
+#include "alloutil/al_Field3D.hpp"
+using namespace al;
+
+// Returns RMS of divergence of velocity field
+double rmsDivergence(Field3D<float>& vel, Array& scratch){
+	scratch.zero();
+	vel.calculateGradientMagnitude(scratch);
+	const float * d = (const float *)scratch.data.ptr;
+	int n = vel.dimx()*vel.dimy()*vel.dimz();
+	double sum = 0;
+	for(int i=0; i<n; ++i) sum += double(d[i])*d[i];
+	return sqrt(sum/n);
+}
+
+int main(){
+	int numThreads = numProcessors();
+	if(numThreads < 2) numThreads = 2;
+	ThreadPool pool(numThreads-1);
+
+	Timer timer;
+
+	const int sizes[] = { 64, 128, 256 };
+
+	for(int s=0; s<3; ++s){
+		int N = sizes[s];
+		Fluid3D<float> fluid(N, N, N);
+		fluid.tolerance(1e-3, 8);
+
+		// smoothed noise, as the fluid diffuses velocities before projecting
+		Field3D<float>& vel = fluid.velocities;
+		vel.front().zero();
+		vel.adduniformS(fluid.rng, 1);
+		vel.back().zero();
+		vel.diffuse(1, fluid.passes);
+		Array src = vel.front();
+		Array scratch(1, Array::type<float>(), N, N, N);
+		double div0 = rmsDivergence(vel, scratch);
+
+		printf("\n%d x %d x %d grid\n", N, N, N);
+		printf("%16s %10s %8s %10s %10s\n", "solver", "time (ms)", "cycles", "residual", "divergence");
+
+		for(int i=0; i<3; ++i){
+			fluid.solver(i ? Fluid3D<float>::MULTIGRID : Fluid3D<float>::GAUSS_SEIDEL);
+			fluid.threadPool(i == 2 ? &pool : NULL);
+			vel.front() = src;
+			fluid.gradient.front().zero();
+
+			timer.start();
+			fluid.project();
+			timer.stop();
+
+			if(i){
+				char name[32];
+				snprintf(name, sizeof(name), "multigrid x %d", i == 2 ? numThreads : 1);
+				printf("%16s %10.1f %8d %10.2e", name, timer.elapsedSec()*1e3,
+					fluid.cycles(), fluid.residual());
+			}
+			else{
+				printf("%16s %10.1f %8s %10s", "Gauss-Seidel", timer.elapsedSec()*1e3, "-", "-");
+			}
+			printf(" %10.2e\n", rmsDivergence(vel, scratch) / div0);
+		}
+		fflush(stdout);
+	}
+
+	printf("\nmultigrid x P uses P threads; cycles are summed over the 8 sub-grids\n");
+
+	return 0;
+}
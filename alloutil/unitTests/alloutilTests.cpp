@@ -0,0 +1,255 @@
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "alloutil/al_Field3D.hpp"
+
+using namespace al;
+
+// Fill 1-component array with uniform noise
+static void noise(Array& a, rnd::Random<>& rng){
+	for(unsigned k=0; k<a.dim(2); ++k)
+	for(unsigned j=0; j<a.dim(1); ++j)
+	for(unsigned i=0; i<a.dim(0); ++i){
+		*a.cell<float>(i,j,k) = rng.uniformS();
+	}
+}
+
+// Fill 3-component array with constant velocity
+static void uniform(Array& a, float vx, float vy, float vz){
+	for(unsigned k=0; k<a.dim(2); ++k)
+	for(unsigned j=0; j<a.dim(1); ++j)
+	for(unsigned i=0; i<a.dim(0); ++i){
+		float * v = a.cell<float>(i,j,k);
+		v[0] = vx; v[1] = vy; v[2] = vz;
+	}
+}
+
+// RMS of divergence as computed by the fluid projection
+static double divergence(Field3D<float>& velocities){
+	Array div;
+	div.format(1, Array::type<float>(), velocities.dimx(), velocities.dimy(), velocities.dimz());
+	div.zero();
+	velocities.calculateGradientMagnitude(div);
+	double sum = 0;
+	for(unsigned k=0; k<div.dim(2); ++k)
+	for(unsigned j=0; j<div.dim(1); ++j)
+	for(unsigned i=0; i<div.dim(0); ++i){
+		double d = *div.cell<float>(i,j,k);
+		sum += d*d;
+	}
+	return sqrt(sum / (div.dim(0)*div.dim(1)*div.dim(2)));
+}
+
+// Multigrid Poisson solver
+void ut_poisson(void)
+{
+	rnd::Random<> rng(3);
+	Array f, p, q;
+	f.format(1, Array::type<float>(), 16, 16, 16);
+	p.format(1, Array::type<float>(), 16, 16, 16);
+	noise(f, rng);
+
+	// V-cycles reduce residual much faster than relaxation alone
+	Poisson3D<float> poisson;
+	p.zero();
+	int cycles = poisson.solve(p, f, 1e-4, 20);
+	assert(cycles > 0 && cycles < 20);
+	assert(poisson.initialResidual() > 0.5);
+	assert(poisson.residual() <= 1e-4);
+	assert(fabs(Poisson3D<float>::residual(p, f) - poisson.residual()) < 1e-5);
+
+	q.format(p.header);
+	q.zero();
+	poisson.relax(q, f, 8*cycles);
+	assert(poisson.residual() < poisson.initialResidual());
+	assert(poisson.residual() > 100 * Poisson3D<float>::residual(p, f));
+}
+
+// Odd number of planes gives the same result with threads
+void ut_odd_planes(void)
+{
+	rnd::Random<> rng(5);
+	Array f, p, q;
+	f.format(1, Array::type<float>(), 12, 12, 9);
+	p.format(1, Array::type<float>(), 12, 12, 9);
+	q.format(1, Array::type<float>(), 12, 12, 9);
+	noise(f, rng);
+	p.zero();
+	q.zero();
+
+	ThreadPool pool(3);
+	Poisson3D<float> serial, threaded;
+	threaded.threadPool(&pool);
+	serial.solve(p, f, 0, 4);
+	threaded.solve(q, f, 0, 4);
+	assert(serial.residual() < serial.initialResidual());
+	assert(0 == memcmp(p.data.ptr, q.data.ptr, p.size()));
+}
+
+// Red-black diffusion gives the same result with threads
+void ut_diffusion(void)
+{
+	rnd::Random<> rng(7);
+	Field3D<float> a(3, 16, 16, 16), b(3, 16, 16, 16);
+	a.front().zero(); a.back().zero();
+	b.back().zero();
+	a.adduniformS(rng, 1);
+	memcpy(b.front().data.ptr, a.front().data.ptr, a.front().size());
+
+	ThreadPool pool(3);
+	a.diffuseRedBlack(0.1, 8);
+	b.diffuseRedBlack(0.1, 8, &pool);
+	assert(0 == memcmp(a.front().data.ptr, b.front().data.ptr, a.front().size()));
+}
+
+// Multigrid projection removes divergence
+void ut_projection(void)
+{
+	Fluid3D<float> fluid(16, 16, 16);
+	fluid.solver(Fluid3D<float>::MULTIGRID);
+	fluid.tolerance(1e-4, 20);
+	fluid.velocities.front().zero();
+	fluid.gradient.front().zero();
+	fluid.velocities.adduniformS(fluid.rng, 1);
+
+	double before = divergence(fluid.velocities);
+	fluid.project();
+	double after = divergence(fluid.velocities);
+	assert(fluid.residual() <= 1e-4);
+	assert(after < 1e-3 * before);
+}
+
+
+// Advection by a constant whole-cell velocity translates the field
+void ut_advection_translate(void)
+{
+	rnd::Random<> rng(11);
+	const int dx = 16, dy = 12, dz = 8;
+	Array src, dst, vel;
+	src.format(1, Array::type<float>(), dx, dy, dz);
+	dst.format(src.header);
+	vel.format(3, Array::type<float>(), dx, dy, dz);
+	noise(src, rng);
+	uniform(vel, 2, -1, 3);
+
+	const Field3D<float>::Edge edges[] = { Field3D<float>::WRAP, Field3D<float>::CLAMP, Field3D<float>::ZERO };
+	for(int e=0; e<3; ++e){
+		Field3D<float>::advect(dst, src, vel, 1, edges[e]);
+
+		for(int k=0; k<dz; ++k)
+		for(int j=0; j<dy; ++j)
+		for(int i=0; i<dx; ++i){
+			int x = i-2, y = j+1, z = k-3;
+			float expected;
+			switch(edges[e]){
+			case Field3D<float>::WRAP:
+				expected = *src.cell<float>((x+dx)%dx, (y+dy)%dy, (z+dz)%dz);
+				break;
+			case Field3D<float>::CLAMP:
+				expected = *src.cell<float>(x<0 ? 0 : x, y>=dy ? dy-1 : y, z<0 ? 0 : z);
+				break;
+			default:
+				expected = (x<0 || y>=dy || z<0) ? 0 : *src.cell<float>(x, y, z);
+			}
+			assert(*dst.cell<float>(i,j,k) == expected);
+		}
+	}
+}
+
+// MacCormack advection stays within the range of the sampled cells
+void ut_advection_maccormack(void)
+{
+	rnd::Random<> rng(13);
+	const int d = 16;
+	Array src, dst, plain, vel, scratch;
+	src.format(1, Array::type<float>(), d, d, d);
+	dst.format(src.header);
+	plain.format(src.header);
+	vel.format(3, Array::type<float>(), d, d, d);
+	noise(src, rng);
+	for(int k=0; k<d; ++k)
+	for(int j=0; j<d; ++j)
+	for(int i=0; i<d; ++i){
+		float * v = vel.cell<float>(i,j,k);
+		v[0] = 1.5 * sin(0.4*j); v[1] = 1.5 * cos(0.3*k); v[2] = 1.5 * sin(0.5*i);
+	}
+
+	Field3D<float>::advect(plain, src, vel, 1, Field3D<float>::WRAP);
+	Field3D<float>::advectMacCormack(dst, src, vel, scratch, 1, Field3D<float>::WRAP);
+
+	bool corrected = false;
+	for(int k=0; k<d; ++k)
+	for(int j=0; j<d; ++j)
+	for(int i=0; i<d; ++i){
+		// cells around back-traced position
+		const float * v = vel.cell<float>(i,j,k);
+		int x = floor(i - v[0]), y = floor(j - v[1]), z = floor(k - v[2]);
+		float lo = 1e10, hi = -1e10;
+		for(int n=0; n<8; ++n){
+			float c = *src.cell<float>((x + (n&1)) & (d-1), (y + ((n>>1)&1)) & (d-1), (z + (n>>2)) & (d-1));
+			if(c < lo) lo = c;
+			if(c > hi) hi = c;
+		}
+		float val = *dst.cell<float>(i,j,k);
+		assert(lo <= val && val <= hi);
+		if(val != *plain.cell<float>(i,j,k)) corrected = true;
+	}
+	assert(corrected);
+}
+
+// Advection gives the same result with threads
+void ut_advection_threads(void)
+{
+	rnd::Random<> rng(17);
+	const int dx = 16, dy = 12, dz = 9;
+	Array src, vel, a, b, scratch;
+	src.format(3, Array::type<float>(), dx, dy, dz);
+	vel.format(src.header);
+	a.format(src.header);
+	b.format(src.header);
+	for(int k=0; k<dz; ++k)
+	for(int j=0; j<dy; ++j)
+	for(int i=0; i<dx; ++i){
+		float * s = src.cell<float>(i,j,k);
+		float * v = vel.cell<float>(i,j,k);
+		for(int c=0; c<3; ++c){
+			s[c] = rng.uniformS();
+			v[c] = 4 * rng.uniformS();
+		}
+	}
+
+	ThreadPool pool(3);
+	const Field3D<float>::Edge edges[] = { Field3D<float>::WRAP, Field3D<float>::CLAMP, Field3D<float>::ZERO };
+	for(int e=0; e<3; ++e){
+		Field3D<float>::advect(a, src, vel, 0.7, edges[e]);
+		Field3D<float>::advect(b, src, vel, 0.7, edges[e], &pool);
+		assert(0 == memcmp(a.data.ptr, b.data.ptr, a.size()));
+
+		Field3D<float>::advectMacCormack(a, src, vel, scratch, 0.7, edges[e]);
+		Field3D<float>::advectMacCormack(b, src, vel, scratch, 0.7, edges[e], &pool);
+		assert(0 == memcmp(a.data.ptr, b.data.ptr, a.size()));
+	}
+}
+
+
+#define RUNTEST(Name)\
+	printf("%s ", #Name);\
+	ut_##Name();\
+	for(size_t i=0; i<32-strlen(#Name); ++i) printf(".");\
+	printf(" pass\n")
+
+int main()
+{
+	RUNTEST(poisson);
+	RUNTEST(odd_planes);
+	RUNTEST(diffusion);
+	RUNTEST(projection);
+	RUNTEST(advection_translate);
+	RUNTEST(advection_maccormack);
+	RUNTEST(advection_threads);
+
+	return 0;
+}